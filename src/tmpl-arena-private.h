@@ -0,0 +1,61 @@
+/* tmpl-arena-private.h
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TMPL_ARENA_PRIVATE_H
+#define TMPL_ARENA_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _TmplArena TmplArena;
+
+typedef struct
+{
+  gpointer  chunk;
+  gsize     pos;
+  GSList   *large;
+  gsize     large_size;
+} TmplArenaMark;
+
+TmplArena *tmpl_arena_new                 (void);
+TmplArena *tmpl_arena_ref                 (TmplArena     *self);
+void       tmpl_arena_unref               (TmplArena     *self);
+gpointer   tmpl_arena_alloc               (TmplArena     *self,
+                                           gsize          size);
+TmplArena *tmpl_arena_from_pointer        (gconstpointer  mem);
+gsize      tmpl_arena_get_size            (TmplArena     *self);
+gchar     *tmpl_arena_strndup             (TmplArena     *self,
+                                           const gchar   *str,
+                                           gsize          len);
+gchar     *tmpl_arena_strconcat           (TmplArena     *self,
+                                           const gchar   *first,
+                                           const gchar   *second);
+void       tmpl_arena_mark                (TmplArena     *self,
+                                           TmplArenaMark *mark);
+void       tmpl_arena_reset               (TmplArena     *self,
+                                           const TmplArenaMark *mark);
+TmplArena *tmpl_arena_get_thread_default  (void);
+void       tmpl_arena_push_thread_default (TmplArena     *self);
+void       tmpl_arena_pop_thread_default  (TmplArena     *self);
+TmplArena *tmpl_arena_get_scratch         (void);
+void       tmpl_arena_push_scratch        (TmplArena     *self);
+void       tmpl_arena_pop_scratch         (TmplArena     *self);
+
+G_END_DECLS
+
+#endif /* TMPL_ARENA_PRIVATE_H */
@@ -0,0 +1,389 @@
+/* tmpl-arena.c
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * An arena allocates the expressions of a parsed template from a few large
+ * chunks rather than individually, and releases the chunks all at once when
+ * the last reference is dropped. Every allocation holds a reference on the
+ * arena, so expressions which outlive their template, such as functions
+ * stored into a scope, keep the memory alive.
+ *
+ * Chunks are aligned to their size so that the arena of an allocation may
+ * be found from its address. Only the thread that made the arena its
+ * thread-default may allocate from it, while references may be dropped
+ * from any thread.
+ *
+ * An arena may also be pushed as the scratch arena of a thread while
+ * expanding a template, in which case the evaluator allocates temporary
+ * strings from it instead of the heap. The expansion takes a mark before
+ * each instruction and resets the arena to it afterwards, so that the
+ * chunks are reused rather than growing with every iteration of a loop.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "tmpl-arena-private.h"
+
+#define CHUNK_SIZE 4096
+
+typedef struct _TmplArenaChunk TmplArenaChunk;
+
+struct _TmplArenaChunk
+{
+  TmplArena      *arena;
+  TmplArenaChunk *next;
+};
+
+struct _TmplArena
+{
+  volatile gint   ref_count;
+  guint           n_chunks;
+  TmplArenaChunk *chunks;
+  TmplArenaChunk *spare;
+  gsize           pos;
+  GSList         *large;
+  gsize           large_size;
+};
+
+#define CHUNK_HEADER_SIZE ((sizeof (TmplArenaChunk) + 7) & ~(gsize)7)
+#define MAX_CHUNK_ALLOC   (CHUNK_SIZE - CHUNK_HEADER_SIZE)
+
+static GPrivate thread_default_key = G_PRIVATE_INIT ((GDestroyNotify)g_queue_free);
+static GPrivate scratch_key = G_PRIVATE_INIT ((GDestroyNotify)g_queue_free);
+
+TmplArena *
+tmpl_arena_new (void)
+{
+  TmplArena *self;
+
+  self = g_slice_new0 (TmplArena);
+  self->ref_count = 1;
+
+  return self;
+}
+
+TmplArena *
+tmpl_arena_ref (TmplArena *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+tmpl_arena_unref (TmplArena *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      while (self->chunks != NULL)
+        {
+          TmplArenaChunk *chunk = self->chunks;
+
+          self->chunks = chunk->next;
+          g_aligned_free (chunk);
+        }
+
+      while (self->spare != NULL)
+        {
+          TmplArenaChunk *chunk = self->spare;
+
+          self->spare = chunk->next;
+          g_aligned_free (chunk);
+        }
+
+      g_slist_free_full (self->large, g_free);
+      g_slice_free (TmplArena, self);
+    }
+}
+
+/*
+ * Allocates @size bytes of zeroed memory, suitably aligned for any of the
+ * records of an expression. The caller is expected to hold a reference on
+ * @self for as long as the memory is used.
+ *
+ * Allocations too large for a chunk are made from the heap, and cannot be
+ * used with tmpl_arena_from_pointer().
+ */
+gpointer
+tmpl_arena_alloc (TmplArena *self,
+                  gsize      size)
+{
+  gpointer ret;
+
+  g_assert (self != NULL);
+  g_assert (size > 0);
+
+  if G_UNLIKELY (size > MAX_CHUNK_ALLOC)
+    {
+      ret = g_malloc0 (size);
+      self->large = g_slist_prepend (self->large, ret);
+      self->large_size += size;
+      return ret;
+    }
+
+  size = (size + 7) & ~(gsize)7;
+
+  if (self->chunks == NULL || self->pos + size > CHUNK_SIZE)
+    {
+      TmplArenaChunk *chunk;
+
+      if (self->spare != NULL)
+        {
+          chunk = self->spare;
+          self->spare = chunk->next;
+          memset ((guint8 *)chunk + CHUNK_HEADER_SIZE, 0, MAX_CHUNK_ALLOC);
+        }
+      else
+        {
+          chunk = g_aligned_alloc0 (1, CHUNK_SIZE, CHUNK_SIZE);
+          chunk->arena = self;
+          self->n_chunks++;
+        }
+
+      chunk->next = self->chunks;
+
+      self->chunks = chunk;
+      self->pos = CHUNK_HEADER_SIZE;
+    }
+
+  ret = (guint8 *)self->chunks + self->pos;
+  self->pos += size;
+
+  return ret;
+}
+
+/*
+ * Gets the arena @mem was allocated from with tmpl_arena_alloc().
+ */
+TmplArena *
+tmpl_arena_from_pointer (gconstpointer mem)
+{
+  TmplArenaChunk *chunk = (TmplArenaChunk *)((guintptr)mem & ~(guintptr)(CHUNK_SIZE - 1));
+
+  return chunk->arena;
+}
+
+/*
+ * Gets the number of bytes reserved by @self.
+ */
+gsize
+tmpl_arena_get_size (TmplArena *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return sizeof *self + (gsize)self->n_chunks * CHUNK_SIZE + self->large_size;
+}
+
+/*
+ * Records the current position of @self so that everything allocated
+ * afterwards may be released with tmpl_arena_reset().
+ */
+void
+tmpl_arena_mark (TmplArena     *self,
+                 TmplArenaMark *mark)
+{
+  g_assert (self != NULL);
+  g_assert (mark != NULL);
+
+  mark->chunk = self->chunks;
+  mark->pos = self->pos;
+  mark->large = self->large;
+  mark->large_size = self->large_size;
+}
+
+/*
+ * Releases everything allocated from @self since @mark was taken. Marks
+ * must be reset in the reverse order they were taken, and none of the
+ * memory allocated since may be used afterwards. Chunks are kept to be
+ * reused by later allocations.
+ */
+void
+tmpl_arena_reset (TmplArena           *self,
+                  const TmplArenaMark *mark)
+{
+  gsize end;
+
+  g_assert (self != NULL);
+  g_assert (mark != NULL);
+
+  end = self->pos;
+
+  while (self->chunks != mark->chunk)
+    {
+      TmplArenaChunk *chunk = self->chunks;
+
+      g_assert (chunk != NULL);
+
+      self->chunks = chunk->next;
+      chunk->next = self->spare;
+      self->spare = chunk;
+
+      /* The rest of the marked chunk may have been skipped over */
+      end = CHUNK_SIZE;
+    }
+
+  while (self->large != mark->large)
+    {
+      GSList *link = self->large;
+
+      self->large = link->next;
+      g_free (link->data);
+      g_slist_free_1 (link);
+    }
+
+  self->large_size = mark->large_size;
+
+  /* Allocations are expected to be zeroed */
+  if (self->chunks != NULL && end > mark->pos)
+    memset ((guint8 *)self->chunks + mark->pos, 0, end - mark->pos);
+
+  self->pos = mark->pos;
+}
+
+/*
+ * Copies @len bytes of @str into @self, followed by a nul byte.
+ */
+gchar *
+tmpl_arena_strndup (TmplArena   *self,
+                    const gchar *str,
+                    gsize        len)
+{
+  gchar *ret;
+
+  g_assert (self != NULL);
+  g_assert (str != NULL || len == 0);
+
+  ret = tmpl_arena_alloc (self, len + 1);
+  if (len > 0)
+    memcpy (ret, str, len);
+
+  return ret;
+}
+
+/*
+ * Concatenates @first and @second into a new string within @self.
+ */
+gchar *
+tmpl_arena_strconcat (TmplArena   *self,
+                      const gchar *first,
+                      const gchar *second)
+{
+  gsize first_len = first ? strlen (first) : 0;
+  gsize second_len = second ? strlen (second) : 0;
+  gchar *ret;
+
+  g_assert (self != NULL);
+
+  ret = tmpl_arena_alloc (self, first_len + second_len + 1);
+  if (first_len > 0)
+    memcpy (ret, first, first_len);
+  if (second_len > 0)
+    memcpy (ret + first_len, second, second_len);
+
+  return ret;
+}
+
+static void
+tmpl_arena_push (GPrivate  *key,
+                 TmplArena *self)
+{
+  GQueue *stack = g_private_get (key);
+
+  if (stack == NULL)
+    {
+      stack = g_queue_new ();
+      g_private_set (key, stack);
+    }
+
+  g_queue_push_head (stack, self);
+}
+
+static void
+tmpl_arena_pop (GPrivate  *key,
+                TmplArena *self)
+{
+  GQueue *stack = g_private_get (key);
+
+  g_return_if_fail (stack != NULL);
+  g_return_if_fail (g_queue_peek_head (stack) == self);
+
+  g_queue_pop_head (stack);
+}
+
+static inline TmplArena *
+tmpl_arena_peek (GPrivate *key)
+{
+  GQueue *stack = g_private_get (key);
+
+  return stack != NULL ? g_queue_peek_head (stack) : NULL;
+}
+
+/*
+ * Gets the arena that expressions created by the calling thread are
+ * allocated from, or %NULL if they are allocated individually.
+ */
+TmplArena *
+tmpl_arena_get_thread_default (void)
+{
+  return tmpl_arena_peek (&thread_default_key);
+}
+
+void
+tmpl_arena_push_thread_default (TmplArena *self)
+{
+  g_return_if_fail (self != NULL);
+
+  tmpl_arena_push (&thread_default_key, self);
+}
+
+void
+tmpl_arena_pop_thread_default (TmplArena *self)
+{
+  tmpl_arena_pop (&thread_default_key, self);
+}
+
+/*
+ * Gets the arena that the evaluator may allocate temporary strings from
+ * on the calling thread, or %NULL if they are allocated from the heap.
+ */
+TmplArena *
+tmpl_arena_get_scratch (void)
+{
+  return tmpl_arena_peek (&scratch_key);
+}
+
+void
+tmpl_arena_push_scratch (TmplArena *self)
+{
+  g_return_if_fail (self != NULL);
+
+  tmpl_arena_push (&scratch_key, self);
+}
+
+void
+tmpl_arena_pop_scratch (TmplArena *self)
+{
+  tmpl_arena_pop (&scratch_key, self);
+}
@@ -89,7 +89,7 @@ tmpl_branch_node_accept (TmplNode      *node,
                 const gchar *exprstr;
 
                 exprstr = tmpl_token_get_text (token);
-                expr = tmpl_expr_from_string (exprstr, error);
+                expr = tmpl_lexer_parse_expr (lexer, exprstr, error);
               }
             else
               expr = tmpl_expr_new_boolean (TRUE);
@@ -115,6 +115,7 @@ tmpl_branch_node_accept (TmplNode      *node,
         case TMPL_TOKEN_EXPRESSION:
         case TMPL_TOKEN_FOR:
         case TMPL_TOKEN_INCLUDE:
+        case TMPL_TOKEN_FLUSH:
         default:
           tmpl_token_free (token);
           g_set_error (error,
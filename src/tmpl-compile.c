@@ -0,0 +1,94 @@
+/* tmpl-compile.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * tmpl-compile parses a template and writes its compiled form so that it
+ * may be loaded with tmpl_template_load_compiled(), typically from a
+ * GResource, without lexing or parsing at runtime. Includes are resolved
+ * now using the directory of the template and any -I directories.
+ */
+
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <tmpl-glib.h>
+
+static gchar **include_dirs;
+static gchar *output_path;
+
+static const GOptionEntry entries[] = {
+  { "include", 'I', 0, G_OPTION_ARG_FILENAME_ARRAY, &include_dirs,
+    "Add DIRECTORY to the include search path", "DIRECTORY" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path,
+    "Write the compiled template to FILE", "FILE" },
+  { NULL }
+};
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(TmplTemplateLocator) locator = NULL;
+  g_autoptr(TmplTemplate) tmpl = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *dirname = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+
+  context = g_option_context_new ("TEMPLATE - compile a template");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (argc != 2 || output_path == NULL)
+    {
+      g_printerr ("usage: %s [-I DIRECTORY...] -o OUTPUT TEMPLATE\n", g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+
+  file = g_file_new_for_commandline_arg (argv[1]);
+  dirname = g_path_get_dirname (argv[1]);
+
+  locator = tmpl_template_locator_new ();
+  tmpl_template_locator_append_search_path (locator, dirname);
+
+  for (guint i = 0; include_dirs != NULL && include_dirs[i] != NULL; i++)
+    tmpl_template_locator_append_search_path (locator, include_dirs[i]);
+
+  tmpl = tmpl_template_new (locator);
+
+  if (!tmpl_template_parse_file (tmpl, file, NULL, &error) ||
+      !(bytes = tmpl_template_save_compiled (tmpl, &error)) ||
+      !g_file_set_contents (output_path,
+                            g_bytes_get_data (bytes, NULL),
+                            g_bytes_get_size (bytes),
+                            &error))
+    {
+      g_printerr ("%s: %s\n", argv[1], error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_strfreev (include_dirs);
+  g_free (output_path);
+
+  return EXIT_SUCCESS;
+}
@@ -79,7 +79,8 @@ tmpl_condition_node_accept (TmplNode      *node,
         case TMPL_TOKEN_IF:
         case TMPL_TOKEN_FOR:
         case TMPL_TOKEN_EXPRESSION:
-          child = tmpl_node_new_for_token (token, error);
+        case TMPL_TOKEN_FLUSH:
+          child = tmpl_node_new_for_token (token, lexer, error);
           tmpl_token_free (token);
 
           if (child == NULL)
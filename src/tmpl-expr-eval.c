@@ -23,12 +23,15 @@
 
 #include <girepository/girepository.h>
 
+#include "tmpl-arena-private.h"
 #include "tmpl-error.h"
 #include "tmpl-expr.h"
 #include "tmpl-expr-private.h"
 #include "tmpl-gi-private.h"
-#include "tmpl-scope.h"
+#include "tmpl-iterator-private.h"
+#include "tmpl-scope-private.h"
 #include "tmpl-symbol.h"
+#include "tmpl-symbol-private.h"
 #include "tmpl-util-private.h"
 
 #define DECLARE_BUILTIN(name) \
@@ -42,10 +45,57 @@ typedef gboolean (*FastDispatch) (const GValue  *left,
                                   GValue        *return_value,
                                   GError       **error);
 
+/*
+ * EvalValue is used within the evaluator so that common operations do not
+ * need to initialize, copy and dispatch on a GValue. Strings and objects
+ * are borrowed from the expression or symbol they were read from, so they
+ * must be made owned with eval_value_own() before anything that could
+ * modify that symbol is evaluated. Anything else is kept as a GValue,
+ * which is also what values are boxed into when leaving the evaluator.
+ */
+typedef enum
+{
+  EVAL_VALUE_BOXED,
+  EVAL_VALUE_DOUBLE,
+  EVAL_VALUE_INT64,
+  EVAL_VALUE_BOOLEAN,
+  EVAL_VALUE_STRING,
+  EVAL_VALUE_OBJECT,
+} EvalValueKind;
+
+typedef struct
+{
+  EvalValueKind kind;
+  union {
+    GValue       v_boxed;
+    gdouble      v_double;
+    gint64       v_int64;
+    gboolean     v_boolean;
+    const gchar *v_string;
+    struct {
+      GObject   *object;
+      GType      type;
+    } v_object;
+  } u;
+} EvalValue;
+
+#define EVAL_VALUE_INIT { EVAL_VALUE_BOXED, { G_VALUE_INIT } }
+
 static gboolean tmpl_expr_eval_internal  (TmplExpr  *node,
                                               TmplScope      *scope,
                                               GValue        *return_value,
                                               GError       **error);
+static gboolean tmpl_expr_eval_value         (TmplExpr      *node,
+                                              TmplScope     *scope,
+                                              EvalValue     *return_value,
+                                              GError       **error);
+static gboolean tmpl_expr_eval_condition     (TmplExpr      *node,
+                                              TmplScope     *scope,
+                                              gboolean      *result,
+                                              GError       **error);
+static void     concat_string_string         (const gchar   *left,
+                                              const gchar   *right,
+                                              GValue        *return_value);
 static gboolean throw_type_mismatch          (GError       **error,
                                               const GValue  *left,
                                               const GValue  *right,
@@ -120,6 +170,7 @@ static BuiltinFunc builtin_funcs [] = {
   builtin_cast_float,
   builtin_cast_double,
   builtin_cast_bool,
+  NULL, /* range() takes several arguments, see tmpl_expr_range_eval() */
 };
 
 static inline guint
@@ -381,318 +432,1055 @@ find_dispatch_slow (TmplExprSimple *node,
   return NULL;
 }
 
-static gboolean
-tmpl_expr_simple_eval (TmplExprSimple  *node,
-                       TmplScope       *scope,
-                       GValue          *return_value,
-                       GError         **error)
+/*
+ * The functions found for pointers by find_dispatch_slow() depend on if
+ * the pointer is %NULL, so they cannot be cached by type.
+ */
+static inline gboolean
+is_cacheable (GType type)
 {
-  GValue left = G_VALUE_INIT;
-  GValue right = G_VALUE_INIT;
-  gboolean ret = FALSE;
+  return G_TYPE_FUNDAMENTAL (type) != G_TYPE_POINTER;
+}
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+static FastDispatch
+find_dispatch (TmplExprSimple *node,
+               const GValue   *left,
+               const GValue   *right)
+{
+  GType left_type = G_VALUE_TYPE (left);
+  GType right_type = G_VALUE_TYPE (right);
+  FastDispatch dispatch = NULL;
+  guint hash;
 
-  if (tmpl_expr_eval_internal (node->left, scope, &left, error) &&
-      ((node->right == NULL) ||
-       tmpl_expr_eval_internal (node->right, scope, &right, error)))
+  for (guint i = 0; i < G_N_ELEMENTS (node->cache); i++)
     {
-      FastDispatch dispatch = NULL;
-      guint hash;
-
-      hash = build_hash (node->type, G_VALUE_TYPE (&left), G_VALUE_TYPE (&right));
-
-      if (hash != 0)
-        dispatch = g_hash_table_lookup (fast_dispatch, GINT_TO_POINTER (hash));
-
-      if G_UNLIKELY (dispatch == NULL)
-        {
-          dispatch = find_dispatch_slow (node, &left, &right);
+      TmplExprDispatchCache *entry = &node->cache[i];
 
-          if (dispatch == NULL)
-            {
-              g_autofree gchar *msg = g_strdup_printf ("type mismatch (%d)", node->type);
-              throw_type_mismatch (error, &left, &right, msg);
-              goto cleanup;
-            }
-        }
-
-      ret = dispatch (&left, &right, return_value, error);
+      if (g_atomic_int_get (&entry->state) == TMPL_EXPR_CACHE_READY &&
+          entry->left == left_type &&
+          entry->right == right_type)
+        return (FastDispatch)entry->func;
     }
 
-cleanup:
-  TMPL_CLEAR_VALUE (&left);
-  TMPL_CLEAR_VALUE (&right);
-
-  return ret;
-}
-
-static gboolean
-tmpl_expr_simple_eval_logical (TmplExprSimple  *node,
-                               TmplScope       *scope,
-                               GValue          *return_value,
-                               GError         **error)
-{
-  GValue left = G_VALUE_INIT;
-  GValue right = G_VALUE_INIT;
-  gboolean ret = FALSE;
+  hash = build_hash (node->type, left_type, right_type);
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+  if (hash != 0)
+    dispatch = g_hash_table_lookup (fast_dispatch, GINT_TO_POINTER (hash));
 
-  g_value_init (return_value, G_TYPE_BOOLEAN);
+  if (dispatch == NULL)
+    dispatch = find_dispatch_slow (node, left, right);
 
-  if (!tmpl_expr_eval_internal (node->left, scope, &left, error))
-    goto failure;
+  if (dispatch == NULL || !is_cacheable (left_type) || !is_cacheable (right_type))
+    return dispatch;
 
-  switch ((int)node->type)
+  /*
+   * Fill the first empty slot. If another thread is filling it, this
+   * pair of types is simply not cached for now.
+   */
+  for (guint i = 0; i < G_N_ELEMENTS (node->cache); i++)
     {
-    case TMPL_EXPR_AND:
-      if (!tmpl_value_as_boolean (&left))
-        {
-          g_value_set_boolean (return_value, FALSE);
-          ret = TRUE;
-          break;
-        }
-      if (!tmpl_expr_eval_internal (node->right, scope, &right, error))
-        goto failure;
-      g_value_set_boolean (return_value, tmpl_value_as_boolean (&right));
-      ret = TRUE;
-      break;
+      TmplExprDispatchCache *entry = &node->cache[i];
 
-    case TMPL_EXPR_OR:
-      if (tmpl_value_as_boolean (&left))
+      if (g_atomic_int_get (&entry->state) != TMPL_EXPR_CACHE_EMPTY)
+        continue;
+
+      if (g_atomic_int_compare_and_exchange (&entry->state, TMPL_EXPR_CACHE_EMPTY, TMPL_EXPR_CACHE_BUSY))
         {
-          g_value_set_boolean (return_value, TRUE);
-          ret = TRUE;
-          break;
+          entry->left = left_type;
+          entry->right = right_type;
+          entry->func = (gpointer)dispatch;
+          g_atomic_int_set (&entry->state, TMPL_EXPR_CACHE_READY);
         }
-      if (!tmpl_expr_eval_internal (node->right, scope, &right, error))
-        goto failure;
-      g_value_set_boolean (return_value, tmpl_value_as_boolean (&right));
-      ret = TRUE;
-      break;
 
-    default:
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_RUNTIME_ERROR,
-                   "Unknown logical operator type: %d", node->type);
       break;
     }
 
-failure:
-  TMPL_CLEAR_VALUE (&left);
-  TMPL_CLEAR_VALUE (&right);
-
-  return ret;
+  return dispatch;
 }
 
-static gboolean
-tmpl_expr_fn_call_eval (TmplExprFnCall  *node,
-                       TmplScope       *scope,
-                       GValue         *return_value,
-                       GError        **error)
+static inline void
+eval_value_clear (EvalValue *value)
 {
-  GValue left = G_VALUE_INIT;
-  gboolean ret = FALSE;
+  if (value->kind == EVAL_VALUE_BOXED)
+    TMPL_CLEAR_VALUE (&value->u.v_boxed);
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+  value->kind = EVAL_VALUE_BOXED;
+  memset (&value->u.v_boxed, 0, sizeof value->u.v_boxed);
+}
 
-  if (tmpl_expr_eval_internal (node->param, scope, &left, error))
-    ret = builtin_funcs [node->builtin] (&left, return_value, error);
+/*
+ * Reads @src into @value, borrowing strings and objects from it.
+ */
+static inline void
+eval_value_borrow (EvalValue    *value,
+                   const GValue *src)
+{
+  GType type = G_VALUE_TYPE (src);
 
-  TMPL_CLEAR_VALUE (&left);
+  switch (type)
+    {
+    case G_TYPE_DOUBLE:
+      value->kind = EVAL_VALUE_DOUBLE;
+      value->u.v_double = g_value_get_double (src);
+      break;
 
-  return ret;
-}
+    case G_TYPE_INT64:
+      value->kind = EVAL_VALUE_INT64;
+      value->u.v_int64 = g_value_get_int64 (src);
+      break;
 
-static gboolean
-tmpl_expr_flow_eval (TmplExprFlow  *node,
-                    TmplScope     *scope,
-                    GValue       *return_value,
-                    GError      **error)
-{
-  GValue cond = G_VALUE_INIT;
-  gboolean ret = FALSE;
+    case G_TYPE_BOOLEAN:
+      value->kind = EVAL_VALUE_BOOLEAN;
+      value->u.v_boolean = g_value_get_boolean (src);
+      break;
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+    case G_TYPE_STRING:
+      value->kind = EVAL_VALUE_STRING;
+      value->u.v_string = g_value_get_string (src);
+      break;
 
-  if (!tmpl_expr_eval_internal (node->condition, scope, &cond, error))
-    goto cleanup;
+    case G_TYPE_INVALID:
+      value->kind = EVAL_VALUE_BOXED;
+      break;
 
-  if (node->type == TMPL_EXPR_IF)
-    {
-      if (tmpl_value_as_boolean (&cond))
+    default:
+      if (G_TYPE_IS_OBJECT (type))
         {
-          if (node->primary != NULL)
-            ret = tmpl_expr_eval_internal (node->primary, scope, return_value, error);
-          else
-            ret = TRUE;
-          goto cleanup;
+          value->kind = EVAL_VALUE_OBJECT;
+          value->u.v_object.object = g_value_get_object (src);
+          value->u.v_object.type = type;
         }
       else
         {
-          if (node->secondary != NULL)
-            ret = tmpl_expr_eval_internal (node->secondary, scope, return_value, error);
-          else
-            ret = TRUE;
-          goto cleanup;
+          value->kind = EVAL_VALUE_BOXED;
+          g_value_init (&value->u.v_boxed, type);
+          g_value_copy (src, &value->u.v_boxed);
         }
+      break;
     }
-  else if (node->type == TMPL_EXPR_WHILE)
+}
+
+/*
+ * Moves @value into @dest, which must not be initialized. Borrowed strings
+ * are copied into the scratch arena of the expansion if there is one.
+ */
+static void
+eval_value_box (EvalValue *value,
+                GValue    *dest)
+{
+  switch (value->kind)
     {
-      if (node->primary != NULL)
-        {
-          while (tmpl_value_as_boolean (&cond))
-            {
-              /* last iteration is result value */
-              g_value_unset (return_value);
-              if (!tmpl_expr_eval_internal (node->primary, scope, return_value, error))
-                goto cleanup;
-
-              g_value_unset (&cond);
-              if (!tmpl_expr_eval_internal (node->condition, scope, &cond, error))
-                goto cleanup;
-            }
-        }
-    }
+    case EVAL_VALUE_BOXED:
+      *dest = value->u.v_boxed;
+      break;
 
-  g_set_error (error,
-               TMPL_ERROR,
-               TMPL_ERROR_INVALID_STATE,
-               "Invalid AST");
+    case EVAL_VALUE_DOUBLE:
+      g_value_init (dest, G_TYPE_DOUBLE);
+      g_value_set_double (dest, value->u.v_double);
+      break;
 
-cleanup:
-  TMPL_CLEAR_VALUE (&cond);
+    case EVAL_VALUE_INT64:
+      g_value_init (dest, G_TYPE_INT64);
+      g_value_set_int64 (dest, value->u.v_int64);
+      break;
 
-  return ret;
-}
+    case EVAL_VALUE_BOOLEAN:
+      g_value_init (dest, G_TYPE_BOOLEAN);
+      g_value_set_boolean (dest, value->u.v_boolean);
+      break;
 
-static gboolean
-tmpl_expr_stmt_list_eval (TmplExprStmtList  *node,
-                          TmplScope         *scope,
-                          GValue            *return_value,
-                          GError           **error)
-{
-  GValue last = G_VALUE_INIT;
+    case EVAL_VALUE_STRING:
+      {
+        const gchar *str = value->u.v_string;
+        TmplArena *scratch;
+
+        g_value_init (dest, G_TYPE_STRING);
+
+        /*
+         * A copy of a static string is still duplicated, so the value may
+         * be assigned to a symbol safely.
+         */
+        if (str != NULL && (scratch = tmpl_arena_get_scratch ()))
+          g_value_set_static_string (dest, tmpl_arena_strndup (scratch, str, strlen (str)));
+        else
+          g_value_set_string (dest, str);
+      }
+      break;
 
-  if G_UNLIKELY (node->stmts == NULL || node->stmts->len == 0)
-    {
-      g_set_error_literal (error,
-                           TMPL_ERROR,
-                           TMPL_ERROR_RUNTIME_ERROR,
-                           "Runtime Error: implausible TmplExprStmtList");
-      return FALSE;
+    case EVAL_VALUE_OBJECT:
+      g_value_init (dest, value->u.v_object.type);
+      g_value_set_object (dest, value->u.v_object.object);
+      break;
+
+    default:
+      g_assert_not_reached ();
     }
 
-  for (guint i = 0; i < node->stmts->len; i++)
-    {
-      TmplExpr *stmt = g_ptr_array_index (node->stmts, i);
+  value->kind = EVAL_VALUE_BOXED;
+  memset (&value->u.v_boxed, 0, sizeof value->u.v_boxed);
+}
 
-      TMPL_CLEAR_VALUE (&last);
+/*
+ * Ensures @value no longer borrows from the symbol it was read from.
+ */
+static inline void
+eval_value_own (EvalValue *value)
+{
+  if (value->kind == EVAL_VALUE_STRING || value->kind == EVAL_VALUE_OBJECT)
+    {
+      GValue tmp = G_VALUE_INIT;
 
-      if (!tmpl_expr_eval_internal (stmt, scope, &last, error))
-        {
-          TMPL_CLEAR_VALUE (&last);
-          return FALSE;
-        }
+      eval_value_box (value, &tmp);
+      value->u.v_boxed = tmp;
     }
-
-  *return_value = last;
-
-  return TRUE;
 }
 
-static gboolean
-tmpl_expr_args_eval (TmplExprSimple  *node,
-                     TmplScope       *scope,
-                     GValue          *return_value,
-                     GError         **error)
+static inline gboolean
+eval_value_as_boolean (const EvalValue *value)
 {
-  GValue left = G_VALUE_INIT;
-  gboolean ret = FALSE;
+  switch (value->kind)
+    {
+    case EVAL_VALUE_DOUBLE:
+      return value->u.v_double != 0.0;
 
-  if (!tmpl_expr_eval_internal (node->left, scope, &left, error))
-    goto cleanup;
+    case EVAL_VALUE_INT64:
+      return value->u.v_int64 != 0;
 
-  if (!tmpl_expr_eval_internal (node->left, scope, return_value, error))
-    goto cleanup;
+    case EVAL_VALUE_BOOLEAN:
+      return value->u.v_boolean;
 
-  ret = TRUE;
+    case EVAL_VALUE_STRING:
+      return value->u.v_string != NULL && value->u.v_string[0] != 0;
 
-cleanup:
-  TMPL_CLEAR_VALUE (&left);
+    case EVAL_VALUE_OBJECT:
+      return value->u.v_object.object != NULL;
 
-  return ret;
+    case EVAL_VALUE_BOXED:
+    default:
+      return tmpl_value_as_boolean (&value->u.v_boxed);
+    }
 }
 
-static gboolean
-tmpl_expr_symbol_ref_eval (TmplExprSymbolRef  *node,
-                           TmplScope          *scope,
-                           GValue             *return_value,
-                           GError            **error)
+static inline void
+eval_value_set_double (EvalValue *value,
+                       gdouble    v_double)
 {
-  TmplSymbol *symbol;
+  value->kind = EVAL_VALUE_DOUBLE;
+  value->u.v_double = v_double;
+}
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
+static inline void
+eval_value_set_int64 (EvalValue *value,
+                      gint64     v_int64)
+{
+  value->kind = EVAL_VALUE_INT64;
+  value->u.v_int64 = v_int64;
+}
 
-  symbol = tmpl_scope_peek (scope, node->symbol);
+static inline void
+eval_value_set_boolean (EvalValue *value,
+                        gboolean   v_boolean)
+{
+  value->kind = EVAL_VALUE_BOOLEAN;
+  value->u.v_boolean = !!v_boolean;
+}
 
-  if (symbol == NULL)
+/*
+ * Expressions which cannot have side effects, so that a value borrowed
+ * before evaluating them remains valid.
+ */
+static inline gboolean
+is_pure_leaf (TmplExpr *node)
+{
+  switch (node->any.type)
     {
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_MISSING_SYMBOL,
-                   "No such symbol \"%s\" in scope",
-                   node->symbol);
+    case TMPL_EXPR_NUMBER:
+    case TMPL_EXPR_BOOLEAN:
+    case TMPL_EXPR_STRING:
+    case TMPL_EXPR_CONSTANT:
+    case TMPL_EXPR_SYMBOL_REF:
+    case TMPL_EXPR_NULL:
+      return TRUE;
+
+    default:
       return FALSE;
     }
+}
 
-  if (tmpl_symbol_get_symbol_type (symbol) == TMPL_SYMBOL_VALUE)
+static inline gboolean
+is_number (const EvalValue *value)
+{
+  return value->kind == EVAL_VALUE_DOUBLE || value->kind == EVAL_VALUE_INT64;
+}
+
+static inline gdouble
+get_number (const EvalValue *value)
+{
+  return value->kind == EVAL_VALUE_DOUBLE ? value->u.v_double : (gdouble)value->u.v_int64;
+}
+
+/*
+ * Applies @type to two int64 operands, returning %FALSE if the result
+ * would overflow so the operation can be done in doubles instead.
+ */
+static inline gboolean
+int64_arith (TmplExprType  type,
+             gint64        l,
+             gint64        r,
+             gint64       *result)
+{
+  switch ((int)type)
     {
-      tmpl_symbol_get_value (symbol, return_value);
+    case TMPL_EXPR_ADD:
+      if ((r > 0 && l > G_MAXINT64 - r) || (r < 0 && l < G_MININT64 - r))
+        return FALSE;
+      *result = l + r;
       return TRUE;
-    }
 
-  g_set_error (error,
-               TMPL_ERROR,
-               TMPL_ERROR_NOT_A_VALUE,
-               "The symbol \"%s\" is not a value",
-               node->symbol);
+    case TMPL_EXPR_SUB:
+      if ((r < 0 && l > G_MAXINT64 + r) || (r > 0 && l < G_MININT64 + r))
+        return FALSE;
+      *result = l - r;
+      return TRUE;
 
-  return FALSE;
+    case TMPL_EXPR_MUL:
+      if (l > 0 ? (r > 0 ? l > G_MAXINT64 / r : r < G_MININT64 / l)
+                : (r > 0 ? l < G_MININT64 / r : (l != 0 && r < G_MAXINT64 / l)))
+        return FALSE;
+      *result = l * r;
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
 }
 
+/*
+ * Applies @type to operands that do not need the dispatch table. Returns
+ * %FALSE if the operands must be boxed and dispatched instead, otherwise
+ * @ret is set to the result of the operation.
+ */
 static gboolean
-tmpl_expr_symbol_assign_eval (TmplExprSymbolAssign  *node,
-                              TmplScope             *scope,
-                              GValue                *return_value,
-                              GError               **error)
+eval_value_fast_op (TmplExprType      type,
+                    const EvalValue  *left,
+                    const EvalValue  *right,
+                    EvalValue        *return_value,
+                    gboolean         *ret,
+                    GError          **error)
 {
-  TmplSymbol *symbol;
+  *ret = TRUE;
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+  if (type == TMPL_EXPR_UNARY_MINUS)
+    {
+      if (left->kind == EVAL_VALUE_DOUBLE)
+        eval_value_set_double (return_value, -left->u.v_double);
+      else if (left->kind == EVAL_VALUE_INT64 && left->u.v_int64 != G_MININT64)
+        eval_value_set_int64 (return_value, -left->u.v_int64);
+      else if (left->kind == EVAL_VALUE_INT64)
+        eval_value_set_double (return_value, -(gdouble)left->u.v_int64);
+      else
+        return FALSE;
+
+      return TRUE;
+    }
+
+  if (left->kind == EVAL_VALUE_INT64 && right->kind == EVAL_VALUE_INT64)
+    {
+      gint64 l = left->u.v_int64;
+      gint64 r = right->u.v_int64;
+      gint64 result;
+
+      switch ((int)type)
+        {
+        /* On overflow, fall through to the double path below */
+        case TMPL_EXPR_ADD:
+        case TMPL_EXPR_SUB:
+        case TMPL_EXPR_MUL:
+          if (!int64_arith (type, l, r, &result))
+            break;
+          eval_value_set_int64 (return_value, result);
+          return TRUE;
+
+        case TMPL_EXPR_LT:  eval_value_set_boolean (return_value, l < r); return TRUE;
+        case TMPL_EXPR_GT:  eval_value_set_boolean (return_value, l > r); return TRUE;
+        case TMPL_EXPR_LTE: eval_value_set_boolean (return_value, l <= r); return TRUE;
+        case TMPL_EXPR_GTE: eval_value_set_boolean (return_value, l >= r); return TRUE;
+        case TMPL_EXPR_EQ:  eval_value_set_boolean (return_value, l == r); return TRUE;
+        case TMPL_EXPR_NE:  eval_value_set_boolean (return_value, l != r); return TRUE;
+        default: break;
+        }
+    }
+
+  if (is_number (left) && is_number (right))
+    {
+      gdouble l = get_number (left);
+      gdouble r = get_number (right);
+
+      switch ((int)type)
+        {
+        case TMPL_EXPR_ADD: eval_value_set_double (return_value, l + r); return TRUE;
+        case TMPL_EXPR_SUB: eval_value_set_double (return_value, l - r); return TRUE;
+        case TMPL_EXPR_MUL: eval_value_set_double (return_value, l * r); return TRUE;
+        case TMPL_EXPR_LT:  eval_value_set_boolean (return_value, l < r); return TRUE;
+        case TMPL_EXPR_GT:  eval_value_set_boolean (return_value, l > r); return TRUE;
+        case TMPL_EXPR_LTE: eval_value_set_boolean (return_value, l <= r); return TRUE;
+        case TMPL_EXPR_GTE: eval_value_set_boolean (return_value, l >= r); return TRUE;
+        case TMPL_EXPR_EQ:  eval_value_set_boolean (return_value, l == r); return TRUE;
+        case TMPL_EXPR_NE:  eval_value_set_boolean (return_value, l != r); return TRUE;
+
+        case TMPL_EXPR_DIV:
+          if (r == 0.0)
+            {
+              g_set_error (error,
+                           TMPL_ERROR,
+                           TMPL_ERROR_DIVIDE_BY_ZERO,
+                           "divide by zero");
+              *ret = FALSE;
+              return TRUE;
+            }
+          eval_value_set_double (return_value, l / r);
+          return TRUE;
+
+        default:
+          return FALSE;
+        }
+    }
+
+  if (left->kind == EVAL_VALUE_STRING && right->kind == EVAL_VALUE_STRING)
+    {
+      switch ((int)type)
+        {
+        case TMPL_EXPR_EQ:
+          eval_value_set_boolean (return_value, 0 == g_strcmp0 (left->u.v_string, right->u.v_string));
+          return TRUE;
+
+        case TMPL_EXPR_NE:
+          eval_value_set_boolean (return_value, 0 != g_strcmp0 (left->u.v_string, right->u.v_string));
+          return TRUE;
+
+        case TMPL_EXPR_ADD:
+          return_value->kind = EVAL_VALUE_BOXED;
+          concat_string_string (left->u.v_string, right->u.v_string, &return_value->u.v_boxed);
+          return TRUE;
+
+        default:
+          return FALSE;
+        }
+    }
+
+  if (left->kind == EVAL_VALUE_BOOLEAN && right->kind == EVAL_VALUE_BOOLEAN)
+    {
+      if (type == TMPL_EXPR_EQ)
+        eval_value_set_boolean (return_value, left->u.v_boolean == right->u.v_boolean);
+      else if (type == TMPL_EXPR_NE)
+        eval_value_set_boolean (return_value, left->u.v_boolean != right->u.v_boolean);
+      else
+        return FALSE;
+
+      return TRUE;
+    }
+
+  if (left->kind == EVAL_VALUE_OBJECT && right->kind == EVAL_VALUE_OBJECT)
+    {
+      if (type == TMPL_EXPR_EQ)
+        eval_value_set_boolean (return_value, left->u.v_object.object == right->u.v_object.object);
+      else if (type == TMPL_EXPR_NE)
+        eval_value_set_boolean (return_value, left->u.v_object.object != right->u.v_object.object);
+      else
+        return FALSE;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+tmpl_expr_simple_eval (TmplExprSimple  *node,
+                       TmplScope       *scope,
+                       EvalValue       *return_value,
+                       GError         **error)
+{
+  EvalValue left = EVAL_VALUE_INIT;
+  EvalValue right = EVAL_VALUE_INIT;
+  GValue left_boxed = G_VALUE_INIT;
+  GValue right_boxed = G_VALUE_INIT;
+  FastDispatch dispatch = NULL;
+  gboolean ret = FALSE;
+  gboolean fast_ret;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  if (!tmpl_expr_eval_value (node->left, scope, &left, error))
+    goto cleanup;
+
+  if (node->right != NULL)
+    {
+      /* Evaluating the right side may assign to what the left borrows */
+      if (!is_pure_leaf (node->right))
+        eval_value_own (&left);
+
+      if (!tmpl_expr_eval_value (node->right, scope, &right, error))
+        goto cleanup;
+    }
+
+  if (eval_value_fast_op (node->type, &left, &right, return_value, &fast_ret, error))
+    {
+      ret = fast_ret;
+      goto cleanup;
+    }
+
+  eval_value_box (&left, &left_boxed);
+  eval_value_box (&right, &right_boxed);
+
+  if G_UNLIKELY (!(dispatch = find_dispatch (node, &left_boxed, &right_boxed)))
+    {
+      g_autofree gchar *msg = g_strdup_printf ("type mismatch (%d)", node->type);
+      throw_type_mismatch (error, &left_boxed, &right_boxed, msg);
+      goto cleanup;
+    }
+
+  return_value->kind = EVAL_VALUE_BOXED;
+  ret = dispatch (&left_boxed, &right_boxed, &return_value->u.v_boxed, error);
+
+cleanup:
+  eval_value_clear (&left);
+  eval_value_clear (&right);
+  TMPL_CLEAR_VALUE (&left_boxed);
+  TMPL_CLEAR_VALUE (&right_boxed);
+
+  return ret;
+}
+
+static gboolean
+tmpl_expr_simple_eval_logical (TmplExprSimple  *node,
+                               TmplScope       *scope,
+                               EvalValue       *return_value,
+                               GError         **error)
+{
+  gboolean left;
+  gboolean right = FALSE;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  if (!tmpl_expr_eval_condition (node->left, scope, &left, error))
+    return FALSE;
+
+  switch ((int)node->type)
+    {
+    case TMPL_EXPR_AND:
+      if (left && !tmpl_expr_eval_condition (node->right, scope, &right, error))
+        return FALSE;
+      eval_value_set_boolean (return_value, left && right);
+      return TRUE;
+
+    case TMPL_EXPR_OR:
+      if (!left && !tmpl_expr_eval_condition (node->right, scope, &right, error))
+        return FALSE;
+      eval_value_set_boolean (return_value, left || right);
+      return TRUE;
+
+    default:
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_RUNTIME_ERROR,
+                   "Unknown logical operator type: %d", node->type);
+      return FALSE;
+    }
+}
+
+static gboolean
+eval_range_bound (TmplExpr   *node,
+                  TmplScope  *scope,
+                  gdouble    *number,
+                  GError    **error)
+{
+  EvalValue value = EVAL_VALUE_INIT;
+  GValue boxed = G_VALUE_INIT;
+  GValue trans = G_VALUE_INIT;
+  gboolean ret = FALSE;
+
+  if (!tmpl_expr_eval_value (node, scope, &value, error))
+    return FALSE;
+
+  if (is_number (&value))
+    {
+      *number = get_number (&value);
+      eval_value_clear (&value);
+      return TRUE;
+    }
+
+  eval_value_box (&value, &boxed);
+  g_value_init (&trans, G_TYPE_DOUBLE);
+
+  if (G_VALUE_TYPE (&boxed) != G_TYPE_INVALID &&
+      g_value_type_transformable (G_VALUE_TYPE (&boxed), G_TYPE_DOUBLE) &&
+      g_value_transform (&boxed, &trans))
+    {
+      *number = g_value_get_double (&trans);
+      ret = TRUE;
+    }
+  else
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_TYPE_MISMATCH,
+                   "range() requires numbers, got %s",
+                   G_VALUE_TYPE (&boxed) ? G_VALUE_TYPE_NAME (&boxed) : "null");
+    }
+
+  TMPL_CLEAR_VALUE (&boxed);
+  g_value_unset (&trans);
+
+  return ret;
+}
+
+/*
+ * range(stop), range(start, stop) and range(start, stop, step) follow the
+ * semantics of Python. Only the bounds are stored in the result, the
+ * numbers are produced by the iterator of the for loop.
+ */
+static gboolean
+tmpl_expr_range_eval (TmplExprFnCall  *node,
+                      TmplScope       *scope,
+                      GValue          *return_value,
+                      GError         **error)
+{
+  TmplExpr *args = node->param;
+  gdouble bounds[3];
+  gdouble start = 0.0;
+  gdouble stop;
+  gdouble step = 1.0;
+  gdouble n_items;
+  guint n_bounds = 0;
+
+  while (args != NULL)
+    {
+      TmplExpr *arg = args;
+
+      if (n_bounds == G_N_ELEMENTS (bounds))
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_SYNTAX_ERROR,
+                       "Too many arguments to function \"range\"");
+          return FALSE;
+        }
+
+      if (args->any.type == TMPL_EXPR_ARGS)
+        {
+          arg = ((TmplExprSimple *)args)->left;
+          args = ((TmplExprSimple *)args)->right;
+        }
+      else
+        {
+          args = NULL;
+        }
+
+      if (!eval_range_bound (arg, scope, &bounds[n_bounds], error))
+        return FALSE;
+
+      n_bounds++;
+    }
+
+  switch (n_bounds)
+    {
+    case 1:
+      stop = bounds[0];
+      break;
+
+    case 2:
+      start = bounds[0];
+      stop = bounds[1];
+      break;
+
+    case 3:
+      start = bounds[0];
+      stop = bounds[1];
+      step = bounds[2];
+      break;
+
+    default:
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_SYNTAX_ERROR,
+                   "Too few arguments to function \"range\"");
+      return FALSE;
+    }
+
+  if (step == 0.0)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_RUNTIME_ERROR,
+                   "range() step must not be zero");
+      return FALSE;
+    }
+
+  n_items = MAX (0.0, ceil ((stop - start) / step));
+
+  /* Also catches NaN and infinite bounds */
+  if (!(n_items < (gdouble)G_MAXSIZE))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_RUNTIME_ERROR,
+                   "range() bounds are out of range");
+      return FALSE;
+    }
+
+  g_value_init (return_value, TMPL_TYPE_RANGE);
+  g_value_take_boxed (return_value, tmpl_range_new (start, step, (gsize)n_items));
+
+  return TRUE;
+}
+
+static gboolean
+tmpl_expr_fn_call_eval (TmplExprFnCall  *node,
+                       TmplScope       *scope,
+                       GValue         *return_value,
+                       GError        **error)
+{
+  GValue left = G_VALUE_INIT;
+  gboolean ret = FALSE;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  if (node->builtin == TMPL_EXPR_BUILTIN_RANGE)
+    return tmpl_expr_range_eval (node, scope, return_value, error);
+
+  if (tmpl_expr_eval_internal (node->param, scope, &left, error))
+    ret = builtin_funcs [node->builtin] (&left, return_value, error);
+
+  TMPL_CLEAR_VALUE (&left);
+
+  return ret;
+}
+
+static gboolean
+tmpl_expr_if_eval (TmplExprFlow  *node,
+                   TmplScope     *scope,
+                   EvalValue     *return_value,
+                   GError       **error)
+{
+  gboolean cond;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  if (!tmpl_expr_eval_condition (node->condition, scope, &cond, error))
+    return FALSE;
+
+  if (cond)
+    return node->primary == NULL ||
+           tmpl_expr_eval_value (node->primary, scope, return_value, error);
+  else
+    return node->secondary == NULL ||
+           tmpl_expr_eval_value (node->secondary, scope, return_value, error);
+}
+
+static gboolean
+tmpl_expr_while_eval (TmplExprFlow  *node,
+                      TmplScope     *scope,
+                      GValue        *return_value,
+                      GError       **error)
+{
+  gboolean cond;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  for (;;)
+    {
+      if (!tmpl_expr_eval_condition (node->condition, scope, &cond, error))
+        return FALSE;
+
+      if (!cond || node->primary == NULL)
+        return TRUE;
+
+      /* last iteration is result value */
+      TMPL_CLEAR_VALUE (return_value);
+      if (!tmpl_expr_eval_internal (node->primary, scope, return_value, error))
+        return FALSE;
+    }
+}
+
+static gboolean
+tmpl_expr_stmt_list_eval (TmplExprStmtList  *node,
+                          TmplScope         *scope,
+                          GValue            *return_value,
+                          GError           **error)
+{
+  GValue last = G_VALUE_INIT;
+
+  if G_UNLIKELY (node->stmts == NULL || node->stmts->len == 0)
+    {
+      g_set_error_literal (error,
+                           TMPL_ERROR,
+                           TMPL_ERROR_RUNTIME_ERROR,
+                           "Runtime Error: implausible TmplExprStmtList");
+      return FALSE;
+    }
+
+  for (guint i = 0; i < node->stmts->len; i++)
+    {
+      TmplExpr *stmt = g_ptr_array_index (node->stmts, i);
+
+      TMPL_CLEAR_VALUE (&last);
+
+      if (!tmpl_expr_eval_internal (stmt, scope, &last, error))
+        {
+          TMPL_CLEAR_VALUE (&last);
+          return FALSE;
+        }
+    }
+
+  *return_value = last;
+
+  return TRUE;
+}
+
+static gboolean
+tmpl_expr_args_eval (TmplExprSimple  *node,
+                     TmplScope       *scope,
+                     GValue          *return_value,
+                     GError         **error)
+{
+  GValue left = G_VALUE_INIT;
+  gboolean ret = FALSE;
+
+  if (!tmpl_expr_eval_internal (node->left, scope, &left, error))
+    goto cleanup;
+
+  if (!tmpl_expr_eval_internal (node->left, scope, return_value, error))
+    goto cleanup;
+
+  ret = TRUE;
+
+cleanup:
+  TMPL_CLEAR_VALUE (&left);
+
+  return ret;
+}
+
+static gboolean
+tmpl_expr_symbol_ref_eval (TmplExprSymbolRef  *node,
+                           TmplScope          *scope,
+                           EvalValue          *return_value,
+                           GError            **error)
+{
+  TmplSymbol *symbol;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+
+  symbol = tmpl_scope_peek_interned (scope, node->symbol);
+
+  if (symbol == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_MISSING_SYMBOL,
+                   "No such symbol \"%s\" in scope",
+                   node->symbol);
+      return FALSE;
+    }
+
+  if (tmpl_symbol_get_symbol_type (symbol) == TMPL_SYMBOL_VALUE)
+    {
+      eval_value_borrow (return_value, tmpl_symbol_peek_value (symbol));
+      return TRUE;
+    }
+
+  g_set_error (error,
+               TMPL_ERROR,
+               TMPL_ERROR_NOT_A_VALUE,
+               "The symbol \"%s\" is not a value",
+               node->symbol);
+
+  return FALSE;
+}
+
+static gboolean
+tmpl_expr_symbol_assign_eval (TmplExprSymbolAssign  *node,
+                              TmplScope             *scope,
+                              GValue                *return_value,
+                              GError               **error)
+{
+  TmplSymbol *symbol;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
 
   if (!tmpl_expr_eval_internal (node->right, scope, return_value, error))
     return FALSE;
 
-  symbol = tmpl_scope_get (scope, node->symbol);
+  symbol = tmpl_scope_get_interned (scope, node->symbol);
   tmpl_symbol_assign_value (symbol, return_value);
 
   return TRUE;
 }
 
+void
+tmpl_expr_property_cache_clear (TmplExprPropertyCache *cache)
+{
+  for (guint i = 0; i < TMPL_EXPR_N_PROPERTY_CACHE; i++)
+    {
+      TmplExprPropertyCache *entry = &cache[i];
+
+      if (entry->state == TMPL_EXPR_CACHE_READY)
+        g_clear_pointer (&entry->pspec, g_param_spec_unref);
+
+      entry->state = TMPL_EXPR_CACHE_EMPTY;
+    }
+}
+
+/*
+ * Resolves @attr on the class of @object, remembering the result for the
+ * type of @object. The returned pspec is owned by the class and therefore
+ * stays valid for as long as @object is alive.
+ */
+static GParamSpec *
+find_object_property (TmplExprPropertyCache  *cache,
+                      GObject                *object,
+                      const gchar            *attr,
+                      GError                **error)
+{
+  GType type = G_OBJECT_TYPE (object);
+  GParamSpec *pspec;
+
+  for (guint i = 0; i < TMPL_EXPR_N_PROPERTY_CACHE; i++)
+    {
+      TmplExprPropertyCache *entry = &cache[i];
+
+      if (g_atomic_int_get (&entry->state) == TMPL_EXPR_CACHE_READY &&
+          entry->type == type)
+        return entry->pspec;
+    }
+
+  if (!(pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (object), attr)))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_NO_SUCH_PROPERTY,
+                   "No such property \"%s\" on object \"%s\"",
+                   attr, G_OBJECT_TYPE_NAME (object));
+      return NULL;
+    }
+
+  for (guint i = 0; i < TMPL_EXPR_N_PROPERTY_CACHE; i++)
+    {
+      TmplExprPropertyCache *entry = &cache[i];
+
+      if (g_atomic_int_get (&entry->state) != TMPL_EXPR_CACHE_EMPTY)
+        continue;
+
+      if (g_atomic_int_compare_and_exchange (&entry->state, TMPL_EXPR_CACHE_EMPTY, TMPL_EXPR_CACHE_BUSY))
+        {
+          entry->type = type;
+          entry->pspec = g_param_spec_ref (pspec);
+          g_atomic_int_set (&entry->state, TMPL_EXPR_CACHE_READY);
+        }
+
+      break;
+    }
+
+  return pspec;
+}
+
+/*
+ * Reads @pspec from @object. The public API is used so that redirected
+ * properties, deprecation warnings and the object reference held during
+ * the call behave as usual. GObject still looks the property up by
+ * pspec->name on every call; the cached pspec only spares the lookup on
+ * the class of @object and our own access checks.
+ */
+static gboolean
+get_object_property (GObject     *object,
+                     GParamSpec  *pspec,
+                     GValue      *value,
+                     GError     **error)
+{
+  if (!(pspec->flags & G_PARAM_READABLE))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_NO_SUCH_PROPERTY,
+                   "Property \"%s\" of object \"%s\" is not readable",
+                   pspec->name, G_OBJECT_TYPE_NAME (object));
+      return FALSE;
+    }
+
+  g_value_init (value, pspec->value_type);
+  g_object_get_property (object, pspec->name, value);
+
+  return TRUE;
+}
+
+/*
+ * Writes @value to @pspec of @object, converting it to the type of the
+ * cached pspec first so that mismatches are reported rather than warned
+ * about by GObject. As with get_object_property(), GObject looks the
+ * property up by name again.
+ */
+static gboolean
+set_object_property (GObject       *object,
+                     GParamSpec    *pspec,
+                     const GValue  *value,
+                     GError       **error)
+{
+  GValue converted = G_VALUE_INIT;
+
+  if (!(pspec->flags & G_PARAM_WRITABLE) ||
+      (pspec->flags & G_PARAM_CONSTRUCT_ONLY))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_NO_SUCH_PROPERTY,
+                   "Property \"%s\" of object \"%s\" is not writable",
+                   pspec->name, G_OBJECT_TYPE_NAME (object));
+      return FALSE;
+    }
+
+  if (G_VALUE_TYPE (value) != G_TYPE_INVALID &&
+      g_value_type_compatible (G_VALUE_TYPE (value), pspec->value_type))
+    {
+      g_object_set_property (object, pspec->name, value);
+      return TRUE;
+    }
+
+  g_value_init (&converted, pspec->value_type);
+
+  if (G_VALUE_TYPE (value) == G_TYPE_INVALID ||
+      !g_value_type_transformable (G_VALUE_TYPE (value), pspec->value_type) ||
+      !g_value_transform (value, &converted))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_TYPE_MISMATCH,
+                   "Cannot assign %s to property \"%s\" of type %s",
+                   G_VALUE_TYPE (value) ? G_VALUE_TYPE_NAME (value) : "null",
+                   pspec->name,
+                   g_type_name (pspec->value_type));
+      g_value_unset (&converted);
+      return FALSE;
+    }
+
+  g_object_set_property (object, pspec->name, &converted);
+  g_value_unset (&converted);
+
+  return TRUE;
+}
+
 static gboolean
 tmpl_expr_getattr_eval (TmplExprGetattr  *node,
                         TmplScope        *scope,
@@ -714,7 +1502,6 @@ tmpl_expr_getattr_eval (TmplExprGetattr  *node,
   if (G_VALUE_HOLDS (&left, TMPL_TYPE_TYPELIB) &&
       g_value_get_pointer (&left) != NULL)
     {
-      GIRepository *repository = tmpl_repository_get_default ();
       GITypelib *typelib = g_value_get_pointer (&left);
       const gchar *ns = gi_typelib_get_namespace (typelib);
       GIBaseInfo *base_info;
@@ -723,7 +1510,7 @@ tmpl_expr_getattr_eval (TmplExprGetattr  *node,
        * Introspection from the first object.
        */
 
-      base_info = gi_repository_find_by_name (repository, ns, node->attr);
+      base_info = tmpl_repository_find_by_name (ns, node->attr);
 
       if (base_info == NULL)
         {
@@ -751,51 +1538,35 @@ tmpl_expr_getattr_eval (TmplExprGetattr  *node,
       /* Check if this is an enum and try to extract the requested attribute */
       if (GI_IS_ENUM_INFO (base_info))
         {
-          GIEnumInfo *enum_info = (GIEnumInfo *)base_info;
-          guint n_values = gi_enum_info_get_n_values (enum_info);
+          GType enum_gtype;
+          gint enum_value;
+
+          if (!tmpl_enum_info_lookup ((GIEnumInfo *)base_info, node->attr, TRUE, &enum_value))
+            {
+              g_set_error (error,
+                           TMPL_ERROR,
+                           TMPL_ERROR_GI_FAILURE,
+                           "No such enum value \"%s\" in enum %s",
+                           node->attr, gi_base_info_get_name (base_info));
+              goto cleanup;
+            }
 
-          /* Search through enum values to find a match */
-          for (guint i = 0; i < n_values; i++)
+          /* Get the GType for this enum */
+          enum_gtype = gi_registered_type_info_get_g_type ((GIRegisteredTypeInfo *)base_info);
+
+          if (enum_gtype == G_TYPE_INVALID)
             {
-              g_autoptr(GIBaseInfo) value_info = NULL;
-              const gchar *value_name;
-
-              value_info = (GIBaseInfo *)gi_enum_info_get_value (enum_info, i);
-              value_name = gi_base_info_get_name (value_info);
-
-              if (strcasecmp (value_name, node->attr) == 0)
-                {
-                  gint enum_value = gi_value_info_get_value ((GIValueInfo *)value_info);
-                  GType enum_gtype;
-
-                  /* Get the GType for this enum */
-                  enum_gtype = gi_registered_type_info_get_g_type ((GIRegisteredTypeInfo *)base_info);
-
-                  if (enum_gtype != G_TYPE_INVALID)
-                    {
-                      g_value_init (return_value, enum_gtype);
-                      g_value_set_enum (return_value, enum_value);
-                      ret = TRUE;
-                      goto cleanup;
-                    }
-                  else
-                    {
-                      g_set_error (error,
-                                   TMPL_ERROR,
-                                   TMPL_ERROR_GI_FAILURE,
-                                   "Failed to get GType for enum %s",
-                                   gi_base_info_get_name (base_info));
-                      goto cleanup;
-                    }
-                }
+              g_set_error (error,
+                           TMPL_ERROR,
+                           TMPL_ERROR_GI_FAILURE,
+                           "Failed to get GType for enum %s",
+                           gi_base_info_get_name (base_info));
+              goto cleanup;
             }
 
-          /* If we get here, the attribute wasn't found in the enum values */
-          g_set_error (error,
-                       TMPL_ERROR,
-                       TMPL_ERROR_GI_FAILURE,
-                       "No such enum value \"%s\" in enum %s",
-                       node->attr, gi_base_info_get_name (base_info));
+          g_value_init (return_value, enum_gtype);
+          g_value_set_enum (return_value, enum_value);
+          ret = TRUE;
           goto cleanup;
         }
       else
@@ -901,20 +1672,10 @@ tmpl_expr_getattr_eval (TmplExprGetattr  *node,
       goto cleanup;
     }
 
-  if (!(pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (object), node->attr)))
-    {
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_NO_SUCH_PROPERTY,
-                   "No such property \"%s\" on object \"%s\"",
-                   node->attr, G_OBJECT_TYPE_NAME (object));
-      goto cleanup;
-    }
-
-  g_value_init (return_value, pspec->value_type);
-  g_object_get_property (object, node->attr, return_value);
+  if (!(pspec = find_object_property (node->cache, object, node->attr, error)))
+    goto cleanup;
 
-  ret = TRUE;
+  ret = get_object_property (object, pspec, return_value, error);
 
 cleanup:
   TMPL_CLEAR_VALUE (&left);
@@ -930,6 +1691,7 @@ tmpl_expr_setattr_eval (TmplExprSetattr  *node,
 {
   GValue left = G_VALUE_INIT;
   GValue right = G_VALUE_INIT;
+  GParamSpec *pspec;
   GObject *object;
   gboolean ret = FALSE;
 
@@ -937,7 +1699,8 @@ tmpl_expr_setattr_eval (TmplExprSetattr  *node,
   g_assert (scope != NULL);
   g_assert (return_value != NULL);
 
-  if (!tmpl_expr_eval_internal (node->left, scope, &left, error))
+  if (!tmpl_expr_eval_internal (node->left, scope, &left, error) ||
+      !tmpl_expr_eval_internal (node->right, scope, &right, error))
     goto cleanup;
 
   if (!G_VALUE_HOLDS_OBJECT (&left))
@@ -961,21 +1724,10 @@ tmpl_expr_setattr_eval (TmplExprSetattr  *node,
       goto cleanup;
     }
 
-  if (!g_object_class_find_property (G_OBJECT_GET_CLASS (object), node->attr))
-    {
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_NO_SUCH_PROPERTY,
-                   "No such property \"%s\" on object \"%s\"",
-                   node->attr, G_OBJECT_TYPE_NAME (object));
-      goto cleanup;
-    }
-
-  if (!tmpl_expr_eval_internal (node->right, scope, &right, error))
+  if (!(pspec = find_object_property (node->cache, object, node->attr, error)) ||
+      !set_object_property (object, pspec, &right, error))
     goto cleanup;
 
-  g_object_set_property (object, node->attr, &right);
-
   g_value_init (return_value, G_VALUE_TYPE (&right));
   g_value_copy (&right, return_value);
 
@@ -1043,13 +1795,215 @@ make_title (const gchar *str)
   return g_string_free (ret, FALSE);
 }
 
+static gchar *
+make_space (const gchar *str)
+{
+  gsize len = strlen (str);
+  gchar *space;
+
+  space = g_malloc (len + 1);
+  memset (space, ' ', len);
+  space[len] = '\0';
+
+  return space;
+}
+
+/*
+ * Methods of strings, enums and GTypes. A TmplExprGiCall resolves its name
+ * to one of these when it is created so that evaluating it does not need
+ * to compare the name against each of them.
+ */
+typedef gboolean (*BuiltinMethod) (TmplExprGiCall  *node,
+                                   const GValue    *receiver,
+                                   TmplScope       *scope,
+                                   GValue          *return_value,
+                                   GError         **error);
+
+#define STRING_METHOD_FUNC(func_name, make_string)                  \
+static gboolean                                                     \
+func_name (TmplExprGiCall  *node,                                   \
+           const GValue    *receiver,                               \
+           TmplScope       *scope,                                  \
+           GValue          *return_value,                           \
+           GError         **error)                                  \
+{                                                                   \
+  const gchar *str = g_value_get_string (receiver) ?: "";           \
+                                                                    \
+  g_value_init (return_value, G_TYPE_STRING);                       \
+  g_value_take_string (return_value, make_string);                  \
+                                                                    \
+  return TRUE;                                                      \
+}
+
+STRING_METHOD_FUNC (string_upper,         g_utf8_strup (str, -1))
+STRING_METHOD_FUNC (string_lower,         g_utf8_strdown (str, -1))
+STRING_METHOD_FUNC (string_casefold,      g_utf8_casefold (str, -1))
+STRING_METHOD_FUNC (string_reverse,       g_utf8_strreverse (str, -1))
+STRING_METHOD_FUNC (string_escape,        g_strescape (str, NULL))
+STRING_METHOD_FUNC (string_escape_markup, g_markup_escape_text (str, -1))
+STRING_METHOD_FUNC (string_space,         make_space (str))
+STRING_METHOD_FUNC (string_title,         make_title (str))
+STRING_METHOD_FUNC (string_mangle,        make_mangle (str))
+
+#undef STRING_METHOD_FUNC
+
+static gboolean
+string_len (TmplExprGiCall  *node,
+            const GValue    *receiver,
+            TmplScope       *scope,
+            GValue          *return_value,
+            GError         **error)
+{
+  const gchar *str = g_value_get_string (receiver) ?: "";
+
+  g_value_init (return_value, G_TYPE_UINT);
+  g_value_set_uint (return_value, strlen (str));
+
+  return TRUE;
+}
+
+static gboolean
+enum_nick (TmplExprGiCall  *node,
+           const GValue    *receiver,
+           TmplScope       *scope,
+           GValue          *return_value,
+           GError         **error)
+{
+  GEnumClass *enum_class = g_type_class_peek (G_VALUE_TYPE (receiver));
+  GEnumValue *enum_value = g_enum_get_value (enum_class, g_value_get_enum (receiver));
+
+  g_value_init (return_value, G_TYPE_STRING);
+
+  if (enum_value != NULL)
+    g_value_set_static_string (return_value, enum_value->value_nick);
+
+  return TRUE;
+}
+
+static gboolean
+gtype_name (TmplExprGiCall  *node,
+            const GValue    *receiver,
+            TmplScope       *scope,
+            GValue          *return_value,
+            GError         **error)
+{
+  g_value_init (return_value, G_TYPE_STRING);
+  g_value_set_static_string (return_value, g_type_name (g_value_get_gtype (receiver)));
+
+  return TRUE;
+}
+
+static gboolean
+gtype_is_a (TmplExprGiCall  *node,
+            const GValue    *receiver,
+            TmplScope       *scope,
+            GValue          *return_value,
+            GError         **error)
+{
+  GValue param1 = G_VALUE_INIT;
+
+  if (node->params == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "No such method %s of GType",
+                   node->name);
+      return FALSE;
+    }
+
+  if (!tmpl_expr_eval_internal (node->params, scope, &param1, error))
+    return FALSE;
+
+  if (!G_VALUE_HOLDS_GTYPE (&param1))
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_TYPE_MISMATCH,
+                   "%s is not a GType",
+                   G_VALUE_TYPE_NAME (&param1));
+      TMPL_CLEAR_VALUE (&param1);
+      return FALSE;
+    }
+
+  g_value_init (return_value, G_TYPE_BOOLEAN);
+  g_value_set_boolean (return_value,
+                       g_type_is_a (g_value_get_gtype (receiver),
+                                    g_value_get_gtype (&param1)));
+
+  TMPL_CLEAR_VALUE (&param1);
+
+  return TRUE;
+}
+
+typedef enum
+{
+  RECEIVER_STRING,
+  RECEIVER_ENUM,
+  RECEIVER_GTYPE,
+} BuiltinReceiver;
+
+static const struct {
+  const gchar     *name;
+  BuiltinReceiver  receiver;
+  BuiltinMethod    func;
+} builtin_methods[TMPL_EXPR_METHOD_LAST] = {
+  [TMPL_EXPR_METHOD_UPPER]         = { "upper",         RECEIVER_STRING, string_upper },
+  [TMPL_EXPR_METHOD_LOWER]         = { "lower",         RECEIVER_STRING, string_lower },
+  [TMPL_EXPR_METHOD_CASEFOLD]      = { "casefold",      RECEIVER_STRING, string_casefold },
+  [TMPL_EXPR_METHOD_REVERSE]       = { "reverse",       RECEIVER_STRING, string_reverse },
+  [TMPL_EXPR_METHOD_LEN]           = { "len",           RECEIVER_STRING, string_len },
+  [TMPL_EXPR_METHOD_ESCAPE]        = { "escape",        RECEIVER_STRING, string_escape },
+  [TMPL_EXPR_METHOD_ESCAPE_MARKUP] = { "escape_markup", RECEIVER_STRING, string_escape_markup },
+  [TMPL_EXPR_METHOD_SPACE]         = { "space",         RECEIVER_STRING, string_space },
+  [TMPL_EXPR_METHOD_TITLE]         = { "title",         RECEIVER_STRING, string_title },
+  [TMPL_EXPR_METHOD_MANGLE]        = { "mangle",        RECEIVER_STRING, string_mangle },
+  [TMPL_EXPR_METHOD_NICK]          = { "nick",          RECEIVER_ENUM,   enum_nick },
+  [TMPL_EXPR_METHOD_NAME]          = { "name",          RECEIVER_GTYPE,  gtype_name },
+  [TMPL_EXPR_METHOD_IS_A]          = { "is_a",          RECEIVER_GTYPE,  gtype_is_a },
+};
+
+TmplExprMethod
+tmpl_expr_method_from_name (const gchar *name)
+{
+  for (guint i = TMPL_EXPR_METHOD_NONE + 1; i < G_N_ELEMENTS (builtin_methods); i++)
+    {
+      if (g_strcmp0 (name, builtin_methods[i].name) == 0)
+        return i;
+    }
+
+  return TMPL_EXPR_METHOD_NONE;
+}
+
+static gboolean
+call_builtin_method (TmplExprGiCall   *node,
+                     BuiltinReceiver   receiver_kind,
+                     const gchar      *receiver_name,
+                     const GValue     *receiver,
+                     TmplScope        *scope,
+                     GValue           *return_value,
+                     GError          **error)
+{
+  if (node->method == TMPL_EXPR_METHOD_NONE ||
+      builtin_methods[node->method].receiver != receiver_kind)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "No such method %s %s",
+                   node->name, receiver_name);
+      return FALSE;
+    }
+
+  return builtin_methods[node->method].func (node, receiver, scope, return_value, error);
+}
+
 static GIBaseInfo *
-find_by_gtype (GIRepository *repository,
-               GType         type)
+find_by_gtype (GType type)
 {
   while ((type != G_TYPE_INVALID))
     {
-      GIBaseInfo *info = gi_repository_find_by_gtype (repository, type);
+      GIBaseInfo *info = tmpl_repository_find_by_gtype (type);
 
       if (info != NULL)
         return info;
@@ -1060,246 +2014,219 @@ find_by_gtype (GIRepository *repository,
   return NULL;
 }
 
-static gboolean
-tmpl_expr_gi_call_eval (TmplExprGiCall  *node,
-                        TmplScope       *scope,
-                        GValue          *return_value,
-                        GError         **error)
+void
+tmpl_expr_gi_call_clear_cache (TmplExprGiCall *self)
 {
-  GValue left = G_VALUE_INIT;
-  GValue right = G_VALUE_INIT;
-  GIRepository *repository;
-  GIBaseInfo *base_info;
-  GIFunctionInfo *function = NULL;
-  GIArgument return_value_arg = { 0 };
-  GITypeInfo return_value_type;
-  GIArgument *dispatch_args = NULL;
-  GITransfer xfer = 0;
-  TmplExpr *args;
-  GObject *object;
-  gboolean ret = FALSE;
-  GArray *in_args = NULL;
-  GArray *values = NULL;
-  GType type;
-  guint dispatch_len = 0;
-  guint n_args;
-  guint offset = 0;
-  guint i;
+  for (guint i = 0; i < G_N_ELEMENTS (self->cache); i++)
+    {
+      TmplExprMethodCache *entry = &self->cache[i];
 
-  g_assert (node != NULL);
-  g_assert (scope != NULL);
-  g_assert (return_value != NULL);
+      if (entry->state == TMPL_EXPR_CACHE_READY)
+        g_clear_pointer (&entry->invoker, tmpl_gi_invoker_unref);
 
-  if (!tmpl_expr_eval_internal (node->object, scope, &left, error))
-    goto cleanup;
+      entry->state = TMPL_EXPR_CACHE_EMPTY;
+    }
+}
 
-  if (G_VALUE_HOLDS_STRING (&left))
+/*
+ * Call sites remember the prepared invoker for the type of the receiver,
+ * or for the typelib of a namespace function, so that calls in a loop
+ * neither search for the function nor prepare the call again.
+ */
+static TmplGiInvoker *
+lookup_invoker (TmplExprGiCall *node,
+                GType           type,
+                gconstpointer   typelib)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (node->cache); i++)
     {
-      const gchar *str = g_value_get_string (&left) ?: "";
-
-      /*
-       * TODO: This should be abstracted somewhere else rather than our G-I call.
-       *       Basically we are adding useful string functions like:
-       *
-       *       "foo".upper()
-       *       "foo".lower()
-       *       "foo".casefold()
-       *       "foo".reverse()
-       *       "foo".len()
-       *       "foo".title()
-       */
-      if (FALSE) {}
-      else if (g_str_equal (node->name, "upper"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_utf8_strup (str, -1));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "lower"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_utf8_strdown (str, -1));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "casefold"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_utf8_casefold (str, -1));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "reverse"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_utf8_strreverse (str, -1));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "len"))
-        {
-          g_value_init (return_value, G_TYPE_UINT);
-          g_value_set_uint (return_value, strlen (str));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "escape"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_strescape (str, NULL));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "escape_markup"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, g_markup_escape_text (str, -1));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "space"))
-        {
-          gchar *space;
-          guint len = strlen (str);
-
-          g_value_init (return_value, G_TYPE_STRING);
-          space = g_malloc (len + 1);
-          memset (space, ' ', len);
-          space[len] = '\0';
-          g_value_take_string (return_value, space);
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "title"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, make_title (str));
-          ret = TRUE;
-        }
-      else if (g_str_equal (node->name, "mangle"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_take_string (return_value, make_mangle (str));
-          ret = TRUE;
-        }
-      else
+      TmplExprMethodCache *entry = &node->cache[i];
+
+      if (g_atomic_int_get (&entry->state) == TMPL_EXPR_CACHE_READY &&
+          entry->type == type &&
+          entry->typelib == typelib)
+        return tmpl_gi_invoker_ref (entry->invoker);
+    }
+
+  return NULL;
+}
+
+static void
+remember_invoker (TmplExprGiCall *node,
+                  GType           type,
+                  gconstpointer   typelib,
+                  TmplGiInvoker  *invoker)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (node->cache); i++)
+    {
+      TmplExprMethodCache *entry = &node->cache[i];
+
+      if (g_atomic_int_get (&entry->state) != TMPL_EXPR_CACHE_EMPTY)
+        continue;
+
+      if (g_atomic_int_compare_and_exchange (&entry->state, TMPL_EXPR_CACHE_EMPTY, TMPL_EXPR_CACHE_BUSY))
         {
-          g_set_error (error,
-                       TMPL_ERROR,
-                       TMPL_ERROR_GI_FAILURE,
-                       "No such method %s for string",
-                       node->name);
+          entry->type = type;
+          entry->typelib = typelib;
+          entry->invoker = tmpl_gi_invoker_ref (invoker);
+          g_atomic_int_set (&entry->state, TMPL_EXPR_CACHE_READY);
         }
 
-      goto cleanup;
+      break;
     }
+}
 
-  if (G_VALUE_HOLDS_ENUM (&left))
+static TmplGiInvoker *
+find_function (TmplExprGiCall  *node,
+               GITypelib       *typelib,
+               GError         **error)
+{
+  g_autoptr(GIBaseInfo) base_info = NULL;
+  TmplGiInvoker *invoker;
+  const gchar *ns;
+
+  if ((invoker = lookup_invoker (node, G_TYPE_INVALID, typelib)))
+    return invoker;
+
+  ns = gi_typelib_get_namespace (typelib);
+  base_info = tmpl_repository_find_by_name (ns, node->name);
+
+  if (base_info == NULL || !GI_IS_FUNCTION_INFO (base_info))
     {
-      if (FALSE) {}
-      else if (g_str_equal (node->name, "nick"))
-        {
-          GEnumClass *enum_class = g_type_class_peek (G_VALUE_TYPE (&left));
-          GEnumValue *enum_value = g_enum_get_value (enum_class, g_value_get_enum (&left));
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "%s is not a function in %s",
+                   node->name, ns);
+      return NULL;
+    }
 
-          g_value_init (return_value, G_TYPE_STRING);
+  if (!(invoker = tmpl_gi_invoker_new ((GIFunctionInfo *)base_info, error)))
+    return NULL;
 
-          if (enum_value != NULL)
-            g_value_set_static_string (return_value, enum_value->value_nick);
+  remember_invoker (node, G_TYPE_INVALID, typelib, invoker);
 
-          ret = TRUE;
-        }
-      else
+  return invoker;
+}
+
+static TmplGiInvoker *
+find_method (TmplExprGiCall  *node,
+             GType            type,
+             GError         **error)
+{
+  g_autoptr(GIFunctionInfo) function = NULL;
+  TmplGiInvoker *invoker;
+  GType iter;
+
+  if ((invoker = lookup_invoker (node, type, NULL)))
+    return invoker;
+
+  for (iter = type; function == NULL && g_type_is_a (iter, G_TYPE_OBJECT); iter = g_type_parent (iter))
+    {
+      GIBaseInfo *base_info;
+      guint n_ifaces;
+
+      base_info = find_by_gtype (iter);
+
+      if (base_info == NULL)
         {
           g_set_error (error,
                        TMPL_ERROR,
                        TMPL_ERROR_GI_FAILURE,
-                       "No such method %s for enum",
-                       node->name);
+                       "Failed to locate GObject Introspection data for %s. "
+                       "Consider importing required module.",
+                       g_type_name (iter));
+          return NULL;
+        }
+
+      /* First locate the function in the object */
+      function = gi_object_info_find_method ((GIObjectInfo *)base_info, node->name);
+      if (function != NULL)
+        break;
+
+      /* Maybe the function is found in an interface */
+      n_ifaces = gi_object_info_get_n_interfaces ((GIObjectInfo *)base_info);
+      for (guint i = 0; function == NULL && i < n_ifaces; i++)
+        {
+          GIInterfaceInfo *iface_info = NULL;
+
+          iface_info = gi_object_info_get_interface ((GIObjectInfo *)base_info, i);
+          function = gi_interface_info_find_method (iface_info, node->name);
+
+          g_clear_pointer (&iface_info, gi_base_info_unref);
         }
+    }
+
+  if (function == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "No such method \"%s\" on object \"%s\"",
+                   node->name, g_type_name (type));
+      return NULL;
+    }
+
+  if (!(invoker = tmpl_gi_invoker_new (function, error)))
+    return NULL;
+
+  remember_invoker (node, type, NULL, invoker);
+
+  return invoker;
+}
+
+static gboolean
+tmpl_expr_gi_call_eval (TmplExprGiCall  *node,
+                        TmplScope       *scope,
+                        GValue          *return_value,
+                        GError         **error)
+{
+  GValue left = G_VALUE_INIT;
+  GValue values_stack[8];
+  GValue *values = NULL;
+  GIBaseInfo *base_info;
+  TmplGiInvoker *invoker = NULL;
+  TmplExpr *args;
+  GObject *object;
+  gboolean ret = FALSE;
+  GType type;
+  guint n_args = 0;
+  guint i;
+
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  if (!tmpl_expr_eval_internal (node->object, scope, &left, error))
+    goto cleanup;
 
+  if (G_VALUE_HOLDS_STRING (&left))
+    {
+      ret = call_builtin_method (node, RECEIVER_STRING, "for string", &left, scope, return_value, error);
       goto cleanup;
     }
 
-  if (G_VALUE_HOLDS_GTYPE (&left))
+  if (G_VALUE_HOLDS_ENUM (&left))
     {
-      if (FALSE) {}
-      else if (g_str_equal (node->name, "name"))
-        {
-          g_value_init (return_value, G_TYPE_STRING);
-          g_value_set_static_string (return_value, g_type_name (g_value_get_gtype (&left)));
-          ret = TRUE;
-          goto cleanup;
-        }
-      else if (g_str_equal (node->name, "is_a"))
-        {
-          if (node->params != NULL)
-            {
-              GValue param1 = G_VALUE_INIT;
-
-              if (!tmpl_expr_eval_internal (node->params, scope, &param1, error))
-                goto cleanup;
-
-              if (!G_VALUE_HOLDS_GTYPE (&param1))
-                {
-                  g_set_error (error,
-                               TMPL_ERROR,
-                               TMPL_ERROR_TYPE_MISMATCH,
-                               "%s is not a GType",
-                               G_VALUE_TYPE_NAME (&param1));
-                  TMPL_CLEAR_VALUE (&param1);
-                  goto cleanup;
-                }
-
-              g_value_init (return_value, G_TYPE_BOOLEAN);
-              g_value_set_boolean (return_value,
-                                   g_type_is_a (g_value_get_gtype (&left),
-                                                g_value_get_gtype (&param1)));
-
-              TMPL_CLEAR_VALUE (&param1);
-
-              ret = TRUE;
-
-              goto cleanup;
-            }
-        }
-
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_GI_FAILURE,
-                   "No such method %s of GType",
-                   node->name);
-
+      ret = call_builtin_method (node, RECEIVER_ENUM, "for enum", &left, scope, return_value, error);
       goto cleanup;
     }
 
-  repository = tmpl_repository_get_default ();
+  if (G_VALUE_HOLDS_GTYPE (&left))
+    {
+      ret = call_builtin_method (node, RECEIVER_GTYPE, "of GType", &left, scope, return_value, error);
+      goto cleanup;
+    }
 
   if (G_VALUE_HOLDS (&left, TMPL_TYPE_TYPELIB) &&
       g_value_get_pointer (&left) != NULL)
     {
       GITypelib *typelib = g_value_get_pointer (&left);
-      const gchar *ns = gi_typelib_get_namespace (typelib);
-
-      base_info = gi_repository_find_by_name (repository, ns, node->name);
-
-      if (base_info == NULL || !GI_IS_FUNCTION_INFO (base_info))
-        {
-          g_set_error (error,
-                       TMPL_ERROR,
-                       TMPL_ERROR_GI_FAILURE,
-                       "%s is not a function in %s",
-                       node->name, ns);
-          goto cleanup;
-        }
-
-      function = (GIFunctionInfo *)base_info;
-
-      n_args = gi_callable_info_get_n_args ((GICallableInfo *)function);
 
-      values = g_array_new (FALSE, TRUE, sizeof (GValue));
-      g_array_set_clear_func (values, (GDestroyNotify)g_value_unset);
-      g_array_set_size (values, n_args);
+      if (!(invoker = find_function (node, typelib, error)))
+        goto cleanup;
 
-      in_args = g_array_new (FALSE, TRUE, sizeof (GIArgument));
-      g_array_set_size (in_args, n_args + 1);
-
-      /* Skip past first param, which is used for Object below */
-      dispatch_args = ((GIArgument *)(gpointer)in_args->data);
-      dispatch_len = n_args;
+      object = NULL;
 
       goto apply_args;
     }
@@ -1349,97 +2276,23 @@ tmpl_expr_gi_call_eval (TmplExprGiCall  *node,
   type = G_OBJECT_TYPE (object);
 
 lookup_for_object:
-  while (g_type_is_a (type, G_TYPE_OBJECT))
-    {
-      guint n_ifaces;
-
-      base_info = find_by_gtype (repository, type);
-
-      if (base_info == NULL)
-        {
-          g_set_error (error,
-                       TMPL_ERROR,
-                       TMPL_ERROR_GI_FAILURE,
-                       "Failed to locate GObject Introspection data for %s. "
-                       "Consider importing required module.",
-                       g_type_name (type));
-          goto cleanup;
-        }
-
-      /* First locate the function in the object */
-      function = gi_object_info_find_method ((GIObjectInfo *)base_info, node->name);
-      if (function != NULL)
-        break;
-
-      /* Maybe the function is found in an interface */
-      n_ifaces = gi_object_info_get_n_interfaces ((GIObjectInfo *)base_info);
-      for (i = 0; function == NULL && i < n_ifaces; i++)
-        {
-          GIInterfaceInfo *iface_info = NULL;
-
-          iface_info = gi_object_info_get_interface ((GIObjectInfo *)base_info, i);
-          function = gi_interface_info_find_method (iface_info, node->name);
-
-          g_clear_pointer (&iface_info, gi_base_info_unref);
-        }
-
-      if (function != NULL)
-        break;
-
-      type = g_type_parent (type);
-    }
-
-  if (function == NULL)
-    {
-      g_set_error (error,
-                   TMPL_ERROR,
-                   TMPL_ERROR_GI_FAILURE,
-                   "No such method \"%s\" on object \"%s\"",
-                   node->name, G_OBJECT_TYPE_NAME (object));
-      goto cleanup;
-    }
-
-  n_args = gi_callable_info_get_n_args ((GICallableInfo *)function);
-
-  values = g_array_new (FALSE, TRUE, sizeof (GValue));
-  g_array_set_clear_func (values, (GDestroyNotify)g_value_unset);
-  g_array_set_size (values, n_args);
+  if (!(invoker = find_method (node, type, error)))
+    goto cleanup;
 
-  in_args = g_array_new (FALSE, TRUE, sizeof (GIArgument));
-  g_array_set_size (in_args, n_args + 1);
+apply_args:
+  n_args = tmpl_gi_invoker_get_n_args (invoker);
 
-  if (object != NULL)
-    {
-      g_array_index (in_args, GIArgument, 0).v_pointer = object;
-      offset = 1;
-    }
+  if (n_args <= G_N_ELEMENTS (values_stack))
+    values = values_stack;
   else
-    {
-      in_args->len--;
-    }
+    values = g_new (GValue, n_args);
 
-  dispatch_args = (GIArgument *)(gpointer)in_args->data;
-  dispatch_len = in_args->len;
+  memset (values, 0, sizeof (GValue) * n_args);
 
-apply_args:
   args = node->params;
 
   for (i = 0; i < n_args; i++)
     {
-      g_autoptr(GIArgInfo) arg_info = gi_callable_info_get_arg ((GICallableInfo *)function, i);
-      GIArgument *arg = &g_array_index (in_args, GIArgument, i + offset);
-      GValue *value = &g_array_index (values, GValue, i);
-      GITypeInfo type_info = { 0 };
-
-      if (gi_arg_info_get_direction (arg_info) != GI_DIRECTION_IN)
-        {
-          g_set_error (error,
-                       TMPL_ERROR,
-                       TMPL_ERROR_RUNTIME_ERROR,
-                       "Only \"in\" parameters are supported");
-          goto cleanup;
-        }
-
       if (args == NULL)
         {
           g_set_error (error,
@@ -1452,28 +2305,18 @@ apply_args:
 
       if (args->any.type == TMPL_EXPR_ARGS)
         {
-          if (!tmpl_expr_eval_internal (((TmplExprSimple *)args)->left, scope, value, error))
+          if (!tmpl_expr_eval_internal (((TmplExprSimple *)args)->left, scope, &values[i], error))
             goto cleanup;
 
           args = ((TmplExprSimple *)args)->right;
         }
       else
         {
-          if (!tmpl_expr_eval_internal (args, scope, value, error))
+          if (!tmpl_expr_eval_internal (args, scope, &values[i], error))
             goto cleanup;
 
           args = NULL;
         }
-
-      gi_arg_info_load_type_info (arg_info, &type_info);
-
-      if (!tmpl_gi_argument_from_g_value (value, &type_info, arg_info, arg, error))
-        {
-          gi_base_info_clear (&type_info);
-          goto cleanup;
-        }
-
-      gi_base_info_clear (&type_info);
     }
 
   if ((args != NULL) && (n_args > 0))
@@ -1486,53 +2329,50 @@ apply_args:
       goto cleanup;
     }
 
-  if (!gi_function_info_invoke (function,
-                                dispatch_args,
-                                dispatch_len,
-                                NULL,
-                                0,
-                                &return_value_arg,
-                                error))
-    goto cleanup;
-
-  gi_callable_info_load_return_type ((GICallableInfo *)function, &return_value_type);
-
-  xfer = gi_callable_info_get_caller_owns ((GICallableInfo *)function);
-  ret = tmpl_gi_argument_to_g_value (return_value, &return_value_type, &return_value_arg, xfer, error);
-
-  gi_base_info_clear (&return_value_type);
+  ret = tmpl_gi_invoker_invoke (invoker, object, values, return_value, error);
 
 cleanup:
-  g_clear_pointer (&in_args, g_array_unref);
-
   if (values != NULL)
     {
-      for (i = 0; i < values->len; i++)
-        {
-          GValue *value = &g_array_index (values, GValue, i);
-
-          if (G_VALUE_TYPE (value) != G_TYPE_INVALID)
-            g_value_unset (value);
-        }
+      for (i = 0; i < n_args; i++)
+        TMPL_CLEAR_VALUE (&values[i]);
 
-      g_clear_pointer (&values, g_array_unref);
+      if (values != values_stack)
+        g_free (values);
     }
 
   TMPL_CLEAR_VALUE (&left);
-  TMPL_CLEAR_VALUE (&right);
 
-  g_clear_pointer (&function, gi_base_info_unref);
+  g_clear_pointer (&invoker, tmpl_gi_invoker_unref);
 
   return ret;
 }
 
+/*
+ * Binds a function argument in the call scope. The symbol is always created
+ * in @local_scope so that arguments shadow, rather than overwrite, symbols of
+ * the same name in the (possibly shared) calling scope.
+ *
+ * Parameter names are interned when the function is defined.
+ */
+static void
+tmpl_expr_bind_argument (TmplScope    *local_scope,
+                         const gchar  *name,
+                         const GValue *value)
+{
+  TmplSymbol *symbol = tmpl_symbol_new ();
+
+  tmpl_symbol_assign_value (symbol, value);
+  tmpl_scope_take_interned (local_scope, name, symbol);
+}
+
 static gboolean
 tmpl_expr_anon_fn_call_eval (TmplExprAnonFnCall  *node,
                              TmplScope           *scope,
                              GValue              *return_value,
                              GError             **error)
 {
-  char **args;
+  const gchar **args;
   TmplExpr *params = NULL;
   TmplScope *local_scope = NULL;
   gboolean ret = FALSE;
@@ -1552,7 +2392,7 @@ tmpl_expr_anon_fn_call_eval (TmplExprAnonFnCall  *node,
     }
 
   args = node->anon->func.symlist;
-  n_args = args ? g_strv_length (args) : 0;
+  n_args = args ? g_strv_length ((gchar **)args) : 0;
   local_scope = tmpl_scope_new_with_parent (scope);
   params = node->params;
 
@@ -1588,7 +2428,7 @@ tmpl_expr_anon_fn_call_eval (TmplExprAnonFnCall  *node,
           params = NULL;
         }
 
-      tmpl_scope_set_value (local_scope, arg, &value);
+      tmpl_expr_bind_argument (local_scope, arg, &value);
       TMPL_CLEAR_VALUE (&value);
     }
 
@@ -1632,7 +2472,7 @@ tmpl_expr_user_fn_call_eval (TmplExprUserFnCall  *node,
   g_assert (scope != NULL);
   g_assert (return_value != NULL);
 
-  symbol = tmpl_scope_peek (scope, node->symbol);
+  symbol = tmpl_scope_peek_interned (scope, node->symbol);
 
   if (symbol == NULL)
     {
@@ -1713,9 +2553,7 @@ prepare:
           params = NULL;
         }
 
-      symbol = tmpl_scope_get (local_scope, arg);
-      tmpl_symbol_assign_value (symbol, &value);
-
+      tmpl_expr_bind_argument (local_scope, arg, &value);
       TMPL_CLEAR_VALUE (&value);
     }
 
@@ -1753,11 +2591,7 @@ tmpl_expr_require_eval (TmplExprRequire  *node,
   g_assert (scope != NULL);
   g_assert (return_value != NULL);
 
-  typelib = gi_repository_require (tmpl_repository_get_default (),
-                                   node->name,
-                                   node->version,
-                                   0,
-                                   &local_error);
+  typelib = tmpl_repository_require (node->name, node->version, &local_error);
 
   g_assert (typelib != NULL || local_error != NULL);
 
@@ -1794,14 +2628,14 @@ tmpl_expr_func_eval (TmplExprFunc  *node,
 
   if (node->symlist != NULL)
     {
-      args = g_ptr_array_new_with_free_func (g_free);
+      args = g_ptr_array_new ();
       for (guint i = 0; node->symlist[i]; i++)
-        g_ptr_array_add (args, g_strdup (node->symlist[i]));
+        g_ptr_array_add (args, (gpointer)node->symlist[i]);
     }
 
   if (node->name != NULL)
     {
-      symbol = tmpl_scope_get (scope, node->name);
+      symbol = tmpl_scope_get_interned (scope, node->name);
       tmpl_symbol_assign_expr (symbol, node->list, args);
       g_clear_pointer (&args, g_ptr_array_unref);
     }
@@ -1817,14 +2651,16 @@ tmpl_expr_func_eval (TmplExprFunc  *node,
 }
 
 static gboolean
-tmpl_expr_eval_internal (TmplExpr   *node,
-                         TmplScope  *scope,
-                         GValue     *return_value,
-                         GError    **error)
+tmpl_expr_eval_value (TmplExpr   *node,
+                      TmplScope  *scope,
+                      EvalValue  *return_value,
+                      GError    **error)
 {
   g_assert (node != NULL);
   g_assert (scope != NULL);
   g_assert (return_value != NULL);
+  g_assert (return_value->kind == EVAL_VALUE_BOXED);
+  g_assert (G_VALUE_TYPE (&return_value->u.v_boxed) == G_TYPE_INVALID);
 
   switch (node->any.type)
     {
@@ -1846,32 +2682,120 @@ tmpl_expr_eval_internal (TmplExpr   *node,
       return tmpl_expr_simple_eval_logical ((TmplExprSimple *)node, scope, return_value, error);
 
     case TMPL_EXPR_NUMBER:
-      g_value_init (return_value, G_TYPE_DOUBLE);
-      g_value_set_double (return_value, ((TmplExprNumber *)node)->number);
+      eval_value_set_double (return_value, ((TmplExprNumber *)node)->number);
       return TRUE;
 
     case TMPL_EXPR_BOOLEAN:
-      g_value_init (return_value, G_TYPE_BOOLEAN);
-      g_value_set_boolean (return_value, ((TmplExprBoolean *)node)->value);
+      eval_value_set_boolean (return_value, ((TmplExprBoolean *)node)->value);
       return TRUE;
 
     case TMPL_EXPR_STRING:
-      g_value_init (return_value, G_TYPE_STRING);
-      g_value_set_string (return_value, ((TmplExprString *)node)->value);
+      return_value->kind = EVAL_VALUE_STRING;
+      return_value->u.v_string = ((TmplExprString *)node)->value;
+      return TRUE;
+
+    case TMPL_EXPR_CONSTANT:
+      eval_value_borrow (return_value, &node->constant.value);
       return TRUE;
 
+    case TMPL_EXPR_SYMBOL_REF:
+      return tmpl_expr_symbol_ref_eval ((TmplExprSymbolRef *)node, scope, return_value, error);
+
+    case TMPL_EXPR_IF:
+      return tmpl_expr_if_eval ((TmplExprFlow *)node, scope, return_value, error);
+
+    case TMPL_EXPR_INVERT_BOOLEAN:
+      {
+        gboolean value;
+
+        if (!tmpl_expr_eval_condition (((TmplExprSimple *)node)->left, scope, &value, error))
+          return FALSE;
+
+        eval_value_set_boolean (return_value, !value);
+
+        return TRUE;
+      }
+
+    default:
+      return tmpl_expr_eval_internal (node, scope, &return_value->u.v_boxed, error);
+    }
+}
+
+static gboolean
+tmpl_expr_eval_condition (TmplExpr   *node,
+                          TmplScope  *scope,
+                          gboolean   *result,
+                          GError    **error)
+{
+  EvalValue value = EVAL_VALUE_INIT;
+
+  if (!tmpl_expr_eval_value (node, scope, &value, error))
+    {
+      eval_value_clear (&value);
+      return FALSE;
+    }
+
+  *result = eval_value_as_boolean (&value);
+
+  eval_value_clear (&value);
+
+  return TRUE;
+}
+
+static gboolean
+tmpl_expr_eval_internal (TmplExpr   *node,
+                         TmplScope  *scope,
+                         GValue     *return_value,
+                         GError    **error)
+{
+  g_assert (node != NULL);
+  g_assert (scope != NULL);
+  g_assert (return_value != NULL);
+
+  switch (node->any.type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_NUMBER:
+    case TMPL_EXPR_BOOLEAN:
+    case TMPL_EXPR_STRING:
+    case TMPL_EXPR_CONSTANT:
+    case TMPL_EXPR_SYMBOL_REF:
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+      {
+        EvalValue value = EVAL_VALUE_INIT;
+
+        if (!tmpl_expr_eval_value (node, scope, &value, error))
+          {
+            eval_value_clear (&value);
+            return FALSE;
+          }
+
+        eval_value_box (&value, return_value);
+
+        return TRUE;
+      }
+
     case TMPL_EXPR_ARGS:
       return tmpl_expr_args_eval ((TmplExprSimple *)node, scope, return_value, error);
 
     case TMPL_EXPR_STMT_LIST:
       return tmpl_expr_stmt_list_eval ((TmplExprStmtList *)node, scope, return_value, error);
 
-    case TMPL_EXPR_IF:
     case TMPL_EXPR_WHILE:
-      return tmpl_expr_flow_eval ((TmplExprFlow *)node, scope, return_value, error);
-
-    case TMPL_EXPR_SYMBOL_REF:
-      return tmpl_expr_symbol_ref_eval ((TmplExprSymbolRef *)node, scope, return_value, error);
+      return tmpl_expr_while_eval ((TmplExprFlow *)node, scope, return_value, error);
 
     case TMPL_EXPR_SYMBOL_ASSIGN:
       return tmpl_expr_symbol_assign_eval ((TmplExprSymbolAssign *)node, scope, return_value, error);
@@ -1897,26 +2821,6 @@ tmpl_expr_eval_internal (TmplExpr   *node,
     case TMPL_EXPR_REQUIRE:
       return tmpl_expr_require_eval ((TmplExprRequire *)node, scope, return_value, error);
 
-    case TMPL_EXPR_INVERT_BOOLEAN:
-      {
-        GValue tmp = G_VALUE_INIT;
-        gboolean ret;
-
-        ret = tmpl_expr_eval_internal (((TmplExprSimple *)node)->left, scope, &tmp, error);
-
-        if (ret)
-          {
-            g_value_init (return_value, G_TYPE_BOOLEAN);
-            g_value_set_boolean (return_value, !tmpl_value_as_boolean (&tmp));
-          }
-
-        TMPL_CLEAR_VALUE (&tmp);
-
-        g_assert (ret == TRUE || (error == NULL || *error != NULL));
-
-        return ret;
-      }
-
     case TMPL_EXPR_FUNC:
       return tmpl_expr_func_eval ((TmplExprFunc *)node, scope, return_value, error);
 
@@ -2005,17 +2909,32 @@ mul_string_double (const GValue  *left,
   return mul_double_string (right, left, return_value, error);
 }
 
+static void
+concat_string_string (const gchar *left,
+                      const gchar *right,
+                      GValue      *return_value)
+{
+  TmplArena *scratch = tmpl_arena_get_scratch ();
+
+  g_value_init (return_value, G_TYPE_STRING);
+
+  if (scratch != NULL)
+    g_value_set_static_string (return_value,
+                               tmpl_arena_strconcat (scratch, left, right));
+  else
+    g_value_take_string (return_value,
+                         g_strconcat (left ? left : "", right, NULL));
+}
+
 static gboolean
 add_string_string (const GValue  *left,
                    const GValue  *right,
                    GValue        *return_value,
                    GError       **error)
 {
-  g_value_init (return_value, G_TYPE_STRING);
-  g_value_take_string (return_value,
-                       g_strdup_printf ("%s%s",
-                                        g_value_get_string (left),
-                                        g_value_get_string (right)));
+  concat_string_string (g_value_get_string (left),
+                        g_value_get_string (right),
+                        return_value);
   return TRUE;
 }
 
@@ -2028,27 +2947,31 @@ add_string_string_slow (const GValue  *left,
   GValue trans = G_VALUE_INIT;
 
   g_value_init (&trans, G_TYPE_STRING);
-  g_value_init (return_value, G_TYPE_STRING);
 
   if (G_VALUE_HOLDS_STRING (left))
     {
       if (!g_value_transform (right, &trans))
-        return FALSE;
+        goto failure;
       right = &trans;
     }
   else
     {
       if (!g_value_transform (left, &trans))
-        return FALSE;
+        goto failure;
       left = &trans;
     }
 
-  g_value_take_string (return_value,
-                       g_strdup_printf ("%s%s",
-                                        g_value_get_string (left),
-                                        g_value_get_string (right)));
+  concat_string_string (g_value_get_string (left),
+                        g_value_get_string (right),
+                        return_value);
+  g_value_unset (&trans);
 
   return TRUE;
+
+failure:
+  g_value_unset (&trans);
+
+  return FALSE;
 }
 
 static gboolean
@@ -2160,9 +3083,8 @@ eq_enum_string (const GValue  *left,
                 GError       **error)
 {
   const gchar *str;
-  GEnumClass *klass;
-  const GEnumValue *val;
   GType type;
+  gint nick_value;
   gint eval;
 
   if (G_VALUE_HOLDS_STRING (left))
@@ -2178,11 +3100,10 @@ eq_enum_string (const GValue  *left,
       type = G_VALUE_TYPE (left);
     }
 
-  klass = g_type_class_peek (type);
-  val = g_enum_get_value ((GEnumClass *)klass, eval);
-
   g_value_init (return_value, G_TYPE_BOOLEAN);
-  g_value_set_boolean (return_value, 0 == g_strcmp0 (str, val->value_nick));
+  g_value_set_boolean (return_value,
+                       tmpl_enum_type_lookup_nick (type, str, &nick_value) &&
+                       nick_value == eval);
 
   return TRUE;
 }
@@ -2330,6 +3251,32 @@ tmpl_expr_eval (TmplExpr   *node,
   return ret;
 }
 
+/*
+ * Evaluates @node as a condition, without boxing the result when it is a
+ * number, boolean, string or object.
+ */
+gboolean
+tmpl_expr_eval_boolean (TmplExpr   *node,
+                        TmplScope  *scope,
+                        gboolean   *result,
+                        GError    **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (node != NULL, FALSE);
+  g_return_val_if_fail (scope != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  if (g_once_init_enter (&fast_dispatch))
+    g_once_init_leave (&fast_dispatch, build_dispatch_table ());
+
+  ret = tmpl_expr_eval_condition (node, scope, result, error);
+
+  g_assert (ret == TRUE || (error == NULL || *error != NULL));
+
+  return ret;
+}
+
 static gboolean
 builtin_abs (const GValue  *value,
              GValue        *return_value,
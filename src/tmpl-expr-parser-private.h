@@ -21,11 +21,14 @@
 
 #include <glib.h>
 
+#include "tmpl-arena-private.h"
+
 G_BEGIN_DECLS
 
 typedef struct
 {
   TmplExpr  *ast;
+  TmplArena *arena;
   TmplScope *scope;
   gpointer   scanner;
   gchar     *error_str;
@@ -33,15 +36,18 @@ typedef struct
   guint      reached_eof : 1;
 } TmplExprParser;
 
-void     tmpl_expr_parser_destroy      (TmplExprParser  *parser);
-void     tmpl_expr_parser_flush        (TmplExprParser  *parser);
-void     tmpl_expr_parser_error        (TmplExprParser  *parser,
-                                        const char      *message);
-gboolean tmpl_expr_parser_parse_string (TmplExprParser  *parser,
-                                        const gchar     *input,
-                                        GError         **error);
-gboolean tmpl_expr_parser_init         (TmplExprParser  *parser,
-                                        GError         **error);
+void      tmpl_expr_parser_destroy      (TmplExprParser  *parser);
+void      tmpl_expr_parser_flush        (TmplExprParser  *parser);
+void      tmpl_expr_parser_error        (TmplExprParser  *parser,
+                                         const char      *message);
+gboolean  tmpl_expr_parser_parse_string (TmplExprParser  *parser,
+                                         const gchar     *input,
+                                         GError         **error);
+gboolean  tmpl_expr_parser_init         (TmplExprParser  *parser,
+                                         GError         **error);
+TmplExpr *tmpl_expr_parser_parse_expr   (TmplExprParser  *parser,
+                                         const gchar     *input,
+                                         GError         **error);
 
 G_END_DECLS
 
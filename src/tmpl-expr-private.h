@@ -27,51 +27,127 @@
 
 G_BEGIN_DECLS
 
+/*
+ * Every expression record starts with this header. Each record is allocated
+ * at its exact size, from the arena of the template being parsed if
+ * @arena is set.
+ */
+#define TMPL_EXPR_HEADER     \
+  TmplExprType  type : 8;    \
+  guint         arena : 1;   \
+  volatile gint ref_count
+
+/*
+ * Some expressions remember what they resolved for the types of their
+ * operands in a few slots which, once filled, are never replaced. This
+ * keeps them safe to read while other threads evaluate the same node.
+ * A slot is claimed by moving it from EMPTY to BUSY and published by
+ * moving it to READY.
+ */
+enum {
+  TMPL_EXPR_CACHE_EMPTY,
+  TMPL_EXPR_CACHE_BUSY,
+  TMPL_EXPR_CACHE_READY,
+};
+
+#define TMPL_EXPR_N_DISPATCH_CACHE 2
+#define TMPL_EXPR_N_METHOD_CACHE   2
+#define TMPL_EXPR_N_PROPERTY_CACHE 2
+
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  TmplExpr      *left;
-  TmplExpr      *right;
+  volatile gint  state;
+  GType          left;
+  GType          right;
+  gpointer       func;
+} TmplExprDispatchCache;
+
+typedef struct
+{
+  TMPL_EXPR_HEADER;
+  TmplExpr              *left;
+  TmplExpr              *right;
+  TmplExprDispatchCache  cache[TMPL_EXPR_N_DISPATCH_CACHE];
 } TmplExprSimple;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  TmplExpr      *object;
-  gchar         *name;
-  TmplExpr      *params;
+  volatile gint  state;
+  GType          type;
+  gconstpointer  typelib;
+  gpointer       invoker;
+} TmplExprMethodCache;
+
+/*
+ * The pspec of an attribute for the last types of object it was used on.
+ * Values are still read and written by name with the GObject API, which
+ * looks the pspec up again.
+ */
+typedef struct
+{
+  volatile gint  state;
+  GType          type;
+  GParamSpec    *pspec;
+} TmplExprPropertyCache;
+
+/*
+ * Methods of strings, enums and GTypes, which are resolved from the name of
+ * a TmplExprGiCall when it is created. Other receivers are always objects
+ * whose methods are found with GObject Introspection.
+ */
+typedef enum
+{
+  TMPL_EXPR_METHOD_NONE,
+  TMPL_EXPR_METHOD_UPPER,
+  TMPL_EXPR_METHOD_LOWER,
+  TMPL_EXPR_METHOD_CASEFOLD,
+  TMPL_EXPR_METHOD_REVERSE,
+  TMPL_EXPR_METHOD_LEN,
+  TMPL_EXPR_METHOD_ESCAPE,
+  TMPL_EXPR_METHOD_ESCAPE_MARKUP,
+  TMPL_EXPR_METHOD_SPACE,
+  TMPL_EXPR_METHOD_TITLE,
+  TMPL_EXPR_METHOD_MANGLE,
+  TMPL_EXPR_METHOD_NICK,
+  TMPL_EXPR_METHOD_NAME,
+  TMPL_EXPR_METHOD_IS_A,
+  TMPL_EXPR_METHOD_LAST
+} TmplExprMethod;
+
+typedef struct
+{
+  TMPL_EXPR_HEADER;
+  TmplExprMethod       method;
+  TmplExpr            *object;
+  gchar               *name;
+  TmplExpr            *params;
+  TmplExprMethodCache  cache[TMPL_EXPR_N_METHOD_CACHE];
 } TmplExprGiCall;
 
 typedef struct
 {
-  TmplExprType     type;
-  volatile gint    ref_count;
+  TMPL_EXPR_HEADER;
   TmplExprBuiltin  builtin;
   TmplExpr        *param;
 } TmplExprFnCall;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  gchar         *symbol;
+  TMPL_EXPR_HEADER;
+  const gchar   *symbol;       /* interned */
   TmplExpr      *params;
 } TmplExprUserFnCall;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
   TmplExpr      *anon;
   TmplExpr      *params;
 } TmplExprAnonFnCall;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
   TmplExpr      *condition;
   TmplExpr      *primary;
   TmplExpr      *secondary;
@@ -79,84 +155,82 @@ typedef struct
 
 typedef struct
 {
-  TmplExprType  type;
-  volatile gint ref_count;
+  TMPL_EXPR_HEADER;
   gdouble       number;
 } TmplExprNumber;
 
 typedef struct
 {
-  TmplExprType  type;
-  volatile gint ref_count;
+  TMPL_EXPR_HEADER;
   guint         value: 1;
 } TmplExprBoolean;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
   gchar         *value;
 } TmplExprString;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  gchar         *symbol;
+  TMPL_EXPR_HEADER;
+  const gchar   *symbol;       /* interned */
 } TmplExprSymbolRef;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  gchar         *symbol;
+  TMPL_EXPR_HEADER;
+  const gchar   *symbol;       /* interned */
   TmplExpr      *right;
 } TmplExprSymbolAssign;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  gchar         *attr;
-  TmplExpr      *left;
+  TMPL_EXPR_HEADER;
+  gchar                 *attr;
+  TmplExpr              *left;
+  TmplExprPropertyCache  cache[TMPL_EXPR_N_PROPERTY_CACHE];
 } TmplExprGetattr;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
-  gchar         *attr;
-  TmplExpr      *left;
-  TmplExpr      *right;
+  TMPL_EXPR_HEADER;
+  gchar                 *attr;
+  TmplExpr              *left;
+  TmplExpr              *right;
+  TmplExprPropertyCache  cache[TMPL_EXPR_N_PROPERTY_CACHE];
 } TmplExprSetattr;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
   gchar         *name;
   gchar         *version;
 } TmplExprRequire;
 
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
 } TmplExprAny;
 
+/* The result of folding an expression that has no literal syntax */
+typedef struct
+{
+  TMPL_EXPR_HEADER;
+  GValue         value;
+} TmplExprConstant;
+
 typedef struct
 {
-  TmplExprType   type;
-  volatile gint  ref_count;
+  TMPL_EXPR_HEADER;
   GPtrArray     *stmts;
 } TmplExprStmtList;
 
 typedef struct
 {
-  TmplExprType    type;
-  volatile gint   ref_count;
-  char           *name;
-  char          **symlist;
+  TMPL_EXPR_HEADER;
+  const gchar    *name;         /* interned */
+  const gchar   **symlist;      /* interned */
   TmplExpr       *list;
 } TmplExprFunc;
 
@@ -178,8 +252,40 @@ union _TmplExpr
   TmplExprRequire      require;
   TmplExprStmtList     stmt_list;
   TmplExprFunc         func;
+  TmplExprConstant     constant;
 };
 
+gboolean  tmpl_expr_has_assignment   (TmplExpr         *self);
+gboolean  tmpl_expr_has_user_call    (TmplExpr         *self);
+gboolean  tmpl_expr_eval_boolean     (TmplExpr         *self,
+                                      TmplScope        *scope,
+                                      gboolean         *result,
+                                      GError          **error);
+void      tmpl_expr_gi_call_clear_cache
+                                     (TmplExprGiCall   *self);
+TmplExprMethod
+          tmpl_expr_method_from_name (const gchar      *name);
+void      tmpl_expr_property_cache_clear
+                                     (TmplExprPropertyCache *cache);
+TmplExpr *tmpl_expr_fold             (TmplExpr         *self);
+TmplExpr *tmpl_expr_copy             (TmplExpr         *self);
+void      tmpl_expr_collect_bindings (TmplExpr         *self,
+                                      GHashTable       *names);
+TmplExpr *tmpl_expr_specialize       (TmplExpr         *self,
+                                      TmplScope        *frozen,
+                                      GHashTable       *shadowed);
+gboolean  tmpl_expr_is_constant      (TmplExpr         *self);
+gboolean  tmpl_expr_is_serializable  (TmplExpr         *self);
+gsize     tmpl_expr_get_memory_usage (TmplExpr         *self,
+                                      GHashTable       *seen);
+guint     tmpl_expr_serialize        (TmplExpr         *self,
+                                      GVariantBuilder  *nodes,
+                                      guint            *n_nodes);
+TmplExpr *tmpl_expr_deserialize      (GVariant         *node,
+                                      TmplExpr        **exprs,
+                                      guint             n_exprs,
+                                      GError          **error);
+
 G_END_DECLS
 
 #endif /* TMPL_EXPR_PRIVATE_H */
@@ -80,6 +80,7 @@ typedef enum
   TMPL_EXPR_FUNC,
   TMPL_EXPR_NOP,
   TMPL_EXPR_NULL,
+  TMPL_EXPR_CONSTANT,
 } TmplExprType;
 
 typedef enum
@@ -107,6 +108,7 @@ typedef enum
   TMPL_EXPR_BUILTIN_CAST_FLOAT,
   TMPL_EXPR_BUILTIN_CAST_DOUBLE,
   TMPL_EXPR_BUILTIN_CAST_BOOL,
+  TMPL_EXPR_BUILTIN_RANGE,
 } TmplExprBuiltin;
 
 TMPL_AVAILABLE_IN_ALL
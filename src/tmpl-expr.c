@@ -16,12 +16,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
+#include "tmpl-arena-private.h"
+#include "tmpl-error.h"
 #include "tmpl-expr.h"
 #include "tmpl-expr-private.h"
 #include "tmpl-expr-parser-private.h"
+#include "tmpl-scope-private.h"
+#include "tmpl-util-private.h"
 
-static gpointer tmpl_expr_new     (TmplExprType  type);
-static void     tmpl_expr_destroy (TmplExpr     *expr);
+static gpointer  tmpl_expr_new           (TmplExprType   type);
+static void      tmpl_expr_destroy       (TmplExpr      *expr);
+static TmplExpr *tmpl_expr_fold_internal (TmplExpr      *self,
+                                          TmplScope    **scope);
 
 G_DEFINE_BOXED_TYPE (TmplExpr, tmpl_expr, tmpl_expr_ref, tmpl_expr_unref)
 
@@ -46,12 +54,107 @@ tmpl_expr_unref (TmplExpr *self)
     tmpl_expr_destroy (self);
 }
 
+static gsize
+tmpl_expr_get_record_size (TmplExprType type)
+{
+  switch (type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+    case TMPL_EXPR_ARGS:
+      return sizeof (TmplExprSimple);
+
+    case TMPL_EXPR_BOOLEAN:
+      return sizeof (TmplExprBoolean);
+
+    case TMPL_EXPR_NUMBER:
+      return sizeof (TmplExprNumber);
+
+    case TMPL_EXPR_STRING:
+      return sizeof (TmplExprString);
+
+    case TMPL_EXPR_STMT_LIST:
+      return sizeof (TmplExprStmtList);
+
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_WHILE:
+      return sizeof (TmplExprFlow);
+
+    case TMPL_EXPR_SYMBOL_REF:
+      return sizeof (TmplExprSymbolRef);
+
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+      return sizeof (TmplExprSymbolAssign);
+
+    case TMPL_EXPR_FN_CALL:
+      return sizeof (TmplExprFnCall);
+
+    case TMPL_EXPR_ANON_FN_CALL:
+      return sizeof (TmplExprAnonFnCall);
+
+    case TMPL_EXPR_USER_FN_CALL:
+      return sizeof (TmplExprUserFnCall);
+
+    case TMPL_EXPR_GETATTR:
+      return sizeof (TmplExprGetattr);
+
+    case TMPL_EXPR_SETATTR:
+      return sizeof (TmplExprSetattr);
+
+    case TMPL_EXPR_GI_CALL:
+      return sizeof (TmplExprGiCall);
+
+    case TMPL_EXPR_REQUIRE:
+      return sizeof (TmplExprRequire);
+
+    case TMPL_EXPR_FUNC:
+      return sizeof (TmplExprFunc);
+
+    case TMPL_EXPR_CONSTANT:
+      return sizeof (TmplExprConstant);
+
+    case TMPL_EXPR_NOP:
+    case TMPL_EXPR_NULL:
+      return sizeof (TmplExprAny);
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/*
+ * Allocates a record of exactly the size needed for @type, from the
+ * thread-default arena if there is one, such as while parsing a template.
+ */
 static gpointer
 tmpl_expr_new (TmplExprType type)
 {
+  TmplArena *arena = tmpl_arena_get_thread_default ();
+  gsize size = tmpl_expr_get_record_size (type);
   TmplExpr *ret;
 
-  ret = g_slice_new0 (TmplExpr);
+  if (arena != NULL)
+    {
+      ret = tmpl_arena_alloc (tmpl_arena_ref (arena), size);
+      ret->any.arena = TRUE;
+    }
+  else
+    {
+      ret = g_slice_alloc0 (size);
+    }
+
   ret->any.type = type;
   ret->any.ref_count = 1;
 
@@ -88,7 +191,6 @@ tmpl_expr_destroy (TmplExpr *self)
       break;
 
     case TMPL_EXPR_USER_FN_CALL:
-      g_clear_pointer (&self->user_fn_call.symbol, g_free);
       g_clear_pointer (&self->user_fn_call.params, tmpl_expr_unref);
       break;
 
@@ -98,11 +200,13 @@ tmpl_expr_destroy (TmplExpr *self)
       break;
 
     case TMPL_EXPR_GETATTR:
+      tmpl_expr_property_cache_clear (self->getattr.cache);
       g_clear_pointer (&self->getattr.attr, g_free);
       g_clear_pointer (&self->getattr.left, tmpl_expr_unref);
       break;
 
     case TMPL_EXPR_SETATTR:
+      tmpl_expr_property_cache_clear (self->setattr.cache);
       g_clear_pointer (&self->setattr.attr, g_free);
       g_clear_pointer (&self->setattr.left, tmpl_expr_unref);
       g_clear_pointer (&self->setattr.right, tmpl_expr_unref);
@@ -127,12 +231,7 @@ tmpl_expr_destroy (TmplExpr *self)
       g_clear_pointer (&self->flow.secondary, tmpl_expr_unref);
       break;
 
-    case TMPL_EXPR_SYMBOL_REF:
-      g_clear_pointer (&self->sym_ref.symbol, g_free);
-      break;
-
     case TMPL_EXPR_SYMBOL_ASSIGN:
-      g_clear_pointer (&self->sym_assign.symbol, g_free);
       g_clear_pointer (&self->sym_assign.right, tmpl_expr_unref);
       break;
 
@@ -141,6 +240,7 @@ tmpl_expr_destroy (TmplExpr *self)
       break;
 
     case TMPL_EXPR_GI_CALL:
+      tmpl_expr_gi_call_clear_cache (&self->gi_call);
       g_clear_pointer (&self->gi_call.name, g_free);
       g_clear_pointer (&self->gi_call.object, tmpl_expr_unref);
       g_clear_pointer (&self->gi_call.params, tmpl_expr_unref);
@@ -152,11 +252,14 @@ tmpl_expr_destroy (TmplExpr *self)
       break;
 
     case TMPL_EXPR_FUNC:
-      g_clear_pointer (&self->func.name, g_free);
-      g_clear_pointer (&self->func.symlist, g_strfreev);
+      g_clear_pointer (&self->func.symlist, g_free);
       g_clear_pointer (&self->func.list, tmpl_expr_unref);
       break;
 
+    case TMPL_EXPR_CONSTANT:
+      g_value_unset (&self->constant.value);
+      break;
+
     case TMPL_EXPR_NOP:
     case TMPL_EXPR_NULL:
       /* This should never happen,
@@ -167,7 +270,11 @@ tmpl_expr_destroy (TmplExpr *self)
       g_assert_not_reached ();
     }
 
-  g_slice_free (TmplExpr, self);
+  /* Arena memory is released along with the arena */
+  if (self->any.arena)
+    tmpl_arena_unref (tmpl_arena_from_pointer (self));
+  else
+    g_slice_free1 (tmpl_expr_get_record_size (self->any.type), self);
 }
 
 /**
@@ -323,7 +430,7 @@ tmpl_expr_new_symbol_ref (const gchar *symbol)
   TmplExprSymbolRef *ret;
 
   ret = tmpl_expr_new (TMPL_EXPR_SYMBOL_REF);
-  ret->symbol = g_strdup (symbol);
+  ret->symbol = g_intern_string (symbol);
 
   return (TmplExpr *)ret;
 }
@@ -335,7 +442,7 @@ tmpl_expr_new_symbol_assign (const gchar *symbol,
   TmplExprSymbolAssign *ret;
 
   ret = tmpl_expr_new (TMPL_EXPR_SYMBOL_ASSIGN);
-  ret->symbol = g_strdup (symbol);
+  ret->symbol = g_intern_string (symbol);
   ret->right = right;
 
   return (TmplExpr *)ret;
@@ -361,7 +468,7 @@ tmpl_expr_new_user_fn_call (const gchar *symbol,
   TmplExprUserFnCall *ret;
 
   ret = tmpl_expr_new (TMPL_EXPR_USER_FN_CALL);
-  ret->symbol = g_strdup (symbol);
+  ret->symbol = g_intern_string (symbol);
   ret->params = params;
 
   return (TmplExpr *)ret;
@@ -377,6 +484,7 @@ tmpl_expr_new_gi_call (TmplExpr    *object,
   ret = tmpl_expr_new (TMPL_EXPR_GI_CALL);
   ret->object = object;
   ret->name = g_strdup (name);
+  ret->method = tmpl_expr_method_from_name (name);
   ret->params = params;
 
   return (TmplExpr *)ret;
@@ -394,8 +502,7 @@ tmpl_expr_from_string (const gchar  *str,
   if (!tmpl_expr_parser_init (&parser, error))
       return NULL;
 
-  if (tmpl_expr_parser_parse_string (&parser, str, error))
-    ret = parser.ast, parser.ast = NULL;
+  ret = tmpl_expr_parser_parse_expr (&parser, str, error);
 
   tmpl_expr_parser_destroy (&parser);
 
@@ -413,10 +520,23 @@ tmpl_expr_new_func (char      *name,
     list = tmpl_expr_new_nop ();
 
   ret = tmpl_expr_new (TMPL_EXPR_FUNC);
-  ret->name = name;
-  ret->symlist = symlist;
+  ret->name = g_intern_string (name);
   ret->list = list;
 
+  /* Parameters are bound in the scope of every call, so intern them once */
+  if (symlist != NULL)
+    {
+      guint len = g_strv_length (symlist);
+
+      ret->symlist = g_new (const gchar *, len + 1);
+      for (guint i = 0; i < len; i++)
+        ret->symlist[i] = g_intern_string (symlist[i]);
+      ret->symlist[len] = NULL;
+    }
+
+  g_free (name);
+  g_strfreev (symlist);
+
   return (TmplExpr *)ret;
 }
 
@@ -449,3 +569,1397 @@ tmpl_expr_new_null (void)
   static TmplExpr interned = { .any.type = TMPL_EXPR_NULL, .any.ref_count = 1 };
   return tmpl_expr_ref (&interned);
 }
+
+static TmplExpr *
+tmpl_expr_new_constant (const GValue *value)
+{
+  TmplExprConstant *ret;
+
+  ret = tmpl_expr_new (TMPL_EXPR_CONSTANT);
+  g_value_init (&ret->value, G_VALUE_TYPE (value));
+  g_value_copy (value, &ret->value);
+
+  return (TmplExpr *)ret;
+}
+
+/*
+ * tmpl_expr_has_assignment:
+ *
+ * Checks if evaluating @self may assign to a symbol, an attribute, or
+ * define a function or namespace within the scope. Calls to functions
+ * are not followed, only the expressions found within @self.
+ *
+ * Returns: %TRUE if @self contains an assignment
+ */
+gboolean
+tmpl_expr_has_assignment (TmplExpr *self)
+{
+  if (self == NULL)
+    return FALSE;
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+    case TMPL_EXPR_SETATTR:
+    case TMPL_EXPR_REQUIRE:
+      return TRUE;
+
+    case TMPL_EXPR_FUNC:
+      /* Anonymous functions are values, named functions define a symbol */
+      return self->func.name != NULL || tmpl_expr_has_assignment (self->func.list);
+
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+    case TMPL_EXPR_ARGS:
+      return tmpl_expr_has_assignment (self->simple.left) ||
+             tmpl_expr_has_assignment (self->simple.right);
+
+    case TMPL_EXPR_USER_FN_CALL:
+      return tmpl_expr_has_assignment (self->user_fn_call.params);
+
+    case TMPL_EXPR_ANON_FN_CALL:
+      return tmpl_expr_has_assignment (self->anon_fn_call.anon) ||
+             tmpl_expr_has_assignment (self->anon_fn_call.params);
+
+    case TMPL_EXPR_GETATTR:
+      return tmpl_expr_has_assignment (self->getattr.left);
+
+    case TMPL_EXPR_STMT_LIST:
+      if (self->stmt_list.stmts != NULL)
+        {
+          for (guint i = 0; i < self->stmt_list.stmts->len; i++)
+            {
+              if (tmpl_expr_has_assignment (g_ptr_array_index (self->stmt_list.stmts, i)))
+                return TRUE;
+            }
+        }
+      return FALSE;
+
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_WHILE:
+      return tmpl_expr_has_assignment (self->flow.condition) ||
+             tmpl_expr_has_assignment (self->flow.primary) ||
+             tmpl_expr_has_assignment (self->flow.secondary);
+
+    case TMPL_EXPR_FN_CALL:
+      return tmpl_expr_has_assignment (self->fn_call.param);
+
+    case TMPL_EXPR_GI_CALL:
+      return tmpl_expr_has_assignment (self->gi_call.object) ||
+             tmpl_expr_has_assignment (self->gi_call.params);
+
+    case TMPL_EXPR_BOOLEAN:
+    case TMPL_EXPR_NUMBER:
+    case TMPL_EXPR_STRING:
+    case TMPL_EXPR_SYMBOL_REF:
+    case TMPL_EXPR_NOP:
+    case TMPL_EXPR_NULL:
+    case TMPL_EXPR_CONSTANT:
+    default:
+      return FALSE;
+    }
+}
+
+typedef void (*TmplExprChildFunc) (TmplExpr **child,
+                                   gpointer   user_data);
+
+/*
+ * Calls @func with the location of each child of @self so that the
+ * child may be replaced.
+ */
+static void
+tmpl_expr_foreach_child (TmplExpr          *self,
+                         TmplExprChildFunc  func,
+                         gpointer           user_data)
+{
+#define VISIT(child) \
+  G_STMT_START { \
+    if ((child) != NULL) \
+      func (&(child), user_data); \
+  } G_STMT_END
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+    case TMPL_EXPR_ARGS:
+      VISIT (self->simple.left);
+      VISIT (self->simple.right);
+      break;
+
+    case TMPL_EXPR_FN_CALL:
+      VISIT (self->fn_call.param);
+      break;
+
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_WHILE:
+      VISIT (self->flow.condition);
+      VISIT (self->flow.primary);
+      VISIT (self->flow.secondary);
+      break;
+
+    case TMPL_EXPR_STMT_LIST:
+      for (guint i = 0; i < self->stmt_list.stmts->len; i++)
+        func ((TmplExpr **)&g_ptr_array_index (self->stmt_list.stmts, i), user_data);
+      break;
+
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+      VISIT (self->sym_assign.right);
+      break;
+
+    case TMPL_EXPR_GETATTR:
+      VISIT (self->getattr.left);
+      break;
+
+    case TMPL_EXPR_SETATTR:
+      VISIT (self->setattr.left);
+      VISIT (self->setattr.right);
+      break;
+
+    case TMPL_EXPR_USER_FN_CALL:
+      VISIT (self->user_fn_call.params);
+      break;
+
+    case TMPL_EXPR_ANON_FN_CALL:
+      VISIT (self->anon_fn_call.anon);
+      VISIT (self->anon_fn_call.params);
+      break;
+
+    case TMPL_EXPR_GI_CALL:
+      VISIT (self->gi_call.object);
+      VISIT (self->gi_call.params);
+      break;
+
+    case TMPL_EXPR_FUNC:
+      VISIT (self->func.list);
+      break;
+
+    case TMPL_EXPR_BOOLEAN:
+    case TMPL_EXPR_NUMBER:
+    case TMPL_EXPR_STRING:
+    case TMPL_EXPR_SYMBOL_REF:
+    case TMPL_EXPR_REQUIRE:
+    case TMPL_EXPR_NOP:
+    case TMPL_EXPR_NULL:
+    case TMPL_EXPR_CONSTANT:
+    default:
+      break;
+    }
+
+#undef VISIT
+}
+
+static void
+tmpl_expr_has_user_call_cb (TmplExpr **child,
+                            gpointer   user_data)
+{
+  gboolean *found = user_data;
+
+  if (!*found)
+    *found = tmpl_expr_has_user_call (*child);
+}
+
+/*
+ * tmpl_expr_has_user_call:
+ *
+ * Checks if evaluating @self may call a function defined by a template or
+ * stored in the scope. The body of such a function is only known when it
+ * is called, so it cannot be checked for assignments ahead of time.
+ *
+ * Returns: %TRUE if @self contains a call to a user defined function
+ */
+gboolean
+tmpl_expr_has_user_call (TmplExpr *self)
+{
+  gboolean found = FALSE;
+
+  if (self == NULL)
+    return FALSE;
+
+  if (self->any.type == TMPL_EXPR_USER_FN_CALL ||
+      self->any.type == TMPL_EXPR_ANON_FN_CALL)
+    return TRUE;
+
+  tmpl_expr_foreach_child (self, tmpl_expr_has_user_call_cb, &found);
+
+  return found;
+}
+
+/* Folded strings are kept in the tree, so do not expand "x" * 1000000 */
+#define FOLD_MAX_STRING_LEN 4096
+
+/*
+ * Creates a literal expression evaluating to @value, or %NULL if @value
+ * is a string longer than @max_len.
+ */
+static TmplExpr *
+tmpl_expr_new_for_value (const GValue *value,
+                         gsize         max_len)
+{
+  switch (G_VALUE_TYPE (value))
+    {
+    case G_TYPE_INVALID:
+      return tmpl_expr_new_nop ();
+
+    case G_TYPE_DOUBLE:
+      return tmpl_expr_new_number (g_value_get_double (value));
+
+    case G_TYPE_BOOLEAN:
+      return tmpl_expr_new_boolean (g_value_get_boolean (value));
+
+    case G_TYPE_STRING:
+      if (g_value_get_string (value) == NULL)
+        return tmpl_expr_new_constant (value);
+      if (strlen (g_value_get_string (value)) > max_len)
+        return NULL;
+      return tmpl_expr_new_string (g_value_get_string (value), -1);
+
+    case G_TYPE_POINTER:
+      if (g_value_get_pointer (value) == NULL)
+        return tmpl_expr_new_null ();
+      return tmpl_expr_new_constant (value);
+
+    default:
+      return tmpl_expr_new_constant (value);
+    }
+}
+
+static gboolean
+tmpl_expr_is_literal (TmplExpr *self)
+{
+  if (self == NULL)
+    return TRUE;
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_BOOLEAN:
+    case TMPL_EXPR_NUMBER:
+    case TMPL_EXPR_STRING:
+    case TMPL_EXPR_NULL:
+    case TMPL_EXPR_CONSTANT:
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+tmpl_expr_is_pure_builtin (TmplExprBuiltin builtin)
+{
+  switch (builtin)
+    {
+    case TMPL_EXPR_BUILTIN_PRINT:
+    case TMPL_EXPR_BUILTIN_PRINTERR:
+    case TMPL_EXPR_BUILTIN_ASSERT:
+    case TMPL_EXPR_BUILTIN_TYPEOF:
+      return FALSE;
+
+    /* A range is not a literal that could be saved with the template */
+    case TMPL_EXPR_BUILTIN_RANGE:
+      return FALSE;
+
+    default:
+      return TRUE;
+    }
+}
+
+/*
+ * Evaluates @self, whose operands are all literals, and returns a literal
+ * expression holding the result. If evaluation fails, such as a division
+ * by zero, %NULL is returned so that the error is raised at runtime.
+ */
+static TmplExpr *
+tmpl_expr_fold_eval (TmplExpr   *self,
+                     TmplScope **scope)
+{
+  GValue value = G_VALUE_INIT;
+  TmplExpr *ret = NULL;
+
+  if (*scope == NULL)
+    *scope = tmpl_scope_new ();
+
+  if (tmpl_expr_eval (self, *scope, &value, NULL) && G_IS_VALUE (&value))
+    ret = tmpl_expr_new_for_value (&value, FOLD_MAX_STRING_LEN);
+
+  TMPL_CLEAR_VALUE (&value);
+
+  return ret;
+}
+
+static void
+tmpl_expr_fold_child (TmplExpr **child,
+                      gpointer   user_data)
+{
+  *child = tmpl_expr_fold_internal (*child, user_data);
+}
+
+static TmplExpr *
+tmpl_expr_fold_internal (TmplExpr   *self,
+                         TmplScope **scope)
+{
+  TmplExpr *ret = NULL;
+
+  tmpl_expr_foreach_child (self, tmpl_expr_fold_child, scope);
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+      if (tmpl_expr_is_literal (self->simple.left) &&
+          tmpl_expr_is_literal (self->simple.right))
+        ret = tmpl_expr_fold_eval (self, scope);
+      break;
+
+    case TMPL_EXPR_GETATTR:
+      /* Only reached with values from tmpl_expr_specialize() */
+      if (tmpl_expr_is_literal (self->getattr.left))
+        ret = tmpl_expr_fold_eval (self, scope);
+      break;
+
+    case TMPL_EXPR_FN_CALL:
+      if (tmpl_expr_is_pure_builtin (self->fn_call.builtin) &&
+          self->fn_call.param != NULL &&
+          tmpl_expr_is_literal (self->fn_call.param))
+        ret = tmpl_expr_fold_eval (self, scope);
+      break;
+
+    case TMPL_EXPR_IF:
+      if (self->flow.condition != NULL &&
+          tmpl_expr_is_literal (self->flow.condition))
+        {
+          GValue value = G_VALUE_INIT;
+
+          if (*scope == NULL)
+            *scope = tmpl_scope_new ();
+
+          if (tmpl_expr_eval (self->flow.condition, *scope, &value, NULL))
+            {
+              TmplExpr *branch;
+
+              if (tmpl_value_as_boolean (&value))
+                branch = self->flow.primary;
+              else
+                branch = self->flow.secondary;
+
+              ret = branch ? tmpl_expr_ref (branch) : tmpl_expr_new_nop ();
+            }
+
+          TMPL_CLEAR_VALUE (&value);
+        }
+      break;
+
+    default:
+      break;
+    }
+
+  if (ret != NULL)
+    {
+      tmpl_expr_unref (self);
+      return ret;
+    }
+
+  return self;
+}
+
+/*
+ * tmpl_expr_fold:
+ * @self: (transfer full): a #TmplExpr
+ *
+ * Replaces the sub-expressions of @self which only depend on literals
+ * with the literal they evaluate to, and conditions which are constant
+ * with the branch that would be taken. This includes arithmetic, string
+ * concatenation, comparisons and the builtins without side effects.
+ *
+ * @self is modified in place, so it must not be shared with another
+ * tree, as is the case for an expression that was just parsed.
+ *
+ * Returns: (transfer full): the folded expression, which may be @self
+ */
+TmplExpr *
+tmpl_expr_fold (TmplExpr *self)
+{
+  TmplScope *scope = NULL;
+  TmplExpr *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = tmpl_expr_fold_internal (self, &scope);
+  g_clear_pointer (&scope, tmpl_scope_unref);
+
+  return ret;
+}
+
+static void
+tmpl_expr_copy_child (TmplExpr **child,
+                      gpointer   user_data)
+{
+  *child = tmpl_expr_copy (*child);
+}
+
+/*
+ * tmpl_expr_copy:
+ * @self: a #TmplExpr
+ *
+ * Creates a deep copy of @self which may be modified without affecting
+ * other users of @self.
+ *
+ * Returns: (transfer full): a new #TmplExpr
+ */
+TmplExpr *
+tmpl_expr_copy (TmplExpr *self)
+{
+  TmplExpr *ret;
+  gboolean arena;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  /* These are interned and immutable */
+  if (self->any.type == TMPL_EXPR_NOP || self->any.type == TMPL_EXPR_NULL)
+    return tmpl_expr_ref (self);
+
+  ret = tmpl_expr_new (self->any.type);
+  arena = ret->any.arena;
+  memcpy (ret, self, tmpl_expr_get_record_size (self->any.type));
+  ret->any.arena = arena;
+  ret->any.ref_count = 1;
+
+  switch (ret->any.type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+      /* The cache may be in the middle of being filled */
+      memset (ret->simple.cache, 0, sizeof ret->simple.cache);
+      break;
+
+    case TMPL_EXPR_GETATTR:
+      ret->getattr.attr = g_strdup (self->getattr.attr);
+      memset (ret->getattr.cache, 0, sizeof ret->getattr.cache);
+      break;
+
+    case TMPL_EXPR_SETATTR:
+      ret->setattr.attr = g_strdup (self->setattr.attr);
+      memset (ret->setattr.cache, 0, sizeof ret->setattr.cache);
+      break;
+
+    case TMPL_EXPR_STRING:
+      ret->string.value = g_strdup (self->string.value);
+      break;
+
+    case TMPL_EXPR_GI_CALL:
+      ret->gi_call.name = g_strdup (self->gi_call.name);
+      memset (ret->gi_call.cache, 0, sizeof ret->gi_call.cache);
+      break;
+
+    case TMPL_EXPR_REQUIRE:
+      ret->require.name = g_strdup (self->require.name);
+      ret->require.version = g_strdup (self->require.version);
+      break;
+
+    case TMPL_EXPR_FUNC:
+      if (self->func.symlist != NULL)
+        ret->func.symlist = g_memdup2 (self->func.symlist,
+                                       (g_strv_length ((gchar **)self->func.symlist) + 1) * sizeof (gchar *));
+      break;
+
+    case TMPL_EXPR_STMT_LIST:
+      ret->stmt_list.stmts = g_ptr_array_new_full (self->stmt_list.stmts->len,
+                                                   (GDestroyNotify)tmpl_expr_unref);
+      for (guint i = 0; i < self->stmt_list.stmts->len; i++)
+        g_ptr_array_add (ret->stmt_list.stmts, g_ptr_array_index (self->stmt_list.stmts, i));
+      break;
+
+    case TMPL_EXPR_CONSTANT:
+      memset (&ret->constant.value, 0, sizeof ret->constant.value);
+      g_value_init (&ret->constant.value, G_VALUE_TYPE (&self->constant.value));
+      g_value_copy (&self->constant.value, &ret->constant.value);
+      break;
+
+    default:
+      break;
+    }
+
+  /* Children still point at those of @self, replace them with copies */
+  tmpl_expr_foreach_child (ret, tmpl_expr_copy_child, NULL);
+
+  return ret;
+}
+
+static void
+tmpl_expr_collect_bindings_child (TmplExpr **child,
+                                  gpointer   user_data)
+{
+  tmpl_expr_collect_bindings (*child, user_data);
+}
+
+/*
+ * tmpl_expr_collect_bindings:
+ * @self: a #TmplExpr
+ * @names: a #GHashTable set of strings
+ *
+ * Adds to @names the name of every symbol that may be bound when
+ * evaluating @self, whether by assignment, by defining a function or
+ * namespace, or as the parameter of a function.
+ */
+void
+tmpl_expr_collect_bindings (TmplExpr   *self,
+                            GHashTable *names)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (names != NULL);
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+      g_hash_table_add (names, g_strdup (self->sym_assign.symbol));
+      break;
+
+    case TMPL_EXPR_REQUIRE:
+      g_hash_table_add (names, g_strdup (self->require.name));
+      break;
+
+    case TMPL_EXPR_FUNC:
+      if (self->func.name != NULL)
+        g_hash_table_add (names, g_strdup (self->func.name));
+      for (guint i = 0; self->func.symlist != NULL && self->func.symlist[i]; i++)
+        g_hash_table_add (names, g_strdup (self->func.symlist[i]));
+      break;
+
+    default:
+      break;
+    }
+
+  tmpl_expr_foreach_child (self, tmpl_expr_collect_bindings_child, names);
+}
+
+typedef struct
+{
+  TmplScope  *frozen;
+  GHashTable *shadowed;
+} TmplExprSpecialize;
+
+static void
+tmpl_expr_specialize_child (TmplExpr **child,
+                            gpointer   user_data)
+{
+  TmplExprSpecialize *state = user_data;
+  TmplExpr *self = *child;
+  TmplSymbol *symbol;
+
+  if (self->any.type != TMPL_EXPR_SYMBOL_REF)
+    {
+      tmpl_expr_foreach_child (self, tmpl_expr_specialize_child, state);
+      return;
+    }
+
+  if (!g_hash_table_contains (state->shadowed, self->sym_ref.symbol) &&
+      (symbol = tmpl_scope_peek_interned (state->frozen, self->sym_ref.symbol)) &&
+      tmpl_symbol_get_symbol_type (symbol) == TMPL_SYMBOL_VALUE)
+    {
+      GValue value = G_VALUE_INIT;
+      TmplExpr *replace;
+
+      tmpl_symbol_get_value (symbol, &value);
+
+      if ((replace = tmpl_expr_new_for_value (&value, G_MAXSIZE)))
+        {
+          tmpl_expr_unref (self);
+          *child = replace;
+        }
+
+      TMPL_CLEAR_VALUE (&value);
+    }
+}
+
+/*
+ * tmpl_expr_specialize:
+ * @self: a #TmplExpr
+ * @frozen: a #TmplScope with symbols that will not change
+ * @shadowed: a #GHashTable set of symbol names to ignore in @frozen
+ *
+ * Creates a copy of @self where references to the values of @frozen are
+ * replaced with the values themselves and then folded. Properties of
+ * objects found in @frozen are also assumed to not change.
+ *
+ * Symbols which may be bound while expanding the template, as found with
+ * tmpl_expr_collect_bindings() and loop identifiers, must be in @shadowed
+ * since they hide those of @frozen.
+ *
+ * Returns: (transfer full): a new #TmplExpr
+ */
+TmplExpr *
+tmpl_expr_specialize (TmplExpr   *self,
+                      TmplScope  *frozen,
+                      GHashTable *shadowed)
+{
+  TmplExprSpecialize state = { frozen, shadowed };
+  TmplExpr *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (frozen != NULL, NULL);
+  g_return_val_if_fail (shadowed != NULL, NULL);
+
+  ret = tmpl_expr_copy (self);
+  tmpl_expr_specialize_child (&ret, &state);
+
+  return tmpl_expr_fold (ret);
+}
+
+/*
+ * tmpl_expr_is_constant:
+ * @self: a #TmplExpr
+ *
+ * Checks if @self is a literal, so that evaluating it has no effect other
+ * than producing a value and cannot fail.
+ *
+ * Returns: %TRUE if @self is a literal
+ */
+gboolean
+tmpl_expr_is_constant (TmplExpr *self)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return self->any.type == TMPL_EXPR_NOP || tmpl_expr_is_literal (self);
+}
+
+static gsize
+tmpl_expr_string_size (const gchar *str)
+{
+  return str != NULL ? strlen (str) + 1 : 0;
+}
+
+typedef struct
+{
+  GHashTable *seen;
+  gsize       size;
+} TmplExprMemoryUsage;
+
+static void
+tmpl_expr_get_memory_usage_child (TmplExpr **child,
+                                  gpointer   user_data)
+{
+  TmplExprMemoryUsage *state = user_data;
+
+  state->size += tmpl_expr_get_memory_usage (*child, state->seen);
+}
+
+/*
+ * tmpl_expr_get_memory_usage:
+ * @self: a #TmplExpr
+ * @seen: a #GHashTable set of expressions and arenas already counted
+ *
+ * Gets the number of bytes used by @self and its children which have not
+ * been counted yet. The arena an expression was allocated from is counted
+ * as a whole the first time it is seen. Interned names are not counted.
+ *
+ * Returns: the number of bytes
+ */
+gsize
+tmpl_expr_get_memory_usage (TmplExpr   *self,
+                            GHashTable *seen)
+{
+  TmplExprMemoryUsage state = { seen, 0 };
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (seen != NULL, 0);
+
+  /* These are interned and shared by every template */
+  if (self->any.type == TMPL_EXPR_NOP || self->any.type == TMPL_EXPR_NULL)
+    return 0;
+
+  if (!g_hash_table_add (seen, self))
+    return 0;
+
+  if (!self->any.arena)
+    state.size += tmpl_expr_get_record_size (self->any.type);
+  else if (g_hash_table_add (seen, tmpl_arena_from_pointer (self)))
+    state.size += tmpl_arena_get_size (tmpl_arena_from_pointer (self));
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_GETATTR:
+      state.size += tmpl_expr_string_size (self->getattr.attr);
+      break;
+
+    case TMPL_EXPR_SETATTR:
+      state.size += tmpl_expr_string_size (self->setattr.attr);
+      break;
+
+    case TMPL_EXPR_STRING:
+      state.size += tmpl_expr_string_size (self->string.value);
+      break;
+
+    case TMPL_EXPR_GI_CALL:
+      state.size += tmpl_expr_string_size (self->gi_call.name);
+      break;
+
+    case TMPL_EXPR_REQUIRE:
+      state.size += tmpl_expr_string_size (self->require.name);
+      state.size += tmpl_expr_string_size (self->require.version);
+      break;
+
+    case TMPL_EXPR_FUNC:
+      if (self->func.symlist != NULL)
+        state.size += (g_strv_length ((gchar **)self->func.symlist) + 1) * sizeof (gchar *);
+      break;
+
+    case TMPL_EXPR_STMT_LIST:
+      state.size += sizeof (GPtrArray) + self->stmt_list.stmts->len * sizeof (gpointer);
+      break;
+
+    default:
+      break;
+    }
+
+  tmpl_expr_foreach_child (self, tmpl_expr_get_memory_usage_child, &state);
+
+  return state.size;
+}
+
+/*
+ * Expressions are serialized as a flat table of "(uv)" nodes holding the
+ * expression type and its payload, where children are referenced by
+ * their index in the table. Children are always written before their
+ * parent so that a table may be loaded in a single pass. Nesting each
+ * child as a variant would quickly exceed the maximum depth of GVariant.
+ */
+#define NO_CHILD G_MAXUINT
+
+static guint
+tmpl_expr_serialize_child (TmplExpr        *child,
+                           GVariantBuilder *nodes,
+                           guint           *n_nodes)
+{
+  if (child == NULL)
+    return NO_CHILD;
+  return tmpl_expr_serialize (child, nodes, n_nodes);
+}
+
+/* The types of TMPL_EXPR_CONSTANT that may be serialized */
+static const struct {
+  GType        type;
+  const gchar *variant_type;
+} constant_types[] = {
+  { G_TYPE_CHAR, "n" },
+  { G_TYPE_UCHAR, "y" },
+  { G_TYPE_INT, "i" },
+  { G_TYPE_UINT, "u" },
+  { G_TYPE_INT64, "x" },
+  { G_TYPE_UINT64, "t" },
+  { G_TYPE_FLOAT, "d" },
+};
+
+static void
+tmpl_expr_check_serializable (TmplExpr **child,
+                              gpointer   user_data)
+{
+  gboolean *serializable = user_data;
+
+  if (*serializable && !tmpl_expr_is_serializable (*child))
+    *serializable = FALSE;
+}
+
+/*
+ * tmpl_expr_is_serializable:
+ * @self: a #TmplExpr
+ *
+ * Checks if @self may be serialized with tmpl_expr_serialize(), which
+ * is not the case when it contains values such as objects, as is
+ * possible after tmpl_expr_specialize().
+ *
+ * Returns: %TRUE if @self can be serialized
+ */
+gboolean
+tmpl_expr_is_serializable (TmplExpr *self)
+{
+  gboolean serializable = TRUE;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (self->any.type == TMPL_EXPR_CONSTANT)
+    {
+      for (guint i = 0; i < G_N_ELEMENTS (constant_types); i++)
+        {
+          if (G_VALUE_TYPE (&self->constant.value) == constant_types[i].type)
+            return TRUE;
+        }
+
+      return FALSE;
+    }
+
+  tmpl_expr_foreach_child (self, tmpl_expr_check_serializable, &serializable);
+
+  return serializable;
+}
+
+static GVariant *
+tmpl_expr_constant_to_variant (const GValue *value)
+{
+  switch (G_VALUE_TYPE (value))
+    {
+    case G_TYPE_CHAR:
+      return g_variant_new_int16 (g_value_get_schar (value));
+
+    case G_TYPE_UCHAR:
+      return g_variant_new_byte (g_value_get_uchar (value));
+
+    case G_TYPE_INT:
+      return g_variant_new_int32 (g_value_get_int (value));
+
+    case G_TYPE_UINT:
+      return g_variant_new_uint32 (g_value_get_uint (value));
+
+    case G_TYPE_INT64:
+      return g_variant_new_int64 (g_value_get_int64 (value));
+
+    case G_TYPE_UINT64:
+      return g_variant_new_uint64 (g_value_get_uint64 (value));
+
+    case G_TYPE_FLOAT:
+      return g_variant_new_double (g_value_get_float (value));
+
+    default:
+      g_return_val_if_reached (NULL);
+    }
+}
+
+static gboolean
+tmpl_expr_constant_from_variant (const gchar *type_name,
+                                 GVariant    *variant,
+                                 GValue      *value)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (constant_types); i++)
+    {
+      if (g_strcmp0 (type_name, g_type_name (constant_types[i].type)) != 0)
+        continue;
+
+      if (!g_variant_is_of_type (variant, G_VARIANT_TYPE (constant_types[i].variant_type)))
+        return FALSE;
+
+      g_value_init (value, constant_types[i].type);
+
+      switch (constant_types[i].type)
+        {
+        case G_TYPE_CHAR:
+          g_value_set_schar (value, (gint8)g_variant_get_int16 (variant));
+          break;
+
+        case G_TYPE_UCHAR:
+          g_value_set_uchar (value, g_variant_get_byte (variant));
+          break;
+
+        case G_TYPE_INT:
+          g_value_set_int (value, g_variant_get_int32 (variant));
+          break;
+
+        case G_TYPE_UINT:
+          g_value_set_uint (value, g_variant_get_uint32 (variant));
+          break;
+
+        case G_TYPE_INT64:
+          g_value_set_int64 (value, g_variant_get_int64 (variant));
+          break;
+
+        case G_TYPE_UINT64:
+          g_value_set_uint64 (value, g_variant_get_uint64 (variant));
+          break;
+
+        case G_TYPE_FLOAT:
+          g_value_set_float (value, g_variant_get_double (variant));
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * tmpl_expr_serialize:
+ * @self: a #TmplExpr
+ * @nodes: a #GVariantBuilder of type "a(uv)"
+ * @n_nodes: the number of nodes found in @nodes
+ *
+ * Appends @self and all of its children to @nodes. @self must be
+ * serializable, see tmpl_expr_is_serializable().
+ *
+ * Returns: the index of @self within @nodes
+ */
+guint
+tmpl_expr_serialize (TmplExpr        *self,
+                     GVariantBuilder *nodes,
+                     guint           *n_nodes)
+{
+  GVariant *payload = NULL;
+
+  g_return_val_if_fail (self != NULL, NO_CHILD);
+  g_return_val_if_fail (nodes != NULL, NO_CHILD);
+  g_return_val_if_fail (n_nodes != NULL, NO_CHILD);
+
+  switch (self->any.type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+    case TMPL_EXPR_ARGS:
+      {
+        guint left = tmpl_expr_serialize_child (self->simple.left, nodes, n_nodes);
+        guint right = tmpl_expr_serialize_child (self->simple.right, nodes, n_nodes);
+        payload = g_variant_new ("(uu)", left, right);
+      }
+      break;
+
+    case TMPL_EXPR_USER_FN_CALL:
+      {
+        guint params = tmpl_expr_serialize_child (self->user_fn_call.params, nodes, n_nodes);
+        payload = g_variant_new ("(su)", self->user_fn_call.symbol, params);
+      }
+      break;
+
+    case TMPL_EXPR_ANON_FN_CALL:
+      {
+        guint anon = tmpl_expr_serialize_child (self->anon_fn_call.anon, nodes, n_nodes);
+        guint params = tmpl_expr_serialize_child (self->anon_fn_call.params, nodes, n_nodes);
+        payload = g_variant_new ("(uu)", anon, params);
+      }
+      break;
+
+    case TMPL_EXPR_GETATTR:
+      {
+        guint left = tmpl_expr_serialize_child (self->getattr.left, nodes, n_nodes);
+        payload = g_variant_new ("(us)", left, self->getattr.attr);
+      }
+      break;
+
+    case TMPL_EXPR_SETATTR:
+      {
+        guint left = tmpl_expr_serialize_child (self->setattr.left, nodes, n_nodes);
+        guint right = tmpl_expr_serialize_child (self->setattr.right, nodes, n_nodes);
+        payload = g_variant_new ("(usu)", left, self->setattr.attr, right);
+      }
+      break;
+
+    case TMPL_EXPR_STMT_LIST:
+      {
+        g_autoptr(GArray) stmts = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+        for (guint i = 0; i < self->stmt_list.stmts->len; i++)
+          {
+            guint32 pos = tmpl_expr_serialize (g_ptr_array_index (self->stmt_list.stmts, i), nodes, n_nodes);
+            g_array_append_val (stmts, pos);
+          }
+
+        payload = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                             stmts->data, stmts->len,
+                                             sizeof (guint32));
+      }
+      break;
+
+    case TMPL_EXPR_BOOLEAN:
+      payload = g_variant_new_boolean (((TmplExprBoolean *)self)->value);
+      break;
+
+    case TMPL_EXPR_NUMBER:
+      payload = g_variant_new_double (self->number.number);
+      break;
+
+    case TMPL_EXPR_STRING:
+      payload = g_variant_new_string (self->string.value);
+      break;
+
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_WHILE:
+      {
+        guint condition = tmpl_expr_serialize_child (self->flow.condition, nodes, n_nodes);
+        guint primary = tmpl_expr_serialize_child (self->flow.primary, nodes, n_nodes);
+        guint secondary = tmpl_expr_serialize_child (self->flow.secondary, nodes, n_nodes);
+        payload = g_variant_new ("(uuu)", condition, primary, secondary);
+      }
+      break;
+
+    case TMPL_EXPR_SYMBOL_REF:
+      payload = g_variant_new_string (self->sym_ref.symbol);
+      break;
+
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+      {
+        guint right = tmpl_expr_serialize_child (self->sym_assign.right, nodes, n_nodes);
+        payload = g_variant_new ("(su)", self->sym_assign.symbol, right);
+      }
+      break;
+
+    case TMPL_EXPR_FN_CALL:
+      {
+        guint param = tmpl_expr_serialize_child (self->fn_call.param, nodes, n_nodes);
+        payload = g_variant_new ("(uu)", (guint)self->fn_call.builtin, param);
+      }
+      break;
+
+    case TMPL_EXPR_GI_CALL:
+      {
+        guint object = tmpl_expr_serialize_child (self->gi_call.object, nodes, n_nodes);
+        guint params = tmpl_expr_serialize_child (self->gi_call.params, nodes, n_nodes);
+        payload = g_variant_new ("(usu)", object, self->gi_call.name, params);
+      }
+      break;
+
+    case TMPL_EXPR_REQUIRE:
+      payload = g_variant_new ("(sms)", self->require.name, self->require.version);
+      break;
+
+    case TMPL_EXPR_FUNC:
+      {
+        static const gchar *empty[] = { NULL };
+        const gchar * const *symlist = (const gchar * const *)self->func.symlist;
+        guint list = tmpl_expr_serialize_child (self->func.list, nodes, n_nodes);
+        payload = g_variant_new ("(ms^asu)",
+                                 self->func.name,
+                                 symlist ? symlist : empty,
+                                 list);
+      }
+      break;
+
+    case TMPL_EXPR_NOP:
+    case TMPL_EXPR_NULL:
+      payload = g_variant_new ("()");
+      break;
+
+    case TMPL_EXPR_CONSTANT:
+      payload = g_variant_new ("(sv)",
+                               G_VALUE_TYPE_NAME (&self->constant.value),
+                               tmpl_expr_constant_to_variant (&self->constant.value));
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  g_variant_builder_add (nodes, "(uv)", (guint)self->any.type, payload);
+
+  return (*n_nodes)++;
+}
+
+static gboolean
+tmpl_expr_get_child (TmplExpr   **exprs,
+                     guint        n_exprs,
+                     guint        index,
+                     gboolean     nullable,
+                     TmplExpr   **child,
+                     GError     **error)
+{
+  if (index == NO_CHILD && nullable)
+    {
+      *child = NULL;
+      return TRUE;
+    }
+
+  if (index >= n_exprs)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_INVALID_STATE,
+                   "Invalid expression reference %u",
+                   index);
+      return FALSE;
+    }
+
+  *child = tmpl_expr_ref (exprs[index]);
+
+  return TRUE;
+}
+
+/*
+ * tmpl_expr_deserialize:
+ * @node: a "(uv)" node created by tmpl_expr_serialize()
+ * @exprs: the expressions for the nodes preceding @node
+ * @n_exprs: the number of elements in @exprs
+ * @error: a location for a #GError, or %NULL
+ *
+ * Creates the expression for @node, which may only reference the
+ * expressions in @exprs. @node may come from untrusted data, so
+ * every reference and type is checked.
+ *
+ * Returns: (transfer full): a #TmplExpr or %NULL and @error is set.
+ */
+TmplExpr *
+tmpl_expr_deserialize (GVariant  *node,
+                       TmplExpr **exprs,
+                       guint      n_exprs,
+                       GError   **error)
+{
+  g_autoptr(GVariant) payload = NULL;
+  TmplExpr *a = NULL;
+  TmplExpr *b = NULL;
+  TmplExpr *c = NULL;
+  const gchar *str = NULL;
+  guint type;
+  guint i, j, k;
+
+  g_return_val_if_fail (node != NULL, NULL);
+  g_return_val_if_fail (g_variant_is_of_type (node, G_VARIANT_TYPE ("(uv)")), NULL);
+
+  g_variant_get (node, "(uv)", &type, &payload);
+
+#define CHECK_PAYLOAD(format) \
+  G_STMT_START { \
+    if (!g_variant_is_of_type (payload, G_VARIANT_TYPE (format))) \
+      goto invalid; \
+  } G_STMT_END
+#define GET_CHILD(index, nullable, child) \
+  G_STMT_START { \
+    if (!tmpl_expr_get_child (exprs, n_exprs, index, nullable, child, error)) \
+      goto failure; \
+  } G_STMT_END
+
+  switch (type)
+    {
+    case TMPL_EXPR_ADD:
+    case TMPL_EXPR_DIV:
+    case TMPL_EXPR_EQ:
+    case TMPL_EXPR_GT:
+    case TMPL_EXPR_GTE:
+    case TMPL_EXPR_LT:
+    case TMPL_EXPR_LTE:
+    case TMPL_EXPR_MUL:
+    case TMPL_EXPR_NE:
+    case TMPL_EXPR_SUB:
+    case TMPL_EXPR_AND:
+    case TMPL_EXPR_OR:
+    case TMPL_EXPR_ARGS:
+      CHECK_PAYLOAD ("(uu)");
+      g_variant_get (payload, "(uu)", &i, &j);
+      GET_CHILD (i, FALSE, &a);
+      GET_CHILD (j, FALSE, &b);
+      return tmpl_expr_new_simple (type, a, b);
+
+    case TMPL_EXPR_UNARY_MINUS:
+    case TMPL_EXPR_INVERT_BOOLEAN:
+      CHECK_PAYLOAD ("(uu)");
+      g_variant_get (payload, "(uu)", &i, &j);
+      GET_CHILD (i, FALSE, &a);
+      GET_CHILD (j, TRUE, &b);
+      return tmpl_expr_new_simple (type, a, b);
+
+    case TMPL_EXPR_USER_FN_CALL:
+      CHECK_PAYLOAD ("(su)");
+      g_variant_get (payload, "(&su)", &str, &i);
+      GET_CHILD (i, TRUE, &a);
+      return tmpl_expr_new_user_fn_call (str, a);
+
+    case TMPL_EXPR_ANON_FN_CALL:
+      CHECK_PAYLOAD ("(uu)");
+      g_variant_get (payload, "(uu)", &i, &j);
+      GET_CHILD (i, FALSE, &a);
+      if (a->any.type != TMPL_EXPR_FUNC)
+        goto invalid;
+      GET_CHILD (j, TRUE, &b);
+      return tmpl_expr_new_anon_call (a, b);
+
+    case TMPL_EXPR_GETATTR:
+      CHECK_PAYLOAD ("(us)");
+      g_variant_get (payload, "(u&s)", &i, &str);
+      GET_CHILD (i, FALSE, &a);
+      return tmpl_expr_new_getattr (a, str);
+
+    case TMPL_EXPR_SETATTR:
+      CHECK_PAYLOAD ("(usu)");
+      g_variant_get (payload, "(u&su)", &i, &str, &j);
+      GET_CHILD (i, FALSE, &a);
+      GET_CHILD (j, FALSE, &b);
+      return tmpl_expr_new_setattr (a, str, b);
+
+    case TMPL_EXPR_STMT_LIST:
+      {
+        g_autoptr(GPtrArray) stmts = NULL;
+        const guint32 *indexes;
+        gsize n_indexes;
+
+        CHECK_PAYLOAD ("au");
+
+        indexes = g_variant_get_fixed_array (payload, &n_indexes, sizeof (guint32));
+        stmts = g_ptr_array_new_with_free_func ((GDestroyNotify)tmpl_expr_unref);
+
+        for (gsize n = 0; n < n_indexes; n++)
+          {
+            GET_CHILD (indexes[n], FALSE, &a);
+            g_ptr_array_add (stmts, g_steal_pointer (&a));
+          }
+
+        return tmpl_expr_new_stmt_list (g_steal_pointer (&stmts));
+      }
+
+    case TMPL_EXPR_BOOLEAN:
+      CHECK_PAYLOAD ("b");
+      return tmpl_expr_new_boolean (g_variant_get_boolean (payload));
+
+    case TMPL_EXPR_NUMBER:
+      CHECK_PAYLOAD ("d");
+      return tmpl_expr_new_number (g_variant_get_double (payload));
+
+    case TMPL_EXPR_STRING:
+      CHECK_PAYLOAD ("s");
+      return tmpl_expr_new_string (g_variant_get_string (payload, NULL), -1);
+
+    case TMPL_EXPR_IF:
+    case TMPL_EXPR_WHILE:
+      CHECK_PAYLOAD ("(uuu)");
+      g_variant_get (payload, "(uuu)", &i, &j, &k);
+      GET_CHILD (i, FALSE, &a);
+      GET_CHILD (j, TRUE, &b);
+      GET_CHILD (k, TRUE, &c);
+      return tmpl_expr_new_flow (type, a, b, c);
+
+    case TMPL_EXPR_SYMBOL_REF:
+      CHECK_PAYLOAD ("s");
+      return tmpl_expr_new_symbol_ref (g_variant_get_string (payload, NULL));
+
+    case TMPL_EXPR_SYMBOL_ASSIGN:
+      CHECK_PAYLOAD ("(su)");
+      g_variant_get (payload, "(&su)", &str, &i);
+      GET_CHILD (i, FALSE, &a);
+      return tmpl_expr_new_symbol_assign (str, a);
+
+    case TMPL_EXPR_FN_CALL:
+      CHECK_PAYLOAD ("(uu)");
+      g_variant_get (payload, "(uu)", &i, &j);
+      if (i > TMPL_EXPR_BUILTIN_RANGE)
+        goto invalid;
+      GET_CHILD (j, FALSE, &a);
+      return tmpl_expr_new_fn_call (i, a);
+
+    case TMPL_EXPR_GI_CALL:
+      CHECK_PAYLOAD ("(usu)");
+      g_variant_get (payload, "(u&su)", &i, &str, &j);
+      GET_CHILD (i, FALSE, &a);
+      GET_CHILD (j, TRUE, &b);
+      return tmpl_expr_new_gi_call (a, str, b);
+
+    case TMPL_EXPR_REQUIRE:
+      {
+        const gchar *version = NULL;
+
+        CHECK_PAYLOAD ("(sms)");
+        g_variant_get (payload, "(&sm&s)", &str, &version);
+
+        return tmpl_expr_new_require (str, version);
+      }
+
+    case TMPL_EXPR_FUNC:
+      {
+        g_autofree gchar *name = NULL;
+        g_auto(GStrv) symlist = NULL;
+
+        CHECK_PAYLOAD ("(msasu)");
+        g_variant_get (payload, "(ms^asu)", &name, &symlist, &i);
+        GET_CHILD (i, FALSE, &a);
+
+        if (symlist[0] == NULL)
+          g_clear_pointer (&symlist, g_strfreev);
+
+        return tmpl_expr_new_func (g_steal_pointer (&name), g_steal_pointer (&symlist), a);
+      }
+
+    case TMPL_EXPR_NOP:
+      return tmpl_expr_new_nop ();
+
+    case TMPL_EXPR_NULL:
+      return tmpl_expr_new_null ();
+
+    case TMPL_EXPR_CONSTANT:
+      {
+        GValue value = G_VALUE_INIT;
+        g_autoptr(GVariant) variant = NULL;
+
+        CHECK_PAYLOAD ("(sv)");
+        g_variant_get (payload, "(&sv)", &str, &variant);
+
+        if (!tmpl_expr_constant_from_variant (str, variant, &value))
+          goto invalid;
+
+        a = tmpl_expr_new_constant (&value);
+        g_value_unset (&value);
+
+        return a;
+      }
+
+    default:
+      break;
+    }
+
+#undef CHECK_PAYLOAD
+#undef GET_CHILD
+
+invalid:
+  g_set_error (error,
+               TMPL_ERROR,
+               TMPL_ERROR_INVALID_STATE,
+               "Invalid expression of type %u",
+               type);
+
+failure:
+  g_clear_pointer (&a, tmpl_expr_unref);
+  g_clear_pointer (&b, tmpl_expr_unref);
+  g_clear_pointer (&c, tmpl_expr_unref);
+
+  return NULL;
+}
@@ -0,0 +1,76 @@
+/* tmpl-flush-node.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "tmpl-flush-node"
+
+#include "tmpl-debug.h"
+#include "tmpl-flush-node.h"
+
+/*
+ * A TmplFlushNode is created for the {{flush}} directive. It has no
+ * contents of its own, but requests that everything expanded so far is
+ * written to the output stream before continuing.
+ */
+
+struct _TmplFlushNode
+{
+  TmplNode parent_instance;
+};
+
+G_DEFINE_TYPE (TmplFlushNode, tmpl_flush_node, TMPL_TYPE_NODE)
+
+static gboolean
+tmpl_flush_node_accept (TmplNode      *node,
+                        TmplLexer     *lexer,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  TMPL_ENTRY;
+  /* no children */
+  TMPL_RETURN (TRUE);
+}
+
+static void
+tmpl_flush_node_visit_children (TmplNode        *node,
+                                TmplNodeVisitor  visitor,
+                                gpointer         user_data)
+{
+  TMPL_ENTRY;
+  /* no children */
+  TMPL_EXIT;
+}
+
+static void
+tmpl_flush_node_class_init (TmplFlushNodeClass *klass)
+{
+  TmplNodeClass *node_class = TMPL_NODE_CLASS (klass);
+
+  node_class->accept = tmpl_flush_node_accept;
+  node_class->visit_children = tmpl_flush_node_visit_children;
+}
+
+static void
+tmpl_flush_node_init (TmplFlushNode *self)
+{
+}
+
+TmplNode *
+tmpl_flush_node_new (void)
+{
+  return g_object_new (TMPL_TYPE_FLUSH_NODE, NULL);
+}
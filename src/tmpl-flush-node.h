@@ -0,0 +1,34 @@
+/* tmpl-flush-node.h
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TMPL_FLUSH_NODE_H
+#define TMPL_FLUSH_NODE_H
+
+#include "tmpl-node.h"
+
+G_BEGIN_DECLS
+
+#define TMPL_TYPE_FLUSH_NODE (tmpl_flush_node_get_type())
+
+G_DECLARE_FINAL_TYPE (TmplFlushNode, tmpl_flush_node, TMPL, FLUSH_NODE, TmplNode)
+
+TmplNode *tmpl_flush_node_new (void);
+
+G_END_DECLS
+
+#endif /* TMPL_FLUSH_NODE_H */
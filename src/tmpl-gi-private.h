@@ -26,6 +26,8 @@ G_BEGIN_DECLS
 
 typedef GType (*TmplGTypeFunc) (void);
 
+typedef struct _TmplGiInvoker TmplGiInvoker;
+
 GType    tmpl_typelib_get_type         (void);
 GType    tmpl_base_info_get_type       (void);
 gboolean tmpl_gi_argument_from_g_value (const GValue  *value,
@@ -41,6 +43,19 @@ gboolean tmpl_gi_argument_to_g_value   (GValue        *value,
 TmplGTypeFunc
          tmpl_gi_get_gtype_func        (GIBaseInfo    *base_info);
 
+TmplGiInvoker *tmpl_gi_invoker_new        (GIFunctionInfo  *function,
+                                           GError         **error);
+TmplGiInvoker *tmpl_gi_invoker_ref        (TmplGiInvoker   *self);
+void           tmpl_gi_invoker_unref      (TmplGiInvoker   *self);
+guint          tmpl_gi_invoker_get_n_args (TmplGiInvoker   *self);
+gboolean       tmpl_gi_invoker_invoke     (TmplGiInvoker   *self,
+                                           gpointer         instance,
+                                           const GValue    *args,
+                                           GValue          *return_value,
+                                           GError         **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TmplGiInvoker, tmpl_gi_invoker_unref)
+
 G_END_DECLS
 
 #endif /* TMPL_GI_PRIVATE_H */
@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <girepository/girffi.h>
+
 #include "tmpl-error.h"
 #include "tmpl-gi-private.h"
 #include "tmpl-util-private.h"
@@ -44,28 +46,6 @@ G_DEFINE_BOXED_TYPE (TmplBaseInfo, tmpl_base_info,
       return_type_mismatch(value, type); \
   } G_STMT_END
 
-static gboolean
-find_enum_value (GIEnumInfo  *info,
-                 const gchar *str,
-                 gint        *v_int)
-{
-  guint n = gi_enum_info_get_n_values (info);
-
-  for (guint i = 0; i < n; i++)
-    {
-      g_autoptr(GIBaseInfo) vinfo = NULL;
-
-      vinfo = (GIBaseInfo *)gi_enum_info_get_value (info, i);
-      if (g_strcmp0 (str, gi_base_info_get_name (vinfo)) == 0)
-        {
-          *v_int = gi_value_info_get_value ((GIValueInfo *)vinfo);
-          return TRUE;
-        }
-    }
-
-  return FALSE;
-}
-
 gboolean
 tmpl_gi_argument_from_g_value (const GValue  *value,
                                GITypeInfo    *type_info,
@@ -386,7 +366,7 @@ tmpl_gi_argument_from_g_value (const GValue  *value,
           {
             if (G_VALUE_HOLDS_STRING (value))
               {
-                if (find_enum_value ((GIEnumInfo *)info, g_value_get_string (value), &arg->v_int))
+                if (tmpl_enum_info_lookup ((GIEnumInfo *)info, g_value_get_string (value), FALSE, &arg->v_int))
                   return TRUE;
               }
 
@@ -643,3 +623,394 @@ tmpl_gi_get_gtype_func (GIBaseInfo *base_info)
 
   return symbol;
 }
+
+/*
+ * A TmplGiInvoker is a GIFunctionInfo prepared for calling. The libffi call
+ * interface is built once and each argument gets a marshaller chosen from
+ * its type so that the common cases do not go through the full conversion
+ * in tmpl_gi_argument_from_g_value().
+ */
+
+#define N_STACK_ARGS 8
+
+typedef struct _TmplGiInvokerArg TmplGiInvokerArg;
+
+typedef gboolean (*TmplGiMarshal) (const GValue      *value,
+                                   TmplGiInvokerArg  *invoker_arg,
+                                   GIArgument        *arg,
+                                   GError           **error);
+
+struct _TmplGiInvokerArg
+{
+  TmplGiMarshal  marshal;
+  GIArgInfo     *arg_info;
+  GITypeInfo    *type_info;
+};
+
+struct _TmplGiInvoker
+{
+  volatile gint      ref_count;
+  guint              n_args;
+  guint              is_method : 1;
+  guint              throws : 1;
+  guint              prepared : 1;
+  GITransfer         return_xfer;
+  GIFunctionInfo    *function;
+  GITypeInfo        *return_type;
+  GIFunctionInvoker  invoker;
+  TmplGiInvokerArg   args[];
+};
+
+static gboolean
+marshal_generic (const GValue      *value,
+                 TmplGiInvokerArg  *invoker_arg,
+                 GIArgument        *arg,
+                 GError           **error)
+{
+  return tmpl_gi_argument_from_g_value (value,
+                                        invoker_arg->type_info,
+                                        invoker_arg->arg_info,
+                                        arg,
+                                        error);
+}
+
+static gboolean
+marshal_boolean (const GValue      *value,
+                 TmplGiInvokerArg  *invoker_arg,
+                 GIArgument        *arg,
+                 GError           **error)
+{
+  if (G_VALUE_TYPE (value) != G_TYPE_BOOLEAN)
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_boolean = g_value_get_boolean (value);
+
+  return TRUE;
+}
+
+static gboolean
+marshal_int32 (const GValue      *value,
+               TmplGiInvokerArg  *invoker_arg,
+               GIArgument        *arg,
+               GError           **error)
+{
+  if (G_VALUE_TYPE (value) != G_TYPE_INT)
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_int32 = g_value_get_int (value);
+
+  return TRUE;
+}
+
+static gboolean
+marshal_int64 (const GValue      *value,
+               TmplGiInvokerArg  *invoker_arg,
+               GIArgument        *arg,
+               GError           **error)
+{
+  if (G_VALUE_TYPE (value) != G_TYPE_INT64)
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_int64 = g_value_get_int64 (value);
+
+  return TRUE;
+}
+
+static gboolean
+marshal_double (const GValue      *value,
+                TmplGiInvokerArg  *invoker_arg,
+                GIArgument        *arg,
+                GError           **error)
+{
+  if (G_VALUE_TYPE (value) != G_TYPE_DOUBLE)
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_double = g_value_get_double (value);
+
+  return TRUE;
+}
+
+/* Only used for (transfer none) strings */
+static gboolean
+marshal_string (const GValue      *value,
+                TmplGiInvokerArg  *invoker_arg,
+                GIArgument        *arg,
+                GError           **error)
+{
+  if (G_VALUE_TYPE (value) != G_TYPE_STRING)
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_string = (char *)g_value_get_string (value);
+
+  return TRUE;
+}
+
+/* Only used for (transfer none) objects and interfaces */
+static gboolean
+marshal_object (const GValue      *value,
+                TmplGiInvokerArg  *invoker_arg,
+                GIArgument        *arg,
+                GError           **error)
+{
+  if (!G_VALUE_HOLDS_OBJECT (value))
+    return marshal_generic (value, invoker_arg, arg, error);
+
+  arg->v_pointer = g_value_get_object (value);
+
+  return TRUE;
+}
+
+static TmplGiMarshal
+find_marshal (GITypeInfo *type_info,
+              GITransfer  xfer)
+{
+  switch (gi_type_info_get_tag (type_info))
+    {
+    case GI_TYPE_TAG_BOOLEAN:
+      return marshal_boolean;
+
+    case GI_TYPE_TAG_INT32:
+      return marshal_int32;
+
+    case GI_TYPE_TAG_INT64:
+      return marshal_int64;
+
+    case GI_TYPE_TAG_DOUBLE:
+      return marshal_double;
+
+    case GI_TYPE_TAG_UTF8:
+    case GI_TYPE_TAG_FILENAME:
+      if (xfer == GI_TRANSFER_NOTHING)
+        return marshal_string;
+      break;
+
+    case GI_TYPE_TAG_INTERFACE:
+      if (xfer == GI_TRANSFER_NOTHING)
+        {
+          g_autoptr(GIBaseInfo) info = gi_type_info_get_interface (type_info);
+
+          if (GI_IS_OBJECT_INFO (info) || GI_IS_INTERFACE_INFO (info))
+            return marshal_object;
+        }
+      break;
+
+    default:
+      break;
+    }
+
+  return marshal_generic;
+}
+
+/**
+ * tmpl_gi_invoker_new:
+ * @function: a #GIFunctionInfo
+ * @error: a location for a #GError, or %NULL
+ *
+ * Prepares @function to be called with tmpl_gi_invoker_invoke().
+ *
+ * Returns: (transfer full): a #TmplGiInvoker or %NULL if @function
+ *   cannot be called from a template.
+ */
+TmplGiInvoker *
+tmpl_gi_invoker_new (GIFunctionInfo  *function,
+                     GError         **error)
+{
+  GICallableInfo *callable = (GICallableInfo *)function;
+  TmplGiInvoker *self;
+  guint n_args;
+
+  g_return_val_if_fail (GI_IS_FUNCTION_INFO (function), NULL);
+
+  n_args = gi_callable_info_get_n_args (callable);
+
+  self = g_malloc0 (sizeof *self + sizeof (TmplGiInvokerArg) * n_args);
+  self->ref_count = 1;
+  self->n_args = n_args;
+  self->is_method = !!gi_callable_info_is_method (callable);
+  self->throws = !!gi_callable_info_can_throw_gerror (callable);
+  self->return_xfer = gi_callable_info_get_caller_owns (callable);
+  self->function = (GIFunctionInfo *)gi_base_info_ref (function);
+  self->return_type = gi_callable_info_get_return_type (callable);
+
+  for (guint i = 0; i < n_args; i++)
+    {
+      TmplGiInvokerArg *invoker_arg = &self->args[i];
+
+      invoker_arg->arg_info = gi_callable_info_get_arg (callable, i);
+      invoker_arg->type_info = gi_arg_info_get_type_info (invoker_arg->arg_info);
+
+      if (gi_arg_info_get_direction (invoker_arg->arg_info) != GI_DIRECTION_IN)
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_RUNTIME_ERROR,
+                       "Only \"in\" parameters are supported");
+          tmpl_gi_invoker_unref (self);
+          return NULL;
+        }
+
+      invoker_arg->marshal =
+        find_marshal (invoker_arg->type_info,
+                      gi_arg_info_get_ownership_transfer (invoker_arg->arg_info));
+    }
+
+  if (!gi_function_info_prep_invoker (function, &self->invoker, error))
+    {
+      tmpl_gi_invoker_unref (self);
+      return NULL;
+    }
+
+  self->prepared = TRUE;
+
+  return self;
+}
+
+TmplGiInvoker *
+tmpl_gi_invoker_ref (TmplGiInvoker *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+tmpl_gi_invoker_unref (TmplGiInvoker *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      for (guint i = 0; i < self->n_args; i++)
+        {
+          g_clear_pointer (&self->args[i].type_info, gi_base_info_unref);
+          g_clear_pointer (&self->args[i].arg_info, gi_base_info_unref);
+        }
+
+      if (self->prepared)
+        gi_function_invoker_clear (&self->invoker);
+
+      g_clear_pointer (&self->return_type, gi_base_info_unref);
+      g_clear_pointer (&self->function, gi_base_info_unref);
+      g_free (self);
+    }
+}
+
+guint
+tmpl_gi_invoker_get_n_args (TmplGiInvoker *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_args;
+}
+
+/**
+ * tmpl_gi_invoker_invoke:
+ * @self: a #TmplGiInvoker
+ * @instance: (nullable): the instance for methods, otherwise %NULL
+ * @args: (array): a #GValue for each argument of the function
+ * @return_value: (out caller-allocates): an uninitialized #GValue
+ * @error: a location for a #GError, or %NULL
+ *
+ * Calls the function with @args. The values in @args must stay alive
+ * until the call has returned, as strings and objects are borrowed
+ * from them.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+tmpl_gi_invoker_invoke (TmplGiInvoker  *self,
+                        gpointer        instance,
+                        const GValue   *args,
+                        GValue         *return_value,
+                        GError        **error)
+{
+  GIArgument in_args_stack[N_STACK_ARGS];
+  gpointer ffi_args_stack[N_STACK_ARGS];
+  g_autofree GIArgument *in_args_heap = NULL;
+  g_autofree gpointer *ffi_args_heap = NULL;
+  GIArgument *in_args = in_args_stack;
+  gpointer *ffi_args = ffi_args_stack;
+  GIFFIReturnValue ffi_return = { 0 };
+  GIArgument return_arg = { 0 };
+  GError *local_error = NULL;
+  GError **local_error_ptr = &local_error;
+  guint n_ffi_args;
+  guint pos = 0;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->n_args == 0 || args != NULL, FALSE);
+  g_return_val_if_fail (return_value != NULL, FALSE);
+
+  if (self->is_method && instance == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "Method \"%s\" requires an instance",
+                   gi_base_info_get_name ((GIBaseInfo *)self->function));
+      return FALSE;
+    }
+
+  if (!self->is_method && instance != NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_GI_FAILURE,
+                   "Function \"%s\" is not a method",
+                   gi_base_info_get_name ((GIBaseInfo *)self->function));
+      return FALSE;
+    }
+
+  n_ffi_args = self->is_method + self->n_args + self->throws;
+
+  if (n_ffi_args > N_STACK_ARGS)
+    {
+      in_args = in_args_heap = g_new (GIArgument, n_ffi_args);
+      ffi_args = ffi_args_heap = g_new (gpointer, n_ffi_args);
+    }
+
+  if (self->is_method)
+    {
+      in_args[pos].v_pointer = instance;
+      ffi_args[pos] = &in_args[pos];
+      pos++;
+    }
+
+  for (guint i = 0; i < self->n_args; i++, pos++)
+    {
+      TmplGiInvokerArg *invoker_arg = &self->args[i];
+
+      if (!invoker_arg->marshal (&args[i], invoker_arg, &in_args[pos], error))
+        return FALSE;
+
+      ffi_args[pos] = &in_args[pos];
+    }
+
+  if (self->throws)
+    ffi_args[pos++] = &local_error_ptr;
+
+  g_assert (pos == n_ffi_args);
+
+  ffi_call (&self->invoker.cif,
+            FFI_FN (self->invoker.native_address),
+            &ffi_return,
+            ffi_args);
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+
+  gi_type_info_extract_ffi_return_value (self->return_type, &ffi_return, &return_arg);
+
+  return tmpl_gi_argument_to_g_value (return_value,
+                                      self->return_type,
+                                      &return_arg,
+                                      self->return_xfer,
+                                      error);
+}
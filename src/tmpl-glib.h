@@ -32,6 +32,7 @@ G_BEGIN_DECLS
 # include "tmpl-scope.h"
 # include "tmpl-symbol.h"
 # include "tmpl-template.h"
+# include "tmpl-template-cache.h"
 # include "tmpl-template-locator.h"
 # include "tmpl-version.h"
 # include "tmpl-version-macros.h"
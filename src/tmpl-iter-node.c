@@ -29,6 +29,7 @@ struct _TmplIterNode
   gchar     *identifier;
   TmplExpr  *expr;
   GPtrArray *children;
+  guint      parallel : 1;
 };
 
 G_DEFINE_TYPE (TmplIterNode, tmpl_iter_node, TMPL_TYPE_NODE)
@@ -76,8 +77,9 @@ tmpl_iter_node_accept (TmplNode      *node,
         case TMPL_TOKEN_FOR:
         case TMPL_TOKEN_EXPRESSION:
         case TMPL_TOKEN_INCLUDE:
+        case TMPL_TOKEN_FLUSH:
         default:
-          if (!(child = tmpl_node_new_for_token (token, error)))
+          if (!(child = tmpl_node_new_for_token (token, lexer, error)))
             {
               tmpl_token_free (token);
               TMPL_RETURN (FALSE);
@@ -148,12 +150,14 @@ tmpl_iter_node_init (TmplIterNode *self)
  * tmpl_iter_node_new:
  * @identifier: the name of the variable inside the loop.
  * @expr: (transfer full): A #TmplExpr.
+ * @parallel: if iterations may be expanded concurrently
  *
  * Returns: (transfer full): A #TmplIterNode.
  */
 TmplNode *
 tmpl_iter_node_new (const gchar *identifier,
-                    TmplExpr    *expr)
+                    TmplExpr    *expr,
+                    gboolean     parallel)
 {
   TmplIterNode *self;
 
@@ -162,6 +166,7 @@ tmpl_iter_node_new (const gchar *identifier,
   self = g_object_new (TMPL_TYPE_ITER_NODE, NULL);
   self->identifier = g_strdup (identifier);
   self->expr = expr;
+  self->parallel = !!parallel;
 
   return TMPL_NODE (self);
 }
@@ -186,3 +191,11 @@ tmpl_iter_node_get_identifier (TmplIterNode *self)
 
   return self->identifier;
 }
+
+gboolean
+tmpl_iter_node_get_parallel (TmplIterNode *self)
+{
+  g_return_val_if_fail (TMPL_IS_ITER_NODE (self), FALSE);
+
+  return self->parallel;
+}
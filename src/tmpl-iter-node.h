@@ -33,9 +33,11 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (TmplIterNode, tmpl_iter_node, TMPL, ITER_NODE, TmplNode)
 
 TmplNode    *tmpl_iter_node_new            (const gchar  *identifier,
-                                            TmplExpr     *expr);
+                                            TmplExpr     *expr,
+                                            gboolean      parallel);
 TmplExpr    *tmpl_iter_node_get_expr       (TmplIterNode *self);
 const gchar *tmpl_iter_node_get_identifier (TmplIterNode *self);
+gboolean     tmpl_iter_node_get_parallel   (TmplIterNode *self);
 
 G_END_DECLS
 
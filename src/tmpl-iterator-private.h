@@ -0,0 +1,47 @@
+/* tmpl-iterator-private.h
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TMPL_ITERATOR_PRIVATE_H
+#define TMPL_ITERATOR_PRIVATE_H
+
+#include "tmpl-iterator.h"
+
+G_BEGIN_DECLS
+
+#define TMPL_TYPE_RANGE (tmpl_range_get_type())
+
+/*
+ * A TmplRange is the result of range() in a template. Iterating it yields
+ * @n_items numbers starting at @start, @step apart, without creating a
+ * container for them.
+ */
+typedef struct
+{
+  gdouble start;
+  gdouble step;
+  gsize   n_items;
+} TmplRange;
+
+GType      tmpl_range_get_type (void);
+TmplRange *tmpl_range_new      (gdouble    start,
+                                gdouble    step,
+                                gsize      n_items);
+TmplRange *tmpl_range_copy     (TmplRange *self);
+void       tmpl_range_free     (TmplRange *self);
+
+G_END_DECLS
+
+#endif /* TMPL_ITERATOR_PRIVATE_H */
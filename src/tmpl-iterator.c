@@ -19,13 +19,42 @@
 #include <gio/gio.h>
 #include <string.h>
 
-#include "tmpl-iterator.h"
+#include "tmpl-iterator-private.h"
 
 typedef gboolean (*GetValue) (TmplIterator *iter,
                               GValue       *value);
 typedef gboolean (*MoveNext) (TmplIterator *iter);
 typedef void     (*Destroy)  (TmplIterator *iter);
 
+G_DEFINE_BOXED_TYPE (TmplRange, tmpl_range, tmpl_range_copy, tmpl_range_free)
+
+TmplRange *
+tmpl_range_new (gdouble start,
+                gdouble step,
+                gsize   n_items)
+{
+  TmplRange *self;
+
+  self = g_slice_new (TmplRange);
+  self->start = start;
+  self->step = step;
+  self->n_items = n_items;
+
+  return self;
+}
+
+TmplRange *
+tmpl_range_copy (TmplRange *self)
+{
+  return g_slice_dup (TmplRange, self);
+}
+
+void
+tmpl_range_free (TmplRange *self)
+{
+  g_slice_free (TmplRange, self);
+}
+
 static gboolean
 string_move_next (TmplIterator *iter)
 {
@@ -214,6 +243,40 @@ list_model_get_value (TmplIterator *iter,
   return TRUE;
 }
 
+static gboolean
+range_move_next (TmplIterator *iter)
+{
+  const TmplRange *range = iter->instance;
+  gsize index = GPOINTER_TO_SIZE (iter->data1);
+
+  index++;
+
+  /* We are 1 based indexing here */
+  if (index <= range->n_items)
+    {
+      iter->data1 = GSIZE_TO_POINTER (index);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+range_get_value (TmplIterator *iter,
+                 GValue       *value)
+{
+  const TmplRange *range = iter->instance;
+  gsize index = GPOINTER_TO_SIZE (iter->data1);
+
+  g_return_val_if_fail (index > 0, FALSE);
+
+  /* Computed from the start so that errors do not accumulate */
+  g_value_init (value, G_TYPE_DOUBLE);
+  g_value_set_double (value, range->start + (index - 1) * range->step);
+
+  return TRUE;
+}
+
 void
 tmpl_iterator_init (TmplIterator *iter,
                     const GValue *value)
@@ -270,6 +333,15 @@ tmpl_iterator_init (TmplIterator *iter,
       iter->destroy = NULL;
       iter->data1 = GINT_TO_POINTER (-1);
     }
+  else if (G_VALUE_HOLDS (value, TMPL_TYPE_RANGE) &&
+           g_value_get_boxed (value) != NULL)
+    {
+      iter->instance = g_value_get_boxed (value);
+      iter->move_next = range_move_next;
+      iter->get_value = range_get_value;
+      iter->destroy = NULL;
+      iter->data1 = GSIZE_TO_POINTER (0);
+    }
   else if (G_VALUE_HOLDS (value, G_TYPE_STRV))
     {
       iter->instance = (const gchar **) g_value_get_boxed (value);
@@ -20,6 +20,8 @@
 
 #include "tmpl-error.h"
 #include "tmpl-debug.h"
+#include "tmpl-expr-private.h"
+#include "tmpl-expr-parser-private.h"
 #include "tmpl-lexer.h"
 #include "tmpl-template-locator.h"
 #include "tmpl-token-input-stream.h"
@@ -30,13 +32,19 @@ struct _TmplLexer
   TmplTemplateLocator  *locator;
   GHashTable           *circular;
   GQueue                unget;
+
+  /* Shared by every tag of the template, including those of includes,
+   * and allocates their expressions from a single arena.
+   */
+  TmplExprParser        expr_parser;
 };
 
 G_DEFINE_POINTER_TYPE (TmplLexer, tmpl_lexer)
 
 TmplLexer *
-tmpl_lexer_new (GInputStream        *stream,
-                TmplTemplateLocator *locator)
+tmpl_lexer_new (GInputStream         *stream,
+                TmplTemplateLocator  *locator,
+                GError              **error)
 {
   TmplLexer *self;
 
@@ -48,6 +56,14 @@ tmpl_lexer_new (GInputStream        *stream,
   self->locator = locator ? g_object_ref (locator) : tmpl_template_locator_new ();
   self->circular = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
+  if (!tmpl_expr_parser_init (&self->expr_parser, error))
+    {
+      tmpl_lexer_free (self);
+      return NULL;
+    }
+
+  self->expr_parser.arena = tmpl_arena_new ();
+
   g_queue_push_head (self->stream_stack, tmpl_token_input_stream_new (stream));
 
   return self;
@@ -68,6 +84,7 @@ tmpl_lexer_free (TmplLexer *self)
         }
 
       g_queue_clear_full (&self->unget, (GDestroyNotify)tmpl_token_free);
+      tmpl_expr_parser_destroy (&self->expr_parser);
       g_clear_pointer (&self->circular, g_hash_table_unref);
       g_clear_pointer (&self->stream_stack, g_queue_free);
       g_clear_object (&self->locator);
@@ -209,3 +226,24 @@ tmpl_lexer_unget (TmplLexer *self,
 
   g_queue_push_head (&self->unget, token);
 }
+
+/**
+ * tmpl_lexer_parse_expr:
+ * @self: A #TmplLexer.
+ * @text: the text of a tag
+ *
+ * Parses the expression found in a tag. This reuses a single expression
+ * scanner for the lifetime of @self rather than creating one per tag.
+ *
+ * Returns: (transfer full) (nullable): A #TmplExpr or %NULL.
+ */
+TmplExpr *
+tmpl_lexer_parse_expr (TmplLexer    *self,
+                       const gchar  *text,
+                       GError      **error)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (text != NULL, NULL);
+
+  return tmpl_expr_parser_parse_expr (&self->expr_parser, text, error);
+}
@@ -25,6 +25,7 @@
 
 #include <gio/gio.h>
 
+#include "tmpl-expr.h"
 #include "tmpl-token.h"
 #include "tmpl-template-locator.h"
 
@@ -32,16 +33,20 @@ G_BEGIN_DECLS
 
 typedef struct _TmplLexer TmplLexer;
 
-GType      tmpl_lexer_get_type (void);
-TmplLexer *tmpl_lexer_new      (GInputStream         *stream,
-                                TmplTemplateLocator  *locator);
-void       tmpl_lexer_free     (TmplLexer            *self);
-void       tmpl_lexer_unget    (TmplLexer            *self,
-                                TmplToken            *token);
-gboolean   tmpl_lexer_next     (TmplLexer            *self,
-                                TmplToken           **token,
-                                GCancellable         *cancellable,
-                                GError              **error);
+GType      tmpl_lexer_get_type   (void);
+TmplLexer *tmpl_lexer_new        (GInputStream         *stream,
+                                  TmplTemplateLocator  *locator,
+                                  GError              **error);
+void       tmpl_lexer_free       (TmplLexer            *self);
+void       tmpl_lexer_unget      (TmplLexer            *self,
+                                  TmplToken            *token);
+gboolean   tmpl_lexer_next       (TmplLexer            *self,
+                                  TmplToken           **token,
+                                  GCancellable         *cancellable,
+                                  GError              **error);
+TmplExpr  *tmpl_lexer_parse_expr (TmplLexer            *self,
+                                  const gchar          *text,
+                                  GError              **error);
 
 
 G_END_DECLS
@@ -29,6 +29,7 @@
 #include "tmpl-debug.h"
 #include "tmpl-error.h"
 #include "tmpl-expr-node.h"
+#include "tmpl-flush-node.h"
 #include "tmpl-iter-node.h"
 #include "tmpl-node.h"
 #include "tmpl-parser.h"
@@ -79,7 +80,8 @@ tmpl_node_real_accept (TmplNode      *self,
         case TMPL_TOKEN_EXPRESSION:
         case TMPL_TOKEN_IF:
         case TMPL_TOKEN_FOR:
-          if (!(child = tmpl_node_new_for_token (token, error)))
+        case TMPL_TOKEN_FLUSH:
+          if (!(child = tmpl_node_new_for_token (token, lexer, error)))
             {
               tmpl_token_free (token);
               TMPL_RETURN (FALSE);
@@ -198,8 +200,43 @@ tmpl_node_visit_children (TmplNode        *self,
   return TMPL_NODE_GET_CLASS (self)->visit_children (self, visitor, user_data);
 }
 
+/*
+ * Parses "<identifier> in <expression>", optionally prefixed with
+ * "parallel". The expression is the remainder of the text so that it
+ * may contain whitespace.
+ */
+static gboolean
+tmpl_node_parse_for (const gchar  *text,
+                     gboolean      parallel,
+                     gchar       **item,
+                     const gchar **exprstr)
+{
+  gint pos = -1;
+  gint n;
+
+  *item = NULL;
+
+  if (parallel)
+    n = sscanf (text, "parallel %ms in %n", item, &pos);
+  else
+    n = sscanf (text, "%ms in %n", item, &pos);
+
+  /* "in" must be followed by whitespace and an expression */
+  if (n != 1 || pos <= 0 || !g_ascii_isspace (text[pos - 1]) || text[pos] == '\0')
+    {
+      free (*item);
+      *item = NULL;
+      return FALSE;
+    }
+
+  *exprstr = &text[pos];
+
+  return TRUE;
+}
+
 TmplNode *
 tmpl_node_new_for_token (TmplToken  *token,
+                         TmplLexer  *lexer,
                          GError    **error)
 {
   TmplNode *ret;
@@ -207,11 +244,12 @@ tmpl_node_new_for_token (TmplToken  *token,
   TMPL_ENTRY;
 
   g_return_val_if_fail (token != NULL, NULL);
+  g_return_val_if_fail (lexer != NULL, NULL);
 
   switch (tmpl_token_type (token))
     {
     case TMPL_TOKEN_TEXT:
-      ret = tmpl_text_node_new (g_strdup (tmpl_token_get_text (token)));
+      ret = tmpl_text_node_new (g_bytes_ref (tmpl_token_get_bytes (token)));
       TMPL_RETURN (ret);
 
     case TMPL_TOKEN_IF:
@@ -221,7 +259,7 @@ tmpl_node_new_for_token (TmplToken  *token,
 
         exprstr = tmpl_token_get_text (token);
 
-        if (!(expr = tmpl_expr_from_string (exprstr, error)))
+        if (!(expr = tmpl_lexer_parse_expr (lexer, exprstr, error)))
           TMPL_RETURN (NULL);
 
         ret = tmpl_branch_node_new (expr);
@@ -231,10 +269,10 @@ tmpl_node_new_for_token (TmplToken  *token,
     case TMPL_TOKEN_FOR:
       {
         const gchar *item_in_expr;
+        const gchar *exprstr = NULL;
         TmplExpr *expr;
-        TmplNode *node = NULL;
+        gboolean parallel = FALSE;
         char *item = NULL;
-        char *exprstr = NULL;
 
         if (!(item_in_expr = tmpl_token_get_text (token)))
           {
@@ -245,25 +283,24 @@ tmpl_node_new_for_token (TmplToken  *token,
             TMPL_RETURN (NULL);
           }
 
-        if (2 != sscanf (item_in_expr, "%ms in %ms", &item, &exprstr))
+        if (!tmpl_node_parse_for (item_in_expr, FALSE, &item, &exprstr) &&
+            !(parallel = tmpl_node_parse_for (item_in_expr, TRUE, &item, &exprstr)))
           {
             g_set_error (error,
                          TMPL_ERROR,
                          TMPL_ERROR_SYNTAX_ERROR,
                          "Invalid for expression: %s", item_in_expr);
-            goto for_cleanup;
+            TMPL_RETURN (NULL);
           }
 
-        if (!(expr = tmpl_expr_from_string (exprstr, error)))
-          goto for_cleanup;
+        if ((expr = tmpl_lexer_parse_expr (lexer, exprstr, error)))
+          ret = tmpl_iter_node_new (item, expr, parallel);
+        else
+          ret = NULL;
 
-        node = tmpl_iter_node_new (item, expr);
-
-      for_cleanup:
         free (item);
-        free (exprstr);
 
-        return node;
+        TMPL_RETURN (ret);
       }
 
     case TMPL_TOKEN_EXPRESSION:
@@ -273,13 +310,17 @@ tmpl_node_new_for_token (TmplToken  *token,
 
         exprstr = tmpl_token_get_text (token);
 
-        if (!(expr = tmpl_expr_from_string (exprstr, error)))
+        if (!(expr = tmpl_lexer_parse_expr (lexer, exprstr, error)))
           TMPL_RETURN (NULL);
 
         ret = tmpl_expr_node_new (expr, token->silence);
         TMPL_RETURN (ret);
       }
 
+    case TMPL_TOKEN_FLUSH:
+      ret = tmpl_flush_node_new ();
+      TMPL_RETURN (ret);
+
     case TMPL_TOKEN_ELSE_IF:
     case TMPL_TOKEN_ELSE:
     case TMPL_TOKEN_END:
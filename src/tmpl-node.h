@@ -51,6 +51,7 @@ struct _TmplNodeClass
 
 TmplNode *tmpl_node_new            (void);
 TmplNode *tmpl_node_new_for_token  (TmplToken        *token,
+                                    TmplLexer        *lexer,
                                     GError          **error);
 gboolean  tmpl_node_accept         (TmplNode         *self,
                                     TmplLexer        *lexer,
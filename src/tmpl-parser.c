@@ -28,6 +28,7 @@ struct _TmplParser
   GObject               parent_instance;
 
   TmplNode             *root;
+  TmplProgram          *program;
   GInputStream         *stream;
   TmplTemplateLocator  *locator;
 
@@ -69,6 +70,7 @@ tmpl_parser_finalize (GObject *object)
   g_clear_object (&self->locator);
   g_clear_object (&self->stream);
   g_clear_object (&self->root);
+  g_clear_pointer (&self->program, tmpl_program_unref);
 
   G_OBJECT_CLASS (tmpl_parser_parent_class)->finalize (object);
 }
@@ -212,7 +214,9 @@ tmpl_parser_parse (TmplParser    *self,
       return FALSE;
     }
 
-  lexer = tmpl_lexer_new (self->stream, self->locator);
+  if (!(lexer = tmpl_lexer_new (self->stream, self->locator, error)))
+    return FALSE;
+
   tmpl_node_accept (self->root, lexer, cancellable, &local_error);
   tmpl_lexer_free (lexer);
 
@@ -222,9 +226,29 @@ tmpl_parser_parse (TmplParser    *self,
       return FALSE;
     }
 
+  if (!(self->program = tmpl_program_new_for_node (self->root, error)))
+    return FALSE;
+
   return TRUE;
 }
 
+/**
+ * tmpl_parser_get_program:
+ * @self: A #TmplParser
+ *
+ * Gets the program compiled from the parsed template. This is only
+ * available after tmpl_parser_parse() has completed successfully.
+ *
+ * Returns: (transfer none) (nullable): A #TmplProgram or %NULL.
+ */
+TmplProgram *
+tmpl_parser_get_program (TmplParser *self)
+{
+  g_return_val_if_fail (TMPL_IS_PARSER (self), NULL);
+
+  return self->program;
+}
+
 /**
  * tmpl_parser_get_locator:
  * @self: an #TmplParser
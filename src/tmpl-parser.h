@@ -26,6 +26,7 @@
 #include <gio/gio.h>
 
 #include "tmpl-node.h"
+#include "tmpl-program.h"
 #include "tmpl-template-locator.h"
 
 G_BEGIN_DECLS
@@ -35,6 +36,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (TmplParser, tmpl_parser, TMPL, PARSER, GObject)
 
 TmplNode            *tmpl_parser_get_root    (TmplParser           *self);
+TmplProgram         *tmpl_parser_get_program (TmplParser           *self);
 TmplParser          *tmpl_parser_new         (GInputStream         *stream);
 TmplTemplateLocator *tmpl_parser_get_locator (TmplParser           *self);
 void                 tmpl_parser_set_locator (TmplParser           *self,
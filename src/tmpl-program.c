@@ -0,0 +1,1229 @@
+/* tmpl-program.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "tmpl-program"
+
+#include <string.h>
+
+#include "tmpl-arena-private.h"
+#include "tmpl-branch-node.h"
+#include "tmpl-condition-node.h"
+#include "tmpl-debug.h"
+#include "tmpl-error.h"
+#include "tmpl-expr-node.h"
+#include "tmpl-expr-private.h"
+#include "tmpl-flush-node.h"
+#include "tmpl-iter-node.h"
+#include "tmpl-program.h"
+#include "tmpl-scope.h"
+#include "tmpl-text-node.h"
+#include "tmpl-util-private.h"
+
+/*
+ * A TmplProgram is the TmplNode tree of a template lowered into a flat
+ * array of instructions. Expanding a template is then a simple loop over
+ * the instructions with a program counter rather than a recursive walk
+ * of the node tree with type checks at every level.
+ *
+ * Branches are lowered into conditional jumps and loops into a pair of
+ * ITER_BEGIN/ITER_NEXT instructions with a jump back to ITER_NEXT at the
+ * end of the loop body. Parallel loops are a single ITER_PARALLEL
+ * instruction followed by the body, which the executor may run for many
+ * items at once.
+ *
+ * Static text references the source buffers of the template, which the
+ * program keeps alive, rather than copies. Loop identifiers are interned so
+ * that scopes may look them up by address rather than by hashing them.
+ *
+ * A program may be serialized so that templates can be compiled ahead of
+ * time, such as by the tmpl-compile tool, and loaded without lexing or
+ * parsing. Includes are resolved at compile time, so the serialized
+ * program is self-contained.
+ */
+
+struct _TmplProgram
+{
+  volatile gint  ref_count;
+  GArray        *instructions;
+  GPtrArray     *sources;
+};
+
+typedef struct
+{
+  GArray    *instructions;
+  GPtrArray *sources;
+  guint      barrier;
+  GError  **error;
+  gboolean  failed;
+} TmplProgramBuilder;
+
+static void tmpl_program_compile_node (TmplProgramBuilder *builder,
+                                       TmplNode           *node);
+
+static void
+clear_instruction (gpointer data)
+{
+  TmplInstruction *insn = data;
+
+  g_clear_pointer (&insn->expr, tmpl_expr_unref);
+}
+
+static guint
+tmpl_program_builder_emit (TmplProgramBuilder *builder,
+                           TmplOpcode          opcode,
+                           TmplExpr           *expr)
+{
+  TmplInstruction insn = { 0 };
+
+  insn.opcode = opcode;
+  insn.expr = expr ? tmpl_expr_ref (expr) : NULL;
+
+  g_array_append_val (builder->instructions, insn);
+
+  return builder->instructions->len - 1;
+}
+
+/*
+ * Binds a label to the position of the next instruction. We must not
+ * merge text into the previous instruction after this, or we would skip
+ * over the text when jumping here.
+ */
+static guint
+tmpl_program_builder_bind (TmplProgramBuilder *builder)
+{
+  builder->barrier = builder->instructions->len;
+  return builder->barrier;
+}
+
+static void
+tmpl_program_builder_patch (TmplProgramBuilder *builder,
+                            guint               position,
+                            guint               target)
+{
+  g_array_index (builder->instructions, TmplInstruction, position).jump = target;
+}
+
+static void
+tmpl_program_builder_emit_text (TmplProgramBuilder *builder,
+                                GBytes             *bytes)
+{
+  TmplInstruction *last = NULL;
+  const gchar *data;
+  gsize len;
+  guint pos;
+
+  if (bytes == NULL || !(data = g_bytes_get_data (bytes, &len)) || len == 0)
+    return;
+
+  /* Keep the source buffer alive for as long as the program */
+  g_ptr_array_add (builder->sources, g_bytes_ref (bytes));
+
+  if (builder->instructions->len > builder->barrier)
+    last = &g_array_index (builder->instructions,
+                           TmplInstruction,
+                           builder->instructions->len - 1);
+
+  /* Coalesce adjacent runs of text, such as those split by an escape */
+  if (last != NULL &&
+      last->opcode == TMPL_OP_TEXT &&
+      last->text + last->len == data)
+    {
+      last->len += len;
+      return;
+    }
+
+  pos = tmpl_program_builder_emit (builder, TMPL_OP_TEXT, NULL);
+  g_array_index (builder->instructions, TmplInstruction, pos).text = data;
+  g_array_index (builder->instructions, TmplInstruction, pos).len = len;
+}
+
+static void
+collect_children (TmplNode *node,
+                  gpointer  user_data)
+{
+  g_ptr_array_add (user_data, node);
+}
+
+static void
+tmpl_program_compile_visitor (TmplNode *node,
+                              gpointer  user_data)
+{
+  TmplProgramBuilder *builder = user_data;
+
+  if (!builder->failed)
+    tmpl_program_compile_node (builder, node);
+}
+
+static void
+tmpl_program_compile_branch (TmplProgramBuilder *builder,
+                             TmplBranchNode     *node)
+{
+  g_autoptr(GPtrArray) conditions = g_ptr_array_new ();
+  g_autoptr(GArray) exits = g_array_new (FALSE, FALSE, sizeof (guint));
+  guint end;
+
+  g_assert (builder != NULL);
+  g_assert (TMPL_IS_BRANCH_NODE (node));
+
+  /* The if branch followed by any else if/else branches */
+  tmpl_node_visit_children (TMPL_NODE (node), collect_children, conditions);
+
+  for (guint i = 0; i < conditions->len; i++)
+    {
+      TmplNode *condition = g_ptr_array_index (conditions, i);
+      TmplExpr *expr = tmpl_condition_node_get_condition (TMPL_CONDITION_NODE (condition));
+      guint test;
+
+      test = tmpl_program_builder_emit (builder, TMPL_OP_JUMP_IF_FALSE, expr);
+      tmpl_node_visit_children (condition, tmpl_program_compile_visitor, builder);
+
+      /* The last branch can fall through to the end */
+      if (i + 1 < conditions->len)
+        {
+          guint exit = tmpl_program_builder_emit (builder, TMPL_OP_JUMP, NULL);
+          g_array_append_val (exits, exit);
+        }
+
+      tmpl_program_builder_patch (builder, test, tmpl_program_builder_bind (builder));
+    }
+
+  end = tmpl_program_builder_bind (builder);
+
+  for (guint i = 0; i < exits->len; i++)
+    tmpl_program_builder_patch (builder, g_array_index (exits, guint, i), end);
+}
+
+/*
+ * The body of a parallel loop is expanded concurrently with child scopes
+ * of the same parent, so it must not write to any scope and its output
+ * must only be written once all iterations complete.
+ */
+static gboolean
+tmpl_program_check_parallel_body (const TmplInstruction  *instructions,
+                                  guint                   begin,
+                                  guint                   end,
+                                  GError                **error)
+{
+  for (guint i = begin; i < end; i++)
+    {
+      const TmplInstruction *insn = &instructions[i];
+
+      if (insn->opcode == TMPL_OP_FLUSH)
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_SYNTAX_ERROR,
+                       "{{flush}} is not allowed within a parallel loop");
+          return FALSE;
+        }
+
+      if (tmpl_expr_has_assignment (insn->expr))
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_SYNTAX_ERROR,
+                       "Parallel loops may not assign to symbols or attributes");
+          return FALSE;
+        }
+
+      /* A function could assign to the shared parent scope */
+      if (tmpl_expr_has_user_call (insn->expr))
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_SYNTAX_ERROR,
+                       "Parallel loops may not call user defined functions");
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+tmpl_program_compile_iter (TmplProgramBuilder *builder,
+                           TmplIterNode       *node)
+{
+  const gchar *identifier;
+  guint begin;
+  guint next;
+  guint jump;
+  guint end;
+
+  g_assert (builder != NULL);
+  g_assert (TMPL_IS_ITER_NODE (node));
+
+  identifier = g_intern_string (tmpl_iter_node_get_identifier (node));
+
+  if (tmpl_iter_node_get_parallel (node))
+    {
+      begin = tmpl_program_builder_emit (builder, TMPL_OP_ITER_PARALLEL, tmpl_iter_node_get_expr (node));
+      g_array_index (builder->instructions, TmplInstruction, begin).text = identifier;
+
+      tmpl_node_visit_children (TMPL_NODE (node), tmpl_program_compile_visitor, builder);
+
+      end = tmpl_program_builder_bind (builder);
+      tmpl_program_builder_patch (builder, begin, end);
+
+      if (!builder->failed &&
+          !tmpl_program_check_parallel_body ((const TmplInstruction *)(gpointer)builder->instructions->data,
+                                             begin + 1, end, builder->error))
+        builder->failed = TRUE;
+
+      return;
+    }
+
+  begin = tmpl_program_builder_emit (builder, TMPL_OP_ITER_BEGIN, tmpl_iter_node_get_expr (node));
+  g_array_index (builder->instructions, TmplInstruction, begin).text = identifier;
+
+  next = tmpl_program_builder_bind (builder);
+  tmpl_program_builder_emit (builder, TMPL_OP_ITER_NEXT, NULL);
+
+  tmpl_node_visit_children (TMPL_NODE (node), tmpl_program_compile_visitor, builder);
+
+  jump = tmpl_program_builder_emit (builder, TMPL_OP_JUMP, NULL);
+  tmpl_program_builder_patch (builder, jump, next);
+
+  end = tmpl_program_builder_bind (builder);
+  tmpl_program_builder_patch (builder, begin, end);
+  tmpl_program_builder_patch (builder, next, end);
+}
+
+static void
+tmpl_program_compile_node (TmplProgramBuilder *builder,
+                           TmplNode           *node)
+{
+  g_assert (builder != NULL);
+  g_assert (TMPL_IS_NODE (node));
+
+  if (TMPL_IS_TEXT_NODE (node))
+    {
+      tmpl_program_builder_emit_text (builder, tmpl_text_node_get_bytes (TMPL_TEXT_NODE (node)));
+    }
+  else if (TMPL_IS_EXPR_NODE (node))
+    {
+      TmplExpr *expr = tmpl_expr_node_get_expr (TMPL_EXPR_NODE (node));
+      guint pos;
+
+      pos = tmpl_program_builder_emit (builder, TMPL_OP_EXPR, expr);
+      g_array_index (builder->instructions, TmplInstruction, pos).silence =
+        tmpl_expr_node_get_silence (TMPL_EXPR_NODE (node));
+    }
+  else if (TMPL_IS_BRANCH_NODE (node))
+    {
+      tmpl_program_compile_branch (builder, TMPL_BRANCH_NODE (node));
+    }
+  else if (TMPL_IS_ITER_NODE (node))
+    {
+      tmpl_program_compile_iter (builder, TMPL_ITER_NODE (node));
+    }
+  else if (TMPL_IS_FLUSH_NODE (node))
+    {
+      tmpl_program_builder_emit (builder, TMPL_OP_FLUSH, NULL);
+    }
+  else
+    {
+      g_warning ("Teach me how to compile %s", G_OBJECT_TYPE_NAME (node));
+    }
+}
+
+/**
+ * tmpl_program_new_for_node:
+ * @root: the root #TmplNode of a parsed template
+ * @error: a location for a #GError, or %NULL
+ *
+ * Lowers the tree of nodes found at @root into a #TmplProgram.
+ *
+ * Returns: (transfer full): A #TmplProgram or %NULL and @error is set.
+ */
+TmplProgram *
+tmpl_program_new_for_node (TmplNode  *root,
+                           GError   **error)
+{
+  TmplProgramBuilder builder = { 0 };
+  TmplProgram *self;
+
+  TMPL_ENTRY;
+
+  g_return_val_if_fail (TMPL_IS_NODE (root), NULL);
+
+  builder.instructions = g_array_new (FALSE, TRUE, sizeof (TmplInstruction));
+  builder.sources = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+  builder.error = error;
+
+  g_array_set_clear_func (builder.instructions, clear_instruction);
+
+  tmpl_node_visit_children (root, tmpl_program_compile_visitor, &builder);
+
+  if (builder.failed)
+    {
+      g_array_unref (builder.instructions);
+      g_ptr_array_unref (builder.sources);
+      TMPL_RETURN (NULL);
+    }
+
+  self = g_slice_new0 (TmplProgram);
+  self->ref_count = 1;
+  self->instructions = builder.instructions;
+  self->sources = builder.sources;
+
+  TMPL_RETURN (self);
+}
+
+TmplProgram *
+tmpl_program_ref (TmplProgram *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+tmpl_program_unref (TmplProgram *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->instructions, g_array_unref);
+      g_clear_pointer (&self->sources, g_ptr_array_unref);
+      g_slice_free (TmplProgram, self);
+    }
+}
+
+/**
+ * tmpl_program_get_instructions:
+ * @self: A #TmplProgram
+ * @n_instructions: (out): the number of instructions
+ *
+ * Gets the instructions for the program. Jump targets are indexes into
+ * the returned array, and a target equal to @n_instructions ends the
+ * program.
+ *
+ * Returns: (transfer none) (array length=n_instructions): the instructions
+ */
+const TmplInstruction *
+tmpl_program_get_instructions (TmplProgram *self,
+                               guint       *n_instructions)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (n_instructions != NULL, NULL);
+
+  *n_instructions = self->instructions->len;
+
+  return (const TmplInstruction *)(gpointer)self->instructions->data;
+}
+
+/**
+ * tmpl_program_get_memory_usage:
+ * @self: A #TmplProgram
+ *
+ * Gets the number of bytes used by the program, including its expressions
+ * and the source text it keeps alive.
+ *
+ * Returns: the number of bytes
+ */
+gsize
+tmpl_program_get_memory_usage (TmplProgram *self)
+{
+  g_autoptr(GHashTable) seen = NULL;
+  gsize ret;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  seen = g_hash_table_new (NULL, NULL);
+
+  ret = sizeof *self
+      + sizeof (GArray) + self->instructions->len * sizeof (TmplInstruction)
+      + sizeof (GPtrArray) + self->sources->len * sizeof (gpointer);
+
+  /* Runs of text usually share the buffer of their source */
+  for (guint i = 0; i < self->sources->len; i++)
+    {
+      GBytes *bytes = g_ptr_array_index (self->sources, i);
+
+      if (g_hash_table_add (seen, bytes))
+        ret += g_bytes_get_size (bytes);
+    }
+
+  for (guint i = 0; i < self->instructions->len; i++)
+    {
+      const TmplInstruction *insn = &g_array_index (self->instructions, TmplInstruction, i);
+
+      if (insn->expr != NULL)
+        ret += tmpl_expr_get_memory_usage (insn->expr, seen);
+    }
+
+  return ret;
+}
+
+/*
+ * The serialized form of a program is a little-endian GVariant containing
+ * a magic string, the format version, a buffer with all of the static text
+ * and loop identifiers, the instructions and the table of expressions.
+ * Instructions reference text by offset and length within the buffer and
+ * expressions by index within the table. Loop identifiers are followed by
+ * a nul byte so that they may be used in place.
+ */
+#define TMPL_PROGRAM_MAGIC   "TmplProgram"
+#define TMPL_PROGRAM_VERSION 1
+#define TMPL_PROGRAM_FORMAT  "(suaya(uuuttb)a(uv))"
+#define NO_EXPR              G_MAXUINT
+
+/**
+ * tmpl_program_serialize:
+ * @self: A #TmplProgram
+ * @error: a location for a #GError, or %NULL
+ *
+ * Serializes @self so that it may later be restored with
+ * tmpl_program_new_from_bytes() without parsing the template again.
+ *
+ * Returns: (transfer full): a #GBytes containing the serialized program,
+ *   or %NULL and @error is set.
+ */
+GBytes *
+tmpl_program_serialize (TmplProgram  *self,
+                        GError      **error)
+{
+  g_autoptr(GByteArray) text = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  GVariantBuilder instructions;
+  GVariantBuilder nodes;
+  guint n_nodes = 0;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  for (guint i = 0; i < self->instructions->len; i++)
+    {
+      const TmplInstruction *insn = &g_array_index (self->instructions, TmplInstruction, i);
+
+      if (insn->expr != NULL && !tmpl_expr_is_serializable (insn->expr))
+        {
+          g_set_error (error,
+                       TMPL_ERROR,
+                       TMPL_ERROR_INVALID_STATE,
+                       "The template contains values which cannot be saved, "
+                       "such as objects captured when specializing it");
+          return NULL;
+        }
+    }
+
+  text = g_byte_array_new ();
+
+  g_variant_builder_init (&instructions, G_VARIANT_TYPE ("a(uuuttb)"));
+  g_variant_builder_init (&nodes, G_VARIANT_TYPE ("a(uv)"));
+
+  for (guint i = 0; i < self->instructions->len; i++)
+    {
+      const TmplInstruction *insn = &g_array_index (self->instructions, TmplInstruction, i);
+      guint expr = NO_EXPR;
+      guint64 offset = 0;
+      guint64 len = 0;
+
+      if (insn->expr != NULL)
+        expr = tmpl_expr_serialize (insn->expr, &nodes, &n_nodes);
+
+      if (insn->opcode == TMPL_OP_TEXT)
+        {
+          offset = text->len;
+          len = insn->len;
+          g_byte_array_append (text, (const guint8 *)insn->text, insn->len);
+        }
+      else if (insn->opcode == TMPL_OP_ITER_BEGIN ||
+               insn->opcode == TMPL_OP_ITER_PARALLEL)
+        {
+          offset = text->len;
+          len = strlen (insn->text);
+          g_byte_array_append (text, (const guint8 *)insn->text, len + 1);
+        }
+
+      g_variant_builder_add (&instructions, "(uuuttb)",
+                             (guint)insn->opcode,
+                             insn->jump,
+                             expr,
+                             offset,
+                             len,
+                             (gboolean)insn->silence);
+    }
+
+  variant = g_variant_new ("(su@ay@a(uuuttb)@a(uv))",
+                           TMPL_PROGRAM_MAGIC,
+                           TMPL_PROGRAM_VERSION,
+                           g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, text->data, text->len, 1),
+                           g_variant_builder_end (&instructions),
+                           g_variant_builder_end (&nodes));
+  g_variant_ref_sink (variant);
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  {
+    GVariant *swapped = g_variant_byteswap (variant);
+    g_variant_unref (variant);
+    variant = swapped;
+  }
+#endif
+
+  return g_variant_get_data_as_bytes (variant);
+}
+
+static gboolean
+tmpl_program_invalid (GError      **error,
+                      const gchar  *message,
+                      guint         pc)
+{
+  g_set_error (error,
+               TMPL_ERROR,
+               TMPL_ERROR_INVALID_STATE,
+               "Invalid compiled template: %s at instruction %u",
+               message, pc);
+  return FALSE;
+}
+
+/*
+ * A program loaded from bytes may come from anywhere, so before it is
+ * handed to the executor we check that it has the same shape as one
+ * emitted by the compiler. Loop bodies must be properly nested, each
+ * ITER_BEGIN must be followed by its ITER_NEXT and closed by a jump back
+ * to it, and jumps may never enter or leave a loop body other than
+ * through those instructions. Otherwise a crafted program could pop an
+ * iterator that was never pushed.
+ */
+static gboolean
+tmpl_program_verify (GArray  *instructions,
+                     GError **error)
+{
+  const TmplInstruction *insns = (const TmplInstruction *)(gpointer)instructions->data;
+  g_autoptr(GArray) stack = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_autofree guint *loops = NULL;
+  guint n = instructions->len;
+
+  /* The innermost loop containing each instruction, which is also
+   * used for the position following the last instruction. */
+  loops = g_new (guint, n + 1);
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      const TmplInstruction *insn = &insns[pc];
+
+      while (stack->len > 0 &&
+             pc >= insns[g_array_index (stack, guint, stack->len - 1)].jump)
+        g_array_set_size (stack, stack->len - 1);
+
+      loops[pc] = stack->len > 0 ? g_array_index (stack, guint, stack->len - 1) : G_MAXUINT;
+
+      if (insn->opcode == TMPL_OP_ITER_BEGIN ||
+          insn->opcode == TMPL_OP_ITER_PARALLEL)
+        {
+          if (insn->jump <= pc || insn->jump > n)
+            return tmpl_program_invalid (error, "loop ends out of range", pc);
+
+          if (stack->len > 0 &&
+              insn->jump > insns[g_array_index (stack, guint, stack->len - 1)].jump)
+            return tmpl_program_invalid (error, "loop is not nested", pc);
+
+          g_array_append_val (stack, pc);
+        }
+    }
+
+  loops[n] = G_MAXUINT;
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      const TmplInstruction *insn = &insns[pc];
+
+      switch (insn->opcode)
+        {
+        case TMPL_OP_TEXT:
+        case TMPL_OP_EXPR:
+        case TMPL_OP_FLUSH:
+          break;
+
+        case TMPL_OP_JUMP:
+        case TMPL_OP_JUMP_IF_FALSE:
+          /* The body of a parallel loop may also jump to its end */
+          if (insn->jump > n ||
+              (loops[insn->jump] != loops[pc] &&
+               !(loops[pc] != G_MAXUINT &&
+                 insns[loops[pc]].opcode == TMPL_OP_ITER_PARALLEL &&
+                 insns[loops[pc]].jump == insn->jump)))
+            return tmpl_program_invalid (error, "jump crosses a loop boundary", pc);
+          break;
+
+        case TMPL_OP_ITER_BEGIN:
+          if (insn->jump < pc + 3 ||
+              insns[pc + 1].opcode != TMPL_OP_ITER_NEXT ||
+              insns[pc + 1].jump != insn->jump ||
+              insns[insn->jump - 1].opcode != TMPL_OP_JUMP ||
+              insns[insn->jump - 1].jump != pc + 1)
+            return tmpl_program_invalid (error, "malformed loop", pc);
+          break;
+
+        case TMPL_OP_ITER_NEXT:
+          if (pc == 0 || insns[pc - 1].opcode != TMPL_OP_ITER_BEGIN)
+            return tmpl_program_invalid (error, "iteration outside of a loop", pc);
+          break;
+
+        case TMPL_OP_ITER_PARALLEL:
+          if (!tmpl_program_check_parallel_body (insns, pc + 1, insn->jump, error))
+            return FALSE;
+          break;
+
+        default:
+          return tmpl_program_invalid (error, "unknown opcode", pc);
+        }
+    }
+
+  return TRUE;
+}
+
+/**
+ * tmpl_program_new_from_bytes:
+ * @bytes: a #GBytes created with tmpl_program_serialize()
+ * @error: a location for a #GError, or %NULL
+ *
+ * Restores a program from @bytes. Static text of the program references
+ * @bytes directly, so no copy of the template is made when @bytes is
+ * found in a #GResource or a mapped file.
+ *
+ * @bytes is not trusted and is checked to be a valid program.
+ *
+ * Returns: (transfer full): A #TmplProgram or %NULL and @error is set.
+ */
+TmplProgram *
+tmpl_program_new_from_bytes (GBytes  *bytes,
+                             GError **error)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) text = NULL;
+  g_autoptr(GVariant) insns = NULL;
+  g_autoptr(GVariant) nodes = NULL;
+  g_autoptr(GPtrArray) exprs = NULL;
+  g_autoptr(GArray) instructions = NULL;
+  g_autoptr(GBytes) text_bytes = NULL;
+  const gchar *text_data;
+  const gchar *magic = NULL;
+  TmplProgram *self;
+  TmplArena *arena;
+  gsize text_len;
+  gsize n_nodes;
+  gsize n_insns;
+  guint version = 0;
+
+  TMPL_ENTRY;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (TMPL_PROGRAM_FORMAT), bytes, FALSE));
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  {
+    GVariant *swapped = g_variant_byteswap (variant);
+    g_variant_unref (variant);
+    variant = swapped;
+  }
+#endif
+
+  g_variant_get (variant, "(&su@ay@a(uuuttb)@a(uv))", &magic, &version, &text, &insns, &nodes);
+
+  if (g_strcmp0 (magic, TMPL_PROGRAM_MAGIC) != 0 || version != TMPL_PROGRAM_VERSION)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_INVALID_STATE,
+                   "Not a compiled template, or compiled by an incompatible version");
+      TMPL_RETURN (NULL);
+    }
+
+  text_bytes = g_variant_get_data_as_bytes (text);
+  text_data = g_bytes_get_data (text_bytes, &text_len);
+
+  n_nodes = g_variant_n_children (nodes);
+  exprs = g_ptr_array_new_full (n_nodes, (GDestroyNotify)tmpl_expr_unref);
+
+  /* Allocate the expressions together, as when parsing */
+  arena = tmpl_arena_new ();
+  tmpl_arena_push_thread_default (arena);
+
+  for (gsize i = 0; i < n_nodes; i++)
+    {
+      g_autoptr(GVariant) node = g_variant_get_child_value (nodes, i);
+      TmplExpr *expr;
+
+      if (!(expr = tmpl_expr_deserialize (node, (TmplExpr **)exprs->pdata, exprs->len, error)))
+        break;
+
+      g_ptr_array_add (exprs, expr);
+    }
+
+  tmpl_arena_pop_thread_default (arena);
+  tmpl_arena_unref (arena);
+
+  if (exprs->len < n_nodes)
+    TMPL_RETURN (NULL);
+
+  n_insns = g_variant_n_children (insns);
+
+  instructions = g_array_sized_new (FALSE, TRUE, sizeof (TmplInstruction), n_insns);
+  g_array_set_clear_func (instructions, clear_instruction);
+
+  for (guint pc = 0; pc < n_insns; pc++)
+    {
+      TmplInstruction insn = { 0 };
+      guint opcode;
+      guint expr;
+      guint64 offset;
+      guint64 len;
+      gboolean silence;
+
+      g_variant_get_child (insns, pc, "(uuuttb)", &opcode, &insn.jump, &expr, &offset, &len, &silence);
+
+      insn.opcode = opcode;
+      insn.silence = !!silence;
+
+      if (offset > text_len || len > text_len - offset)
+        {
+          tmpl_program_invalid (error, "text out of range", pc);
+          TMPL_RETURN (NULL);
+        }
+
+      switch (insn.opcode)
+        {
+        case TMPL_OP_TEXT:
+          insn.text = text_data + offset;
+          insn.len = len;
+          break;
+
+        case TMPL_OP_ITER_BEGIN:
+        case TMPL_OP_ITER_PARALLEL:
+          /* The identifier must be nul-terminated in place */
+          if (len == text_len - offset ||
+              text_data[offset + len] != '\0' ||
+              memchr (text_data + offset, '\0', len) != NULL)
+            {
+              tmpl_program_invalid (error, "invalid loop identifier", pc);
+              TMPL_RETURN (NULL);
+            }
+          insn.text = g_intern_string (text_data + offset);
+          break;
+
+        default:
+          break;
+        }
+
+      switch (insn.opcode)
+        {
+        case TMPL_OP_EXPR:
+        case TMPL_OP_JUMP_IF_FALSE:
+        case TMPL_OP_ITER_BEGIN:
+        case TMPL_OP_ITER_PARALLEL:
+          if (expr >= exprs->len)
+            {
+              tmpl_program_invalid (error, "missing expression", pc);
+              TMPL_RETURN (NULL);
+            }
+          insn.expr = tmpl_expr_ref (g_ptr_array_index (exprs, expr));
+          break;
+
+        default:
+          break;
+        }
+
+      g_array_append_val (instructions, insn);
+    }
+
+  if (!tmpl_program_verify (instructions, error))
+    TMPL_RETURN (NULL);
+
+  self = g_slice_new0 (TmplProgram);
+  self->ref_count = 1;
+  self->instructions = g_steal_pointer (&instructions);
+  self->sources = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+  g_ptr_array_add (self->sources, g_steal_pointer (&text_bytes));
+
+  TMPL_RETURN (self);
+}
+
+/*
+ * Specializing a program evaluates everything that only depends on a scope
+ * whose symbols will not change. Expressions are replaced with their value,
+ * which turns output of constants into text and conditions into either an
+ * unconditional jump or nothing at all. Instructions which can no longer
+ * be reached and jumps to the next instruction are then removed, which
+ * leaves runs of text that are merged into a single instruction.
+ *
+ * Instructions are only ever removed, never moved, so the loop structure
+ * expected by tmpl_program_verify() is preserved.
+ */
+
+typedef struct
+{
+  TmplInstruction insn;
+  guint           kept : 1;
+  guint           absorbed : 1;
+  guint           landing : 1;
+  guint           generated : 1;
+} TmplProgramSlot;
+
+static gboolean
+tmpl_program_is_jump (TmplOpcode opcode)
+{
+  return opcode == TMPL_OP_JUMP ||
+         opcode == TMPL_OP_JUMP_IF_FALSE ||
+         opcode == TMPL_OP_ITER_BEGIN ||
+         opcode == TMPL_OP_ITER_NEXT ||
+         opcode == TMPL_OP_ITER_PARALLEL;
+}
+
+static void
+tmpl_program_specialize_slot (TmplProgramSlot *slot,
+                              TmplScope       *scope,
+                              GPtrArray       *generated)
+{
+  TmplInstruction *insn = &slot->insn;
+  GValue value = G_VALUE_INIT;
+
+  if (insn->expr == NULL || !tmpl_expr_is_constant (insn->expr))
+    return;
+
+  switch (insn->opcode)
+    {
+    case TMPL_OP_EXPR:
+      /* A constant cannot fail, so this is the same as the executor */
+      if (!insn->silence &&
+          tmpl_expr_eval (insn->expr, scope, &value, NULL) &&
+          G_IS_VALUE (&value))
+        {
+          GValue transform = G_VALUE_INIT;
+
+          g_value_init (&transform, G_TYPE_STRING);
+
+          if (g_value_transform (&value, &transform) &&
+              g_value_get_string (&transform) != NULL)
+            {
+              gchar *str = g_value_dup_string (&transform);
+
+              g_ptr_array_add (generated, str);
+              slot->generated = TRUE;
+              insn->opcode = TMPL_OP_TEXT;
+              insn->text = str;
+              insn->len = strlen (str);
+            }
+
+          g_value_unset (&transform);
+        }
+
+      if (insn->opcode == TMPL_OP_EXPR)
+        {
+          insn->opcode = TMPL_OP_TEXT;
+          insn->text = NULL;
+          insn->len = 0;
+        }
+
+      g_clear_pointer (&insn->expr, tmpl_expr_unref);
+      break;
+
+    case TMPL_OP_JUMP_IF_FALSE:
+      if (tmpl_expr_eval (insn->expr, scope, &value, NULL) &&
+          !tmpl_value_as_boolean (&value))
+        {
+          insn->opcode = TMPL_OP_JUMP;
+        }
+      else
+        {
+          /* Always true, fall through to the body */
+          insn->opcode = TMPL_OP_TEXT;
+          insn->text = NULL;
+          insn->len = 0;
+        }
+
+      g_clear_pointer (&insn->expr, tmpl_expr_unref);
+      break;
+
+    case TMPL_OP_TEXT:
+    case TMPL_OP_JUMP:
+    case TMPL_OP_ITER_BEGIN:
+    case TMPL_OP_ITER_NEXT:
+    case TMPL_OP_FLUSH:
+    case TMPL_OP_ITER_PARALLEL:
+    default:
+      break;
+    }
+
+  TMPL_CLEAR_VALUE (&value);
+}
+
+static void
+tmpl_program_mark_reachable (TmplProgramSlot *slots,
+                             guint            n)
+{
+  g_autoptr(GArray) pending = g_array_new (FALSE, FALSE, sizeof (guint));
+  guint pc = 0;
+
+  if (n > 0)
+    g_array_append_val (pending, pc);
+
+  while (pending->len > 0)
+    {
+      const TmplInstruction *insn;
+      guint next;
+
+      pc = g_array_index (pending, guint, pending->len - 1);
+      g_array_set_size (pending, pending->len - 1);
+
+      if (pc >= n || slots[pc].kept)
+        continue;
+
+      slots[pc].kept = TRUE;
+      insn = &slots[pc].insn;
+
+      if (insn->opcode != TMPL_OP_JUMP)
+        {
+          next = pc + 1;
+          g_array_append_val (pending, next);
+        }
+
+      if (tmpl_program_is_jump (insn->opcode))
+        g_array_append_val (pending, insn->jump);
+    }
+}
+
+/*
+ * Finds the instruction that a jump to @target lands on, which is the
+ * next instruction that was kept.
+ */
+static guint
+tmpl_program_resolve (TmplProgramSlot *slots,
+                      guint            n,
+                      guint            target)
+{
+  while (target < n && (!slots[target].kept || slots[target].absorbed))
+    target++;
+  return target;
+}
+
+/**
+ * tmpl_program_specialize:
+ * @self: A #TmplProgram
+ * @frozen: a #TmplScope with symbols that will not change
+ *
+ * Creates a new program where the expressions only depending on the
+ * symbols of @frozen are evaluated ahead of time.
+ *
+ * Returns: (transfer full): A #TmplProgram
+ */
+TmplProgram *
+tmpl_program_specialize (TmplProgram *self,
+                         TmplScope   *frozen)
+{
+  g_autoptr(GHashTable) bindings = NULL;
+  g_autoptr(GPtrArray) generated = NULL;
+  g_autoptr(GArray) loops = NULL;
+  g_autoptr(TmplScope) scope = NULL;
+  g_autofree TmplProgramSlot *slots = NULL;
+  g_autofree guint *map = NULL;
+  const TmplInstruction *insns;
+  TmplProgram *ret;
+  TmplArena *arena;
+  guint n;
+
+  TMPL_ENTRY;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (frozen != NULL, NULL);
+
+  insns = tmpl_program_get_instructions (self, &n);
+  slots = g_new0 (TmplProgramSlot, n);
+  map = g_new0 (guint, n + 1);
+  bindings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  loops = g_array_new (FALSE, FALSE, sizeof (guint));
+  generated = g_ptr_array_new_with_free_func (g_free);
+  scope = tmpl_scope_new ();
+
+  /* Symbols bound by the template hide those of @frozen */
+  for (guint pc = 0; pc < n; pc++)
+    {
+      if (insns[pc].expr != NULL)
+        tmpl_expr_collect_bindings (insns[pc].expr, bindings);
+    }
+
+  arena = tmpl_arena_new ();
+  tmpl_arena_push_thread_default (arena);
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      /* As do the identifiers of the loops containing @pc */
+      while (loops->len > 0 && pc >= insns[g_array_index (loops, guint, loops->len - 1)].jump)
+        g_array_set_size (loops, loops->len - 1);
+
+      slots[pc].insn = insns[pc];
+
+      if (insns[pc].expr != NULL)
+        {
+          GHashTable *shadowed = bindings;
+
+          if (loops->len > 0)
+            {
+              GHashTableIter iter;
+              gpointer key;
+
+              shadowed = g_hash_table_new (g_str_hash, g_str_equal);
+
+              g_hash_table_iter_init (&iter, bindings);
+              while (g_hash_table_iter_next (&iter, &key, NULL))
+                g_hash_table_add (shadowed, key);
+
+              for (guint i = 0; i < loops->len; i++)
+                g_hash_table_add (shadowed, (gpointer)insns[g_array_index (loops, guint, i)].text);
+            }
+
+          slots[pc].insn.expr = tmpl_expr_specialize (insns[pc].expr, frozen, shadowed);
+          tmpl_program_specialize_slot (&slots[pc], scope, generated);
+
+          if (shadowed != bindings)
+            g_hash_table_unref (shadowed);
+        }
+
+      if (insns[pc].opcode == TMPL_OP_ITER_BEGIN ||
+          insns[pc].opcode == TMPL_OP_ITER_PARALLEL)
+        g_array_append_val (loops, pc);
+    }
+
+  tmpl_arena_pop_thread_default (arena);
+  tmpl_arena_unref (arena);
+
+  tmpl_program_mark_reachable (slots, n);
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      /* Instructions which became empty text fall through */
+      if (slots[pc].insn.opcode == TMPL_OP_TEXT && slots[pc].insn.len == 0)
+        slots[pc].kept = FALSE;
+    }
+
+  /* Going backwards, so that removing a jump is seen by those around it */
+  for (guint pc = n; pc > 0; pc--)
+    {
+      TmplProgramSlot *slot = &slots[pc - 1];
+
+      if (slot->kept &&
+          slot->insn.opcode == TMPL_OP_JUMP &&
+          tmpl_program_resolve (slots, n, pc) == tmpl_program_resolve (slots, n, slot->insn.jump))
+        slot->kept = FALSE;
+    }
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      if (slots[pc].kept && tmpl_program_is_jump (slots[pc].insn.opcode))
+        {
+          guint target = tmpl_program_resolve (slots, n, slots[pc].insn.jump);
+
+          if (target < n)
+            slots[target].landing = TRUE;
+        }
+    }
+
+  /* Text which nothing jumps to is merged into the text before it */
+  for (guint pc = 1, head = 0; pc < n; pc++)
+    {
+      if (!slots[pc].kept)
+        continue;
+
+      if (slots[pc].insn.opcode == TMPL_OP_TEXT &&
+          !slots[pc].landing &&
+          slots[head].kept &&
+          slots[head].insn.opcode == TMPL_OP_TEXT)
+        slots[pc].absorbed = TRUE;
+      else
+        head = pc;
+    }
+
+  for (guint pc = 0, pos = 0; pc <= n; pc++)
+    {
+      map[pc] = pos;
+      if (pc < n && slots[pc].kept && !slots[pc].absorbed)
+        pos++;
+    }
+
+  ret = g_slice_new0 (TmplProgram);
+  ret->ref_count = 1;
+  ret->instructions = g_array_new (FALSE, TRUE, sizeof (TmplInstruction));
+  ret->sources = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+
+  g_array_set_clear_func (ret->instructions, clear_instruction);
+
+  /* Static text still references the sources of @self */
+  for (guint i = 0; i < self->sources->len; i++)
+    g_ptr_array_add (ret->sources, g_bytes_ref (g_ptr_array_index (self->sources, i)));
+
+  for (guint pc = 0; pc < n; pc++)
+    {
+      TmplInstruction insn;
+
+      if (!slots[pc].kept || slots[pc].absorbed)
+        continue;
+
+      insn = slots[pc].insn;
+      slots[pc].insn.expr = NULL;
+
+      if (tmpl_program_is_jump (insn.opcode))
+        insn.jump = map[tmpl_program_resolve (slots, n, insn.jump)];
+
+      if (insn.opcode == TMPL_OP_TEXT)
+        {
+          GString *run = NULL;
+
+          for (guint next = pc + 1;
+               next < n && (!slots[next].kept || slots[next].absorbed);
+               next++)
+            {
+              if (!slots[next].absorbed)
+                continue;
+
+              if (run == NULL)
+                run = g_string_new_len (insn.text, insn.len);
+
+              g_string_append_len (run, slots[next].insn.text, slots[next].insn.len);
+            }
+
+          if (run != NULL)
+            {
+              GBytes *bytes = g_string_free_to_bytes (run);
+
+              insn.text = g_bytes_get_data (bytes, &insn.len);
+              g_ptr_array_add (ret->sources, bytes);
+            }
+          else if (slots[pc].generated)
+            {
+              GBytes *bytes = g_bytes_new (insn.text, insn.len);
+
+              insn.text = g_bytes_get_data (bytes, NULL);
+              g_ptr_array_add (ret->sources, bytes);
+            }
+        }
+
+      g_array_append_val (ret->instructions, insn);
+    }
+
+  for (guint pc = 0; pc < n; pc++)
+    g_clear_pointer (&slots[pc].insn.expr, tmpl_expr_unref);
+
+  TMPL_RETURN (ret);
+}
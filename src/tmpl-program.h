@@ -0,0 +1,71 @@
+/* tmpl-program.h
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TMPL_PROGRAM_H
+#define TMPL_PROGRAM_H
+
+#include "tmpl-expr.h"
+#include "tmpl-node.h"
+
+G_BEGIN_DECLS
+
+typedef struct _TmplProgram TmplProgram;
+
+typedef enum
+{
+  TMPL_OP_TEXT,          /* append text/len to the output */
+  TMPL_OP_EXPR,          /* evaluate expr, append the result unless silenced */
+  TMPL_OP_JUMP,          /* continue at jump */
+  TMPL_OP_JUMP_IF_FALSE, /* evaluate expr, continue at jump if it is false */
+  TMPL_OP_ITER_BEGIN,    /* evaluate expr and push an iterator for symbol text,
+                          * or continue at jump if there is nothing to iterate */
+  TMPL_OP_ITER_NEXT,     /* advance the top iterator, or pop it and continue at jump */
+  TMPL_OP_FLUSH,         /* write pending output to the stream */
+  TMPL_OP_ITER_PARALLEL, /* evaluate expr and expand the body up to jump once per
+                          * item, binding symbol text, possibly concurrently */
+} TmplOpcode;
+
+typedef struct
+{
+  TmplOpcode   opcode;
+  guint        jump;
+  TmplExpr    *expr;
+  const gchar *text;
+  gsize        len;
+  guint        silence : 1;
+} TmplInstruction;
+
+TmplProgram           *tmpl_program_new_for_node     (TmplNode     *root,
+                                                      GError      **error);
+TmplProgram           *tmpl_program_new_from_bytes   (GBytes       *bytes,
+                                                      GError      **error);
+TmplProgram           *tmpl_program_ref              (TmplProgram  *self);
+void                   tmpl_program_unref            (TmplProgram  *self);
+const TmplInstruction *tmpl_program_get_instructions (TmplProgram  *self,
+                                                      guint        *n_instructions);
+gsize                  tmpl_program_get_memory_usage (TmplProgram  *self);
+GBytes                *tmpl_program_serialize        (TmplProgram  *self,
+                                                      GError      **error);
+TmplProgram           *tmpl_program_specialize       (TmplProgram  *self,
+                                                      TmplScope    *frozen);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TmplProgram, tmpl_program_unref)
+
+G_END_DECLS
+
+#endif /* TMPL_PROGRAM_H */
@@ -0,0 +1,38 @@
+/* tmpl-scope-private.h
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TMPL_SCOPE_PRIVATE_H
+#define TMPL_SCOPE_PRIVATE_H
+
+#include "tmpl-scope.h"
+
+G_BEGIN_DECLS
+
+/*
+ * These take a name that was interned with g_intern_string(), such as the
+ * symbols of parsed expressions, and so avoid hashing the name.
+ */
+TmplSymbol *tmpl_scope_get_interned  (TmplScope   *self,
+                                      const gchar *name);
+TmplSymbol *tmpl_scope_peek_interned (TmplScope   *self,
+                                      const gchar *name);
+void        tmpl_scope_take_interned (TmplScope   *self,
+                                      const gchar *name,
+                                      TmplSymbol  *symbol);
+
+G_END_DECLS
+
+#endif /* TMPL_SCOPE_PRIVATE_H */
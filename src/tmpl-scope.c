@@ -18,23 +18,132 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "tmpl-gi-private.h"
-#include "tmpl-scope.h"
+#include "tmpl-scope-private.h"
 #include "tmpl-symbol.h"
 #include "tmpl-util-private.h"
 
+/*
+ * Scopes for loops and function calls hold a few symbols at most, so the
+ * first symbols are stored inline and searched linearly. Past that, they
+ * are moved into a hash table.
+ */
+#define TMPL_SCOPE_N_INLINE     4
+#define TMPL_SCOPE_FREELIST_MAX 32
+
+typedef struct
+{
+  const gchar *name;
+  TmplSymbol  *symbol;
+} TmplScopeSlot;
+
 struct _TmplScope
 {
   volatile gint      ref_count;
+  guint              n_slots;
   TmplScope         *parent;
   GHashTable        *symbols;
   TmplScopeResolver  resolver;
   gpointer           resolver_data;
   GDestroyNotify     resolver_destroy;
+  TmplScopeSlot      slots[TMPL_SCOPE_N_INLINE];
 };
 
+/*
+ * Freed scopes are kept per-thread for reuse, as a scope is created for
+ * every loop and function call while expanding.
+ */
+typedef struct
+{
+  guint      len;
+  TmplScope *scopes[TMPL_SCOPE_FREELIST_MAX];
+} TmplScopeFreelist;
+
+static void tmpl_scope_freelist_free (gpointer data);
+
+static GPrivate freelist_key = G_PRIVATE_INIT (tmpl_scope_freelist_free);
+
 G_DEFINE_BOXED_TYPE (TmplScope, tmpl_scope, tmpl_scope_ref, tmpl_scope_unref)
 
+static void
+tmpl_scope_freelist_free (gpointer data)
+{
+  TmplScopeFreelist *freelist = data;
+
+  for (guint i = 0; i < freelist->len; i++)
+    g_slice_free (TmplScope, freelist->scopes[i]);
+
+  g_free (freelist);
+}
+
+static TmplScope *
+tmpl_scope_alloc (void)
+{
+  TmplScopeFreelist *freelist = g_private_get (&freelist_key);
+  TmplScope *self;
+
+  if (freelist == NULL || freelist->len == 0)
+    return g_slice_new0 (TmplScope);
+
+  self = freelist->scopes[--freelist->len];
+  memset (self, 0, sizeof *self);
+
+  return self;
+}
+
+static void
+tmpl_scope_release (TmplScope *self)
+{
+  TmplScopeFreelist *freelist = g_private_get (&freelist_key);
+
+  if (freelist == NULL)
+    {
+      freelist = g_new0 (TmplScopeFreelist, 1);
+      g_private_set (&freelist_key, freelist);
+    }
+
+  if (freelist->len < TMPL_SCOPE_FREELIST_MAX)
+    freelist->scopes[freelist->len++] = self;
+  else
+    g_slice_free (TmplScope, self);
+}
+
+static inline TmplSymbol *
+tmpl_scope_lookup (TmplScope   *self,
+                   const gchar *name)
+{
+  if (self->symbols != NULL)
+    return g_hash_table_lookup (self->symbols, name);
+
+  for (guint i = 0; i < self->n_slots; i++)
+    {
+      if (self->slots[i].name == name)
+        return self->slots[i].symbol;
+    }
+
+  return NULL;
+}
+
+/*
+ * Symbols are keyed by their interned name so that a lookup is a pointer
+ * comparison at each level of the scope chain. Expressions intern the
+ * names they reference when they are parsed, so only the public API,
+ * which is given arbitrary strings, needs to intern names at runtime.
+ *
+ * A name that has never been interned cannot be in any scope, so lookups
+ * use g_quark_try_string() rather than growing the table of interned
+ * strings with names that are only ever looked up.
+ */
+static inline const gchar *
+tmpl_scope_try_intern (const gchar *name)
+{
+  GQuark quark = g_quark_try_string (name);
+
+  return quark ? g_quark_to_string (quark) : NULL;
+}
+
 TmplScope *
 tmpl_scope_ref (TmplScope *self)
 {
@@ -54,13 +163,19 @@ tmpl_scope_unref (TmplScope *self)
 
   if (g_atomic_int_dec_and_test (&self->ref_count))
     {
+      TmplScope *parent = self->parent;
+
       if (self->resolver_destroy)
         g_clear_pointer (&self->resolver_data, self->resolver_destroy);
       self->resolver = NULL;
       self->resolver_destroy = NULL;
       g_clear_pointer (&self->symbols, g_hash_table_unref);
-      g_clear_pointer (&self->parent, tmpl_scope_unref);
-      g_slice_free (TmplScope, self);
+      for (guint i = 0; i < self->n_slots; i++)
+        tmpl_symbol_unref (self->slots[i].symbol);
+      tmpl_scope_release (self);
+
+      if (parent != NULL)
+        tmpl_scope_unref (parent);
     }
 }
 
@@ -76,7 +191,7 @@ tmpl_scope_new (void)
 {
   TmplScope *self;
 
-  self = g_slice_new0 (TmplScope);
+  self = tmpl_scope_alloc ();
   self->ref_count = 1;
   self->parent = NULL;
 
@@ -97,16 +212,21 @@ tmpl_scope_new_with_parent (TmplScope *parent)
 {
   TmplScope *self;
 
-  self = g_slice_new0 (TmplScope);
+  self = tmpl_scope_alloc ();
   self->ref_count = 1;
   self->parent = parent != NULL ? tmpl_scope_ref (parent) : NULL;
 
   return self;
 }
 
+/*
+ * @interned is the interned form of @name, or %NULL if @name has never been
+ * interned, in which case only the resolvers may provide the symbol.
+ */
 static TmplSymbol *
 tmpl_scope_get_full (TmplScope   *self,
                      const gchar *name,
+                     const gchar *interned,
                      gboolean     create)
 {
   TmplSymbol *symbol = NULL;
@@ -114,19 +234,12 @@ tmpl_scope_get_full (TmplScope   *self,
 
   g_return_val_if_fail (self != NULL, NULL);
 
-  /* See if this scope has the symbol */
-  if (self->symbols != NULL)
-    {
-      if ((symbol = g_hash_table_lookup (self->symbols, name)))
-        return symbol;
-    }
-
-  /* Try to locate the symbol in a parent scope */
-  for (parent = self->parent; parent != NULL; parent = parent->parent)
+  /* See if this scope or a parent scope has the symbol */
+  if (interned != NULL)
     {
-      if (parent->symbols != NULL)
+      for (parent = self; parent != NULL; parent = parent->parent)
         {
-          if ((symbol = g_hash_table_lookup (parent->symbols, name)))
+          if ((symbol = tmpl_scope_lookup (parent, interned)))
             return symbol;
         }
     }
@@ -139,7 +252,9 @@ tmpl_scope_get_full (TmplScope   *self,
           if (parent->resolver (parent, name, &symbol, parent->resolver_data) && symbol)
             {
               /* Pass ownership to our scope, and return a weak ref */
-              tmpl_scope_take (self, name, symbol);
+              tmpl_scope_take_interned (self,
+                                        interned ? interned : g_intern_string (name),
+                                        symbol);
               return symbol;
             }
         }
@@ -149,7 +264,9 @@ tmpl_scope_get_full (TmplScope   *self,
     {
       /* Define the symbol in this scope */
       symbol = tmpl_symbol_new ();
-      tmpl_scope_take (self, name, symbol);
+      tmpl_scope_take_interned (self,
+                                interned ? interned : g_intern_string (name),
+                                symbol);
     }
 
   return symbol;
@@ -166,7 +283,99 @@ TmplSymbol *
 tmpl_scope_get (TmplScope   *self,
                 const gchar *name)
 {
-  return tmpl_scope_get_full (self, name, TRUE);
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  return tmpl_scope_get_full (self, name, g_intern_string (name), TRUE);
+}
+
+/*
+ * Like tmpl_scope_get(), but @name must have been interned with
+ * g_intern_string().
+ */
+TmplSymbol *
+tmpl_scope_get_interned (TmplScope   *self,
+                         const gchar *name)
+{
+  g_assert (self != NULL);
+  g_assert (name != NULL);
+
+  return tmpl_scope_get_full (self, name, name, TRUE);
+}
+
+/*
+ * Like tmpl_scope_peek(), but @name must have been interned with
+ * g_intern_string().
+ */
+TmplSymbol *
+tmpl_scope_peek_interned (TmplScope   *self,
+                          const gchar *name)
+{
+  g_assert (self != NULL);
+  g_assert (name != NULL);
+
+  return tmpl_scope_get_full (self, name, name, FALSE);
+}
+
+/*
+ * Like tmpl_scope_take(), but @name must have been interned with
+ * g_intern_string().
+ */
+void
+tmpl_scope_take_interned (TmplScope   *self,
+                          const gchar *name,
+                          TmplSymbol  *symbol)
+{
+  g_assert (self != NULL);
+  g_assert (name != NULL);
+
+  if (self->symbols != NULL)
+    {
+      if G_UNLIKELY (symbol == NULL)
+        g_hash_table_remove (self->symbols, name);
+      else
+        g_hash_table_insert (self->symbols, (gpointer)name, symbol);
+      return;
+    }
+
+  for (guint i = 0; i < self->n_slots; i++)
+    {
+      if (self->slots[i].name == name)
+        {
+          tmpl_symbol_unref (self->slots[i].symbol);
+
+          if G_UNLIKELY (symbol == NULL)
+            self->slots[i] = self->slots[--self->n_slots];
+          else
+            self->slots[i].symbol = symbol;
+
+          return;
+        }
+    }
+
+  if G_UNLIKELY (symbol == NULL)
+    return;
+
+  if (self->n_slots < TMPL_SCOPE_N_INLINE)
+    {
+      self->slots[self->n_slots].name = name;
+      self->slots[self->n_slots].symbol = symbol;
+      self->n_slots++;
+      return;
+    }
+
+  self->symbols = g_hash_table_new_full (NULL,
+                                         NULL,
+                                         NULL,
+                                         (GDestroyNotify) tmpl_symbol_unref);
+
+  for (guint i = 0; i < self->n_slots; i++)
+    g_hash_table_insert (self->symbols,
+                         (gpointer)self->slots[i].name,
+                         self->slots[i].symbol);
+  self->n_slots = 0;
+
+  g_hash_table_insert (self->symbols, (gpointer)name, symbol);
 }
 
 /**
@@ -185,23 +394,18 @@ tmpl_scope_take (TmplScope   *self,
                  const gchar *name,
                  TmplSymbol  *symbol)
 {
+  const gchar *interned;
+
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
   if G_UNLIKELY (symbol == NULL)
-    {
-      if G_LIKELY (self->symbols != NULL)
-        g_hash_table_remove (self->symbols, name);
-      return;
-    }
-
-  if (self->symbols == NULL)
-    self->symbols = g_hash_table_new_full (g_str_hash,
-                                           g_str_equal,
-                                           g_free,
-                                           (GDestroyNotify) tmpl_symbol_unref);
+    interned = tmpl_scope_try_intern (name);
+  else
+    interned = g_intern_string (name);
 
-  g_hash_table_insert (self->symbols, g_strdup (name), symbol);
+  if (interned != NULL)
+    tmpl_scope_take_interned (self, interned, symbol);
 }
 
 /**
@@ -243,7 +447,7 @@ tmpl_scope_set_value (TmplScope    *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_value (tmpl_scope_get_full (self, name, TRUE), value);
+  tmpl_symbol_assign_value (tmpl_scope_get (self, name), value);
 }
 
 /**
@@ -262,7 +466,7 @@ tmpl_scope_set_boolean (TmplScope   *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_boolean (tmpl_scope_get_full (self, name, TRUE), value);
+  tmpl_symbol_assign_boolean (tmpl_scope_get (self, name), value);
 }
 
 /**
@@ -281,7 +485,7 @@ tmpl_scope_set_double (TmplScope   *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_double (tmpl_scope_get_full (self, name, TRUE), value);
+  tmpl_symbol_assign_double (tmpl_scope_get (self, name), value);
 }
 
 /**
@@ -301,7 +505,7 @@ tmpl_scope_set_object (TmplScope   *self,
   g_return_if_fail (name != NULL);
   g_return_if_fail (!value || G_IS_OBJECT (value));
 
-  tmpl_symbol_assign_object (tmpl_scope_get_full (self, name, TRUE), value);
+  tmpl_symbol_assign_object (tmpl_scope_get (self, name), value);
 }
 
 /**
@@ -324,7 +528,7 @@ tmpl_scope_set_variant (TmplScope   *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_variant (tmpl_scope_get_full (self, name, TRUE),
+  tmpl_symbol_assign_variant (tmpl_scope_get (self, name),
                               value);
 }
 
@@ -344,7 +548,7 @@ tmpl_scope_set_strv (TmplScope   *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_variant (tmpl_scope_get_full (self, name, TRUE),
+  tmpl_symbol_assign_variant (tmpl_scope_get (self, name),
                               g_variant_new_strv (value, -1));
 }
 
@@ -364,7 +568,7 @@ tmpl_scope_set_string (TmplScope   *self,
   g_return_if_fail (self != NULL);
   g_return_if_fail (name != NULL);
 
-  tmpl_symbol_assign_string (tmpl_scope_get_full (self, name, TRUE), value);
+  tmpl_symbol_assign_string (tmpl_scope_get (self, name), value);
 }
 
 /**
@@ -381,7 +585,7 @@ tmpl_scope_peek (TmplScope   *self,
   g_return_val_if_fail (self != NULL, NULL);
   g_return_val_if_fail (name != NULL, NULL);
 
-  return tmpl_scope_get_full (self, name, FALSE);
+  return tmpl_scope_get_full (self, name, tmpl_scope_try_intern (name), FALSE);
 }
 
 void
@@ -430,7 +634,7 @@ tmpl_scope_require (TmplScope    *self,
   g_return_val_if_fail (self != NULL, FALSE);
   g_return_val_if_fail (namespace_ != NULL, FALSE);
 
-  if (!(typelib = gi_repository_require (tmpl_repository_get_default (), namespace_, version, 0, NULL)))
+  if (!(typelib = tmpl_repository_require (namespace_, version, NULL)))
     return FALSE;
 
   g_value_init (&value, TMPL_TYPE_TYPELIB);
@@ -446,15 +650,21 @@ tmpl_scope_list_symbols_internal (TmplScope *self,
                                   GPtrArray *ar,
                                   gboolean   recursive)
 {
-  GHashTableIter iter;
-  const char *key;
-
   g_assert (self != NULL);
   g_assert (ar != NULL);
 
-  g_hash_table_iter_init (&iter, self->symbols);
-  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
-    g_ptr_array_add (ar, g_strdup (key));
+  if (self->symbols != NULL)
+    {
+      GHashTableIter iter;
+      const char *key;
+
+      g_hash_table_iter_init (&iter, self->symbols);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+        g_ptr_array_add (ar, g_strdup (key));
+    }
+
+  for (guint i = 0; i < self->n_slots; i++)
+    g_ptr_array_add (ar, g_strdup (self->slots[i].name));
 
   if (recursive && self->parent)
     tmpl_scope_list_symbols_internal (self->parent, ar, recursive);
@@ -18,6 +18,7 @@
 
 #include "tmpl-expr.h"
 #include "tmpl-symbol.h"
+#include "tmpl-symbol-private.h"
 
 G_DEFINE_BOXED_TYPE (TmplSymbol, tmpl_symbol, tmpl_symbol_ref, tmpl_symbol_unref)
 
@@ -108,6 +109,8 @@ tmpl_symbol_assign_value (TmplSymbol   *self,
  *
  * Sets the symbol as a %TMPL_SYMBOL_EXPR with the given ordered and
  * named parameters.
+ *
+ * The parameter names are interned, so @args is not referenced.
  */
 void
 tmpl_symbol_assign_expr (TmplSymbol *self,
@@ -124,7 +127,12 @@ tmpl_symbol_assign_expr (TmplSymbol *self,
     self->u.expr.expr = tmpl_expr_ref (expr);
 
   if (args != NULL)
-    self->u.expr.params = g_ptr_array_ref (args);
+    {
+      self->u.expr.params = g_ptr_array_sized_new (args->len);
+      for (guint i = 0; i < args->len; i++)
+        g_ptr_array_add (self->u.expr.params,
+                         (gpointer)g_intern_string (g_ptr_array_index (args, i)));
+    }
 }
 
 TmplSymbolType
@@ -180,6 +188,15 @@ tmpl_symbol_get_value (TmplSymbol *self,
     }
 }
 
+const GValue *
+tmpl_symbol_peek_value (TmplSymbol *self)
+{
+  g_assert (self != NULL);
+  g_assert (self->type == TMPL_SYMBOL_VALUE);
+
+  return &self->u.value;
+}
+
 void
 tmpl_symbol_assign_boolean (TmplSymbol *self,
                             gboolean    v_bool)
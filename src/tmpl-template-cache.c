@@ -0,0 +1,555 @@
+/* tmpl-template-cache.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "tmpl-template-cache"
+
+#include "tmpl-template-cache.h"
+
+/**
+ * TmplTemplateCache:
+ *
+ * #TmplTemplateCache shares parsed templates between callers and threads.
+ *
+ * Templates are located by path using the #TmplTemplateLocator of the
+ * cache and parsed at most once. Each request validates the cached template
+ * against the modification time and size of its source, or a checksum of
+ * the contents when no modification time is available, and the template is
+ * only parsed again if the source has changed. Concurrent requests for the
+ * same path share a single load.
+ *
+ * Templates returned from the cache are shared and must be treated as
+ * immutable. They may be expanded from many threads at once, but must not
+ * be parsed again or have their locator changed.
+ *
+ * Only the source of the requested template is validated. Changes to
+ * included templates are not noticed until the entry is invalidated with
+ * tmpl_template_cache_invalidate().
+ *
+ * Since: 3.42
+ */
+
+typedef struct
+{
+  guint64  mtime;
+  goffset  size;
+  gchar   *checksum;
+} CacheStamp;
+
+typedef struct
+{
+  /* Guarded by TmplTemplateCache.mutex */
+  gint          ref_count;
+  gchar        *path;
+  TmplTemplate *template;
+  GError       *error;
+  CacheStamp    stamp;
+  guint         generation;
+  guint         loading : 1;
+} CacheEntry;
+
+struct _TmplTemplateCache
+{
+  GObject              parent_instance;
+
+  TmplTemplateLocator *locator;
+
+  GMutex               mutex;
+  GCond                cond;
+  GHashTable          *entries;
+};
+
+G_DEFINE_TYPE (TmplTemplateCache, tmpl_template_cache, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_LOCATOR,
+  LAST_PROP
+};
+
+static GParamSpec *properties [LAST_PROP];
+
+static CacheEntry *
+cache_entry_new (const gchar *path)
+{
+  CacheEntry *entry;
+
+  entry = g_slice_new0 (CacheEntry);
+  entry->ref_count = 1;
+  entry->path = g_strdup (path);
+
+  return entry;
+}
+
+static CacheEntry *
+cache_entry_ref (CacheEntry *entry)
+{
+  entry->ref_count++;
+  return entry;
+}
+
+static void
+cache_entry_unref (CacheEntry *entry)
+{
+  if (--entry->ref_count == 0)
+    {
+      g_clear_object (&entry->template);
+      g_clear_error (&entry->error);
+      g_clear_pointer (&entry->stamp.checksum, g_free);
+      g_clear_pointer (&entry->path, g_free);
+      g_slice_free (CacheEntry, entry);
+    }
+}
+
+static GBytes *
+read_all_bytes (GInputStream  *stream,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  GOutputStream *memory;
+  GBytes *ret = NULL;
+
+  memory = g_memory_output_stream_new_resizable ();
+
+  if (g_output_stream_splice (memory,
+                              stream,
+                              (G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET),
+                              cancellable,
+                              error) >= 0)
+    ret = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory));
+
+  g_object_unref (memory);
+
+  return ret;
+}
+
+/*
+ * Locates and validates the source for @path against @stamp. If it has not
+ * changed, @previous is returned, otherwise the source is parsed into a new
+ * template. @stamp is updated to reflect the source that was read.
+ *
+ * This is called without the cache lock held.
+ */
+static TmplTemplate *
+tmpl_template_cache_load_source (TmplTemplateCache  *self,
+                                 const gchar        *path,
+                                 TmplTemplate       *previous,
+                                 CacheStamp         *stamp,
+                                 GCancellable       *cancellable,
+                                 GError            **error)
+{
+  TmplTemplate *ret = NULL;
+  GInputStream *stream;
+  GFileInfo *info = NULL;
+  GBytes *bytes = NULL;
+  gchar *checksum = NULL;
+  guint64 mtime = 0;
+  goffset size = 0;
+
+  g_assert (TMPL_IS_TEMPLATE_CACHE (self));
+  g_assert (path != NULL);
+  g_assert (stamp != NULL);
+
+  if (!(stream = tmpl_template_locator_locate (self->locator, path, error)))
+    return NULL;
+
+  if (G_IS_FILE_INPUT_STREAM (stream) &&
+      (info = g_file_input_stream_query_info (G_FILE_INPUT_STREAM (stream),
+                                              G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                              G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC","
+                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                              cancellable,
+                                              NULL)) &&
+      g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    {
+      mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+            + g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+      size = g_file_info_get_size (info);
+
+      if (previous != NULL && mtime == stamp->mtime && size == stamp->size)
+        {
+          ret = g_object_ref (previous);
+          goto cleanup;
+        }
+    }
+
+  if (!(bytes = read_all_bytes (stream, cancellable, error)))
+    goto cleanup;
+
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+
+  if (previous != NULL && g_strcmp0 (checksum, stamp->checksum) == 0)
+    {
+      ret = g_object_ref (previous);
+    }
+  else
+    {
+      TmplTemplate *template = tmpl_template_new (self->locator);
+
+      if (tmpl_template_parse_bytes (template, bytes, cancellable, error))
+        ret = g_steal_pointer (&template);
+
+      g_clear_object (&template);
+    }
+
+  if (ret != NULL)
+    {
+      stamp->mtime = mtime;
+      stamp->size = size;
+      g_free (stamp->checksum);
+      stamp->checksum = g_steal_pointer (&checksum);
+    }
+
+cleanup:
+  g_clear_object (&info);
+  g_clear_pointer (&bytes, g_bytes_unref);
+  g_clear_pointer (&checksum, g_free);
+  g_object_unref (stream);
+
+  return ret;
+}
+
+static void
+tmpl_template_cache_finalize (GObject *object)
+{
+  TmplTemplateCache *self = (TmplTemplateCache *)object;
+
+  g_clear_pointer (&self->entries, g_hash_table_unref);
+  g_clear_object (&self->locator);
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (tmpl_template_cache_parent_class)->finalize (object);
+}
+
+static void
+tmpl_template_cache_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+  TmplTemplateCache *self = TMPL_TEMPLATE_CACHE (object);
+
+  switch (prop_id)
+    {
+    case PROP_LOCATOR:
+      g_value_set_object (value, self->locator);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+tmpl_template_cache_set_property (GObject      *object,
+                                  guint         prop_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+  TmplTemplateCache *self = TMPL_TEMPLATE_CACHE (object);
+
+  switch (prop_id)
+    {
+    case PROP_LOCATOR:
+      self->locator = g_value_dup_object (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+tmpl_template_cache_class_init (TmplTemplateCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = tmpl_template_cache_finalize;
+  object_class->get_property = tmpl_template_cache_get_property;
+  object_class->set_property = tmpl_template_cache_set_property;
+
+  /**
+   * TmplTemplateCache:locator:
+   *
+   * The locator used to find templates, and by the cached templates to
+   * resolve includes. Its search path should not be modified once the
+   * cache is in use.
+   *
+   * Since: 3.42
+   */
+  properties [PROP_LOCATOR] =
+    g_param_spec_object ("locator",
+                         "Locator",
+                         "The locator used for resolving templates",
+                         TMPL_TYPE_TEMPLATE_LOCATOR,
+                         (G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_properties (object_class, LAST_PROP, properties);
+}
+
+static void
+tmpl_template_cache_init (TmplTemplateCache *self)
+{
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->entries = g_hash_table_new_full (g_str_hash,
+                                         g_str_equal,
+                                         NULL,
+                                         (GDestroyNotify)cache_entry_unref);
+}
+
+/**
+ * tmpl_template_cache_new:
+ * @locator: A #TmplTemplateLocator
+ *
+ * Creates a new #TmplTemplateCache which locates templates using @locator.
+ *
+ * Returns: (transfer full): A #TmplTemplateCache
+ *
+ * Since: 3.42
+ */
+TmplTemplateCache *
+tmpl_template_cache_new (TmplTemplateLocator *locator)
+{
+  g_return_val_if_fail (TMPL_IS_TEMPLATE_LOCATOR (locator), NULL);
+
+  return g_object_new (TMPL_TYPE_TEMPLATE_CACHE,
+                       "locator", locator,
+                       NULL);
+}
+
+/**
+ * tmpl_template_cache_get_locator:
+ * @self: A #TmplTemplateCache
+ *
+ * Gets the locator used to find templates.
+ *
+ * Returns: (transfer none): A #TmplTemplateLocator
+ *
+ * Since: 3.42
+ */
+TmplTemplateLocator *
+tmpl_template_cache_get_locator (TmplTemplateCache *self)
+{
+  g_return_val_if_fail (TMPL_IS_TEMPLATE_CACHE (self), NULL);
+
+  return self->locator;
+}
+
+static void
+tmpl_template_cache_cancelled_cb (GCancellable      *cancellable,
+                                  TmplTemplateCache *self)
+{
+  /* Wake up waiters so they can notice they were cancelled */
+  g_mutex_lock (&self->mutex);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * tmpl_template_cache_load:
+ * @self: A #TmplTemplateCache
+ * @path: the path of the template, relative to the locator search path
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Gets the parsed template for @path, parsing it only if it is not
+ * already cached or the source has changed since it was parsed.
+ *
+ * This function is thread-safe. If another thread is already loading
+ * @path, this waits for and shares the result of that load. Cancelling
+ * @cancellable stops the wait with %G_IO_ERROR_CANCELLED without affecting
+ * the other load.
+ *
+ * Returns: (transfer full): A #TmplTemplate which must not be modified, or
+ *   %NULL and @error is set.
+ *
+ * Since: 3.42
+ */
+TmplTemplate *
+tmpl_template_cache_load (TmplTemplateCache  *self,
+                          const gchar        *path,
+                          GCancellable       *cancellable,
+                          GError            **error)
+{
+  TmplTemplate *previous;
+  TmplTemplate *ret = NULL;
+  CacheEntry *entry;
+  CacheStamp stamp = { 0 };
+  GError *local_error = NULL;
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE_CACHE (self), NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+
+  g_mutex_lock (&self->mutex);
+
+again:
+  if (!(entry = g_hash_table_lookup (self->entries, path)))
+    {
+      entry = cache_entry_new (path);
+      g_hash_table_insert (self->entries, entry->path, entry);
+    }
+
+  if (entry->loading)
+    {
+      guint generation = entry->generation;
+      gboolean retry = FALSE;
+      gulong handler_id = 0;
+
+      cache_entry_ref (entry);
+
+      /*
+       * The handler takes the lock, so it must be connected (which may run
+       * it immediately) and disconnected (which waits for it) unlocked.
+       */
+      if (cancellable != NULL)
+        {
+          g_mutex_unlock (&self->mutex);
+          handler_id = g_cancellable_connect (cancellable,
+                                              G_CALLBACK (tmpl_template_cache_cancelled_cb),
+                                              self,
+                                              NULL);
+          g_mutex_lock (&self->mutex);
+        }
+
+      while (entry->generation == generation &&
+             !g_cancellable_is_cancelled (cancellable))
+        g_cond_wait (&self->cond, &self->mutex);
+
+      if (entry->generation == generation)
+        {
+          g_cancellable_set_error_if_cancelled (cancellable, error);
+        }
+      else if (entry->template != NULL)
+        {
+          ret = g_object_ref (entry->template);
+        }
+      else if (entry->error != NULL &&
+               !g_error_matches (entry->error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_propagate_error (error, g_error_copy (entry->error));
+        }
+      else
+        {
+          /* The loader was cancelled, but we were not. Try for ourselves. */
+          retry = TRUE;
+        }
+
+      cache_entry_unref (entry);
+      g_mutex_unlock (&self->mutex);
+
+      if (handler_id != 0)
+        g_cancellable_disconnect (cancellable, handler_id);
+
+      if (retry)
+        {
+          g_mutex_lock (&self->mutex);
+          goto again;
+        }
+
+      return ret;
+    }
+
+  /* Claim the entry and load it without holding the lock */
+  entry->loading = TRUE;
+  cache_entry_ref (entry);
+  previous = entry->template ? g_object_ref (entry->template) : NULL;
+  stamp.mtime = entry->stamp.mtime;
+  stamp.size = entry->stamp.size;
+  stamp.checksum = g_strdup (entry->stamp.checksum);
+
+  g_mutex_unlock (&self->mutex);
+
+  ret = tmpl_template_cache_load_source (self, path, previous, &stamp, cancellable, &local_error);
+
+  g_mutex_lock (&self->mutex);
+
+  g_clear_error (&entry->error);
+
+  if (ret != NULL)
+    {
+      g_set_object (&entry->template, ret);
+      g_free (entry->stamp.checksum);
+      entry->stamp = stamp;
+      stamp.checksum = NULL;
+    }
+  else
+    {
+      entry->error = g_error_copy (local_error);
+    }
+
+  entry->loading = FALSE;
+  entry->generation++;
+  g_cond_broadcast (&self->cond);
+  cache_entry_unref (entry);
+
+  g_mutex_unlock (&self->mutex);
+
+  g_clear_object (&previous);
+  g_free (stamp.checksum);
+
+  if (local_error != NULL)
+    g_propagate_error (error, local_error);
+
+  return ret;
+}
+
+/**
+ * tmpl_template_cache_invalidate:
+ * @self: A #TmplTemplateCache
+ * @path: the path of the template
+ *
+ * Drops the cached template for @path so that it is parsed again by the
+ * next call to tmpl_template_cache_load(). Templates that were already
+ * handed out are not affected.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_cache_invalidate (TmplTemplateCache *self,
+                                const gchar       *path)
+{
+  g_return_if_fail (TMPL_IS_TEMPLATE_CACHE (self));
+  g_return_if_fail (path != NULL);
+
+  g_mutex_lock (&self->mutex);
+  g_hash_table_remove (self->entries, path);
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * tmpl_template_cache_clear:
+ * @self: A #TmplTemplateCache
+ *
+ * Drops all cached templates.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_cache_clear (TmplTemplateCache *self)
+{
+  g_return_if_fail (TMPL_IS_TEMPLATE_CACHE (self));
+
+  g_mutex_lock (&self->mutex);
+  g_hash_table_remove_all (self->entries);
+  g_mutex_unlock (&self->mutex);
+}
@@ -0,0 +1,57 @@
+/* tmpl-template-cache.h
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (TMPL_GLIB_INSIDE) && !defined (TMPL_GLIB_COMPILATION)
+# error "Only <tmpl-glib.h> can be included directly."
+#endif
+
+#ifndef TMPL_TEMPLATE_CACHE_H
+#define TMPL_TEMPLATE_CACHE_H
+
+#include <gio/gio.h>
+
+#include "tmpl-version-macros.h"
+
+#include "tmpl-template.h"
+#include "tmpl-template-locator.h"
+
+G_BEGIN_DECLS
+
+#define TMPL_TYPE_TEMPLATE_CACHE (tmpl_template_cache_get_type())
+
+TMPL_AVAILABLE_IN_3_42
+G_DECLARE_FINAL_TYPE (TmplTemplateCache, tmpl_template_cache, TMPL, TEMPLATE_CACHE, GObject)
+
+TMPL_AVAILABLE_IN_3_42
+TmplTemplateCache   *tmpl_template_cache_new         (TmplTemplateLocator  *locator);
+TMPL_AVAILABLE_IN_3_42
+TmplTemplateLocator *tmpl_template_cache_get_locator (TmplTemplateCache    *self);
+TMPL_AVAILABLE_IN_3_42
+TmplTemplate        *tmpl_template_cache_load        (TmplTemplateCache    *self,
+                                                      const gchar          *path,
+                                                      GCancellable         *cancellable,
+                                                      GError              **error);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_cache_invalidate  (TmplTemplateCache    *self,
+                                                      const gchar          *path);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_cache_clear       (TmplTemplateCache    *self);
+
+G_END_DECLS
+
+#endif /* TMPL_TEMPLATE_CACHE_H */
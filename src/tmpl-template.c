@@ -21,40 +21,78 @@
 #include <glib/gi18n.h>
 #include <string.h>
 
-#include "tmpl-branch-node.h"
-#include "tmpl-condition-node.h"
+#include "tmpl-arena-private.h"
 #include "tmpl-error.h"
-#include "tmpl-expr-node.h"
-#include "tmpl-iter-node.h"
+#include "tmpl-expr-private.h"
 #include "tmpl-iterator.h"
 #include "tmpl-parser.h"
-#include "tmpl-scope.h"
+#include "tmpl-program.h"
+#include "tmpl-scope-private.h"
 #include "tmpl-symbol.h"
 #include "tmpl-template.h"
-#include "tmpl-text-node.h"
 #include "tmpl-util-private.h"
 
 typedef struct
 {
-  TmplParser          *parser;
+  TmplProgram         *program;
   TmplTemplateLocator *locator;
+  guint                flush_threshold;
+  guint                use_arena : 1;
 } TmplTemplatePrivate;
 
 typedef struct
 {
-  TmplTemplate   *self;
-  TmplNode       *root;
-  GString        *output;
-  TmplScope      *scope;
-  GError        **error;
-  gboolean        result;
+  TmplIterator   iter;
+  GValue         value[1];
+  TmplScope     *scope;
+  TmplSymbol    *symbol;
+  TmplArena     *scratch;
+  TmplArenaMark  mark;
+} TmplTemplateFrame;
+
+/*
+ * Output is collected as a list of segments which are written to the
+ * stream with a single vectored write. Static text is referenced from the
+ * program rather than copied, except for runs so short that another
+ * GOutputVector would cost more than the copy. Everything else is
+ * appended to the scratch buffer.
+ */
+#define TEXT_COPY_THRESHOLD 16
+
+typedef struct
+{
+  const gchar *data;   /* NULL if the segment is found in scratch */
+  gsize        offset; /* offset within scratch if data is NULL */
+  gsize        len;
+} TmplTemplateSegment;
+
+typedef struct
+{
+  GArray  *segments;
+  GString *scratch;
+  gsize    len;
+} TmplTemplateOutput;
+
+typedef struct
+{
+  TmplTemplate       *self;
+  TmplProgram        *program;
+  TmplTemplateOutput  output;
+  GOutputStream      *stream;
+  GCancellable       *cancellable;
+  TmplScope          *scope;
+  GArray             *frames;
+  GError            **error;
+  gsize               flush_threshold;
 } TmplTemplateExpandState;
 
 G_DEFINE_TYPE_WITH_PRIVATE (TmplTemplate, tmpl_template, G_TYPE_OBJECT)
 
 enum {
   PROP_0,
+  PROP_FLUSH_THRESHOLD,
   PROP_LOCATOR,
+  PROP_USE_ARENA,
   LAST_PROP
 };
 
@@ -66,7 +104,7 @@ tmpl_template_finalize (GObject *object)
   TmplTemplate *self = (TmplTemplate *)object;
   TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
 
-  g_clear_object (&priv->parser);
+  g_clear_pointer (&priv->program, tmpl_program_unref);
 
   G_OBJECT_CLASS (tmpl_template_parent_class)->finalize (object);
 }
@@ -81,10 +119,18 @@ tmpl_template_get_property (GObject    *object,
 
   switch (prop_id)
     {
+    case PROP_FLUSH_THRESHOLD:
+      g_value_set_uint (value, tmpl_template_get_flush_threshold (self));
+      break;
+
     case PROP_LOCATOR:
       g_value_set_object (value, tmpl_template_get_locator (self));
       break;
 
+    case PROP_USE_ARENA:
+      g_value_set_boolean (value, tmpl_template_get_use_arena (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     }
@@ -100,10 +146,18 @@ tmpl_template_set_property (GObject      *object,
 
   switch (prop_id)
     {
+    case PROP_FLUSH_THRESHOLD:
+      tmpl_template_set_flush_threshold (self, g_value_get_uint (value));
+      break;
+
     case PROP_LOCATOR:
       tmpl_template_set_locator (self, g_value_get_object (value));
       break;
 
+    case PROP_USE_ARENA:
+      tmpl_template_set_use_arena (self, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     }
@@ -118,6 +172,29 @@ tmpl_template_class_init (TmplTemplateClass *klass)
   object_class->get_property = tmpl_template_get_property;
   object_class->set_property = tmpl_template_set_property;
 
+  /**
+   * TmplTemplate:flush-threshold:
+   *
+   * The number of bytes of expanded output that may be buffered before
+   * it is written to the output stream of tmpl_template_expand().
+   *
+   * If zero, the entire expansion is buffered and only written once the
+   * template has been successfully expanded. Otherwise, output is
+   * streamed as it is produced, which keeps memory usage bounded and
+   * gets the first bytes out sooner. Note that with streaming enabled, a
+   * failed expansion may have already written partial output.
+   *
+   * Since: 3.42
+   */
+  properties [PROP_FLUSH_THRESHOLD] =
+    g_param_spec_uint ("flush-threshold",
+                       "Flush Threshold",
+                       "The number of buffered bytes that causes output to be flushed",
+                       0, G_MAXUINT, 0,
+                       (G_PARAM_READWRITE |
+                        G_PARAM_EXPLICIT_NOTIFY |
+                        G_PARAM_STATIC_STRINGS));
+
   properties [PROP_LOCATOR] =
     g_param_spec_object ("locator",
                          "Locator",
@@ -128,6 +205,29 @@ tmpl_template_class_init (TmplTemplateClass *klass)
                           G_PARAM_CONSTRUCT |
                           G_PARAM_STATIC_STRINGS));
 
+  /**
+   * TmplTemplate:use-arena:
+   *
+   * If temporary strings produced while evaluating expressions should be
+   * allocated from an arena rather than the heap. The arena is reused
+   * once each expression of the template has been expanded, so the memory
+   * used does not grow with the number of iterations of a loop.
+   *
+   * This avoids most allocations for templates that build strings. Values
+   * passed to functions and methods called by the template must not be
+   * kept by them without being copied.
+   *
+   * Since: 3.42
+   */
+  properties [PROP_USE_ARENA] =
+    g_param_spec_boolean ("use-arena",
+                          "Use Arena",
+                          "If temporaries are allocated from a per-expansion arena",
+                          FALSE,
+                          (G_PARAM_READWRITE |
+                           G_PARAM_EXPLICIT_NOTIFY |
+                           G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_properties (object_class, LAST_PROP, properties);
 }
 
@@ -155,6 +255,60 @@ tmpl_template_new (TmplTemplateLocator *locator)
                        NULL);
 }
 
+/*
+ * Local files are mapped rather than read so that the lexer scans the
+ * pages directly and the template text is shared with any other process
+ * mapping the same file. Static text of the program references the
+ * mapping for as long as the template is alive. Anything that cannot be
+ * mapped, such as a pipe, is read as a stream instead.
+ */
+static GInputStream *
+tmpl_template_open_file (GFile         *file,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  g_autofree gchar *path = NULL;
+
+  g_assert (G_IS_FILE (file));
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  if ((path = g_file_get_path (file)))
+    {
+      g_autoptr(GMappedFile) mapped = NULL;
+
+      if ((mapped = g_mapped_file_new (path, FALSE, NULL)))
+        {
+          g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mapped);
+
+          return tmpl_input_stream_new_for_bytes (bytes);
+        }
+    }
+
+  return (GInputStream *)g_file_read (file, cancellable, error);
+}
+
+/**
+ * tmpl_template_parse_file:
+ * @self: A #TmplTemplate
+ * @file: a #GFile
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses the template found in @file.
+ *
+ * Local files are memory-mapped and the static text of the template
+ * references the mapping for the lifetime of @self, rather than a copy.
+ * The file must therefore not be truncated or rewritten in place while
+ * @self is alive, or expanding @self may crash with %SIGBUS. Replacing the
+ * file atomically, such as with g_file_set_contents() or
+ * g_file_replace(), is safe. If the file may be modified in place, load
+ * it with g_file_load_bytes() and use tmpl_template_parse_bytes() instead.
+ *
+ * Returns: %TRUE if the template was parsed, otherwise %FALSE and
+ *   @error is set.
+ */
 gboolean
 tmpl_template_parse_file (TmplTemplate  *self,
                           GFile         *file,
@@ -168,7 +322,7 @@ tmpl_template_parse_file (TmplTemplate  *self,
   g_return_val_if_fail (G_IS_FILE (file), FALSE);
   g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
 
-  stream = (GInputStream *)g_file_read (file, cancellable, error);
+  stream = tmpl_template_open_file (file, cancellable, error);
 
   if (stream != NULL)
     {
@@ -179,6 +333,159 @@ tmpl_template_parse_file (TmplTemplate  *self,
   return ret;
 }
 
+typedef struct
+{
+  GFile               *file;
+  TmplTemplateLocator *locator;
+} ParseFile;
+
+static void
+parse_file_free (gpointer data)
+{
+  ParseFile *pf = data;
+
+  g_clear_object (&pf->file);
+  g_clear_object (&pf->locator);
+  g_slice_free (ParseFile, pf);
+}
+
+static void
+tmpl_template_parse_file_worker (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  ParseFile *pf = task_data;
+  GInputStream *stream;
+  TmplParser *parser;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (TMPL_IS_TEMPLATE (source_object));
+  g_assert (pf != NULL);
+  g_assert (G_IS_FILE (pf->file));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  /*
+   * Only the file and locator are used from this thread. The resulting
+   * program is attached to the template from the calling thread in
+   * tmpl_template_parse_file_finish().
+   */
+
+  if (!(stream = tmpl_template_open_file (pf->file, cancellable, &error)))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  parser = tmpl_parser_new (stream);
+  tmpl_parser_set_locator (parser, pf->locator);
+
+  if (tmpl_parser_parse (parser, cancellable, &error))
+    g_task_return_pointer (task,
+                           tmpl_program_ref (tmpl_parser_get_program (parser)),
+                           (GDestroyNotify)tmpl_program_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (parser);
+  g_object_unref (stream);
+}
+
+/**
+ * tmpl_template_parse_file_async:
+ * @self: A #TmplTemplate
+ * @file: a #GFile
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously parses @file on a worker thread.
+ *
+ * The template is only updated once tmpl_template_parse_file_finish() is
+ * called from @callback, so @self may continue to be used from the calling
+ * thread while the parse is in progress.
+ *
+ * As with tmpl_template_parse_file(), local files are memory-mapped and
+ * must not be rewritten in place while @self is alive.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_parse_file_async (TmplTemplate        *self,
+                                GFile               *file,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+  ParseFile *pf;
+  GTask *task;
+
+  g_return_if_fail (TMPL_IS_TEMPLATE (self));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  pf = g_slice_new0 (ParseFile);
+  pf->file = g_object_ref (file);
+  pf->locator = priv->locator ? g_object_ref (priv->locator) : NULL;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, tmpl_template_parse_file_async);
+  g_task_set_task_data (task, pf, parse_file_free);
+  g_task_run_in_thread (task, tmpl_template_parse_file_worker);
+  g_object_unref (task);
+}
+
+/**
+ * tmpl_template_parse_file_finish:
+ * @self: A #TmplTemplate
+ * @result: a #GAsyncResult provided to the callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes an asynchronous request to tmpl_template_parse_file_async().
+ *
+ * Returns: %TRUE if the template was parsed, otherwise %FALSE and
+ *   @error is set.
+ *
+ * Since: 3.42
+ */
+gboolean
+tmpl_template_parse_file_finish (TmplTemplate  *self,
+                                 GAsyncResult  *result,
+                                 GError       **error)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+  TmplProgram *program;
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  if (!(program = g_task_propagate_pointer (G_TASK (result), error)))
+    return FALSE;
+
+  g_clear_pointer (&priv->program, tmpl_program_unref);
+  priv->program = program;
+
+  return TRUE;
+}
+
+/**
+ * tmpl_template_parse_path:
+ * @self: A #TmplTemplate
+ * @path: the path of a template file
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses the template found at @path.
+ *
+ * The file is memory-mapped for the lifetime of @self, so the same
+ * restrictions as for tmpl_template_parse_file() apply: it must not be
+ * truncated or rewritten in place while @self is alive.
+ *
+ * Returns: %TRUE if the template was parsed, otherwise %FALSE and
+ *   @error is set.
+ */
 gboolean
 tmpl_template_parse_path (TmplTemplate  *self,
                           const gchar   *path,
@@ -230,14 +537,52 @@ tmpl_template_parse_string (TmplTemplate  *self,
                             const gchar   *str,
                             GError       **error)
 {
-  GInputStream *stream;
+  GBytes *bytes;
   gboolean ret;
 
   g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
   g_return_val_if_fail (str, FALSE);
 
-  stream = g_memory_input_stream_new_from_data (g_strdup (str), strlen (str), g_free);
-  ret = tmpl_template_parse (self, stream, NULL, error);
+  bytes = g_bytes_new (str, strlen (str));
+  ret = tmpl_template_parse_bytes (self, bytes, NULL, error);
+  g_bytes_unref (bytes);
+
+  return ret;
+}
+
+/**
+ * tmpl_template_parse_bytes:
+ * @self: A #TmplTemplate
+ * @bytes: a #GBytes containing the template
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses the template found in @bytes.
+ *
+ * The contents of @bytes are scanned in place rather than copied, and
+ * static text of the template continues to reference @bytes, so @bytes
+ * must not be modified for the lifetime of @self.
+ *
+ * Returns: %TRUE if the template was parsed, otherwise %FALSE and
+ *   @error is set.
+ *
+ * Since: 3.42
+ */
+gboolean
+tmpl_template_parse_bytes (TmplTemplate  *self,
+                           GBytes        *bytes,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  GInputStream *stream;
+  gboolean ret;
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
+  g_return_val_if_fail (bytes != NULL, FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  stream = tmpl_input_stream_new_for_bytes (bytes);
+  ret = tmpl_template_parse (self, stream, cancellable, error);
   g_object_unref (stream);
 
   return ret;
@@ -263,7 +608,9 @@ tmpl_template_parse (TmplTemplate  *self,
 
   if (tmpl_parser_parse (parser, cancellable, error))
     {
-      g_set_object (&priv->parser, parser);
+      /* Only the compiled program is needed to expand the template */
+      g_clear_pointer (&priv->program, tmpl_program_unref);
+      priv->program = tmpl_program_ref (tmpl_parser_get_program (parser));
       ret = TRUE;
     }
 
@@ -272,12 +619,312 @@ tmpl_template_parse (TmplTemplate  *self,
   return ret;
 }
 
+/**
+ * tmpl_template_load_compiled:
+ * @self: A #TmplTemplate
+ * @bytes: a #GBytes created with tmpl_template_save_compiled()
+ * @error: a location for a #GError, or %NULL
+ *
+ * Loads a template that was compiled ahead of time, such as with the
+ * tmpl-compile tool, rather than parsing it.
+ *
+ * No lexing or parsing is performed and static text of the template is
+ * referenced from @bytes rather than copied, which makes this well suited
+ * to templates embedded in a #GResource with g_resources_lookup_data().
+ *
+ * Includes were resolved when the template was compiled, so the locator
+ * of @self is not used.
+ *
+ * Returns: %TRUE if the template was loaded, otherwise %FALSE and
+ *   @error is set.
+ *
+ * Since: 3.42
+ */
+gboolean
+tmpl_template_load_compiled (TmplTemplate  *self,
+                             GBytes        *bytes,
+                             GError       **error)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+  TmplProgram *program;
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
+  g_return_val_if_fail (bytes != NULL, FALSE);
+
+  if (!(program = tmpl_program_new_from_bytes (bytes, error)))
+    return FALSE;
+
+  g_clear_pointer (&priv->program, tmpl_program_unref);
+  priv->program = program;
+
+  return TRUE;
+}
+
+/**
+ * tmpl_template_save_compiled:
+ * @self: A #TmplTemplate
+ * @error: a location for a #GError, or %NULL
+ *
+ * Serializes the compiled form of a parsed template so that it may be
+ * restored with tmpl_template_load_compiled().
+ *
+ * The format is versioned and independent of the host byte order, so
+ * templates may be compiled at build time when cross-compiling.
+ *
+ * Returns: (transfer full): a #GBytes or %NULL and @error is set.
+ *
+ * Since: 3.42
+ */
+GBytes *
+tmpl_template_save_compiled (TmplTemplate  *self,
+                             GError       **error)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), NULL);
+
+  if (priv->program == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_INVALID_STATE,
+                   _("Must parse template before saving it"));
+      return NULL;
+    }
+
+  return tmpl_program_serialize (priv->program, error);
+}
+
+/**
+ * tmpl_template_specialize:
+ * @self: A #TmplTemplate
+ * @frozen: a #TmplScope containing symbols that will not change
+ * @error: a location for a #GError, or %NULL
+ *
+ * Creates a new template from @self where everything that only depends
+ * on the symbols of @frozen has been evaluated ahead of time. Expressions
+ * are replaced with their results, branches which can no longer be taken
+ * are removed and the remaining text is merged, so that expanding the new
+ * template only performs the work depending on the scope it is given.
+ *
+ * This is useful when many expansions share a set of symbols, such as
+ * site configuration, along with a few that change for every expansion.
+ *
+ * The values of @frozen, including properties of objects found in it,
+ * are captured now and later changes are not seen by the new template.
+ * Symbols which the template assigns to or uses as loop identifiers are
+ * not taken from @frozen. Functions defined in @frozen are not inlined
+ * and must still be found in the scope used for expansion, for example
+ * by creating that scope with @frozen as its parent.
+ *
+ * Returns: (transfer full): a new #TmplTemplate or %NULL and @error is set.
+ *
+ * Since: 3.42
+ */
+TmplTemplate *
+tmpl_template_specialize (TmplTemplate  *self,
+                          TmplScope     *frozen,
+                          GError       **error)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+  TmplTemplatePrivate *ret_priv;
+  TmplTemplate *ret;
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), NULL);
+  g_return_val_if_fail (frozen != NULL, NULL);
+
+  if (priv->program == NULL)
+    {
+      g_set_error (error,
+                   TMPL_ERROR,
+                   TMPL_ERROR_INVALID_STATE,
+                   _("Must parse template before specializing it"));
+      return NULL;
+    }
+
+  ret = g_object_new (G_OBJECT_TYPE (self),
+                      "locator", priv->locator,
+                      "flush-threshold", priv->flush_threshold,
+                      "use-arena", priv->use_arena,
+                      NULL);
+
+  ret_priv = tmpl_template_get_instance_private (ret);
+  ret_priv->program = tmpl_program_specialize (priv->program, frozen);
+
+  return ret;
+}
+
+/**
+ * tmpl_template_get_memory_usage:
+ * @self: A #TmplTemplate
+ *
+ * Gets the number of bytes of memory used by the parsed template. This
+ * includes the compiled program, its expressions and the text of the
+ * template and its includes, which the template keeps alive.
+ *
+ * Expressions of a template are allocated together when it is parsed and
+ * released together when it is finalized.
+ *
+ * Returns: the number of bytes, or 0 if the template has not been parsed
+ *
+ * Since: 3.42
+ */
+gsize
+tmpl_template_get_memory_usage (TmplTemplate *self)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), 0);
+
+  if (priv->program == NULL)
+    return 0;
+
+  return tmpl_program_get_memory_usage (priv->program);
+}
+
+static void
+tmpl_template_output_init (TmplTemplateOutput *output)
+{
+  output->segments = g_array_new (FALSE, FALSE, sizeof (TmplTemplateSegment));
+  output->scratch = g_string_new (NULL);
+  output->len = 0;
+}
+
+static void
+tmpl_template_output_clear (TmplTemplateOutput *output)
+{
+  g_clear_pointer (&output->segments, g_array_unref);
+  if (output->scratch != NULL)
+    g_string_free (g_steal_pointer (&output->scratch), TRUE);
+  output->len = 0;
+}
+
 static void
-value_into_string (const GValue *value,
-                   GString      *str)
+tmpl_template_output_append (TmplTemplateOutput *output,
+                             const gchar        *str,
+                             gsize               len)
+{
+  TmplTemplateSegment *last = NULL;
+
+  if (len == 0)
+    return;
+
+  if (output->segments->len > 0)
+    last = &g_array_index (output->segments, TmplTemplateSegment, output->segments->len - 1);
+
+  if (last != NULL && last->data == NULL && last->offset + last->len == output->scratch->len)
+    {
+      last->len += len;
+    }
+  else
+    {
+      TmplTemplateSegment segment = { NULL, output->scratch->len, len };
+
+      g_array_append_val (output->segments, segment);
+    }
+
+  g_string_append_len (output->scratch, str, len);
+  output->len += len;
+}
+
+static inline void
+tmpl_template_output_append_static (TmplTemplateOutput *output,
+                                    const gchar        *data,
+                                    gsize               len)
+{
+  TmplTemplateSegment segment = { data, 0, len };
+
+  if (len < TEXT_COPY_THRESHOLD)
+    {
+      tmpl_template_output_append (output, data, len);
+      return;
+    }
+
+  g_array_append_val (output->segments, segment);
+  output->len += len;
+}
+
+static void
+tmpl_template_output_append_output (TmplTemplateOutput       *output,
+                                    const TmplTemplateOutput *other)
+{
+  gsize base = output->scratch->len;
+
+  g_string_append_len (output->scratch, other->scratch->str, other->scratch->len);
+
+  for (guint i = 0; i < other->segments->len; i++)
+    {
+      TmplTemplateSegment segment = g_array_index (other->segments, TmplTemplateSegment, i);
+
+      if (segment.data == NULL)
+        segment.offset += base;
+
+      g_array_append_val (output->segments, segment);
+    }
+
+  output->len += other->len;
+}
+
+static gboolean
+tmpl_template_output_write (TmplTemplateOutput  *output,
+                            GOutputStream       *stream,
+                            GCancellable        *cancellable,
+                            GError             **error)
+{
+  GOutputVector *vectors;
+  gboolean ret;
+
+  g_assert (output != NULL);
+  g_assert (G_IS_OUTPUT_STREAM (stream));
+
+  if (output->len == 0)
+    return TRUE;
+
+  vectors = g_new (GOutputVector, output->segments->len);
+
+  for (guint i = 0; i < output->segments->len; i++)
+    {
+      const TmplTemplateSegment *segment = &g_array_index (output->segments, TmplTemplateSegment, i);
+
+      vectors[i].buffer = segment->data ? segment->data : output->scratch->str + segment->offset;
+      vectors[i].size = segment->len;
+    }
+
+  ret = g_output_stream_writev_all (stream,
+                                    vectors,
+                                    output->segments->len,
+                                    NULL,
+                                    cancellable,
+                                    error);
+
+  g_free (vectors);
+
+  if (ret)
+    {
+      g_array_set_size (output->segments, 0);
+      g_string_truncate (output->scratch, 0);
+      output->len = 0;
+    }
+
+  return ret;
+}
+
+static void
+value_into_output (const GValue       *value,
+                   TmplTemplateOutput *output)
 {
   GValue transform = G_VALUE_INIT;
 
+  if (G_VALUE_HOLDS_STRING (value))
+    {
+      const gchar *tmp;
+
+      if (NULL != (tmp = g_value_get_string (value)))
+        tmpl_template_output_append (output, tmp, strlen (tmp));
+
+      return;
+    }
+
   g_value_init (&transform, G_TYPE_STRING);
 
   if (g_value_transform (value, &transform))
@@ -285,135 +932,510 @@ value_into_string (const GValue *value,
       const gchar *tmp;
 
       if (NULL != (tmp = g_value_get_string (&transform)))
-        g_string_append (str, tmp);
+        tmpl_template_output_append (output, tmp, strlen (tmp));
     }
 
   g_value_unset (&transform);
 }
 
+static gboolean
+tmpl_template_expand_flush (TmplTemplateExpandState *state)
+{
+  g_assert (state != NULL);
+  g_assert (G_IS_OUTPUT_STREAM (state->stream));
+
+  return tmpl_template_output_write (&state->output,
+                                     state->stream,
+                                     state->cancellable,
+                                     state->error);
+}
+
+static inline gboolean
+tmpl_template_expand_maybe_flush (TmplTemplateExpandState *state)
+{
+  if (state->flush_threshold > 0 && state->output.len >= state->flush_threshold)
+    return tmpl_template_expand_flush (state);
+  return TRUE;
+}
+
+/*
+ * Creates @identifier in @scope even if a parent scope has a symbol of the
+ * same name, so that loop variables never overwrite outer symbols. Loop
+ * identifiers are interned by the program.
+ */
+static TmplSymbol *
+tmpl_template_bind_symbol (TmplScope   *scope,
+                           const gchar *identifier)
+{
+  TmplSymbol *symbol = tmpl_symbol_new ();
+
+  tmpl_scope_take_interned (scope, identifier, symbol);
+
+  return symbol;
+}
+
+/*
+ * Releases the temporary strings that were allocated from @scratch since
+ * @mark was taken. Nothing evaluated by an instruction outlives it, except
+ * for the collection of a loop which is released when its frame is popped.
+ */
+static inline void
+tmpl_template_expand_release (TmplArena           *scratch,
+                              const TmplArenaMark *mark)
+{
+  if (scratch != NULL)
+    tmpl_arena_reset (scratch, mark);
+}
+
+static void
+tmpl_template_expand_push_frame (TmplTemplateExpandState *state,
+                                 const gchar             *identifier,
+                                 GValue                  *value,
+                                 TmplArena               *scratch,
+                                 const TmplArenaMark     *mark)
+{
+  TmplTemplateFrame *frame;
+
+  g_array_set_size (state->frames, state->frames->len + 1);
+  frame = &g_array_index (state->frames, TmplTemplateFrame, state->frames->len - 1);
+
+  /* Steal the collection so that it lives as long as the iterator */
+  *frame->value = *value;
+  memset (value, 0, sizeof *value);
+
+  frame->scope = state->scope;
+  state->scope = tmpl_scope_new_with_parent (frame->scope);
+  frame->symbol = tmpl_template_bind_symbol (state->scope, identifier);
+  frame->scratch = scratch;
+
+  if (scratch != NULL)
+    frame->mark = *mark;
+
+  tmpl_iterator_init (&frame->iter, frame->value);
+}
+
 static void
-tmpl_template_expand_visitor (TmplNode *node,
-                              gpointer  user_data)
+tmpl_template_expand_pop_frame (TmplTemplateExpandState *state)
+{
+  TmplTemplateFrame *frame;
+
+  g_assert (state->frames->len > 0);
+
+  frame = &g_array_index (state->frames, TmplTemplateFrame, state->frames->len - 1);
+
+  tmpl_iterator_destroy (&frame->iter);
+  TMPL_CLEAR_VALUE (frame->value);
+  tmpl_template_expand_release (frame->scratch, &frame->mark);
+
+  tmpl_scope_unref (state->scope);
+  state->scope = frame->scope;
+
+  g_array_set_size (state->frames, state->frames->len - 1);
+}
+
+static gboolean tmpl_template_expand_parallel (TmplTemplateExpandState *state,
+                                               const TmplInstruction   *insn,
+                                               guint                    pc,
+                                               const GValue            *collection);
+
+/*
+ * Runs the instructions from @begin until control reaches @end, which is
+ * either the end of the program or the end of a parallel loop body.
+ */
+static gboolean
+tmpl_template_expand_program (TmplTemplateExpandState *state,
+                              guint                    begin,
+                              guint                    end)
 {
-  TmplTemplateExpandState *state = user_data;
+  const TmplInstruction *instructions;
+  TmplArena *scratch = tmpl_arena_get_scratch ();
+  guint n_instructions;
+  guint pc = begin;
 
-  g_assert (TMPL_IS_NODE (node));
   g_assert (state != NULL);
+  g_assert (state->program != NULL);
 
-  /* Short cirtcuit if an error occurred */
-  if (state->result == FALSE)
-    return;
+  instructions = tmpl_program_get_instructions (state->program, &n_instructions);
+  end = MIN (end, n_instructions);
 
-  if (TMPL_IS_TEXT_NODE (node))
-    {
-      g_string_append (state->output, tmpl_text_node_get_text (TMPL_TEXT_NODE (node)));
-    }
-  else if (TMPL_IS_EXPR_NODE (node))
+  while (pc < end)
     {
-      GValue return_value = { 0 };
-      TmplExpr *expr;
+      const TmplInstruction *insn = &instructions[pc];
+      GValue value = G_VALUE_INIT;
+      TmplArenaMark mark;
 
-      expr = tmpl_expr_node_get_expr (TMPL_EXPR_NODE (node));
+      if (g_cancellable_set_error_if_cancelled (state->cancellable, state->error))
+        return FALSE;
 
-      if (!tmpl_expr_eval (expr, state->scope, &return_value, state->error))
+      if (scratch != NULL)
+        tmpl_arena_mark (scratch, &mark);
+
+      switch (insn->opcode)
         {
-          state->result = FALSE;
-          return;
-        }
+        case TMPL_OP_TEXT:
+          tmpl_template_output_append_static (&state->output, insn->text, insn->len);
+          if (!tmpl_template_expand_maybe_flush (state))
+            return FALSE;
+          pc++;
+          break;
 
-      if (!tmpl_expr_node_get_silence (TMPL_EXPR_NODE (node)))
-        value_into_string (&return_value, state->output);
+        case TMPL_OP_EXPR:
+          if (!tmpl_expr_eval (insn->expr, state->scope, &value, state->error))
+            return FALSE;
 
-      g_value_unset (&return_value);
-    }
-  else if (TMPL_IS_BRANCH_NODE (node))
-    {
-      TmplNode *child;
-      GError *local_error = NULL;
+          if (!insn->silence && G_IS_VALUE (&value))
+            value_into_output (&value, &state->output);
 
-      child = tmpl_branch_node_branch (TMPL_BRANCH_NODE (node), state->scope, &local_error);
+          TMPL_CLEAR_VALUE (&value);
+          tmpl_template_expand_release (scratch, &mark);
 
-      if (child != NULL)
-        tmpl_node_visit_children (child, tmpl_template_expand_visitor, state);
-      else if (local_error != NULL)
-        {
-          g_propagate_error (state->error, local_error);
-          state->result = FALSE;
+          if (!tmpl_template_expand_maybe_flush (state))
+            return FALSE;
+          pc++;
+          break;
+
+        case TMPL_OP_JUMP:
+          pc = insn->jump;
+          break;
+
+        case TMPL_OP_JUMP_IF_FALSE:
+          {
+            gboolean cond;
+
+            if (!tmpl_expr_eval_boolean (insn->expr, state->scope, &cond, state->error))
+              return FALSE;
+
+            tmpl_template_expand_release (scratch, &mark);
+
+            if (cond)
+              pc++;
+            else
+              pc = insn->jump;
+          }
+          break;
+
+        case TMPL_OP_ITER_BEGIN:
+          if (!tmpl_expr_eval (insn->expr, state->scope, &value, state->error))
+            return FALSE;
+
+          if (tmpl_value_as_boolean (&value))
+            {
+              tmpl_template_expand_push_frame (state, insn->text, &value, scratch, &mark);
+              pc++;
+            }
+          else
+            {
+              TMPL_CLEAR_VALUE (&value);
+              tmpl_template_expand_release (scratch, &mark);
+              pc = insn->jump;
+            }
+          break;
+
+        case TMPL_OP_ITER_NEXT:
+          {
+            TmplTemplateFrame *frame;
+
+            g_assert (state->frames->len > 0);
+
+            frame = &g_array_index (state->frames, TmplTemplateFrame, state->frames->len - 1);
+
+            if (tmpl_iterator_next (&frame->iter))
+              {
+                tmpl_iterator_get_value (&frame->iter, &value);
+                tmpl_symbol_assign_value (frame->symbol, &value);
+                TMPL_CLEAR_VALUE (&value);
+                tmpl_template_expand_release (scratch, &mark);
+                pc++;
+              }
+            else
+              {
+                tmpl_template_expand_pop_frame (state);
+                pc = insn->jump;
+              }
+          }
+          break;
+
+        case TMPL_OP_ITER_PARALLEL:
+          if (!tmpl_expr_eval (insn->expr, state->scope, &value, state->error))
+            return FALSE;
+
+          if (tmpl_value_as_boolean (&value) &&
+              !tmpl_template_expand_parallel (state, insn, pc, &value))
+            {
+              TMPL_CLEAR_VALUE (&value);
+              return FALSE;
+            }
+
+          TMPL_CLEAR_VALUE (&value);
+          tmpl_template_expand_release (scratch, &mark);
+          pc = insn->jump;
+          break;
+
+        case TMPL_OP_FLUSH:
+          if (!tmpl_template_expand_flush (state) ||
+              !g_output_stream_flush (state->stream, state->cancellable, state->error))
+            return FALSE;
+          pc++;
+          break;
+
+        default:
+          g_assert_not_reached ();
+          return FALSE;
         }
     }
-  else if (TMPL_IS_CONDITION_NODE (node))
-    {
-      TmplExpr *expr;
-      GValue value = G_VALUE_INIT;
 
-      expr = tmpl_condition_node_get_condition (TMPL_CONDITION_NODE (node));
+  return TRUE;
+}
+
+/*
+ * Iterations of a parallel loop are split into chunks of consecutive items
+ * which are claimed in order by the calling thread and by any idle threads
+ * of a shared pool. Each chunk is expanded into its own buffer with its own
+ * child scope, and the buffers are appended to the output in order once
+ * every chunk has completed. The body was checked by the compiler to not
+ * assign to any scope, so the chunks only read from the shared parent.
+ */
+#define PARALLEL_CHUNKS_PER_THREAD 4
 
-      if (!tmpl_expr_eval (expr, state->scope, &value, state->error))
-        {
-          state->result = FALSE;
-          return;
-        }
+typedef struct
+{
+  volatile gint  ref_count;
+
+  TmplProgram   *program;
+  TmplScope     *scope;
+  GCancellable  *cancellable;
+  const gchar   *identifier;
+  guint          begin;
+  guint          end;
+
+  GArray        *items;
+  guint          chunk_size;
+  guint          n_chunks;
+  volatile gint  next_chunk;
+  volatile gint  failed;
+
+  /* Guarded by mutex */
+  GMutex         mutex;
+  GCond          cond;
+  TmplTemplateOutput *outputs;
+  guint          n_completed;
+  GError        *error;
+} TmplTemplateParallel;
+
+static void
+clear_value (gpointer data)
+{
+  TMPL_CLEAR_VALUE ((GValue *)data);
+}
 
-      if (tmpl_value_as_boolean (&value))
-        tmpl_node_visit_children (node, tmpl_template_expand_visitor, state);
+static TmplTemplateParallel *
+tmpl_template_parallel_ref (TmplTemplateParallel *loop)
+{
+  g_atomic_int_inc (&loop->ref_count);
+  return loop;
+}
 
-      TMPL_CLEAR_VALUE (&value);
+static void
+tmpl_template_parallel_unref (TmplTemplateParallel *loop)
+{
+  if (g_atomic_int_dec_and_test (&loop->ref_count))
+    {
+      for (guint i = 0; loop->outputs != NULL && i < loop->n_chunks; i++)
+        tmpl_template_output_clear (&loop->outputs[i]);
+
+      g_clear_pointer (&loop->outputs, g_free);
+      g_clear_pointer (&loop->items, g_array_unref);
+      g_clear_pointer (&loop->scope, tmpl_scope_unref);
+      g_clear_pointer (&loop->program, tmpl_program_unref);
+      g_clear_object (&loop->cancellable);
+      g_clear_error (&loop->error);
+      g_mutex_clear (&loop->mutex);
+      g_cond_clear (&loop->cond);
+      g_slice_free (TmplTemplateParallel, loop);
     }
-  else if (TMPL_IS_ITER_NODE (node))
+}
+
+static void
+tmpl_template_parallel_expand_chunk (TmplTemplateParallel *loop,
+                                     guint                 chunk)
+{
+  TmplTemplateExpandState state = { 0 };
+  TmplSymbol *symbol;
+  GError *error = NULL;
+  gboolean ret = TRUE;
+  guint first;
+  guint last;
+
+  g_assert (loop != NULL);
+  g_assert (chunk < loop->n_chunks);
+
+  first = chunk * loop->chunk_size;
+  last = MIN (first + loop->chunk_size, loop->items->len);
+
+  state.program = loop->program;
+  tmpl_template_output_init (&state.output);
+  state.cancellable = loop->cancellable;
+  state.frames = g_array_new (FALSE, TRUE, sizeof (TmplTemplateFrame));
+  state.error = &error;
+  state.scope = tmpl_scope_new_with_parent (loop->scope);
+
+  symbol = tmpl_template_bind_symbol (state.scope, loop->identifier);
+
+  /* Stop early if another chunk failed, the output will be discarded */
+  for (guint i = first; ret && i < last && !g_atomic_int_get (&loop->failed); i++)
     {
-      const gchar *identifier;
-      TmplExpr *expr;
-      GValue return_value = G_VALUE_INIT;
+      tmpl_symbol_assign_value (symbol, &g_array_index (loop->items, GValue, i));
+      ret = tmpl_template_expand_program (&state, loop->begin, loop->end);
+    }
 
-      identifier = tmpl_iter_node_get_identifier (TMPL_ITER_NODE (node));
+  while (state.frames->len > 0)
+    tmpl_template_expand_pop_frame (&state);
 
-      expr = tmpl_iter_node_get_expr (TMPL_ITER_NODE (node));
+  g_mutex_lock (&loop->mutex);
 
-      if (!tmpl_expr_eval (expr, state->scope, &return_value, state->error))
-        {
-          state->result = FALSE;
-          return;
-        }
+  if (!ret)
+    {
+      if (loop->error == NULL)
+        loop->error = g_steal_pointer (&error);
+      g_atomic_int_set (&loop->failed, TRUE);
+    }
+  else
+    {
+      loop->outputs[chunk] = state.output;
+      memset (&state.output, 0, sizeof state.output);
+    }
 
-      if (tmpl_value_as_boolean (&return_value))
-        {
-          TmplIterator iter;
-          TmplScope *old_scope = state->scope;
-          TmplScope *new_scope = tmpl_scope_new_with_parent (old_scope);
-          TmplSymbol *symbol;
+  if (++loop->n_completed == loop->n_chunks)
+    g_cond_broadcast (&loop->cond);
 
-          state->scope = new_scope;
+  g_mutex_unlock (&loop->mutex);
 
-          symbol = tmpl_scope_get (new_scope, identifier);
+  tmpl_template_output_clear (&state.output);
+  g_array_unref (state.frames);
+  tmpl_scope_unref (state.scope);
+  g_clear_error (&error);
+}
 
-          tmpl_iterator_init (&iter, &return_value);
+static void
+tmpl_template_parallel_run (TmplTemplateParallel *loop)
+{
+  guint chunk;
 
-          while (tmpl_iterator_next (&iter))
-            {
-              GValue value = G_VALUE_INIT;
+  while ((chunk = g_atomic_int_add (&loop->next_chunk, 1)) < loop->n_chunks)
+    tmpl_template_parallel_expand_chunk (loop, chunk);
+}
 
-              tmpl_iterator_get_value (&iter, &value);
-              tmpl_symbol_assign_value (symbol, &value);
-              TMPL_CLEAR_VALUE (&value);
+static void
+tmpl_template_parallel_worker (gpointer data,
+                               gpointer user_data)
+{
+  TmplTemplateParallel *loop = data;
 
-              tmpl_node_visit_children (node, tmpl_template_expand_visitor, state);
+  tmpl_template_parallel_run (loop);
+  tmpl_template_parallel_unref (loop);
+}
 
-              if (state->result == FALSE)
-                break;
-            }
+static GThreadPool *
+tmpl_template_get_thread_pool (void)
+{
+  static GThreadPool *pool;
 
-          tmpl_iterator_destroy (&iter);
+  if (g_once_init_enter_pointer (&pool))
+    g_once_init_leave_pointer (&pool,
+                               g_thread_pool_new (tmpl_template_parallel_worker,
+                                                  NULL,
+                                                  g_get_num_processors (),
+                                                  FALSE,
+                                                  NULL));
 
-          state->scope = old_scope;
-          tmpl_scope_unref (new_scope);
-        }
+  return pool;
+}
 
-      g_value_unset (&return_value);
+static gboolean
+tmpl_template_expand_parallel (TmplTemplateExpandState *state,
+                               const TmplInstruction   *insn,
+                               guint                    pc,
+                               const GValue            *collection)
+{
+  TmplTemplateParallel *loop;
+  TmplIterator iter;
+  gboolean ret = TRUE;
+  guint n_threads;
+  guint n_workers;
+
+  g_assert (state != NULL);
+  g_assert (insn != NULL);
+  g_assert (insn->opcode == TMPL_OP_ITER_PARALLEL);
+  g_assert (collection != NULL);
+
+  loop = g_slice_new0 (TmplTemplateParallel);
+  loop->ref_count = 1;
+  loop->program = tmpl_program_ref (state->program);
+  loop->scope = tmpl_scope_ref (state->scope);
+  loop->cancellable = state->cancellable ? g_object_ref (state->cancellable) : NULL;
+  loop->identifier = insn->text;
+  loop->begin = pc + 1;
+  loop->end = insn->jump;
+  loop->items = g_array_new (FALSE, TRUE, sizeof (GValue));
+  g_array_set_clear_func (loop->items, clear_value);
+  g_mutex_init (&loop->mutex);
+  g_cond_init (&loop->cond);
+
+  /* Materialize the items so that they can be partitioned */
+  tmpl_iterator_init (&iter, collection);
+  while (tmpl_iterator_next (&iter))
+    {
+      GValue value = G_VALUE_INIT;
+
+      tmpl_iterator_get_value (&iter, &value);
+      g_array_append_val (loop->items, value);
     }
-  else
+  tmpl_iterator_destroy (&iter);
+
+  if (loop->items->len == 0)
+    goto cleanup;
+
+  n_threads = MAX (1, g_get_num_processors ());
+  loop->chunk_size = MAX (1, loop->items->len / (n_threads * PARALLEL_CHUNKS_PER_THREAD));
+  loop->n_chunks = (loop->items->len + loop->chunk_size - 1) / loop->chunk_size;
+  loop->outputs = g_new0 (TmplTemplateOutput, loop->n_chunks);
+
+  /*
+   * The calling thread expands chunks too, which guarantees progress even
+   * if every pool thread is busy, such as with nested parallel loops.
+   */
+  n_workers = MIN (loop->n_chunks, n_threads) - 1;
+  for (guint i = 0; i < n_workers; i++)
+    g_thread_pool_push (tmpl_template_get_thread_pool (),
+                        tmpl_template_parallel_ref (loop),
+                        NULL);
+
+  tmpl_template_parallel_run (loop);
+
+  g_mutex_lock (&loop->mutex);
+  while (loop->n_completed < loop->n_chunks)
+    g_cond_wait (&loop->cond, &loop->mutex);
+  g_mutex_unlock (&loop->mutex);
+
+  if (loop->error != NULL)
+    {
+      g_propagate_error (state->error, g_steal_pointer (&loop->error));
+      ret = FALSE;
+      goto cleanup;
+    }
+
+  for (guint i = 0; i < loop->n_chunks; i++)
     {
-      g_warning ("Teach me how to expand %s", G_OBJECT_TYPE_NAME (node));
+      tmpl_template_output_append_output (&state->output, &loop->outputs[i]);
+
+      if (!(ret = tmpl_template_expand_maybe_flush (state)))
+        break;
     }
+
+cleanup:
+  tmpl_template_parallel_unref (loop);
+
+  return ret;
 }
 
 /**
@@ -433,6 +1455,16 @@ tmpl_template_expand_visitor (TmplNode *node,
  * To set a symbol value, get the symbol with tmpl_scope_get() and assign
  * a value using tmpl_scope_assign_value() or similar methods.
  *
+ * Unless #TmplTemplate:flush-threshold is set, or the template contains a
+ * `{{flush}}` directive, nothing is written to @stream until the whole
+ * template has been expanded.
+ *
+ * Once parsed, a template may be expanded from multiple threads at the same
+ * time, provided each expansion uses its own @scope. Those scopes may share
+ * a parent scope as long as nothing modifies it during expansion, and any
+ * resolver set with tmpl_scope_set_resolver() on it must be thread-safe.
+ * The template must not be parsed again while it is being expanded.
+ *
  * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
  */
 gboolean
@@ -445,12 +1477,14 @@ tmpl_template_expand (TmplTemplate  *self,
   TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
   TmplTemplateExpandState state = { 0 };
   TmplScope *local_scope = NULL;
+  TmplArena *arena = NULL;
+  gboolean ret;
 
   g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
   g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
   g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
 
-  if (priv->parser == NULL)
+  if (priv->program == NULL)
     {
       g_set_error (error,
                    TMPL_ERROR,
@@ -462,31 +1496,155 @@ tmpl_template_expand (TmplTemplate  *self,
   if (scope == NULL)
     scope = local_scope = tmpl_scope_new ();
 
-  state.root = tmpl_parser_get_root (priv->parser);
+  state.program = priv->program;
   state.self = self;
-  state.output = g_string_new (NULL);
-  state.result = TRUE;
+  tmpl_template_output_init (&state.output);
+  state.stream = stream;
+  state.cancellable = cancellable;
+  state.flush_threshold = priv->flush_threshold;
+  state.frames = g_array_new (FALSE, TRUE, sizeof (TmplTemplateFrame));
   state.error = error;
   state.scope = scope;
 
-  tmpl_node_visit_children (state.root, tmpl_template_expand_visitor, &state);
+  if (priv->use_arena)
+    {
+      arena = tmpl_arena_new ();
+      tmpl_arena_push_scratch (arena);
+    }
+
+  ret = tmpl_template_expand_program (&state, 0, G_MAXUINT) &&
+        tmpl_template_expand_flush (&state);
+
+  /* Unwind any loops that were left due to an error */
+  while (state.frames->len > 0)
+    tmpl_template_expand_pop_frame (&state);
+
+  if (arena != NULL)
+    {
+      tmpl_arena_pop_scratch (arena);
+      tmpl_arena_unref (arena);
+    }
 
-  if (state.result != FALSE)
-    state.result = g_output_stream_write_all (stream,
-                                              state.output->str,
-                                              state.output->len,
-                                              NULL,
-                                              cancellable,
-                                              error);
+  g_assert (state.scope == scope);
 
-  g_string_free (state.output, TRUE);
+  g_array_unref (state.frames);
+  tmpl_template_output_clear (&state.output);
 
   if (local_scope != NULL)
     tmpl_scope_unref (local_scope);
 
-  g_assert (state.result == TRUE || (state.error == NULL || *state.error != NULL));
+  g_assert (ret == TRUE || (state.error == NULL || *state.error != NULL));
+
+  return ret;
+}
+
+typedef struct
+{
+  GOutputStream *stream;
+  TmplScope     *scope;
+} Expand;
+
+static void
+expand_free (gpointer data)
+{
+  Expand *e = data;
+
+  g_clear_object (&e->stream);
+  g_clear_pointer (&e->scope, tmpl_scope_unref);
+  g_slice_free (Expand, e);
+}
+
+static void
+tmpl_template_expand_worker (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+  TmplTemplate *self = source_object;
+  Expand *e = task_data;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (TMPL_IS_TEMPLATE (self));
+  g_assert (e != NULL);
+  g_assert (G_IS_OUTPUT_STREAM (e->stream));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  if (tmpl_template_expand (self, e->stream, e->scope, cancellable, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+/**
+ * tmpl_template_expand_async:
+ * @self: A #TmplTemplate.
+ * @stream: a #GOutputStream to write the results to
+ * @scope: (nullable): A #TmplScope containing state for the template, or %NULL.
+ * @cancellable: (nullable): An optional cancellable for the operation.
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously expands the template into @stream on a worker thread.
+ *
+ * @cancellable is checked between each instruction of the compiled program,
+ * so a long running expansion may be abandoned quickly.
+ *
+ * Neither @scope, @stream, nor any objects reachable from @scope may be
+ * used from another thread until the operation has completed, and the
+ * template must not be re-parsed in the mean time.
+ *
+ * See tmpl_template_expand() for more information.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_expand_async (TmplTemplate        *self,
+                            GOutputStream       *stream,
+                            TmplScope           *scope,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  Expand *e;
+  GTask *task;
 
-  return state.result;
+  g_return_if_fail (TMPL_IS_TEMPLATE (self));
+  g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  e = g_slice_new0 (Expand);
+  e->stream = g_object_ref (stream);
+  e->scope = scope ? tmpl_scope_ref (scope) : NULL;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, tmpl_template_expand_async);
+  g_task_set_task_data (task, e, expand_free);
+  g_task_run_in_thread (task, tmpl_template_expand_worker);
+  g_object_unref (task);
+}
+
+/**
+ * tmpl_template_expand_finish:
+ * @self: A #TmplTemplate
+ * @result: a #GAsyncResult provided to the callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes an asynchronous request to tmpl_template_expand_async().
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ *
+ * Since: 3.42
+ */
+gboolean
+tmpl_template_expand_finish (TmplTemplate  *self,
+                             GAsyncResult  *result,
+                             GError       **error)
+{
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 /**
@@ -565,3 +1723,97 @@ tmpl_template_set_locator (TmplTemplate        *self,
   if (g_set_object (&priv->locator, locator))
     g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_LOCATOR]);
 }
+
+/**
+ * tmpl_template_get_flush_threshold:
+ * @self: A #TmplTemplate
+ *
+ * Gets the #TmplTemplate:flush-threshold property.
+ *
+ * Returns: the number of bytes buffered before flushing, or 0 if the
+ *   expansion is buffered until completion.
+ *
+ * Since: 3.42
+ */
+guint
+tmpl_template_get_flush_threshold (TmplTemplate *self)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), 0);
+
+  return priv->flush_threshold;
+}
+
+/**
+ * tmpl_template_set_flush_threshold:
+ * @self: A #TmplTemplate
+ * @flush_threshold: the number of bytes to buffer, or 0
+ *
+ * Sets the number of bytes of expanded output to buffer before it is
+ * written to the output stream. See #TmplTemplate:flush-threshold.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_set_flush_threshold (TmplTemplate *self,
+                                   guint         flush_threshold)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_if_fail (TMPL_IS_TEMPLATE (self));
+
+  if (priv->flush_threshold != flush_threshold)
+    {
+      priv->flush_threshold = flush_threshold;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_FLUSH_THRESHOLD]);
+    }
+}
+
+/**
+ * tmpl_template_get_use_arena:
+ * @self: A #TmplTemplate
+ *
+ * Gets the #TmplTemplate:use-arena property.
+ *
+ * Returns: %TRUE if temporaries are allocated from a per-expansion arena.
+ *
+ * Since: 3.42
+ */
+gboolean
+tmpl_template_get_use_arena (TmplTemplate *self)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_val_if_fail (TMPL_IS_TEMPLATE (self), FALSE);
+
+  return priv->use_arena;
+}
+
+/**
+ * tmpl_template_set_use_arena:
+ * @self: A #TmplTemplate
+ * @use_arena: if an arena should be used
+ *
+ * Sets if temporaries produced while expanding @self should be allocated
+ * from an arena released once the expansion completes. See
+ * #TmplTemplate:use-arena.
+ *
+ * Since: 3.42
+ */
+void
+tmpl_template_set_use_arena (TmplTemplate *self,
+                             gboolean      use_arena)
+{
+  TmplTemplatePrivate *priv = tmpl_template_get_instance_private (self);
+
+  g_return_if_fail (TMPL_IS_TEMPLATE (self));
+
+  use_arena = !!use_arena;
+
+  if (priv->use_arena != use_arena)
+    {
+      priv->use_arena = use_arena;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_USE_ARENA]);
+    }
+}
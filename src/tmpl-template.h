@@ -53,6 +53,16 @@ gboolean             tmpl_template_parse_file     (TmplTemplate         *self,
                                                    GFile                *file,
                                                    GCancellable         *cancellable,
                                                    GError              **error);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_parse_file_async  (TmplTemplate         *self,
+                                                      GFile                *file,
+                                                      GCancellable         *cancellable,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+TMPL_AVAILABLE_IN_3_42
+gboolean             tmpl_template_parse_file_finish (TmplTemplate         *self,
+                                                      GAsyncResult         *result,
+                                                      GError              **error);
 TMPL_AVAILABLE_IN_ALL
 gboolean             tmpl_template_parse_resource (TmplTemplate         *self,
                                                    const gchar          *path,
@@ -67,21 +77,60 @@ TMPL_AVAILABLE_IN_ALL
 gboolean             tmpl_template_parse_string   (TmplTemplate         *self,
                                                    const gchar          *input,
                                                    GError              **error);
+TMPL_AVAILABLE_IN_3_42
+gboolean             tmpl_template_parse_bytes    (TmplTemplate         *self,
+                                                   GBytes               *bytes,
+                                                   GCancellable         *cancellable,
+                                                   GError              **error);
 TMPL_AVAILABLE_IN_ALL
 gboolean             tmpl_template_parse          (TmplTemplate         *self,
                                                    GInputStream         *stream,
                                                    GCancellable         *cancellable,
                                                    GError              **error);
+TMPL_AVAILABLE_IN_3_42
+gboolean             tmpl_template_load_compiled  (TmplTemplate         *self,
+                                                   GBytes               *bytes,
+                                                   GError              **error);
+TMPL_AVAILABLE_IN_3_42
+GBytes              *tmpl_template_save_compiled  (TmplTemplate         *self,
+                                                   GError              **error);
+TMPL_AVAILABLE_IN_3_42
+TmplTemplate        *tmpl_template_specialize     (TmplTemplate         *self,
+                                                   TmplScope            *frozen,
+                                                   GError              **error);
 TMPL_AVAILABLE_IN_ALL
 gboolean             tmpl_template_expand         (TmplTemplate         *self,
                                                    GOutputStream        *stream,
                                                    TmplScope            *scope,
                                                    GCancellable         *cancellable,
                                                    GError              **error);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_expand_async   (TmplTemplate         *self,
+                                                   GOutputStream        *stream,
+                                                   TmplScope            *scope,
+                                                   GCancellable         *cancellable,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+TMPL_AVAILABLE_IN_3_42
+gboolean             tmpl_template_expand_finish  (TmplTemplate         *self,
+                                                   GAsyncResult         *result,
+                                                   GError              **error);
 TMPL_AVAILABLE_IN_ALL
 gchar               *tmpl_template_expand_string  (TmplTemplate         *self,
                                                    TmplScope            *scope,
                                                    GError              **error);
+TMPL_AVAILABLE_IN_3_42
+guint                tmpl_template_get_flush_threshold (TmplTemplate    *self);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_set_flush_threshold (TmplTemplate    *self,
+                                                        guint            flush_threshold);
+TMPL_AVAILABLE_IN_3_42
+gsize                tmpl_template_get_memory_usage    (TmplTemplate    *self);
+TMPL_AVAILABLE_IN_3_42
+gboolean             tmpl_template_get_use_arena       (TmplTemplate    *self);
+TMPL_AVAILABLE_IN_3_42
+void                 tmpl_template_set_use_arena       (TmplTemplate    *self,
+                                                        gboolean         use_arena);
 
 G_END_DECLS
 
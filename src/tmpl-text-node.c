@@ -24,7 +24,7 @@
 struct _TmplTextNode
 {
   TmplNode  parent_instance;
-  gchar    *text;
+  GBytes   *bytes;
 };
 
 G_DEFINE_TYPE (TmplTextNode, tmpl_text_node, TMPL_TYPE_NODE)
@@ -55,7 +55,7 @@ tmpl_text_node_finalize (GObject *object)
 {
   TmplTextNode *self = (TmplTextNode *)object;
 
-  g_clear_pointer (&self->text, g_free);
+  g_clear_pointer (&self->bytes, g_bytes_unref);
 
   G_OBJECT_CLASS (tmpl_text_node_parent_class)->finalize (object);
 }
@@ -79,27 +79,37 @@ tmpl_text_node_init (TmplTextNode *node)
 
 /**
  * tmpl_text_node_new:
- * @text: (transfer full): the text for the node
+ * @bytes: (transfer full): the text for the node
  *
- * Creates a new text node.
+ * Creates a new text node. @bytes is usually a slice of the template
+ * source so that the text is not copied.
  *
  * Returns: (transfer full): the new node.
  */
 TmplNode *
-tmpl_text_node_new (gchar *text)
+tmpl_text_node_new (GBytes *bytes)
 {
   TmplTextNode *self;
 
+  g_return_val_if_fail (bytes != NULL, NULL);
+
   self = g_object_new (TMPL_TYPE_TEXT_NODE, NULL);
-  self->text = text;
+  self->bytes = bytes;
 
   return TMPL_NODE (self);
 }
 
-const gchar *
-tmpl_text_node_get_text (TmplTextNode *self)
+/**
+ * tmpl_text_node_get_bytes:
+ *
+ * Gets the text of the node.
+ *
+ * Returns: (transfer none): A #GBytes.
+ */
+GBytes *
+tmpl_text_node_get_bytes (TmplTextNode *self)
 {
   g_return_val_if_fail (TMPL_IS_TEXT_NODE (self), NULL);
 
-  return self->text;
+  return self->bytes;
 }
@@ -27,10 +27,8 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (TmplTextNode, tmpl_text_node, TMPL, TEXT_NODE, TmplNode)
 
-TmplNode     *tmpl_text_node_new      (gchar        *text);
-const gchar  *tmpl_text_node_get_text (TmplTextNode *self);
-void          tmpl_text_node_set_text (TmplTextNode *self,
-                                       const gchar  *text);
+TmplNode *tmpl_text_node_new       (GBytes       *bytes);
+GBytes   *tmpl_text_node_get_bytes (TmplTextNode *self);
 
 G_END_DECLS
 
@@ -18,47 +18,231 @@
 
 #include "config.h"
 
+#if defined (__SSE2__)
+# include <emmintrin.h>
+#endif
+#if defined (__GNUC__) && defined (__x86_64__)
+# include <immintrin.h>
+# define TMPL_SCAN_AVX2 1
+#endif
+
 #include "tmpl-token-input-stream.h"
 #include "tmpl-token-private.h"
+#include "tmpl-util-private.h"
 
 struct _TmplTokenInputStream
 {
-  GDataInputStream parent_instance;
-  guint            swallow_newline : 1;
-  guint            last_was_text_with_newline : 1;
+  GDataInputStream  parent_instance;
+
+  /*
+   * The whole template is read into a single buffer before scanning so
+   * that text tokens can reference slices of it rather than copies.
+   */
+  GBytes           *bytes;
+  const gchar      *data;
+  gsize             len;
+  gsize             pos;
+
+  guint             swallow_newline : 1;
 };
 
 G_DEFINE_TYPE (TmplTokenInputStream, tmpl_token_input_stream, G_TYPE_DATA_INPUT_STREAM)
 
+static void
+tmpl_token_input_stream_finalize (GObject *object)
+{
+  TmplTokenInputStream *self = (TmplTokenInputStream *)object;
+
+  g_clear_pointer (&self->bytes, g_bytes_unref);
+
+  G_OBJECT_CLASS (tmpl_token_input_stream_parent_class)->finalize (object);
+}
+
 static void
 tmpl_token_input_stream_class_init (TmplTokenInputStreamClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = tmpl_token_input_stream_finalize;
 }
 
 static void
 tmpl_token_input_stream_init (TmplTokenInputStream *self)
 {
-  self->last_was_text_with_newline = TRUE;
 }
 
 static gboolean
-tmpl_token_input_stream_read_unichar (TmplTokenInputStream  *self,
-                                      gunichar              *unichar,
-                                      GCancellable          *cancellable,
-                                      GError               **error)
+tmpl_token_input_stream_load (TmplTokenInputStream  *self,
+                              GCancellable          *cancellable,
+                              GError               **error)
 {
-  GBufferedInputStream *stream = (GBufferedInputStream *)self;
-  gchar str[8] = { 0 };
-  gint c;
-  gint n;
-  gint i;
+  GOutputStream *memory;
+  GInputStream *base_stream;
+  GBytes *bytes;
+  gboolean ret;
 
   g_assert (TMPL_IS_TOKEN_INPUT_STREAM (self));
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  if (-1 == (c = g_buffered_input_stream_read_byte (stream, cancellable, error)))
+  if (self->bytes != NULL)
+    return TRUE;
+
+  /* Scan the bytes of mapped files and strings in place */
+  base_stream = g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (self));
+
+  if ((bytes = tmpl_input_stream_peek_bytes (base_stream)))
+    {
+      self->bytes = g_bytes_ref (bytes);
+      self->data = g_bytes_get_data (self->bytes, &self->len);
+      self->pos = 0;
+      return TRUE;
+    }
+
+  memory = g_memory_output_stream_new_resizable ();
+  ret = g_output_stream_splice (memory,
+                                G_INPUT_STREAM (self),
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                cancellable,
+                                error) >= 0;
+
+  if (ret)
+    {
+      self->bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory));
+      self->data = g_bytes_get_data (self->bytes, &self->len);
+      self->pos = 0;
+    }
+
+  g_object_unref (memory);
+
+  return ret;
+}
+
+/*
+ * The lexer only ever needs to find the next of a few delimiters, so
+ * rather than looking at each byte we compare 16 or 32 bytes at a time
+ * against every delimiter and locate the first match from the resulting
+ * mask. Any remainder shorter than a vector is scanned a byte at a time.
+ *
+ * Text is scanned for \ and {, while tags are scanned for \, ", } and %.
+ */
+static const gchar text_delimiters[4] = { '\\', '{', '\\', '{' };
+static const gchar tag_delimiters[4] = { '\\', '"', '}', '%' };
+
+#ifdef TMPL_SCAN_AVX2
+__attribute__((target ("avx2")))
+static gsize
+tmpl_token_scan_avx2 (const gchar *data,
+                      gsize        len,
+                      const gchar  set[4])
+{
+  const __m256i a = _mm256_set1_epi8 (set[0]);
+  const __m256i b = _mm256_set1_epi8 (set[1]);
+  const __m256i c = _mm256_set1_epi8 (set[2]);
+  const __m256i d = _mm256_set1_epi8 (set[3]);
+  gsize i;
+
+  for (i = 0; i + 32 <= len; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *)(gconstpointer)(data + i));
+      __m256i m = _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, a),
+                                                    _mm256_cmpeq_epi8 (v, b)),
+                                   _mm256_or_si256 (_mm256_cmpeq_epi8 (v, c),
+                                                    _mm256_cmpeq_epi8 (v, d)));
+      guint mask = (guint)_mm256_movemask_epi8 (m);
+
+      if (mask != 0)
+        return i + __builtin_ctz (mask);
+    }
+
+  return i;
+}
+#endif
+
+/*
+ * Returns the offset of the first byte of @data found in @set,
+ * or @len if there is none.
+ */
+static gsize
+tmpl_token_scan (const gchar *data,
+                 gsize        len,
+                 const gchar  set[4])
+{
+  gsize i = 0;
+
+#ifdef TMPL_SCAN_AVX2
+  static gsize has_avx2;
+
+  if (g_once_init_enter (&has_avx2))
+    g_once_init_leave (&has_avx2, __builtin_cpu_supports ("avx2") ? 2 : 1);
+
+  if (has_avx2 == 2 && len >= 32)
+    {
+      i = tmpl_token_scan_avx2 (data, len, set);
+
+      if (i < len && (data[i] == set[0] || data[i] == set[1] ||
+                      data[i] == set[2] || data[i] == set[3]))
+        return i;
+    }
+#endif
+
+#ifdef __SSE2__
+  {
+    const __m128i a = _mm_set1_epi8 (set[0]);
+    const __m128i b = _mm_set1_epi8 (set[1]);
+    const __m128i c = _mm_set1_epi8 (set[2]);
+    const __m128i d = _mm_set1_epi8 (set[3]);
+
+    for (; i + 16 <= len; i += 16)
+      {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(gconstpointer)(data + i));
+        __m128i m = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, a),
+                                                _mm_cmpeq_epi8 (v, b)),
+                                  _mm_or_si128 (_mm_cmpeq_epi8 (v, c),
+                                                _mm_cmpeq_epi8 (v, d)));
+        gint mask = _mm_movemask_epi8 (m);
+
+        if (mask != 0)
+          return i + g_bit_nth_lsf (mask, -1);
+      }
+  }
+#endif
+
+  for (; i < len; i++)
+    {
+      if (data[i] == set[0] || data[i] == set[1] ||
+          data[i] == set[2] || data[i] == set[3])
+        return i;
+    }
+
+  return len;
+}
+
+static inline gint
+tmpl_token_input_stream_read_byte (TmplTokenInputStream *self)
+{
+  if (self->pos >= self->len)
+    return -1;
+
+  return (guchar)self->data[self->pos++];
+}
+
+/*
+ * Skips past the next UTF-8 character, returning %FALSE if the end of the
+ * buffer was reached first.
+ */
+static gboolean
+tmpl_token_input_stream_skip_unichar (TmplTokenInputStream *self)
+{
+  guchar c;
+  gsize n;
+
+  g_assert (TMPL_IS_TOKEN_INPUT_STREAM (self));
+
+  if (self->pos >= self->len)
     return FALSE;
 
+  c = self->data[self->pos];
+
   if ((c & 0x80) == 0)
     n = 1;
   else if ((c & 0xE0) == 0xC0)
@@ -72,59 +256,72 @@ tmpl_token_input_stream_read_unichar (TmplTokenInputStream  *self,
   else if ((c & 0xFE) == 0xFC)
     n = 6;
   else
-    n = 0;
-
-  str [0] = c;
+    n = 1;
 
-  for (i = 1; i < n; i++)
+  if (n > self->len - self->pos)
     {
-      if (-1 == (c = g_buffered_input_stream_read_byte (stream, cancellable, error)))
-        return FALSE;
-
-      str [i] = (gchar)c;
+      self->pos = self->len;
+      return FALSE;
     }
 
-  *unichar = g_utf8_get_char (str);
+  self->pos += n;
 
   return TRUE;
 }
 
+static TmplToken *
+tmpl_token_input_stream_new_text (TmplTokenInputStream *self,
+                                  gsize                 begin,
+                                  gsize                 end)
+{
+  g_assert (begin < end);
+  g_assert (end <= self->len);
+
+  return tmpl_token_new_text (g_bytes_new_from_bytes (self->bytes, begin, end - begin));
+}
+
+/*
+ * Reads the contents of a tag up to the closing delimiter. The contents
+ * are copied as runs between the delimiters found by tmpl_token_scan().
+ */
 static gchar *
-tmpl_token_input_stream_read_tag (TmplTokenInputStream  *self,
-                                  char                   first,
-                                  gsize                 *length,
-                                  GCancellable          *cancellable,
-                                  GError               **error)
+tmpl_token_input_stream_read_tag (TmplTokenInputStream *self,
+                                  char                  first)
 {
-  GBufferedInputStream *stream = (GBufferedInputStream *)self;
-  GByteArray *ar;
-  GError *local_error = NULL;
+  GString *str;
   gboolean in_string = FALSE;
-  guchar byte;
-  gint c;
+  gsize run;
 
   g_assert (TMPL_IS_TOKEN_INPUT_STREAM (self));
-  g_assert (length != NULL);
-  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  ar = g_byte_array_new ();
+  str = g_string_new (NULL);
+  run = self->pos;
 
   while (TRUE)
     {
-      if (-1 == (c = g_buffered_input_stream_read_byte (stream, cancellable, &local_error)))
+      gsize pos;
+      gchar c;
+
+      pos = self->pos + tmpl_token_scan (self->data + self->pos,
+                                         self->len - self->pos,
+                                         tag_delimiters);
+
+      if (pos >= self->len)
         goto failure;
 
+      c = self->data[pos];
+      self->pos = pos + 1;
+
       switch (c)
         {
         case '\\':
+          /* The escaped byte is kept as is within strings */
           if (in_string)
             {
-              g_byte_array_append (ar, (const guchar *)"\\", 1);
-
-              if (-1 == (c = g_buffered_input_stream_read_byte (stream, cancellable, &local_error)))
+              if (self->pos >= self->len)
                 goto failure;
+              self->pos++;
             }
-
           break;
 
         case '"':
@@ -133,48 +330,36 @@ tmpl_token_input_stream_read_tag (TmplTokenInputStream  *self,
 
         case '%':
         case '}':
-          if (!in_string)
+          if (!in_string && first == c)
             {
-              if (first != c)
-                break;
-
-              if (-1 == (c = g_buffered_input_stream_read_byte (stream, cancellable, &local_error)))
+              if (self->pos >= self->len)
                 goto failure;
 
-              /* Check if we got matching }} or %} */
-              if (c == '}')
-                goto finish;
+              g_string_append_len (str, self->data + run, pos - run);
 
-              g_byte_array_append (ar, (const guchar *)"}", 1);
+              /* Check if we got matching }} or %} */
+              if (self->data[self->pos] == '}')
+                {
+                  self->pos++;
+                  return g_string_free (str, FALSE);
+                }
+
+              /* Otherwise it is kept as "}" along with the byte after it */
+              g_string_append_c (str, '}');
+              run = self->pos;
+              self->pos++;
             }
-
           break;
 
         default:
-          break;
+          g_assert_not_reached ();
         }
-
-      byte = (guchar)c;
-      g_byte_array_append (ar, (const guchar *)&byte, 1);
     }
 
-finish:
-  *length = ar->len;
-
-  byte = 0;
-  g_byte_array_append (ar, (const guchar *)&byte, 1);
-
-  return (gchar *)g_byte_array_free (ar, FALSE);
-
 failure:
-  *length = 0;
-
-  g_byte_array_free (ar, TRUE);
-
-  if (local_error)
-    g_propagate_error (error, local_error);
+  g_string_free (str, TRUE);
 
-  return FALSE;
+  return NULL;
 }
 
 /**
@@ -193,12 +378,11 @@ tmpl_token_input_stream_read_token (TmplTokenInputStream  *self,
                                     GCancellable          *cancellable,
                                     GError               **error)
 {
-  GDataInputStream *stream = (GDataInputStream *)self;
   TmplToken *ret;
-  GError *local_error = NULL;
-  gunichar ch;
   gchar *text;
-  gsize len;
+  gsize begin;
+  gsize end;
+  gint c;
 
   g_return_val_if_fail (TMPL_IS_TOKEN_INPUT_STREAM (self), NULL);
 
@@ -213,116 +397,96 @@ tmpl_token_input_stream_read_token (TmplTokenInputStream  *self,
    * Once we resolve that, we walk forward past the expression until }}.
    * To walk past the expression, we need to know when we are in a
    * string, since }} could theoretically be in there too.
+   *
+   * Text is returned as slices of the source buffer, so escapes such as
+   * \{ produce a slice of just the escaped character.
    */
 
-  text = g_data_input_stream_read_upto (stream, "\\{", -1, &len, cancellable, error);
+  if (!tmpl_token_input_stream_load (self, cancellable, error))
+    return NULL;
+
+  begin = self->pos;
+  end = begin + tmpl_token_scan (self->data + begin, self->len - begin, text_delimiters);
+  self->pos = end;
 
   /*
    * Handle end of stream.
    */
-  if (text == NULL)
+  if (begin == self->len)
     return NULL;
 
   /*
    * If we start with a newline, and need to swallow it (as can happen if the
    * last tag was at the end of the line), skip past the newline.
    */
-  if (self->swallow_newline && *text == '\n')
-    {
-      gchar *tmp = g_strdup (text + 1);
-      g_free (text);
-      text = tmp;
-    }
+  if (self->swallow_newline && begin < end && self->data[begin] == '\n')
+    begin++;
 
   self->swallow_newline = FALSE;
 
   /*
    * Handle successful read up to \ or {.
    */
-  if (*text != '\0')
-    {
-      self->last_was_text_with_newline = g_str_has_suffix (text, "\n");
-
-      return tmpl_token_new_text (text);
-    }
-
-  g_free (text);
+  if (begin < end)
+    return tmpl_token_input_stream_new_text (self, begin, end);
 
   /*
-   * Peek what type of delimiter we hit.
+   * Peek what type of delimiter we hit. Probably just end of file.
    */
-  ch = g_data_input_stream_read_byte (stream, cancellable, &local_error);
-
-  /* Probably just end of file */
-  if (ch == 0)
+  if (-1 == (c = tmpl_token_input_stream_read_byte (self)))
     return NULL;
 
+  begin = self->pos - 1;
+
   /*
    * Handle possible escaped \{.
    */
-  if (ch == '\\')
+  if (c == '\\')
     {
-      gchar str[8] = { 0 };
-
-      self->last_was_text_with_newline = FALSE;
-
       /*
        * Get the next char after \.
        */
-      if (!tmpl_token_input_stream_read_unichar (self, &ch, cancellable, error))
-        return tmpl_token_new_unichar ('\\');
+      if (!tmpl_token_input_stream_skip_unichar (self))
+        return tmpl_token_input_stream_new_text (self, begin, begin + 1);
 
       /*
        * Handle escaping {.
        */
-      if (ch == '{')
-        return tmpl_token_new_unichar ('{');
+      if (self->data[begin + 1] == '{')
+        return tmpl_token_input_stream_new_text (self, begin + 1, begin + 2);
 
       /*
        * Nothing escaped, return string as it was read.
        */
-      g_unichar_to_utf8 (ch, str);
-
-      return tmpl_token_new_text (g_strdup_printf ("\\%s", str));
+      return tmpl_token_input_stream_new_text (self, begin, self->pos);
     }
 
-  g_assert (ch == '{');
+  g_assert (c == '{');
 
   /*
    * Look for { following {. If we reached the end of the stream, just
    * return a token for the final {.
    */
-  if (!tmpl_token_input_stream_read_unichar (self, &ch, cancellable, error))
-    {
-      self->last_was_text_with_newline = FALSE;
-      return tmpl_token_new_unichar ('{');
-    }
+  if (!tmpl_token_input_stream_skip_unichar (self))
+    return tmpl_token_input_stream_new_text (self, begin, begin + 1);
 
   /*
    * If this is not a {{ or {%, then just return a string for the pair.
    */
-  if (ch != '{' && ch != '%')
-    {
-      gchar str[8] = { 0 };
-
-      g_unichar_to_utf8 (ch, str);
-
-      self->last_was_text_with_newline = FALSE;
-
-      return tmpl_token_new_text (g_strdup_printf ("{%s", str));
-    }
+  c = self->data[begin + 1];
+  if (c != '{' && c != '%')
+    return tmpl_token_input_stream_new_text (self, begin, self->pos);
 
   /*
    * Scan ahead until we find matching }} or %}.
    */
-  if (!(text = tmpl_token_input_stream_read_tag (self, ch == '{' ? '}' : '%', &len, cancellable, error)))
+  if (!(text = tmpl_token_input_stream_read_tag (self, c == '{' ? '}' : '%')))
     return NULL;
 
   ret = tmpl_token_new_generic (g_steal_pointer (&text));
-  ret->silence = ch == '%';
+  ret->silence = c == '%';
 
-  self->swallow_newline = ret != NULL && ret->type != TMPL_TOKEN_EXPRESSION;
-  self->last_was_text_with_newline = FALSE;
+  self->swallow_newline = ret->type != TMPL_TOKEN_EXPRESSION;
 
   return ret;
 }
@@ -27,6 +27,7 @@ struct _TmplToken
 {
   TmplTokenType type;
   gchar *text;
+  GBytes *bytes;
   guint silence : 1;
 };
 
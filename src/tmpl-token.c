@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tmpl-token-private.h"
 
@@ -43,6 +44,7 @@ tmpl_token_free (TmplToken *self)
   if (self != NULL)
     {
       g_free (self->text);
+      g_clear_pointer (&self->bytes, g_bytes_unref);
       g_slice_free (TmplToken, self);
     }
 }
@@ -60,37 +62,27 @@ tmpl_token_new_eof (void)
 
 /**
  * tmpl_token_new_text:
- * @text: (transfer full): The text for the token.
+ * @bytes: (transfer full): The text for the token.
  *
- * Creates a new #TmplToken containing @text.
- * This is a text literal type.
+ * Creates a new #TmplToken containing @bytes, which is usually a slice
+ * of the template source. This is a text literal type.
  *
  * Returns: (transfer full): A newly allocated #TmplToken.
  */
 TmplToken *
-tmpl_token_new_text (gchar *text)
+tmpl_token_new_text (GBytes *bytes)
 {
   TmplToken *self;
 
+  g_return_val_if_fail (bytes != NULL, NULL);
+
   self = tmpl_token_new ();
   self->type = TMPL_TOKEN_TEXT;
-  self->text = text;
+  self->bytes = bytes;
 
   return self;
 }
 
-TmplToken *
-tmpl_token_new_unichar (gunichar ch)
-{
-  gchar utf8[8];
-  gint len;
-
-  len = g_unichar_to_utf8 (ch, utf8);
-  utf8 [len] = '\0';
-
-  return tmpl_token_new_text (g_strdup (utf8));
-}
-
 TmplTokenType
 tmpl_token_type (TmplToken *self)
 {
@@ -169,6 +161,11 @@ tmpl_token_new_generic (gchar *text)
       self->type = TMPL_TOKEN_INCLUDE;
       self->text = g_strstrip (g_strdup (text));
     }
+  else if (strcmp (g_strstrip (text), "flush") == 0)
+    {
+      self->type = TMPL_TOKEN_FLUSH;
+      self->text = NULL;
+    }
   else
     {
       self->type = TMPL_TOKEN_EXPRESSION;
@@ -188,3 +185,18 @@ tmpl_token_get_text (TmplToken *self)
 
   return self->text;
 }
+
+/**
+ * tmpl_token_get_bytes:
+ *
+ * Gets the contents of a text token.
+ *
+ * Returns: (transfer none) (nullable): A #GBytes or %NULL.
+ */
+GBytes *
+tmpl_token_get_bytes (TmplToken *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->bytes;
+}
@@ -41,13 +41,14 @@ typedef enum
   TMPL_TOKEN_FOR,
   TMPL_TOKEN_EXPRESSION,
   TMPL_TOKEN_INCLUDE,
+  TMPL_TOKEN_FLUSH,
 } TmplTokenType;
 
 TmplToken     *tmpl_token_new_generic      (gchar     *str);
-TmplToken     *tmpl_token_new_unichar      (gunichar   ch);
-TmplToken     *tmpl_token_new_text         (gchar     *text);
+TmplToken     *tmpl_token_new_text         (GBytes    *bytes);
 TmplToken     *tmpl_token_new_eof          (void);
 const gchar   *tmpl_token_get_text         (TmplToken *self);
+GBytes        *tmpl_token_get_bytes        (TmplToken *self);
 TmplTokenType  tmpl_token_type             (TmplToken *self);
 void           tmpl_token_free             (TmplToken *self);
 gchar         *tmpl_token_include_get_path (TmplToken *self);
@@ -19,6 +19,7 @@
 #ifndef TMPL_UTIL_PRIVATE_H
 #define TMPL_UTIL_PRIVATE_H
 
+#include <gio/gio.h>
 #include <girepository/girepository.h>
 
 G_BEGIN_DECLS
@@ -31,6 +32,21 @@ void          tmpl_destroy_in_main_context (GMainContext   *main_context,
 gchar        *tmpl_value_repr              (const GValue   *value);
 gboolean      tmpl_value_as_boolean        (const GValue   *value);
 GIRepository *tmpl_repository_get_default  (void);
+GIBaseInfo   *tmpl_repository_find_by_name (const gchar    *namespace_,
+                                            const gchar    *name);
+GIBaseInfo   *tmpl_repository_find_by_gtype (GType          type);
+GITypelib    *tmpl_repository_require      (const gchar    *namespace_,
+                                            const gchar    *version,
+                                            GError        **error);
+gboolean      tmpl_enum_info_lookup        (GIEnumInfo     *info,
+                                            const gchar    *name,
+                                            gboolean        ignore_case,
+                                            gint           *value);
+gboolean      tmpl_enum_type_lookup_nick   (GType           enum_type,
+                                            const gchar    *nick,
+                                            gint           *value);
+GInputStream *tmpl_input_stream_new_for_bytes (GBytes       *bytes);
+GBytes       *tmpl_input_stream_peek_bytes    (GInputStream *stream);
 
 G_END_DECLS
 
@@ -17,6 +17,7 @@
  */
 
 #include <glib-object.h>
+#include <string.h>
 
 #include "tmpl-gi-private.h"
 #include "tmpl-util-private.h"
@@ -170,17 +171,337 @@ tmpl_value_as_boolean (const GValue *value)
   return ret;
 }
 
+/*
+ * GIRepository lazily fills internal caches while looking up types and
+ * loading typelibs, so lookups performed while evaluating expressions are
+ * serialized to allow expanding templates from multiple threads.
+ */
+G_LOCK_DEFINE_STATIC (repository);
+
+/*
+ * Introspection data found for a GType, protected by the repository lock.
+ * Types without data are not remembered since a typelib providing them
+ * may still be required.
+ */
+static GHashTable *infos_by_gtype;
+
 GIRepository *
 tmpl_repository_get_default (void)
 {
   static GIRepository *instance;
 
-  if (instance == NULL)
+  if (g_once_init_enter_pointer (&instance))
 #if GLIB_CHECK_VERSION(2, 85, 0)
-    instance = gi_repository_dup_default ();
+    g_once_init_leave_pointer (&instance, gi_repository_dup_default ());
 #else
-    instance = gi_repository_new ();
+    g_once_init_leave_pointer (&instance, gi_repository_new ());
 #endif
 
   return instance;
 }
+
+GIBaseInfo *
+tmpl_repository_find_by_name (const gchar *namespace_,
+                              const gchar *name)
+{
+  GIRepository *repository = tmpl_repository_get_default ();
+  GIBaseInfo *ret;
+
+  G_LOCK (repository);
+  ret = gi_repository_find_by_name (repository, namespace_, name);
+  G_UNLOCK (repository);
+
+  return ret;
+}
+
+/*
+ * Returns: (transfer none) (nullable): the introspection data for @type,
+ *   which remains valid for the lifetime of the process.
+ */
+GIBaseInfo *
+tmpl_repository_find_by_gtype (GType type)
+{
+  GIRepository *repository = tmpl_repository_get_default ();
+  GIBaseInfo *ret;
+
+  G_LOCK (repository);
+
+  if G_UNLIKELY (infos_by_gtype == NULL)
+    infos_by_gtype = g_hash_table_new_full (NULL, NULL, NULL, gi_base_info_unref);
+
+  if (!(ret = g_hash_table_lookup (infos_by_gtype, GSIZE_TO_POINTER (type))) &&
+      (ret = gi_repository_find_by_gtype (repository, type)))
+    g_hash_table_insert (infos_by_gtype, GSIZE_TO_POINTER (type), ret);
+
+  G_UNLOCK (repository);
+
+  return ret;
+}
+
+GITypelib *
+tmpl_repository_require (const gchar  *namespace_,
+                         const gchar  *version,
+                         GError      **error)
+{
+  GIRepository *repository = tmpl_repository_get_default ();
+  GITypelib *ret;
+
+  G_LOCK (repository);
+  ret = gi_repository_require (repository, namespace_, version, 0, error);
+  G_UNLOCK (repository);
+
+  return ret;
+}
+
+/*
+ * Enum members are looked up by name from templates, for example with
+ * MyNs.MyEnum.value or when comparing an enum to a string. Rather than
+ * scanning the values each time, an index is built the first time an
+ * enum type is used and kept for the lifetime of the process. Indexes
+ * are never modified once built, so only finding them requires a lock.
+ */
+G_LOCK_DEFINE_STATIC (enum_indexes);
+
+typedef struct
+{
+  GHashTable *names;
+  GHashTable *folded;
+} EnumInfoIndex;
+
+/* GType of a GIEnumInfo -> EnumInfoIndex */
+static GHashTable *enum_info_indexes;
+
+/* GType of a GEnumClass -> nick -> value */
+static GHashTable *enum_nick_indexes;
+
+static guint
+ascii_case_hash (gconstpointer key)
+{
+  const gchar *str = key;
+  guint h = 5381;
+
+  for (; *str; str++)
+    h = (h << 5) + h + g_ascii_tolower (*str);
+
+  return h;
+}
+
+static gboolean
+ascii_case_equal (gconstpointer a,
+                  gconstpointer b)
+{
+  return g_ascii_strcasecmp (a, b) == 0;
+}
+
+static gboolean
+lookup_enum_index (GHashTable  *enum_index,
+                   const gchar *name,
+                   gint        *value)
+{
+  gpointer v;
+
+  if (!g_hash_table_lookup_extended (enum_index, name, NULL, &v))
+    return FALSE;
+
+  *value = GPOINTER_TO_INT (v);
+
+  return TRUE;
+}
+
+static EnumInfoIndex *
+enum_info_index_new (GIEnumInfo *info)
+{
+  EnumInfoIndex *enum_index;
+  guint n_values;
+
+  enum_index = g_new0 (EnumInfoIndex, 1);
+  enum_index->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  enum_index->folded = g_hash_table_new (ascii_case_hash, ascii_case_equal);
+
+  n_values = gi_enum_info_get_n_values (info);
+
+  for (guint i = 0; i < n_values; i++)
+    {
+      g_autoptr(GIValueInfo) value_info = gi_enum_info_get_value (info, i);
+      gchar *name = g_strdup (gi_base_info_get_name ((GIBaseInfo *)value_info));
+      gpointer value = GINT_TO_POINTER ((gint)gi_value_info_get_value (value_info));
+
+      /* Like a linear scan, the first member of a name wins */
+      if (g_hash_table_contains (enum_index->names, name))
+        {
+          g_free (name);
+          continue;
+        }
+
+      g_hash_table_insert (enum_index->names, name, value);
+
+      if (!g_hash_table_contains (enum_index->folded, name))
+        g_hash_table_insert (enum_index->folded, name, value);
+    }
+
+  return enum_index;
+}
+
+static gboolean
+enum_info_lookup_slow (GIEnumInfo  *info,
+                       const gchar *name,
+                       gboolean     ignore_case,
+                       gint        *value)
+{
+  guint n_values = gi_enum_info_get_n_values (info);
+
+  for (guint i = 0; i < n_values; i++)
+    {
+      g_autoptr(GIValueInfo) value_info = gi_enum_info_get_value (info, i);
+      const gchar *value_name = gi_base_info_get_name ((GIBaseInfo *)value_info);
+
+      if (ignore_case ? g_ascii_strcasecmp (name, value_name) == 0
+                      : strcmp (name, value_name) == 0)
+        {
+          *value = gi_value_info_get_value (value_info);
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/*
+ * tmpl_enum_info_lookup:
+ * @info: a #GIEnumInfo
+ * @name: the introspected name of a member, such as "read_write"
+ * @ignore_case: if @name should be compared ignoring ASCII case
+ * @value: (out): a location for the value of the member
+ *
+ * Finds the member of @info named @name.
+ *
+ * Returns: %TRUE if @value was set
+ */
+gboolean
+tmpl_enum_info_lookup (GIEnumInfo  *info,
+                       const gchar *name,
+                       gboolean     ignore_case,
+                       gint        *value)
+{
+  EnumInfoIndex *enum_index;
+  GType type;
+
+  g_return_val_if_fail (GI_IS_ENUM_INFO (info), FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (name == NULL)
+    return FALSE;
+
+  /* Enums without a GType are rare enough to not be indexed */
+  type = gi_registered_type_info_get_g_type ((GIRegisteredTypeInfo *)info);
+  if (type == G_TYPE_NONE || type == G_TYPE_INVALID)
+    return enum_info_lookup_slow (info, name, ignore_case, value);
+
+  G_LOCK (enum_indexes);
+
+  if G_UNLIKELY (enum_info_indexes == NULL)
+    enum_info_indexes = g_hash_table_new (NULL, NULL);
+
+  if (!(enum_index = g_hash_table_lookup (enum_info_indexes, GSIZE_TO_POINTER (type))))
+    {
+      enum_index = enum_info_index_new (info);
+      g_hash_table_insert (enum_info_indexes, GSIZE_TO_POINTER (type), enum_index);
+    }
+
+  G_UNLOCK (enum_indexes);
+
+  return lookup_enum_index (ignore_case ? enum_index->folded : enum_index->names, name, value);
+}
+
+/*
+ * tmpl_enum_type_lookup_nick:
+ * @enum_type: the #GType of an enum
+ * @nick: the nick of a member, such as "read-write"
+ * @value: (out): a location for the value of the member
+ *
+ * Finds the member of @enum_type with the nick @nick.
+ *
+ * Returns: %TRUE if @value was set
+ */
+gboolean
+tmpl_enum_type_lookup_nick (GType        enum_type,
+                            const gchar *nick,
+                            gint        *value)
+{
+  GHashTable *enum_index;
+
+  g_return_val_if_fail (G_TYPE_IS_ENUM (enum_type), FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (nick == NULL)
+    return FALSE;
+
+  G_LOCK (enum_indexes);
+
+  if G_UNLIKELY (enum_nick_indexes == NULL)
+    enum_nick_indexes = g_hash_table_new (NULL, NULL);
+
+  if (!(enum_index = g_hash_table_lookup (enum_nick_indexes, GSIZE_TO_POINTER (enum_type))))
+    {
+      /* The class is kept alive along with the nicks of the index */
+      GEnumClass *klass = g_type_class_ref (enum_type);
+
+      enum_index = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (guint i = 0; i < klass->n_values; i++)
+        {
+          const GEnumValue *enum_value = &klass->values[i];
+
+          if (!g_hash_table_contains (enum_index, enum_value->value_nick))
+            g_hash_table_insert (enum_index,
+                                 (gpointer)enum_value->value_nick,
+                                 GINT_TO_POINTER (enum_value->value));
+        }
+
+      g_hash_table_insert (enum_nick_indexes, GSIZE_TO_POINTER (enum_type), enum_index);
+    }
+
+  G_UNLOCK (enum_indexes);
+
+  return lookup_enum_index (enum_index, nick, value);
+}
+
+G_DEFINE_QUARK (tmpl-input-stream-bytes, tmpl_input_stream_bytes)
+
+/*
+ * tmpl_input_stream_new_for_bytes:
+ *
+ * Creates a stream reading from @bytes which remembers @bytes, so that
+ * the lexer may scan @bytes directly rather than reading the stream into
+ * a copy. See tmpl_input_stream_peek_bytes().
+ */
+GInputStream *
+tmpl_input_stream_new_for_bytes (GBytes *bytes)
+{
+  GInputStream *stream;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  stream = g_memory_input_stream_new_from_bytes (bytes);
+  g_object_set_qdata_full (G_OBJECT (stream),
+                           tmpl_input_stream_bytes_quark (),
+                           g_bytes_ref (bytes),
+                           (GDestroyNotify)g_bytes_unref);
+
+  return stream;
+}
+
+/*
+ * tmpl_input_stream_peek_bytes:
+ *
+ * Gets the bytes of a stream created with tmpl_input_stream_new_for_bytes().
+ *
+ * Returns: (transfer none) (nullable): a #GBytes or %NULL
+ */
+GBytes *
+tmpl_input_stream_peek_bytes (GInputStream *stream)
+{
+  g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+
+  return g_object_get_qdata (G_OBJECT (stream), tmpl_input_stream_bytes_quark ());
+}
@@ -0,0 +1,83 @@
+/* bench-gi-call.c
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Measures the cost of calling a method through GObject Introspection from
+ * within a loop, compared to reading a symbol in the same loop. Compare the
+ * results between revisions to see the effect of changes to method lookup.
+ */
+
+#include <stdlib.h>
+#include <tmpl-glib.h>
+
+#define N_ITEMS 10000
+#define N_RUNS  20
+
+static gdouble
+run (const gchar *text,
+     TmplScope   *scope)
+{
+  g_autoptr(TmplTemplate) tmpl = tmpl_template_new (NULL);
+  g_autoptr(GError) error = NULL;
+  gint64 best = G_MAXINT64;
+
+  if (!tmpl_template_parse_string (tmpl, text, &error))
+    g_error ("%s", error->message);
+
+  for (guint i = 0; i < N_RUNS; i++)
+    {
+      g_autofree gchar *str = NULL;
+      gint64 begin = g_get_monotonic_time ();
+
+      if (!(str = tmpl_template_expand_string (tmpl, scope, &error)))
+        g_error ("%s", error->message);
+
+      best = MIN (best, g_get_monotonic_time () - begin);
+    }
+
+  /* nanoseconds per iteration of the loop */
+  return best * 1000.0 / N_ITEMS;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GSimpleAction) action = g_simple_action_new ("bench", NULL);
+  g_autoptr(GPtrArray) items = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(TmplScope) scope = tmpl_scope_new ();
+  gdouble symbol;
+  gdouble method;
+
+  for (guint i = 0; i < N_ITEMS; i++)
+    g_ptr_array_add (items, g_strdup_printf ("%u", i));
+  g_ptr_array_add (items, NULL);
+
+  tmpl_scope_set_strv (scope, "items", (const gchar **)items->pdata);
+  tmpl_scope_set_object (scope, "action", action);
+  tmpl_scope_set_string (scope, "name", "bench");
+
+  symbol = run ("{{for i in items}}{{name}}{{end}}", scope);
+  method = run ("{% require Gio %}{{for i in items}}{{action.get_name()}}{{end}}", scope);
+
+  g_print ("symbol reference: %8.1lf ns/iteration\n", symbol);
+  g_print ("method call:      %8.1lf ns/iteration\n", method);
+  g_print ("method overhead:  %8.1lf ns/call\n", method - symbol);
+
+  return EXIT_SUCCESS;
+}
@@ -252,6 +252,820 @@ test_variant_array_of_dicts (void)
   g_assert_finalize_object (tmpl);
 }
 
+static void
+test_fold (void)
+{
+  static const struct {
+    const char *expr;
+    GType       type;
+    double      number;
+    const char *string;
+  } tests[] = {
+    { "1 + 2 * 3", G_TYPE_DOUBLE, 7 },
+    { "x * (2 + 3)", G_TYPE_DOUBLE, 10 },
+    { "\"a\" + \"b\" + s", G_TYPE_STRING, 0, "abc" },
+    { "1 < 2 && !false", G_TYPE_BOOLEAN, TRUE },
+    { "i32(-3.7)", G_TYPE_INT, -3 },
+    { "abs(i64(-5))", G_TYPE_INT64, 5 },
+    { "if 1 > 2 then x; else s;;", G_TYPE_STRING, 0, "c" },
+  };
+  TmplScope *scope = tmpl_scope_new ();
+  GError *error = NULL;
+
+  tmpl_scope_set_double (scope, "x", 2);
+  tmpl_scope_set_string (scope, "s", "c");
+
+  for (guint i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      TmplExpr *expr = tmpl_expr_from_string (tests[i].expr, &error);
+      GValue ret = G_VALUE_INIT;
+      gboolean r;
+
+      g_assert_no_error (error);
+      g_assert_nonnull (expr);
+
+      /* A folded expression must give the same result every time */
+      for (guint j = 0; j < 2; j++)
+        {
+          r = tmpl_expr_eval (expr, scope, &ret, &error);
+          g_assert_no_error (error);
+          g_assert_true (r);
+          g_assert_true (G_VALUE_TYPE (&ret) == tests[i].type);
+
+          if (G_VALUE_HOLDS_STRING (&ret))
+            g_assert_cmpstr (g_value_get_string (&ret), ==, tests[i].string);
+          else if (G_VALUE_HOLDS_DOUBLE (&ret))
+            g_assert_cmpfloat (g_value_get_double (&ret), ==, tests[i].number);
+          else if (G_VALUE_HOLDS_BOOLEAN (&ret))
+            g_assert_cmpint (g_value_get_boolean (&ret), ==, tests[i].number);
+          else if (G_VALUE_HOLDS_INT (&ret))
+            g_assert_cmpint (g_value_get_int (&ret), ==, tests[i].number);
+          else if (G_VALUE_HOLDS_INT64 (&ret))
+            g_assert_cmpint (g_value_get_int64 (&ret), ==, tests[i].number);
+
+          g_value_unset (&ret);
+        }
+
+      tmpl_expr_unref (expr);
+    }
+
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_fold_error (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GError *error = NULL;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  /* Errors are left to be reported when evaluating */
+  expr = tmpl_expr_from_string ("1 / 0", &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (expr);
+
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_DIVIDE_BY_ZERO);
+  g_assert_false (r);
+  g_clear_error (&error);
+
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (scope);
+}
+
+static gboolean
+resolve_symbol (TmplScope    *scope,
+                const gchar  *name,
+                TmplSymbol  **symbol,
+                gpointer      user_data)
+{
+  guint *n_calls = user_data;
+
+  if (!g_str_has_prefix (name, "resolved_"))
+    return FALSE;
+
+  (*n_calls)++;
+
+  *symbol = tmpl_symbol_new ();
+  tmpl_symbol_assign_string (*symbol, name);
+
+  return TRUE;
+}
+
+static void
+test_resolver (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  TmplScope *child = tmpl_scope_new_with_parent (scope);
+  GError *error = NULL;
+  TmplSymbol *symbol;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gchar *name;
+  gchar *str;
+  guint n_calls = 0;
+  gboolean r;
+
+  tmpl_scope_set_resolver (scope, resolve_symbol, &n_calls, NULL);
+
+  /* A name that has never been seen may still be provided by the resolver */
+  name = g_strdup_printf ("resolved_%u", g_test_rand_int ());
+  symbol = tmpl_scope_peek (child, name);
+  g_assert_nonnull (symbol);
+  g_assert_cmpint (n_calls, ==, 1);
+  g_assert_true (tmpl_scope_peek (child, name) == symbol);
+  g_assert_cmpint (n_calls, ==, 1);
+  str = tmpl_scope_dup_string (child, name);
+  g_assert_cmpstr (str, ==, name);
+  g_free (str);
+  g_free (name);
+
+  g_assert_null (tmpl_scope_peek (child, "unresolved"));
+  tmpl_scope_take (child, "unresolved", NULL);
+
+  /* Symbols set by name are found by expressions and vice versa */
+  tmpl_scope_set_string (child, "x", "!");
+  expr = tmpl_expr_from_string ("resolved_a + x", &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (expr);
+
+  r = tmpl_expr_eval (expr, child, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "resolved_a!");
+  g_assert_cmpint (n_calls, ==, 2);
+  g_value_unset (&ret);
+
+  tmpl_scope_set_string (child, "resolved_a", "a");
+  r = tmpl_expr_eval (expr, child, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "a!");
+  g_assert_cmpint (n_calls, ==, 2);
+  g_value_unset (&ret);
+
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (child);
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_scope_symbols (void)
+{
+  static const gchar *names[] = { "a", "b", "c", "d", "e", "f" };
+  TmplScope *scope = tmpl_scope_new ();
+  TmplScope *child = tmpl_scope_new_with_parent (scope);
+  gchar **symbols;
+  gchar *str;
+
+  symbols = tmpl_scope_list_symbols (scope, FALSE);
+  g_assert_cmpint (g_strv_length (symbols), ==, 0);
+  g_strfreev (symbols);
+
+  /* Enough symbols to outgrow the inline storage */
+  for (guint i = 0; i < G_N_ELEMENTS (names); i++)
+    {
+      tmpl_scope_set_string (child, names[i], names[i]);
+
+      for (guint j = 0; j <= i; j++)
+        {
+          str = tmpl_scope_dup_string (child, names[j]);
+          g_assert_cmpstr (str, ==, names[j]);
+          g_free (str);
+        }
+
+      symbols = tmpl_scope_list_symbols (child, FALSE);
+      g_assert_cmpint (g_strv_length (symbols), ==, i + 1);
+      g_strfreev (symbols);
+    }
+
+  tmpl_scope_set_string (scope, "g", "g");
+  symbols = tmpl_scope_list_symbols (child, TRUE);
+  g_assert_cmpint (g_strv_length (symbols), ==, G_N_ELEMENTS (names) + 1);
+  g_strfreev (symbols);
+
+  /* Removing a symbol reveals that of the parent scope */
+  tmpl_scope_set_string (scope, "a", "parent");
+  tmpl_scope_take (child, "a", NULL);
+  str = tmpl_scope_dup_string (child, "a");
+  g_assert_cmpstr (str, ==, "parent");
+  g_free (str);
+
+  tmpl_scope_unref (child);
+
+  /* A recycled scope must not see the symbols of a previous one */
+  child = tmpl_scope_new_with_parent (scope);
+  tmpl_scope_set_string (child, "x", "x");
+  tmpl_scope_take (child, "x", NULL);
+  g_assert_null (tmpl_scope_peek (child, "x"));
+  g_assert_null (tmpl_scope_peek (child, "b"));
+  symbols = tmpl_scope_list_symbols (child, FALSE);
+  g_assert_cmpint (g_strv_length (symbols), ==, 0);
+  g_strfreev (symbols);
+
+  tmpl_scope_unref (child);
+  tmpl_scope_unref (scope);
+}
+
+static gboolean
+eval_string (TmplScope   *scope,
+             const gchar *text,
+             GValue      *ret)
+{
+  GError *error = NULL;
+  TmplExpr *expr;
+  gboolean r;
+
+  expr = tmpl_expr_from_string (text, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (expr);
+
+  r = tmpl_expr_eval (expr, scope, ret, &error);
+  g_assert_no_error (error);
+  tmpl_expr_unref (expr);
+
+  return r;
+}
+
+static void
+test_unboxed (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GValue value = G_VALUE_INIT;
+  GValue ret = G_VALUE_INIT;
+
+  g_value_init (&value, G_TYPE_INT64);
+  g_value_set_int64 (&value, 6);
+  tmpl_scope_set_value (scope, "n", &value);
+  g_value_unset (&value);
+
+  tmpl_scope_set_double (scope, "d", 1.5);
+  tmpl_scope_set_string (scope, "a", "x");
+
+  /* Integers stay integers unless mixed with doubles */
+  g_assert_true (eval_string (scope, "n * n - 1", &ret));
+  g_assert_true (G_VALUE_HOLDS_INT64 (&ret));
+  g_assert_cmpint (g_value_get_int64 (&ret), ==, 35);
+  g_value_unset (&ret);
+
+  g_assert_true (eval_string (scope, "n + d", &ret));
+  g_assert_true (G_VALUE_HOLDS_DOUBLE (&ret));
+  g_assert_cmpfloat (g_value_get_double (&ret), ==, 7.5);
+  g_value_unset (&ret);
+
+  g_assert_true (eval_string (scope, "n >= 6 && !(d == 0) && a != \"y\"", &ret));
+  g_assert_true (G_VALUE_HOLDS_BOOLEAN (&ret));
+  g_assert_true (g_value_get_boolean (&ret));
+  g_value_unset (&ret);
+
+  g_assert_true (eval_string (scope, "if a == \"x\" then a; else \"\";;", &ret));
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "x");
+  g_value_unset (&ret);
+
+  /* Reassigning a symbol must not affect the value already read from it */
+  g_assert_true (eval_string (scope, "a + (a = \"z\")", &ret));
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "xz");
+  g_value_unset (&ret);
+
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_int64_overflow (void)
+{
+  static const struct {
+    const char *expr;
+    gboolean    is_int64;
+    gint64      v_int64;
+    gdouble     v_double;
+  } tests[] = {
+    { "max + one",    FALSE, 0, (gdouble)G_MAXINT64 + 1.0 },
+    { "max - one",    TRUE,  G_MAXINT64 - 1 },
+    { "min - one",    FALSE, 0, (gdouble)G_MININT64 - 1.0 },
+    { "min + one",    TRUE,  G_MININT64 + 1 },
+    { "min - neg",    TRUE,  G_MININT64 + 1 },
+    { "max - neg",    FALSE, 0, (gdouble)G_MAXINT64 + 1.0 },
+    { "-min",         FALSE, 0, -(gdouble)G_MININT64 },
+    { "-max",         TRUE,  -G_MAXINT64 },
+    { "max * two",    FALSE, 0, (gdouble)G_MAXINT64 * 2.0 },
+    { "min * neg",    FALSE, 0, -(gdouble)G_MININT64 },
+    { "neg * min",    FALSE, 0, -(gdouble)G_MININT64 },
+    { "max * neg",    TRUE,  -G_MAXINT64 },
+    { "min * one",    TRUE,  G_MININT64 },
+    { "min * two",    FALSE, 0, (gdouble)G_MININT64 * 2.0 },
+    { "neg * neg",    TRUE,  1 },
+  };
+  TmplScope *scope = tmpl_scope_new ();
+  GValue value = G_VALUE_INIT;
+  GValue ret = G_VALUE_INIT;
+
+  g_value_init (&value, G_TYPE_INT64);
+  g_value_set_int64 (&value, G_MAXINT64);
+  tmpl_scope_set_value (scope, "max", &value);
+  g_value_set_int64 (&value, G_MININT64);
+  tmpl_scope_set_value (scope, "min", &value);
+  g_value_set_int64 (&value, 1);
+  tmpl_scope_set_value (scope, "one", &value);
+  g_value_set_int64 (&value, 2);
+  tmpl_scope_set_value (scope, "two", &value);
+  g_value_set_int64 (&value, -1);
+  tmpl_scope_set_value (scope, "neg", &value);
+  g_value_unset (&value);
+
+  /* Results that do not fit an int64 are computed as doubles */
+  for (guint i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      g_assert_true (eval_string (scope, tests[i].expr, &ret));
+
+      if (tests[i].is_int64)
+        {
+          g_assert_true (G_VALUE_HOLDS_INT64 (&ret));
+          g_assert_cmpint (g_value_get_int64 (&ret), ==, tests[i].v_int64);
+        }
+      else
+        {
+          g_assert_true (G_VALUE_HOLDS_DOUBLE (&ret));
+          g_assert_cmpfloat (g_value_get_double (&ret), ==, tests[i].v_double);
+        }
+
+      g_value_unset (&ret);
+    }
+
+  tmpl_scope_unref (scope);
+}
+
+static void
+set_value (TmplScope  *scope,
+           const char *name,
+           GType       type,
+           ...)
+{
+  GValue value = G_VALUE_INIT;
+  va_list args;
+
+  va_start (args, type);
+  g_value_init (&value, type);
+
+  if (type == G_TYPE_INT)
+    g_value_set_int (&value, va_arg (args, int));
+  else if (type == G_TYPE_UINT)
+    g_value_set_uint (&value, va_arg (args, guint));
+  else if (type == G_TYPE_GTYPE)
+    g_value_set_gtype (&value, va_arg (args, GType));
+  else if (G_TYPE_IS_ENUM (type))
+    g_value_set_enum (&value, va_arg (args, int));
+  else
+    g_assert_not_reached ();
+
+  va_end (args);
+
+  tmpl_scope_set_value (scope, name, &value);
+  g_value_unset (&value);
+}
+
+static void
+test_dispatch_cache (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GError *error = NULL;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  expr = tmpl_expr_from_string ("a == b", &error);
+  g_assert_no_error (error);
+
+  /* The same node must dispatch correctly as operand types change */
+  for (guint i = 0; i < 3; i++)
+    {
+      set_value (scope, "a", G_TYPE_INT, 1);
+      tmpl_scope_set_double (scope, "b", 1.0);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_true (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+
+      set_value (scope, "a", G_TYPE_UINT, 2);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_false (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+
+      set_value (scope, "a", G_TYPE_GTYPE, G_TYPE_OBJECT);
+      set_value (scope, "b", G_TYPE_GTYPE, G_TYPE_OBJECT);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_true (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+
+      /* Comparing with null depends on the value, not only its type */
+      tmpl_scope_set_null (scope, "a");
+      tmpl_scope_set_string (scope, "b", "b");
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_false (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+
+      tmpl_scope_set_string (scope, "b", NULL);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_true (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+    }
+
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_method_cache (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GSimpleAction *simple = g_simple_action_new ("simple", NULL);
+  GPropertyAction *property = g_property_action_new ("property", simple, "enabled");
+  GFileInfo *file_info = g_file_info_new ();
+  GError *error = NULL;
+  TmplExpr *require;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  g_file_info_set_name (file_info, "file");
+
+  require = tmpl_expr_from_string ("require Gio", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (require, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_value_unset (&ret);
+
+  expr = tmpl_expr_from_string ("x.get_name()", &error);
+  g_assert_no_error (error);
+
+  /* More receiver types than the call site can remember */
+  for (guint i = 0; i < 3; i++)
+    {
+      tmpl_scope_set_object (scope, "x", simple);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, "simple");
+      g_value_unset (&ret);
+
+      tmpl_scope_set_object (scope, "x", property);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, "property");
+      g_value_unset (&ret);
+
+      tmpl_scope_set_object (scope, "x", file_info);
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, "file");
+      g_value_unset (&ret);
+    }
+
+  tmpl_expr_unref (require);
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (scope);
+  g_object_unref (file_info);
+  g_object_unref (property);
+  g_object_unref (simple);
+}
+
+static void
+test_gi_invoker (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GFileInfo *file_info = g_file_info_new ();
+  GError *error = NULL;
+  TmplExpr *require;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  g_file_info_set_attribute_string (file_info, "standard::name", "file");
+  tmpl_scope_set_object (scope, "info", file_info);
+  tmpl_scope_set_string (scope, "prefix", "tem");
+
+  require = tmpl_expr_from_string ("require GLib", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (require, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_value_unset (&ret);
+  tmpl_expr_unref (require);
+
+  /* Functions of a namespace, called more than once from one call site */
+  expr = tmpl_expr_from_string ("GLib.str_has_prefix(\"template\", prefix)", &error);
+  g_assert_no_error (error);
+  for (guint i = 0; i < 2; i++)
+    {
+      r = tmpl_expr_eval (expr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_true (G_VALUE_HOLDS_BOOLEAN (&ret));
+      g_assert_true (g_value_get_boolean (&ret));
+      g_value_unset (&ret);
+    }
+  tmpl_expr_unref (expr);
+
+  /* Methods with arguments */
+  expr = tmpl_expr_from_string ("info.get_attribute_string(\"standard::name\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "file");
+  g_value_unset (&ret);
+  tmpl_expr_unref (expr);
+
+  expr = tmpl_expr_from_string ("info.has_attribute(\"standard::name\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_true (g_value_get_boolean (&ret));
+  g_value_unset (&ret);
+  tmpl_expr_unref (expr);
+
+  /* Errors thrown by the function are propagated */
+  expr = tmpl_expr_from_string ("GLib.shell_unquote(\"'a b'\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpstr (g_value_get_string (&ret), ==, "a b");
+  g_value_unset (&ret);
+  tmpl_expr_unref (expr);
+
+  expr = tmpl_expr_from_string ("GLib.shell_unquote(\"'a b\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, G_SHELL_ERROR, G_SHELL_ERROR_BAD_QUOTING);
+  g_assert_false (r);
+  g_clear_error (&error);
+  tmpl_expr_unref (expr);
+
+  expr = tmpl_expr_from_string ("GLib.str_has_prefix(\"template\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_SYNTAX_ERROR);
+  g_assert_false (r);
+  g_clear_error (&error);
+  tmpl_expr_unref (expr);
+
+  tmpl_scope_unref (scope);
+  g_object_unref (file_info);
+}
+
+static void
+test_property_cache (void)
+{
+  TmplScope *scope = tmpl_scope_new ();
+  GSimpleAction *simple = g_simple_action_new ("simple", NULL);
+  GPropertyAction *property = g_property_action_new ("property", simple, "enabled");
+  GIcon *icon = g_themed_icon_new ("folder");
+  GError *error = NULL;
+  TmplExpr *getattr;
+  TmplExpr *setattr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  getattr = tmpl_expr_from_string ("x.name", &error);
+  g_assert_no_error (error);
+
+  /* Both actions override the properties of GAction */
+  for (guint i = 0; i < 2; i++)
+    {
+      tmpl_scope_set_object (scope, "x", simple);
+      r = tmpl_expr_eval (getattr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, "simple");
+      g_value_unset (&ret);
+
+      tmpl_scope_set_object (scope, "x", property);
+      r = tmpl_expr_eval (getattr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, "property");
+      g_value_unset (&ret);
+    }
+
+  /* "name" is write-only on GThemedIcon */
+  tmpl_scope_set_object (scope, "x", icon);
+  r = tmpl_expr_eval (getattr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_NO_SUCH_PROPERTY);
+  g_assert_false (r);
+  g_clear_error (&error);
+
+  setattr = tmpl_expr_from_string ("x.enabled = false", &error);
+  g_assert_no_error (error);
+  tmpl_scope_set_object (scope, "x", simple);
+  for (guint i = 0; i < 2; i++)
+    {
+      r = tmpl_expr_eval (setattr, scope, &ret, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_value_unset (&ret);
+      g_assert_false (g_action_get_enabled (G_ACTION (simple)));
+      g_simple_action_set_enabled (simple, TRUE);
+
+      /* "enabled" is read-only on GPropertyAction */
+      tmpl_scope_set_object (scope, "x", property);
+      r = tmpl_expr_eval (setattr, scope, &ret, &error);
+      g_assert_error (error, TMPL_ERROR, TMPL_ERROR_NO_SUCH_PROPERTY);
+      g_assert_false (r);
+      g_clear_error (&error);
+      tmpl_scope_set_object (scope, "x", simple);
+    }
+  tmpl_expr_unref (setattr);
+
+  /* Construct-only properties cannot be assigned either */
+  setattr = tmpl_expr_from_string ("x.name = \"renamed\"", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (setattr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_NO_SUCH_PROPERTY);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_assert_cmpstr (g_action_get_name (G_ACTION (simple)), ==, "simple");
+  tmpl_expr_unref (setattr);
+
+  setattr = tmpl_expr_from_string ("x.enabled = \"yes\"", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (setattr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_TYPE_MISMATCH);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_assert_true (g_action_get_enabled (G_ACTION (simple)));
+  tmpl_expr_unref (setattr);
+
+  /* The right-hand side is evaluated before the property is resolved */
+  setattr = tmpl_expr_from_string ("x.no_such_property = (y = 3)", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (setattr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_NO_SUCH_PROPERTY);
+  g_assert_false (r);
+  g_clear_error (&error);
+  eval_string (scope, "y", &ret);
+  g_assert_cmpfloat (g_value_get_double (&ret), ==, 3);
+  g_value_unset (&ret);
+
+  tmpl_expr_unref (getattr);
+  tmpl_expr_unref (setattr);
+  tmpl_scope_unref (scope);
+  g_object_unref (icon);
+  g_object_unref (property);
+  g_object_unref (simple);
+}
+
+static void
+test_enum_index (void)
+{
+  static const struct {
+    const char *expr;
+    gboolean    result;
+  } tests[] = {
+    { "x == \"directory\"", TRUE },
+    { "\"directory\" == x", TRUE },
+    { "x != \"regular\"", TRUE },
+    { "x == \"regular\"", FALSE },
+    { "x == \"no-such-nick\"", FALSE },
+    { "x == Gio.FileType.DIRECTORY", TRUE },
+    { "x == Gio.FileType.directory", TRUE },
+    { "x == Gio.FileType.special", FALSE },
+  };
+  TmplScope *scope = tmpl_scope_new ();
+  GFileInfo *file_info = g_file_info_new ();
+  GError *error = NULL;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  set_value (scope, "x", G_TYPE_FILE_TYPE, G_FILE_TYPE_DIRECTORY);
+  tmpl_scope_set_object (scope, "info", file_info);
+
+  expr = tmpl_expr_from_string ("require Gio", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_value_unset (&ret);
+  tmpl_expr_unref (expr);
+
+  for (guint i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      /* Twice, to use the index once it has been built */
+      for (guint j = 0; j < 2; j++)
+        {
+          expr = tmpl_expr_from_string (tests[i].expr, &error);
+          g_assert_no_error (error);
+          r = tmpl_expr_eval (expr, scope, &ret, &error);
+          g_assert_no_error (error);
+          g_assert_true (r);
+          g_assert_true (G_VALUE_HOLDS_BOOLEAN (&ret));
+          g_assert_cmpint (g_value_get_boolean (&ret), ==, tests[i].result);
+          g_value_unset (&ret);
+          tmpl_expr_unref (expr);
+        }
+    }
+
+  expr = tmpl_expr_from_string ("Gio.FileType.no_such_value", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_GI_FAILURE);
+  g_assert_false (r);
+  g_clear_error (&error);
+  tmpl_expr_unref (expr);
+
+  /* Strings are accepted for enum arguments by name */
+  expr = tmpl_expr_from_string ("info.set_file_type(\"mountable\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  if (G_IS_VALUE (&ret))
+    g_value_unset (&ret);
+  g_assert_cmpint (g_file_info_get_file_type (file_info), ==, G_FILE_TYPE_MOUNTABLE);
+  tmpl_expr_unref (expr);
+
+  tmpl_scope_unref (scope);
+  g_object_unref (file_info);
+}
+
+static void
+test_builtin_methods (void)
+{
+  static const struct {
+    const char *expr;
+    const char *result;
+  } tests[] = {
+    { "\"Abc\".upper()", "ABC" },
+    { "\"Abc\".lower()", "abc" },
+    { "\"Abc\".reverse()", "cbA" },
+    { "\"a<b\".escape_markup()", "a&lt;b" },
+    { "\"abc\".space()", "   " },
+    { "\"hello world\".title()", "Hello World" },
+    { "\"GtkWidget\".mangle()", "gtk_widget" },
+    { "x.nick()", "directory" },
+    { "typeof(x).name()", "GFileType" },
+  };
+  TmplScope *scope = tmpl_scope_new ();
+  GError *error = NULL;
+  TmplExpr *expr;
+  GValue ret = G_VALUE_INIT;
+  gboolean r;
+
+  set_value (scope, "x", G_TYPE_FILE_TYPE, G_FILE_TYPE_DIRECTORY);
+
+  for (guint i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      r = eval_string (scope, tests[i].expr, &ret);
+      g_assert_true (r);
+      g_assert_cmpstr (g_value_get_string (&ret), ==, tests[i].result);
+      g_value_unset (&ret);
+    }
+
+  r = eval_string (scope, "\"abc\".len()", &ret);
+  g_assert_true (r);
+  g_assert_cmpuint (g_value_get_uint (&ret), ==, 3);
+  g_value_unset (&ret);
+
+  r = eval_string (scope, "typeof(x).is_a(typeof(x))", &ret);
+  g_assert_true (r);
+  g_assert_true (g_value_get_boolean (&ret));
+  g_value_unset (&ret);
+
+  /* Methods are only found for the receiver they belong to */
+  expr = tmpl_expr_from_string ("\"abc\".nick()", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_GI_FAILURE);
+  g_assert_false (r);
+  g_clear_error (&error);
+  tmpl_expr_unref (expr);
+
+  expr = tmpl_expr_from_string ("x.upper()", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &ret, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_GI_FAILURE);
+  g_assert_false (r);
+  g_clear_error (&error);
+  tmpl_expr_unref (expr);
+
+  tmpl_scope_unref (scope);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -263,5 +1077,17 @@ main (int argc,
   g_test_add_func ("/Tmpl/Expr/variant-dict-mixed-types", test_variant_dict_mixed_types);
   g_test_add_func ("/Tmpl/Expr/variant-nested-dict", test_variant_nested_dict);
   g_test_add_func ("/Tmpl/Expr/variant-array-of-dicts", test_variant_array_of_dicts);
+  g_test_add_func ("/Tmpl/Expr/fold", test_fold);
+  g_test_add_func ("/Tmpl/Expr/fold-error", test_fold_error);
+  g_test_add_func ("/Tmpl/Expr/resolver", test_resolver);
+  g_test_add_func ("/Tmpl/Expr/scope-symbols", test_scope_symbols);
+  g_test_add_func ("/Tmpl/Expr/unboxed", test_unboxed);
+  g_test_add_func ("/Tmpl/Expr/int64-overflow", test_int64_overflow);
+  g_test_add_func ("/Tmpl/Expr/dispatch-cache", test_dispatch_cache);
+  g_test_add_func ("/Tmpl/Expr/method-cache", test_method_cache);
+  g_test_add_func ("/Tmpl/Expr/gi-invoker", test_gi_invoker);
+  g_test_add_func ("/Tmpl/Expr/property-cache", test_property_cache);
+  g_test_add_func ("/Tmpl/Expr/enum-index", test_enum_index);
+  g_test_add_func ("/Tmpl/Expr/builtin-methods", test_builtin_methods);
   return g_test_run ();
 }
@@ -18,6 +18,10 @@
  * SPDX-License-Identifier: LGPL-3.0-or-later
  */
 
+#include <string.h>
+
+#include <glib/gstdio.h>
+
 #include <tmpl-glib.h>
 
 static char *
@@ -73,11 +77,942 @@ test1 (void)
   g_assert_finalize_object (tmpl);
 }
 
+static void
+test_flush (void)
+{
+  TmplTemplate *tmpl = NULL;
+  GOutputStream *stream = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  /* Explicit {{flush}} writes buffered output before a later failure */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "abc{{flush}}def{{missing}}", &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  stream = g_memory_output_stream_new_resizable ();
+  r = tmpl_template_expand (tmpl, stream, NULL, NULL, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_MISSING_SYMBOL);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_assert_cmpint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (stream)), ==, 3);
+  g_assert_cmpmem (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream)), 3, "abc", 3);
+  g_clear_object (&stream);
+
+  /* With a threshold, output is streamed as it is produced */
+  tmpl_template_set_flush_threshold (tmpl, 1);
+  g_assert_cmpuint (tmpl_template_get_flush_threshold (tmpl), ==, 1);
+
+  stream = g_memory_output_stream_new_resizable ();
+  r = tmpl_template_expand (tmpl, stream, NULL, NULL, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_MISSING_SYMBOL);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_assert_cmpint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (stream)), ==, 6);
+  g_assert_cmpmem (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream)), 6, "abcdef", 6);
+  g_clear_object (&stream);
+
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+test_control_flow (void)
+{
+  static const char *items[] = { "a", "b", "cd", NULL };
+  static const char *marks[] = { "x", "y", NULL };
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{for i in items}}"
+                                  "{{if i == \"a\"}}A{{else if i == \"b\"}}B{{else}}{{i}}{{end}}"
+                                  "{{for c in marks}}.{{end}}"
+                                  "{{end}}"
+                                  "{{if false}}never{{end}}!",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_strv (scope, "items", items);
+  tmpl_scope_set_strv (scope, "marks", marks);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "A..B..cd..!");
+  g_free (str);
+
+  /* Loop variables must not leak out of the loop */
+  g_assert_null (tmpl_scope_peek (scope, "i"));
+
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+async_cb (GObject      *object,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+  GAsyncResult **ret = user_data;
+  *ret = g_object_ref (result);
+}
+
+static GAsyncResult *
+await_result (GAsyncResult **result)
+{
+  while (*result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  return *result;
+}
+
+static void
+test_async (void)
+{
+  GFile *file = get_test_file ("test-template-test1.tmpl");
+  GFile *expected = get_test_file ("test-template-test1.tmpl.expected");
+  GCancellable *cancellable = NULL;
+  GOutputStream *stream = NULL;
+  GAsyncResult *result = NULL;
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *estr = NULL;
+  gboolean r;
+
+  tmpl = tmpl_template_new (NULL);
+  tmpl_template_parse_file_async (tmpl, file, NULL, async_cb, &result);
+  r = tmpl_template_parse_file_finish (tmpl, await_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_clear_object (&result);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "title", "My Title");
+
+  stream = g_memory_output_stream_new_resizable ();
+  tmpl_template_expand_async (tmpl, stream, scope, NULL, async_cb, &result);
+  r = tmpl_template_expand_finish (tmpl, await_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_clear_object (&result);
+
+  estr = get_file_contents (expected);
+  g_assert_cmpmem (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream)),
+                   g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (stream)),
+                   estr, strlen (estr));
+  g_clear_object (&stream);
+
+  /* A cancelled expansion must not complete */
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  stream = g_memory_output_stream_new_resizable ();
+  tmpl_template_expand_async (tmpl, stream, scope, cancellable, async_cb, &result);
+  r = tmpl_template_expand_finish (tmpl, await_result (&result), &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_clear_object (&result);
+  g_clear_object (&stream);
+  g_clear_object (&cancellable);
+
+  /* The worker thread may still hold references briefly */
+  g_free (estr);
+  tmpl_scope_unref (scope);
+  g_object_unref (file);
+  g_object_unref (expected);
+  g_object_unref (tmpl);
+}
+
+static gpointer
+cache_load_thread (gpointer data)
+{
+  TmplTemplateCache *cache = data;
+  GError *error = NULL;
+  TmplTemplate *tmpl;
+
+  tmpl = tmpl_template_cache_load (cache, "cached.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (tmpl);
+
+  return tmpl;
+}
+
+typedef struct
+{
+  TmplTemplateLocator parent_instance;
+  GMutex mutex;
+  GCond cond;
+  guint entered : 1;
+  guint released : 1;
+} BlockingLocator;
+
+typedef TmplTemplateLocatorClass BlockingLocatorClass;
+
+static GType blocking_locator_get_type (void);
+G_DEFINE_TYPE (BlockingLocator, blocking_locator, TMPL_TYPE_TEMPLATE_LOCATOR)
+
+static GInputStream *
+blocking_locator_locate (TmplTemplateLocator  *locator,
+                         const gchar          *path,
+                         GError              **error)
+{
+  BlockingLocator *self = (BlockingLocator *)locator;
+
+  g_mutex_lock (&self->mutex);
+  self->entered = TRUE;
+  g_cond_broadcast (&self->cond);
+  while (!self->released)
+    g_cond_wait (&self->cond, &self->mutex);
+  g_mutex_unlock (&self->mutex);
+
+  return g_memory_input_stream_new_from_data ("blocked", -1, NULL);
+}
+
+static void
+blocking_locator_finalize (GObject *object)
+{
+  BlockingLocator *self = (BlockingLocator *)object;
+
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (blocking_locator_parent_class)->finalize (object);
+}
+
+static void
+blocking_locator_class_init (BlockingLocatorClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = blocking_locator_finalize;
+  klass->locate = blocking_locator_locate;
+}
+
+static void
+blocking_locator_init (BlockingLocator *self)
+{
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+}
+
+static gpointer
+cache_load_blocked_thread (gpointer data)
+{
+  TmplTemplateCache *cache = data;
+  GError *error = NULL;
+  TmplTemplate *tmpl;
+
+  tmpl = tmpl_template_cache_load (cache, "blocked.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (tmpl);
+
+  return tmpl;
+}
+
+static gpointer
+cancel_thread (gpointer data)
+{
+  g_usleep (G_USEC_PER_SEC / 100);
+  g_cancellable_cancel (data);
+  return NULL;
+}
+
+static void
+test_cache_cancel (void)
+{
+  BlockingLocator *locator;
+  TmplTemplateCache *cache;
+  GCancellable *cancellable;
+  TmplTemplate *tmpl;
+  GThread *loader;
+  GThread *canceller;
+  GError *error = NULL;
+
+  locator = g_object_new (blocking_locator_get_type (), NULL);
+  cache = tmpl_template_cache_new (TMPL_TEMPLATE_LOCATOR (locator));
+
+  loader = g_thread_new ("cache-load", cache_load_blocked_thread, cache);
+
+  g_mutex_lock (&locator->mutex);
+  while (!locator->entered)
+    g_cond_wait (&locator->cond, &locator->mutex);
+  g_mutex_unlock (&locator->mutex);
+
+  /* A cancelled waiter returns while the loader is still blocked */
+  cancellable = g_cancellable_new ();
+  canceller = g_thread_new ("cancel", cancel_thread, cancellable);
+  tmpl = tmpl_template_cache_load (cache, "blocked.tmpl", cancellable, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (tmpl);
+  g_clear_error (&error);
+  g_thread_join (canceller);
+
+  /* Waiters that are already cancelled do not wait at all */
+  tmpl = tmpl_template_cache_load (cache, "blocked.tmpl", cancellable, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (tmpl);
+  g_clear_error (&error);
+
+  g_mutex_lock (&locator->mutex);
+  locator->released = TRUE;
+  g_cond_broadcast (&locator->cond);
+  g_mutex_unlock (&locator->mutex);
+
+  /* The other load is unaffected */
+  tmpl = g_thread_join (loader);
+  g_assert_nonnull (tmpl);
+
+  g_object_unref (cancellable);
+  g_object_unref (tmpl);
+  g_assert_finalize_object (cache);
+  g_assert_finalize_object (locator);
+}
+
+static void
+test_cache (void)
+{
+  TmplTemplateLocator *locator = NULL;
+  TmplTemplateCache *cache = NULL;
+  TmplTemplate *tmpl1 = NULL;
+  TmplTemplate *tmpl2 = NULL;
+  TmplScope *scope = NULL;
+  GThread *threads[4];
+  GError *error = NULL;
+  char *tmpdir = NULL;
+  char *path = NULL;
+  char *str = NULL;
+  gboolean r;
+  guint i;
+
+  tmpdir = g_dir_make_tmp ("test-template-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (tmpdir, "cached.tmpl", NULL);
+
+  r = g_file_set_contents (path, "one {{x}}", -1, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  locator = tmpl_template_locator_new ();
+  tmpl_template_locator_append_search_path (locator, tmpdir);
+  cache = tmpl_template_cache_new (locator);
+  g_assert_true (tmpl_template_cache_get_locator (cache) == locator);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "x", "X");
+
+  /* Unchanged sources are parsed once and shared */
+  tmpl1 = tmpl_template_cache_load (cache, "cached.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (tmpl1);
+  tmpl2 = tmpl_template_cache_load (cache, "cached.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (tmpl1 == tmpl2);
+  g_clear_object (&tmpl2);
+
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    threads[i] = g_thread_new ("cache-load", cache_load_thread, cache);
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    {
+      tmpl2 = g_thread_join (threads[i]);
+      g_assert_true (tmpl1 == tmpl2);
+      g_clear_object (&tmpl2);
+    }
+
+  str = tmpl_template_expand_string (tmpl1, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "one X");
+  g_clear_pointer (&str, g_free);
+
+  /* A changed source is parsed again */
+  r = g_file_set_contents (path, "second {{x}}", -1, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  tmpl2 = tmpl_template_cache_load (cache, "cached.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (tmpl2);
+  g_assert_true (tmpl1 != tmpl2);
+
+  str = tmpl_template_expand_string (tmpl2, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "second X");
+  g_clear_pointer (&str, g_free);
+
+  /* Invalidation forces a reparse even without changes */
+  tmpl_template_cache_invalidate (cache, "cached.tmpl");
+  g_clear_object (&tmpl1);
+  tmpl1 = tmpl_template_cache_load (cache, "cached.tmpl", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (tmpl1 != tmpl2);
+
+  /* Missing templates are reported */
+  tmpl_template_cache_clear (cache);
+  g_clear_object (&tmpl2);
+  tmpl2 = tmpl_template_cache_load (cache, "missing.tmpl", NULL, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_TEMPLATE_NOT_FOUND);
+  g_assert_null (tmpl2);
+  g_clear_error (&error);
+
+  g_unlink (path);
+  g_rmdir (tmpdir);
+
+  g_free (path);
+  g_free (tmpdir);
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (tmpl1);
+  g_assert_finalize_object (cache);
+  g_assert_finalize_object (locator);
+}
+
+static void
+test_parallel (void)
+{
+  static const char *marks[] = { "x", "y", NULL };
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GPtrArray *items = NULL;
+  GString *expected = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  items = g_ptr_array_new_with_free_func (g_free);
+  expected = g_string_new (NULL);
+  for (guint i = 0; i < 1000; i++)
+    {
+      g_ptr_array_add (items, g_strdup_printf ("%u", i));
+      g_string_append_printf (expected, "[%u..]", i);
+    }
+  g_ptr_array_add (items, NULL);
+  g_string_append (expected, "outer");
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_strv (scope, "items", (const char **)items->pdata);
+  tmpl_scope_set_strv (scope, "marks", marks);
+  tmpl_scope_set_string (scope, "i", "outer");
+
+  /* Output is the same as a serial loop, and "i" is not overwritten */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{for parallel i in items}}"
+                                  "[{{i}}{{for c in marks}}.{{end}}]"
+                                  "{{end}}{{i}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, expected->str);
+  g_clear_pointer (&str, g_free);
+  g_clear_object (&tmpl);
+
+  /* Errors in any iteration fail the expansion */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "{{for parallel i in items}}{{missing}}{{end}}", &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_MISSING_SYMBOL);
+  g_assert_null (str);
+  g_clear_error (&error);
+  g_clear_object (&tmpl);
+
+  /* Bodies may not write to the scope */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "{{for parallel i in items}}{{x = i}}{{end}}", &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_SYNTAX_ERROR);
+  g_assert_false (r);
+  g_clear_error (&error);
+  r = tmpl_template_parse_string (tmpl, "{{for parallel i in items}}{{flush}}{{end}}", &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_SYNTAX_ERROR);
+  g_assert_false (r);
+  g_clear_error (&error);
+
+  /* Nor call functions, which could assign to the shared scope */
+  r = tmpl_template_parse_string (tmpl,
+                                  "{% def bump(v) i = v end %}"
+                                  "{{for parallel x in items}}{{bump(x)}}{{end}}",
+                                  &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_SYNTAX_ERROR);
+  g_assert_false (r);
+  g_clear_error (&error);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{for parallel x in items}}{{if x == \"1\"}}{{(func(v) v)(x)}}{{end}}{{end}}",
+                                  &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_SYNTAX_ERROR);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_clear_object (&tmpl);
+
+  /* "parallel" is still a valid loop identifier */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "{{for parallel in marks}}{{parallel}}{{end}}", &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "xy");
+  g_clear_pointer (&str, g_free);
+
+  g_assert_finalize_object (tmpl);
+  tmpl_scope_unref (scope);
+  g_string_free (expected, TRUE);
+  g_ptr_array_unref (items);
+}
+
+static void
+test_text (void)
+{
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  /* Text is sliced from the source, including around escapes */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{x}} a long run of static text \\{{not a tag}}"
+                                  " and a backslash \\ here{{x}}{x\n"
+                                  "{{if true}}\n"
+                                  "swallowed newline{{end}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "x", "X");
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==,
+                   "X a long run of static text {{not a tag}}"
+                   " and a backslash \\ hereX{x\n"
+                   "swallowed newline");
+
+  g_free (str);
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+test_compiled (void)
+{
+  static const char *items[] = { "a", "b", "c", NULL };
+  TmplTemplate *tmpl = NULL;
+  TmplTemplate *loaded = NULL;
+  TmplScope *scope = NULL;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  char *expected = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_strv (scope, "items", items);
+  tmpl_scope_set_double (scope, "n", 3);
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{if n > 2}}big{{else if n > 1}}medium{{else}}small{{end}}\n"
+                                  "{{for i in items}}<{{i}}>{{end}}\n"
+                                  "{{for parallel i in items}}[{{if i == \"b\"}}{{i}}{{end}}]{{end}}\n"
+                                  "{{n * 2 + abs(-1)}} {{\"str\"}} {{!false}} {{-n}}\n",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  expected = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (expected);
+
+  bytes = tmpl_template_save_compiled (tmpl, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (bytes);
+
+  /* The loaded template expands exactly like the parsed one */
+  loaded = tmpl_template_new (NULL);
+  r = tmpl_template_load_compiled (loaded, bytes, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (loaded, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, expected);
+  g_clear_pointer (&str, g_free);
+  g_clear_pointer (&bytes, g_bytes_unref);
+  g_clear_object (&loaded);
+
+  /* Anything else is rejected */
+  bytes = g_bytes_new_static ("not a template", 14);
+  loaded = tmpl_template_new (NULL);
+  r = tmpl_template_load_compiled (loaded, bytes, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_INVALID_STATE);
+  g_assert_false (r);
+  g_clear_error (&error);
+  g_clear_pointer (&bytes, g_bytes_unref);
+
+  g_free (expected);
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (loaded);
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+test_bytes (void)
+{
+  static const char input[] = "{{if true}}\nhello {{x}}{{end}}, and goodbye";
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  /* The bytes are scanned in place and must outlive our reference */
+  bytes = g_bytes_new (input, strlen (input));
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_bytes (tmpl, bytes, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_bytes_unref (bytes);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "x", "world");
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "hello world, and goodbye");
+
+  g_free (str);
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+test_specialize (void)
+{
+  static const char *items[] = { "a", "b", NULL };
+  static const char *expected =
+    "<h1>Example</h1>\n"
+    "hello bob\n"
+    "a@Example b@Example \n"
+    "ab\n"
+    "fourExample!Example";
+  TmplTemplate *tmpl = NULL;
+  TmplTemplate *specialized = NULL;
+  TmplScope *frozen = NULL;
+  TmplScope *scope = NULL;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  frozen = tmpl_scope_new ();
+  tmpl_scope_set_string (frozen, "site", "Example");
+  tmpl_scope_set_boolean (frozen, "debug", FALSE);
+  tmpl_scope_set_strv (frozen, "items", items);
+  tmpl_scope_set_double (frozen, "n", 2);
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "<h1>{{site}}</h1>\n"
+                                  "{{if debug}}debug {{user}}{{else if n > 1}}hello {{user}}{{else}}bye{{end}}\n"
+                                  "{{for i in items}}{{i}}@{{site}} {{end}}\n"
+                                  "{{for site in items}}{{site}}{{end}}\n"
+                                  "{{if n * 2 == 4}}four{{end}}{{site + \"!\"}}{% x = site %}{{x}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  scope = tmpl_scope_new_with_parent (frozen);
+  tmpl_scope_set_string (scope, "user", "bob");
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, expected);
+  g_clear_pointer (&str, g_free);
+  g_clear_pointer (&scope, tmpl_scope_unref);
+
+  specialized = tmpl_template_specialize (tmpl, frozen, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (specialized);
+
+  /* Later changes to the frozen scope are not seen */
+  tmpl_scope_set_string (frozen, "site", "Changed");
+
+  /* Only the dynamic symbols are needed to expand */
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "user", "bob");
+  str = tmpl_template_expand_string (specialized, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, expected);
+  g_clear_pointer (&str, g_free);
+
+  /* The strv of the frozen scope cannot be saved */
+  bytes = tmpl_template_save_compiled (specialized, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_INVALID_STATE);
+  g_assert_null (bytes);
+  g_clear_error (&error);
+
+  tmpl_scope_unref (scope);
+  tmpl_scope_unref (frozen);
+  g_assert_finalize_object (specialized);
+  g_assert_finalize_object (tmpl);
+}
+
+static void
+test_memory_usage (void)
+{
+  TmplTemplate *tmpl = NULL;
+  TmplTemplate *loaded = NULL;
+  TmplScope *scope = NULL;
+  TmplExpr *expr = NULL;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  GValue value = G_VALUE_INIT;
+  char *str = NULL;
+  gboolean r;
+
+  tmpl = tmpl_template_new (NULL);
+  g_assert_cmpuint (tmpl_template_get_memory_usage (tmpl), ==, 0);
+
+  r = tmpl_template_parse_string (tmpl,
+                                  "{% def greet(name) \"hello \" + name end %}"
+                                  "{{greet(x)}}{{if x != \"\"}}!{{end}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpuint (tmpl_template_get_memory_usage (tmpl), >, 0);
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "x", "world");
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "hello world!");
+  g_free (str);
+
+  bytes = tmpl_template_save_compiled (tmpl, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (bytes);
+
+  loaded = tmpl_template_new (NULL);
+  r = tmpl_template_load_compiled (loaded, bytes, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpuint (tmpl_template_get_memory_usage (loaded), >, 0);
+  g_assert_finalize_object (loaded);
+  g_bytes_unref (bytes);
+
+  /* Functions defined by the template outlive it */
+  g_assert_finalize_object (tmpl);
+
+  expr = tmpl_expr_from_string ("greet(\"again\")", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, scope, &value, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpstr (g_value_get_string (&value), ==, "hello again");
+
+  g_value_unset (&value);
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_arena (void)
+{
+  static const char *items[] = { "a", "b", "cd", NULL };
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *expected = NULL;
+  char *str = NULL;
+  char *pad = NULL;
+  char *s = NULL;
+  gboolean r;
+
+  tmpl = tmpl_template_new (NULL);
+  g_assert_false (tmpl_template_get_use_arena (tmpl));
+
+  r = tmpl_template_parse_string (tmpl,
+                                  "{% def wrap(x) \"<\" + x + \">\" end %}"
+                                  "{% s = \"\" %}"
+                                  "{{for i in items}}{% s = s + wrap(i) %}{{i + \"!\"}}{{end}}"
+                                  "{{s}}|{{pad + s}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  /* Larger than a chunk of the arena */
+  pad = g_strnfill (10000, 'x');
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_strv (scope, "items", items);
+  tmpl_scope_set_string (scope, "pad", pad);
+  expected = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_str_has_prefix (expected, "a!b!cd!<a><b><cd>|xxx"));
+  g_assert_true (g_str_has_suffix (expected, "xxx<a><b><cd>"));
+  tmpl_scope_unref (scope);
+
+  tmpl_template_set_use_arena (tmpl, TRUE);
+  g_assert_true (tmpl_template_get_use_arena (tmpl));
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_strv (scope, "items", items);
+  tmpl_scope_set_string (scope, "pad", pad);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, expected);
+
+  /* Values assigned to the scope outlive the expansion */
+  s = tmpl_scope_dup_string (scope, "s");
+  g_assert_cmpstr (s, ==, "<a><b><cd>");
+
+  tmpl_scope_unref (scope);
+  g_assert_finalize_object (tmpl);
+  g_free (expected);
+  g_free (str);
+  g_free (pad);
+  g_free (s);
+}
+
+static void
+test_range (void)
+{
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *str = NULL;
+  gboolean r;
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_double (scope, "n", 3);
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{for i in range(n)}}{{i32(i)}},{{end}}|"
+                                  "{{for i in range(2, 8, 2)}}{{i32(i)}},{{end}}|"
+                                  "{{for i in range(n, 0, -1)}}{{i32(i)}},{{end}}|"
+                                  "{{for i in range(0, 1, 0.25)}}{{i32(i * 100)}},{{end}}|"
+                                  "{{for i in range(5, 1)}}x{{end}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (str, ==, "0,1,2,|2,4,6,|3,2,1,|0,25,50,75,|");
+  g_clear_pointer (&str, g_free);
+  g_clear_object (&tmpl);
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "{{for i in range(1, 2, 0)}}{{end}}", &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_RUNTIME_ERROR);
+  g_assert_null (str);
+  g_clear_error (&error);
+  g_clear_object (&tmpl);
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl, "{{for i in range(\"3\")}}{{end}}", &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  str = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_error (error, TMPL_ERROR, TMPL_ERROR_TYPE_MISMATCH);
+  g_assert_null (str);
+  g_clear_error (&error);
+  g_clear_object (&tmpl);
+
+  tmpl_scope_unref (scope);
+}
+
+static void
+test_arena_loop (void)
+{
+  TmplTemplate *tmpl = NULL;
+  TmplScope *scope = NULL;
+  GError *error = NULL;
+  char *expected = NULL;
+  char *str = NULL;
+  char *pad = NULL;
+  char *t = NULL;
+  gboolean r;
+
+  /*
+   * Every iteration allocates temporaries, some larger than a chunk of the
+   * arena, and loops over a string that was itself built in the arena.
+   */
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{% s = \"\" %}"
+                                  "{{for i in range(300)}}"
+                                  "{{if (pad + s) != \"\"}}<{{s + \"|\"}}>{{end}}"
+                                  "{{for c in (y + s)}}{{if c == \"y\"}}{{c + \".\"}}{{end}}{{end}}"
+                                  "{% s = s + \"ab\" %}"
+                                  "{% t = pad + s %}"
+                                  "{{end}}"
+                                  "{{s}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  pad = g_strnfill (5000, 'x');
+
+  scope = tmpl_scope_new ();
+  tmpl_scope_set_string (scope, "pad", pad);
+  tmpl_scope_set_string (scope, "y", "y");
+  expected = tmpl_template_expand_string (tmpl, scope, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_str_has_prefix (expected, "<|>y.<ab|>y.<abab|>y."));
+  tmpl_scope_unref (scope);
+
+  tmpl_template_set_use_arena (tmpl, TRUE);
+
+  /* Strings released after one iteration must not corrupt the next */
+  for (guint i = 0; i < 2; i++)
+    {
+      scope = tmpl_scope_new ();
+      tmpl_scope_set_string (scope, "pad", pad);
+      tmpl_scope_set_string (scope, "y", "y");
+      str = tmpl_template_expand_string (tmpl, scope, &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (str, ==, expected);
+      g_clear_pointer (&str, g_free);
+
+      t = tmpl_scope_dup_string (scope, "t");
+      g_assert_cmpint (strlen (t), ==, 5000 + 600);
+      g_assert_cmpint (t[4999], ==, 'x');
+      g_assert_true (g_str_has_suffix (t, "abab"));
+      g_clear_pointer (&t, g_free);
+
+      tmpl_scope_unref (scope);
+    }
+
+  g_assert_finalize_object (tmpl);
+  g_free (expected);
+  g_free (pad);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Tmpl/Template/test1", test1);
+  g_test_add_func ("/Tmpl/Template/flush", test_flush);
+  g_test_add_func ("/Tmpl/Template/control-flow", test_control_flow);
+  g_test_add_func ("/Tmpl/Template/async", test_async);
+  g_test_add_func ("/Tmpl/Template/cache", test_cache);
+  g_test_add_func ("/Tmpl/Template/cache-cancel", test_cache_cancel);
+  g_test_add_func ("/Tmpl/Template/parallel", test_parallel);
+  g_test_add_func ("/Tmpl/Template/text", test_text);
+  g_test_add_func ("/Tmpl/Template/compiled", test_compiled);
+  g_test_add_func ("/Tmpl/Template/bytes", test_bytes);
+  g_test_add_func ("/Tmpl/Template/specialize", test_specialize);
+  g_test_add_func ("/Tmpl/Template/memory-usage", test_memory_usage);
+  g_test_add_func ("/Tmpl/Template/arena", test_arena);
+  g_test_add_func ("/Tmpl/Template/arena-loop", test_arena_loop);
+  g_test_add_func ("/Tmpl/Template/range", test_range);
   return g_test_run ();
 }
@@ -0,0 +1,129 @@
+/* test-threads.c
+ *
+ * Copyright 2022 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <tmpl-glib.h>
+
+#define N_THREADS    8
+#define N_ITERATIONS 200
+
+typedef struct
+{
+  TmplTemplate *tmpl;
+  TmplScope    *parent;
+  guint         id;
+} Worker;
+
+static gpointer
+worker_thread (gpointer data)
+{
+  Worker *worker = data;
+  GError *error = NULL;
+  char *expected;
+  guint i;
+
+  expected = g_strdup_printf ("a%fb%fmyaction100", worker->id * 2.0, worker->id * 2.0);
+
+  for (i = 0; i < N_ITERATIONS; i++)
+    {
+      TmplScope *scope = tmpl_scope_new_with_parent (worker->parent);
+      char *str;
+
+      tmpl_scope_set_double (scope, "id", worker->id);
+
+      str = tmpl_template_expand_string (worker->tmpl, scope, &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (str, ==, expected);
+
+      g_free (str);
+      tmpl_scope_unref (scope);
+    }
+
+  g_free (expected);
+
+  return NULL;
+}
+
+static void
+test_concurrent_expand (void)
+{
+  static const char *items[] = { "a", "b", NULL };
+  GThread *threads[N_THREADS];
+  Worker workers[N_THREADS];
+  GSimpleAction *action;
+  TmplTemplate *tmpl;
+  TmplScope *parent;
+  TmplExpr *expr;
+  GValue value = G_VALUE_INIT;
+  GError *error = NULL;
+  gboolean r;
+  guint i;
+
+  tmpl = tmpl_template_new (NULL);
+  r = tmpl_template_parse_string (tmpl,
+                                  "{{for i in items}}{{i}}{{scale(id)}}{{end}}"
+                                  "{{action.get_name()}}{{i32(n)}}",
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  /* The parent scope is shared by all expansions and must not be modified */
+  parent = tmpl_scope_new ();
+  r = tmpl_scope_require (parent, "Gio", "2.0");
+  g_assert_true (r);
+  tmpl_scope_set_strv (parent, "items", items);
+  tmpl_scope_set_double (parent, "n", 100);
+  action = g_simple_action_new ("myaction", NULL);
+  tmpl_scope_set_object (parent, "action", action);
+
+  /* The argument shadows "n" rather than assigning to the shared scope */
+  expr = tmpl_expr_from_string ("def scale(n)\n  n * 2\nend\n", &error);
+  g_assert_no_error (error);
+  r = tmpl_expr_eval (expr, parent, &value, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  if (G_IS_VALUE (&value))
+    g_value_unset (&value);
+
+  for (i = 0; i < N_THREADS; i++)
+    {
+      workers[i].tmpl = tmpl;
+      workers[i].parent = parent;
+      workers[i].id = i;
+      threads[i] = g_thread_new ("expand", worker_thread, &workers[i]);
+    }
+
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+
+  tmpl_expr_unref (expr);
+  tmpl_scope_unref (parent);
+  g_assert_finalize_object (action);
+  g_assert_finalize_object (tmpl);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Tmpl/Threads/concurrent-expand", test_concurrent_expand);
+  return g_test_run ();
+}